@@ -12,6 +12,7 @@
 #define ADC_PRIO	(NORMALPRIO + 2)
 #define RPM_PRIO	(NORMALPRIO + 1)
 #define PARAMLD_PRIO	(NORMALPRIO)
+#define SV_PRIO		(NORMALPRIO + 10)
 
 // threads stack size
 #define PBSTX_WASZ	2048
@@ -20,5 +21,6 @@
 #define ADC_WASZ	512
 #define RPM_WASZ	256
 #define PARAMLD_WASZ	2048
+#define SV_WASZ		256
 
 #endif /* _FW_CONFIG_H_ */
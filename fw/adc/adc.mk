@@ -3,6 +3,8 @@ ADCSRC = ${MINIECU}/fw/adc/th_adc.c \
 	 ${MINIECU}/fw/adc/adc_temp.c \
 	 ${MINIECU}/fw/adc/adc_oilp.c \
 	 ${MINIECU}/fw/adc/adc_flow.c \
-	 ${MINIECU}/fw/adc/adc_cpu.c
+	 ${MINIECU}/fw/adc/adc_cpu.c \
+	 ${MINIECU}/fw/adc/adc_crank.c \
+	 ${MINIECU}/fw/adc/adc_spectrum.c
 
 ADCINC =
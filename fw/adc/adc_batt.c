@@ -21,14 +21,15 @@
  */
 
 #include "th_adc.h"
+#include "log/th_log.h"
 #include "param_table.h"
-#include <string.h>
 
 
 /* -*- parameters -*-  */
 int32_t gp_batt_cells;
-char gp_batt_type[PT_STRING_SIZE];
+uint8_t gp_batt_type;
 float gp_batt_voltage_trimm;
+float gp_batt_pfail_volt;
 
 
 /**
@@ -71,39 +72,42 @@ static uint32_t (*m_batt_remaining_func)(void) = batt_get_remaining_nimh;
 
 /* -*- global -*- */
 
-void on_change_batt_type(struct param_entry *p)
+/* called in param batch critical section: alarm rules see new
+ * min voltage together with new param generation
+ */
+void apply_batt_type(const struct param_entry *p ATTR_UNUSED)
 {
-#define BATT_TYPE_IS(type)	\
-	(strcasecmp(gp_batt_type, BATT_TYPE__ ## type) == 0)
-
-	m_batt_remaining_func = NULL;
-	if (BATT_TYPE_IS(NiMH)) {
+	/* value already checked by param module */
+	switch (gp_batt_type) {
+	case BATT_TYPE__NiMH:
 		m_batt_min_cell_volt = BATT_CELL_NiMH;
 		m_batt_remaining_func = batt_get_remaining_nimh;
-	}
-	else if (BATT_TYPE_IS(NiCd)) {
+		break;
+	case BATT_TYPE__NiCd:
 		m_batt_min_cell_volt = BATT_CELL_NiCd;
 		m_batt_remaining_func = batt_get_remaining_nimh;
-	}
-	else if (BATT_TYPE_IS(LiIon)) {
+		break;
+	case BATT_TYPE__LiIon:
 		m_batt_min_cell_volt = BATT_CELL_LiIon;
-	}
-	else if (BATT_TYPE_IS(LiPo)) {
+		m_batt_remaining_func = NULL;
+		break;
+	case BATT_TYPE__LiPo:
 		m_batt_min_cell_volt = BATT_CELL_LiPo;
-	}
-	else if (BATT_TYPE_IS(LiFePo)) {
+		m_batt_remaining_func = NULL;
+		break;
+	case BATT_TYPE__LiFePo:
 		m_batt_min_cell_volt = BATT_CELL_LiFePo;
-	}
-	else if (BATT_TYPE_IS(Pb)) {
+		m_batt_remaining_func = NULL;
+		break;
+	case BATT_TYPE__Pb:
 		m_batt_min_cell_volt = BATT_CELL_Pb;
-	}
-	else {
+		m_batt_remaining_func = NULL;
+		break;
+	default:
 		m_batt_min_cell_volt = 0.0;
-		strcpy(gp_batt_type, p->default_value.s);
-		debug_printf(DP_ERROR, "BATT: unknown battery type");
+		m_batt_remaining_func = NULL;
+		break;
 	}
-
-#undef BATT_TYPE_IS
 }
 
 /**
@@ -115,12 +119,11 @@ uint32_t batt_get_voltage(void)
 }
 
 /**
- * Check battery voltage
- * @return true if voltage is LOW
+ * Return battery low voltage level [V]
  */
-bool batt_check_voltage(void)
+float batt_get_min_voltage(void)
 {
-	return (m_batt_min_cell_volt * gp_batt_cells) > get_vbat();
+	return m_batt_min_cell_volt * gp_batt_cells;
 }
 
 /**
@@ -138,8 +141,73 @@ bool batt_get_remaining(uint32_t *out)
 	return true;
 }
 
+/* -*- power fail detection -*- */
+
+/*
+ * SDADC1 has no analog watchdog, so raw (unfiltered) samples checked
+ * in conversion callback: detection delay ~0.7 ms instead of LPF lag.
+ * Cleared after voltage stays above threshold + hysteresis
+ * (e.g. starter dip).
+ */
+#define PFAIL_TIME_US		1000		/* samples below threshold, at any ADC rate */
+#define PFAIL_MIN_SAMPLES	2
+#define PFAIL_HYSTERESIS	0.3		/* [V] */
+#define PFAIL_RECOVER		MS2ST(1000)
+
+static unsigned m_pfail_cnt;
+static unsigned m_pfail_samples = PFAIL_MIN_SAMPLES;
+static volatile bool m_pfail;
+static systime_t m_pfail_ok_time;
+
+/**
+ * Check raw battery sample
+ * Called from SDADC1 ISR.
+ */
+void batt_pfail_check_isr(float raw_vbat)
+{
+	if (m_pfail || gp_batt_pfail_volt <= 0.0)
+		return;
+
+	if (raw_vbat + gp_batt_voltage_trimm >= gp_batt_pfail_volt) {
+		m_pfail_cnt = 0;
+		return;
+	}
+
+	if (++m_pfail_cnt < m_pfail_samples)
+		return;
+
+	m_pfail_cnt = 0;
+	m_pfail = true;
+
+	chSysLockFromISR();
+	log_power_fail_i();
+	chSysUnlockFromISR();
+}
+
+/**
+ * Supply falling, noncritical work should be stopped
+ */
+bool batt_pfail_is_active(void)
+{
+	return m_pfail;
+}
+
 void adc_handle_battery(void)
 {
-	/* TODO: send event to Log */
+	/* rate lowered while engine stopped */
+	unsigned samples = adc_get_rate() * PFAIL_TIME_US / 1000000;
+	m_pfail_samples = (samples > PFAIL_MIN_SAMPLES)? samples : PFAIL_MIN_SAMPLES;
+
+	if (!m_pfail) {
+		m_pfail_ok_time = osalOsGetSystemTimeX();
+		return;
+	}
+
+	if (get_vbat() < gp_batt_pfail_volt + PFAIL_HYSTERESIS)
+		m_pfail_ok_time = osalOsGetSystemTimeX();
+	else if (chVTTimeElapsedSinceX(m_pfail_ok_time) >= PFAIL_RECOVER) {
+		m_pfail = false;
+		debug_printf(DP_INFO, "BATT: power restored");
+	}
 }
 
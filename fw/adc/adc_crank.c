@@ -0,0 +1,147 @@
+/**
+ * @file       adc_crank.c
+ * @brief      Crank-synchronous sampling
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "th_adc.h"
+#include "param_table.h"
+#include <math.h>
+#include <string.h>
+
+/*
+ * Converters can't be triggered by RPM capture timer (TIM2 is not in
+ * SDADC trigger list), so samples of fixed rate acquisition are
+ * placed by crank angle: both capture edges and ADC blocks are time
+ * stamped by realtime counter, binning itself is in lib/crankbins.c.
+ */
+
+/* -*- parameters -*- */
+bool gp_crank_flow_enable;
+bool gp_crank_oilp_enable;
+extern int32_t gp_pulses_per_revolution;	// th_rpm.c
+
+/* -*- private data -*- */
+
+static CrankPosition m_pos;
+static CrankBins m_acc[CRANK_NCH];		//!< current revolution
+static float m_rev[CRANK_NCH][CRANK_BINS];	//!< last complete revolution
+static float m_rev_avg[CRANK_NCH];
+static uint32_t m_rev_seq;
+
+/* -*- global -*- */
+
+/**
+ * Channel sampled by crank angle (converter needed)
+ */
+bool crank_is_enabled(enum crank_channel ch)
+{
+	switch (ch) {
+	case CRANK_CH_FLOW:
+		return gp_crank_flow_enable;
+	case CRANK_CH_OILP:
+		return gp_crank_oilp_enable;
+	default:
+		return false;
+	}
+}
+
+/**
+ * RPM capture edge.
+ * Called from ICU ISR.
+ *
+ * @param edge		edge time (realtime counter)
+ * @param period_us	time from previous edge
+ * @param rev_start	edge starts new revolution
+ */
+void crank_edge_isr(rtcnt_t edge, uint32_t period_us, bool rev_start)
+{
+	chSysLockFromISR();
+	bool complete = cbinEdge(&m_pos, edge, period_us * (STM32_HCLK / 1000000), rev_start);
+	if (complete) {
+		for (size_t ch = 0; ch < CRANK_NCH; ch++)
+			m_rev_avg[ch] = cbinFinish(&m_acc[ch], m_rev[ch]);
+
+		m_rev_seq++;
+	}
+	else if (rev_start)
+		memset(m_acc, 0, sizeof(m_acc));
+	chSysUnlockFromISR();
+}
+
+/**
+ * Engine stopped (capture timeout).
+ * Called from ICU ISR.
+ */
+void crank_reset_isr(void)
+{
+	chSysLockFromISR();
+	cbinPositionReset(&m_pos);
+	chSysUnlockFromISR();
+}
+
+/**
+ * Place sample to angle bin.
+ * Called from SDADC ISR.
+ *
+ * @param ch		channel
+ * @param value		sample
+ * @param t		sample trigger time (realtime counter)
+ */
+void crank_sample_isr(enum crank_channel ch, float value, rtcnt_t t)
+{
+	if (!crank_is_enabled(ch))
+		return;
+
+	chSysLockFromISR();
+	cbinAdd(&m_acc[ch], cbinIndex(&m_pos, t, gp_pulses_per_revolution), value);
+	chSysUnlockFromISR();
+}
+
+/**
+ * Get angle domain array of last complete revolution.
+ *
+ * @param[out] out	CRANK_BINS values, bin i: [i, i + 1) * 360° / CRANK_BINS
+ * @param[out] seq	revolution number, changes on each revolution
+ * @return false if channel disabled or no revolution yet
+ */
+bool crank_get_revolution(enum crank_channel ch, float out[CRANK_BINS], uint32_t *seq)
+{
+	if (ch >= CRANK_NCH || !crank_is_enabled(ch))
+		return false;
+
+	chSysLock();
+	memcpy(out, m_rev[ch], sizeof(m_rev[ch]));
+	*seq = m_rev_seq;
+	chSysUnlock();
+
+	return *seq > 0;
+}
+
+/**
+ * Cycle averaged value of last complete revolution.
+ */
+bool crank_get_cycle_average(enum crank_channel ch, float *out)
+{
+	if (ch >= CRANK_NCH || !crank_is_enabled(ch) || m_rev_seq == 0)
+		return false;
+
+	*out = m_rev_avg[ch];
+	return !isnan(*out);
+}
@@ -32,7 +32,6 @@ float gp_flow_dia2;		// mm
 float gp_flow_cd;
 float gp_flow_ro;		// kg/m3
 int32_t gp_flow_tank_ml;	// mL
-int32_t gp_flow_low_ml;		// mL
 
 
 /* -*- private variabled -*- */
@@ -48,10 +47,35 @@ static float m_flow_mlsec;	// mL3/sec
 
 /* -*- global -*- */
 
-void on_change_flow_params(struct param_entry *p ATTR_UNUSED)
+/* derived from staged batch by validate, published by apply */
+static float m_staged_C;
+static float m_staged_A2;
+
+bool validate_flow_params(const struct param_batch *batch)
 {
-	m_A2 = M_PI * powf(gp_flow_dia2 / 1000.0, 2) / 4.0;
-	m_C = gp_flow_cd / sqrtf(1 - powf(gp_flow_dia2 / gp_flow_dia1, 4));
+	float dia1 = *(const float *)param_batch_value(batch, &gp_flow_dia1);
+	float dia2 = *(const float *)param_batch_value(batch, &gp_flow_dia2);
+	float cd = *(const float *)param_batch_value(batch, &gp_flow_cd);
+
+	if (!(dia2 < dia1)) {
+		debug_printf(DP_ERROR, "FLOW: orifice must be less than pipe");
+		return false;
+	}
+
+	m_staged_A2 = M_PI * powf(dia2 / 1000.0, 2) / 4.0;
+	m_staged_C = cd / sqrtf(1 - powf(dia2 / dia1, 4));
+	return true;
+}
+
+void apply_flow_params(const struct param_entry *p ATTR_UNUSED)
+{
+	m_A2 = m_staged_A2;
+	m_C = m_staged_C;
+}
+
+bool flow_is_enabled(void)
+{
+	return gp_flow_enable;
 }
 
 /**
@@ -73,15 +97,15 @@ uint32_t flow_get_used_ml(void)
 }
 
 /**
- * Check fuel reserve
- * @return true if fuel level is LOW
+ * Return fuel remaining in tank [mL] (if tank volume known)
  */
-bool flow_check_fuel(void)
+bool flow_get_remaining_ml(int32_t *out)
 {
-	if (gp_flow_low_ml == 0.0 || gp_flow_tank_ml == 0.0)
+	if (gp_flow_tank_ml == 0.0)
 		return false;
 
-	return (gp_flow_tank_ml - m_total_used_ml) <= gp_flow_low_ml;
+	*out = gp_flow_tank_ml - m_total_used_ml;
+	return true;
 }
 
 /**
@@ -107,7 +131,7 @@ void adc_handle_flow(void)
 {
 	static bool is_inited = false;
 	if (!is_inited) {
-		on_change_flow_params(NULL);
+		param_apply_current(validate_flow_params, apply_flow_params);
 		is_inited = true;
 	}
 
@@ -118,8 +142,19 @@ void adc_handle_flow(void)
 	 * http://en.wikipedia.org/wiki/Orifice_plate
 	 */
 
-	float dP = arduino_map(adc_getflt_flow(), gp_flow_v0, FLOW_MAXV, MP3V5004DP_MINP, MP3V5004DP_MAXP);
-	float Q = m_C * m_A2 * sqrtf(2.0 * dP / gp_flow_ro);
+	/* take consistent copy of config */
+	float C, A2, v0, ro;
+	uint32_t gen;
+	do {
+		gen = param_read_begin();
+		C = m_C;
+		A2 = m_A2;
+		v0 = gp_flow_v0;
+		ro = gp_flow_ro;
+	} while (param_read_retry(gen));
+
+	float dP = arduino_map(adc_getflt_flow(), v0, FLOW_MAXV, MP3V5004DP_MINP, MP3V5004DP_MAXP);
+	float Q = C * A2 * sqrtf(2.0 * dP / ro);
 
 	m_flow_mlsec = Q * 1e6;
 
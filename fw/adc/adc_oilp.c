@@ -24,10 +24,9 @@
 #include "ntc.h"
 #include "param_table.h"
 #include <math.h>
-#include <string.h>
 
 /* -*- parameters -*-  */
-char gp_oilp_mode[PT_STRING_SIZE];
+uint8_t gp_oilp_mode;
 int32_t gp_oilp_r;
 float gp_oilp_sh_a;
 float gp_oilp_sh_b;
@@ -57,25 +56,26 @@ static void oilp_handle_ntc10k(void)
 
 /* -*- global -*- */
 
-void on_change_oilp_mode(struct param_entry *p)
+void on_change_oilp_mode(struct param_entry *p ATTR_UNUSED)
 {
-#define OILP_MODE_IS(mode)	\
-	(strcasecmp(gp_oilp_mode, OILP_MODE__ ## mode) == 0)
-
 	m_oilp_temp = NAN;
-	if (OILP_MODE_IS(Disabled)) {
+	switch (gp_oilp_mode) {
+	case OILP_MODE__Disabled:
 		m_oilp_handle_func = NULL;
-	}
-	else if (OILP_MODE_IS(NTC10k)) {
+		break;
+	case OILP_MODE__NTC10k:
 		m_oilp_handle_func = oilp_handle_ntc10k;
-	}
-	else {
+		break;
+	default:
 		m_oilp_handle_func = NULL;
-		strcpy(gp_oilp_mode, p->default_value.s);
 		debug_printf(DP_ERROR, "OILP: unknown mode");
+		break;
 	}
+}
 
-#undef OILP_MODE_IS
+bool oilp_is_enabled(void)
+{
+	return gp_oilp_mode != OILP_MODE__Disabled;
 }
 
 /**
@@ -0,0 +1,175 @@
+/**
+ * @file       adc_spectrum.c
+ * @brief      Spectrum capture
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "th_adc.h"
+#include "lib/rfft.h"
+
+/*
+ * One-shot capture: ADC ISR averages `decimation` samples of selected
+ * channel (also anti alias) and fills window. Transform done by
+ * requester thread (PBStx, below ADC, RPM and log threads).
+ *
+ * One buffer for all links: new capture refused until requester
+ * sent result (or dropped it) with spectrum_release().
+ */
+
+enum spectrum_state {
+	SPECTRUM_IDLE = 0,
+	SPECTRUM_CAPTURE,
+	SPECTRUM_READY,
+	SPECTRUM_BUSY		//!< transform and send in progress
+};
+
+static float m_buf[SPECTRUM_MAX_WINDOW];
+static volatile enum spectrum_state m_state;
+static enum spectrum_channel m_channel;
+static uint32_t m_window;
+static uint32_t m_decimation;
+static float m_rate;
+static uint32_t m_pos;
+static float m_acc;
+static uint32_t m_acc_cnt;
+
+/* -*- global -*- */
+
+/**
+ * Start capture.
+ *
+ * @param ch		channel
+ * @param window	FFT size, power of 2 in [SPECTRUM_MIN_WINDOW, SPECTRUM_MAX_WINDOW]
+ * @param decimation	samples averaged to one point, 1..SPECTRUM_MAX_DECIMATION
+ * @return false on bad arguments or if other capture not released
+ */
+bool spectrum_start(enum spectrum_channel ch, uint32_t window, uint32_t decimation)
+{
+	if (ch >= SPECTRUM_NCH
+			|| window < SPECTRUM_MIN_WINDOW || window > SPECTRUM_MAX_WINDOW
+			|| (window & (window - 1)) != 0
+			|| decimation < 1 || decimation > SPECTRUM_MAX_DECIMATION)
+		return false;
+
+	chSysLock();
+	if (m_state != SPECTRUM_IDLE) {
+		chSysUnlock();
+		return false;
+	}
+
+	m_channel = ch;
+	m_window = window;
+	m_decimation = decimation;
+	m_rate = adc_get_rate();
+	m_pos = 0;
+	m_acc = 0.0;
+	m_acc_cnt = 0;
+	m_state = SPECTRUM_CAPTURE;
+	chSysUnlock();
+
+	return true;
+}
+
+/**
+ * Feed sample.
+ * Called from SDADC ISR.
+ */
+void spectrum_sample_isr(enum spectrum_channel ch, float value)
+{
+	if (m_state != SPECTRUM_CAPTURE || ch != m_channel)
+		return;
+
+	m_acc += value;
+	if (++m_acc_cnt < m_decimation)
+		return;
+
+	m_buf[m_pos++] = m_acc / m_acc_cnt;
+	m_acc = 0.0;
+	m_acc_cnt = 0;
+
+	if (m_pos >= m_window)
+		m_state = SPECTRUM_READY;
+}
+
+/**
+ * Conversion rate changed: capture restarted,
+ * samples of two rates can not be mixed.
+ */
+void spectrum_rate_changed_i(void)
+{
+	m_rate = adc_get_rate();
+	if (m_state == SPECTRUM_CAPTURE) {
+		m_pos = 0;
+		m_acc = 0.0;
+		m_acc_cnt = 0;
+	}
+}
+
+/**
+ * Capture on channel in progress (converter needed at full rate)
+ */
+bool spectrum_is_capturing(enum spectrum_channel ch)
+{
+	return m_state == SPECTRUM_CAPTURE && m_channel == ch;
+}
+
+bool spectrum_is_ready(void)
+{
+	return m_state == SPECTRUM_READY;
+}
+
+/**
+ * Hann window, real FFT and amplitude, capture buffer reused.
+ * Result valid until @a spectrum_release().
+ *
+ * @param[out] sample_rate	decimated sample rate [Hz]
+ * @param[out] nbins		window / 2 + 1
+ * @return amplitude spectrum [V], NULL if not captured
+ */
+const float *spectrum_compute(enum spectrum_channel *ch, uint32_t *window,
+		float *sample_rate, uint32_t *nbins)
+{
+	chSysLock();
+	if (m_state != SPECTRUM_READY) {
+		chSysUnlock();
+		return NULL;
+	}
+
+	m_state = SPECTRUM_BUSY;
+	chSysUnlock();
+
+	rfft_hann(m_buf, m_window);
+	rfft(m_buf, m_window);
+	rfft_magnitude(m_buf, m_window);
+
+	*ch = m_channel;
+	*window = m_window;
+	*sample_rate = m_rate / m_decimation;
+	*nbins = m_window / 2 + 1;
+
+	return m_buf;
+}
+
+/**
+ * Result sent or requester gone, buffer free for next capture.
+ */
+void spectrum_release(void)
+{
+	m_state = SPECTRUM_IDLE;
+}
@@ -26,7 +26,6 @@
 
 /* -*- parameters -*-  */
 int32_t gp_temp_r;
-float gp_temp_overheat;
 float gp_temp_sh_a;
 float gp_temp_sh_b;
 float gp_temp_sh_c;
@@ -47,15 +46,6 @@ int32_t temp_get_temperature(void)
 	return m_temp * 1000;
 }
 
-/**
- * Check engine temperature
- * @return true if temperature is HIGH
- */
-bool temp_check_temperature(void)
-{
-	return m_temp > gp_temp_overheat || adc_getflt_int_temp() > 90.0;
-}
-
 void adc_handle_temperature(void)
 {
 	float ntc_r;
@@ -22,6 +22,10 @@
 
 #include "alert_led.h"
 #include "th_adc.h"
+#include "th_rpm.h"
+#include "alarm.h"
+#include "supervisor.h"
+#include "log/blackbox.h"
 #include "param.h"
 #include "lib/lowpassfilter2p.h"
 
@@ -37,7 +41,8 @@
 #define DEBUG_ADC_FREQ	TRUE
 
 /* -*- parameters -*- */
-// None
+int32_t gp_adc_rate;
+int32_t gp_adc_idle_rate;
 
 
 /* -*- private data -*- */
@@ -70,6 +75,21 @@ static LowPassFilter2p fo_oilp_volt;
 static LowPassFilter2p fo_vbat;
 static LowPassFilter2p fo_flow_volt;
 
+// block time stamps
+static adc_timestamp_t m_ts_adc1;
+static adc_timestamp_t m_ts_sdadc1;
+static adc_timestamp_t m_ts_sdadc3;
+static float m_trigger_rate;	// [Hz] exact
+
+// conversion gating
+static uint32_t m_rate;		// [Hz] requested
+static bool m_flow_on;
+static bool m_oilp_on;
+/* running totals, wrap; one per ISR: converter DMA ISRs preempt each other */
+enum { ISR_ADC1 = 0, ISR_SDADC1, ISR_SDADC3, ISR_MAX };
+static volatile uint32_t m_isr_cycles[ISR_MAX];
+static uint32_t m_isr_load;	// [0.01 %]
+
 // thread
 static THD_WORKING_AREA(wa_adc, ADC_WASZ);
 
@@ -104,11 +124,74 @@ static float sdadc_sez_to_voltage(adcsample_t adc)
 	return (((int16_t) adc) + 32767) * SDADC_VREF / (SDADC_GAIN * 65535);
 }
 
+/* ISR time accounting, DWT cycles */
+#define ISR_TIME_BEGIN()	rtcnt_t isr_t0 = chSysGetRealtimeCounterX()
+#define ISR_TIME_END(isr)	m_isr_cycles[isr] += chSysGetRealtimeCounterX() - isr_t0
+
+/* -*- trigger timer -*- */
+
+/* One timer triggers all converters (TIM3, TIM4 and TIM19 reach both
+ * ADC1 and SDADC injected triggers). TIM19 taken because no HAL driver
+ * can use it (mcuconf.h has no GPT/ICU/PWM option for it), so register
+ * level setup here can't clash with a driver, and TIM3/TIM4 stay free:
+ * - ADC1: TIM19_TRGO (update event)
+ * - SDADC1: TIM19_CC2 rising edge (PWM1 mode: rises on update)
+ * - SDADC3: synchronized with SDADC1 injected conversions (JSYNC)
+ * So all groups start at same instant.
+ */
+#define TRIG_CLOCK		1000000		/* counter clock [Hz] */
+#define TRIG_RTC_PER_TICK	(STM32_HCLK / TRIG_CLOCK)
+
+static void adc_trigger_start(uint32_t rate)
+{
+	rccEnableAPB2(RCC_APB2ENR_TIM19EN, FALSE);
+
+	TIM19->CR1 = 0;
+	TIM19->PSC = STM32_TIMCLK2 / TRIG_CLOCK - 1;
+	TIM19->ARR = TRIG_CLOCK / rate - 1;
+	TIM19->CCR2 = (TIM19->ARR + 1) / 2;
+	TIM19->CCMR1 = TIM_CCMR1_OC2M_2 | TIM_CCMR1_OC2M_1	/* PWM1 */
+		| TIM_CCMR1_OC2PE;				/* CCR2 preload */
+	TIM19->CR2 = TIM_CR2_MMS_1;				/* TRGO: update */
+	TIM19->EGR = TIM_EGR_UG;
+	TIM19->CR1 = TIM_CR1_ARPE | TIM_CR1_CEN;
+
+	m_trigger_rate = (float)TRIG_CLOCK / (TIM19->ARR + 1);
+}
+
+/** Change rate on the fly, ARR and CCR2 preloaded,
+ * new period starts with next update event.
+ * Must be called with lock.
+ */
+static void adc_trigger_set_rate_i(uint32_t rate)
+{
+	TIM19->ARR = TRIG_CLOCK / rate - 1;
+	TIM19->CCR2 = (TIM19->ARR + 1) / 2;
+
+	m_trigger_rate = (float)TRIG_CLOCK / (TIM19->ARR + 1);
+}
+
+/** Stamp conversion block with its trigger time.
+ * Conversion ends before next trigger, so counter holds
+ * time since trigger. ISR context.
+ */
+static void adc_stamp_block(adc_timestamp_t *ts)
+{
+	rtcnt_t now = chSysGetRealtimeCounterX();
+	uint32_t since_trigger = TIM19->CNT;
+
+	ts->seq++;
+	ts->rtc = now - since_trigger * TRIG_RTC_PER_TICK;
+}
+
 /* -*- callback functions -*- */
 
 static void adc_int_temp_vrtc_cb(ADCDriver *adcp ATTR_UNUSED,
 		adcsample_t *buffer, size_t n ATTR_UNUSED)
 {
+	ISR_TIME_BEGIN();
+	adc_stamp_block(&m_ts_adc1);
+
 	r_int_temp = adc_to_int_temp(buffer[0]);
 	r_vrtc = 2 * adc_to_voltage(buffer[1]);
 
@@ -118,34 +201,57 @@ static void adc_int_temp_vrtc_cb(ADCDriver *adcp ATTR_UNUSED,
 #if DEBUG_ADC_FREQ
 	palTogglePad(GPIOC, GPIOC_XP2_PC13);
 #endif
+	ISR_TIME_END(ISR_ADC1);
 }
 
-static void adc_temp_oilp_vbat_cb(ADCDriver *adcp ATTR_UNUSED,
+static void adc_temp_oilp_vbat_cb(ADCDriver *adcp,
 		adcsample_t *buffer, size_t n ATTR_UNUSED)
 {
+	/* channels stored in ascending order, AIN5P dropped if OIL_P unused */
+	bool oilp = adcp->grpp->num_channels == 3;
+
+	ISR_TIME_BEGIN();
+	adc_stamp_block(&m_ts_sdadc1);
+
 	r_vbat = 3 * sdadc_sez_to_voltage(buffer[0]);	// AIN4P
-	r_oilp_volt = sdadc_sez_to_voltage(buffer[1]);	// AIN5P
-	r_temp_volt = sdadc_sez_to_voltage(buffer[2]);	// AIN6P
+	r_temp_volt = sdadc_sez_to_voltage(buffer[(oilp)? 2 : 1]);	// AIN6P
+
+	batt_pfail_check_isr(r_vbat);
 
 	f_vbat = lpf2pApply(&fo_vbat, r_vbat);
-	f_oilp_volt = lpf2pApply(&fo_oilp_volt, r_oilp_volt);
 	f_temp_volt = lpf2pApply(&fo_temp_volt, r_temp_volt);
 
+	if (oilp) {
+		r_oilp_volt = sdadc_sez_to_voltage(buffer[1]);	// AIN5P
+
+		crank_sample_isr(CRANK_CH_OILP, r_oilp_volt, m_ts_sdadc1.rtc);
+		spectrum_sample_isr(SPECTRUM_CH_OILP, r_oilp_volt);
+		f_oilp_volt = lpf2pApply(&fo_oilp_volt, r_oilp_volt);
+	}
+
 #if DEBUG_ADC_FREQ
 	palTogglePad(GPIOA, GPIOA_XP2_PA1);
 #endif
+	ISR_TIME_END(ISR_SDADC1);
 }
 
 static void adc_flow_cb(ADCDriver *adcp ATTR_UNUSED,
 		adcsample_t *buffer, size_t n ATTR_UNUSED)
 {
+	ISR_TIME_BEGIN();
+	adc_stamp_block(&m_ts_sdadc3);
+
 	r_flow_volt = sdadc_sez_to_voltage(buffer[0]);	// AIN6P
 
+	crank_sample_isr(CRANK_CH_FLOW, r_flow_volt, m_ts_sdadc3.rtc);
+	spectrum_sample_isr(SPECTRUM_CH_FLOW, r_flow_volt);
+
 	f_flow_volt = lpf2pApply(&fo_flow_volt, r_flow_volt);
 
 #if DEBUG_ADC_FREQ
 	palTogglePad(GPIOA, GPIOA_XP2_PA2);
 #endif
+	ISR_TIME_END(ISR_SDADC3);
 }
 
 static void adc_error_cb(ADCDriver *adcd ATTR_UNUSED, adcerror_t err ATTR_UNUSED)
@@ -164,7 +270,7 @@ static const ADCConversionGroup adc1group = {
 	.error_cb = adc_error_cb,
 	.u.adc = {
 		.cr1 = 0,
-		.cr2 = ADC_CR2_SWSTART,
+		.cr2 = ADC_CR2_EXTTRIG,		/* EXTSEL 000: TIM19_TRGO */
 		.ltr = 0,
 		.htr = 0,
 		.smpr = {
@@ -198,7 +304,8 @@ static const ADCConversionGroup sdadc1group = {
 	.end_cb = adc_temp_oilp_vbat_cb,
 	.error_cb = adc_error_cb,
 	.u.sdadc = {
-		.cr2 = SDADC_CR2_JSWSTART,
+		.cr2 = SDADC_CR2_JEXTEN_0 |		/* rising edge */
+			SDADC_CR2_JEXTSEL_2 | SDADC_CR2_JEXTSEL_0,	/* 101: TIM19_CC2 */
 		.jchgr = SDADC_JCHGR_CH(6) |
 			SDADC_JCHGR_CH(5) |
 			SDADC_JCHGR_CH(4),
@@ -211,6 +318,25 @@ static const ADCConversionGroup sdadc1group = {
 	}
 };
 
+/* V bat, engine therm 1 (OIL_P disabled) */
+static const ADCConversionGroup sdadc1group_no_oilp = {
+	.circular = TRUE,
+	.num_channels = 2,
+	.end_cb = adc_temp_oilp_vbat_cb,
+	.error_cb = adc_error_cb,
+	.u.sdadc = {
+		.cr2 = SDADC_CR2_JEXTEN_0 |		/* rising edge */
+			SDADC_CR2_JEXTSEL_2 | SDADC_CR2_JEXTSEL_0,	/* 101: TIM19_CC2 */
+		.jchgr = SDADC_JCHGR_CH(6) |
+			SDADC_JCHGR_CH(4),
+		.confchr = {
+			SDADC_CONFCHR1_CH6(0) |
+				SDADC_CONFCHR1_CH4(0),
+			0
+		}
+	}
+};
+
 /* Flow sensor */
 static const ADCConfig sdadc3cfg = {
 	.cr1 = 0,
@@ -226,7 +352,7 @@ static const ADCConversionGroup sdadc3group = {
 	.end_cb = adc_flow_cb,
 	.error_cb = adc_error_cb,
 	.u.sdadc = {
-		.cr2 = SDADC_CR2_JSWSTART /* | SDADC_CR2_FAST */,
+		.cr2 = SDADC_CR2_JSYNC,	/* started with SDADC1 */
 		.jchgr = SDADC_JCHGR_CH(6),
 		.confchr = {
 			SDADC_CONFCHR1_CH6(0),
@@ -254,6 +380,171 @@ MAKE_GETTER(int_temp, int_temp);
 
 #undef MAKE_GETTER
 
+/** Get time stamp of last converted block
+ */
+void adc_get_timestamp(enum adc_converter conv, adc_timestamp_t *ts)
+{
+	const adc_timestamp_t *src;
+
+	switch (conv) {
+	case ADC_CONV_ADC1:
+		src = &m_ts_adc1;
+		break;
+	case ADC_CONV_SDADC1:
+		src = &m_ts_sdadc1;
+		break;
+	case ADC_CONV_SDADC3:
+	default:
+		src = &m_ts_sdadc3;
+		break;
+	}
+
+	chSysLock();
+	*ts = *src;
+	chSysUnlock();
+}
+
+/** Exact conversion rate of all converters [Hz]
+ */
+float adc_get_rate(void)
+{
+	return m_trigger_rate;
+}
+
+/** Time spent in conversion callbacks [0.01 %]
+ */
+uint32_t adc_get_isr_load(void)
+{
+	return m_isr_load;
+}
+
+/* -*- conversion gating -*- */
+
+/* conversion callback filters and their cutoff [Hz] */
+static const struct {
+	LowPassFilter2p *filter;
+	float cutoff;
+} m_filters[] = {
+	/* SAR ADC1 */
+	{ &fo_int_temp, 50.0 },
+	{ &fo_vrtc, 50.0 },
+	/* SD ADC1 */
+	{ &fo_temp_volt, 10.0 },
+	{ &fo_oilp_volt, 10.0 },
+	{ &fo_vbat, 10.0 },
+	/* SD ADC3 */
+	{ &fo_flow_volt, 50.0 },
+};
+
+/* new coefficients, calculated outside of lock (not on small thread stack) */
+static LowPassFilter2p m_filters_new[ARRAY_SIZE(m_filters)];
+
+static void adc_filters_calc(float rate)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(m_filters); i++) {
+		lpf2pObjectInit(&m_filters_new[i]);
+		lpf2pSetCutoffFrequency(&m_filters_new[i], rate, m_filters[i].cutoff);
+	}
+}
+
+/** Switch filters to calculated coefficients, filter state kept.
+ * Must be called with lock.
+ */
+static void adc_filters_setup_i(void)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(m_filters); i++)
+		lpf2pCopyCoefficients(m_filters[i].filter, &m_filters_new[i]);
+}
+
+static void adc_start_sdadc1(void)
+{
+	adcStartConversion(&SDADCD1, (m_oilp_on)? &sdadc1group : &sdadc1group_no_oilp,
+			p_temp_oilp_vbat_samples, 1);
+}
+
+/* SDADC3 fully stopped (clock off) when flow not used */
+static void adc_start_sdadc3(void)
+{
+	adcStart(&SDADCD3, &sdadc3cfg);
+	adcSTM32Calibrate(&SDADCD3);
+	adcStartConversion(&SDADCD3, &sdadc3group, p_flow_samples, 1);
+}
+
+static void adc_stop_sdadc3(void)
+{
+	adcStopConversion(&SDADCD3);
+	adcStop(&SDADCD3);
+}
+
+/**
+ * Convert only what is used:
+ * - SDADC3 (flow) stopped if flow, its crank sampling and spectrum unused;
+ * - OIL_P dropped from SDADC1 group the same way;
+ * - ADC_IDLE_RATE while engine not running (and no spectrum capture).
+ */
+static void adc_update_gating(bool init)
+{
+	bool flow = flow_is_enabled() || crank_is_enabled(CRANK_CH_FLOW)
+		|| spectrum_is_capturing(SPECTRUM_CH_FLOW);
+	bool oilp = oilp_is_enabled() || crank_is_enabled(CRANK_CH_OILP)
+		|| spectrum_is_capturing(SPECTRUM_CH_OILP);
+	bool full = rpm_is_engine_running()
+		|| spectrum_is_capturing(SPECTRUM_CH_FLOW)
+		|| spectrum_is_capturing(SPECTRUM_CH_OILP);
+	uint32_t rate = (full || gp_adc_idle_rate > gp_adc_rate)? gp_adc_rate : gp_adc_idle_rate;
+
+	if (!init && flow == m_flow_on && oilp == m_oilp_on && rate == m_rate)
+		return;
+
+	if (rate != m_rate) {
+		/* exact rate as set by adc_trigger_set_rate_i() */
+		adc_filters_calc((float)TRIG_CLOCK / (TRIG_CLOCK / rate));
+
+		chSysLock();
+		adc_trigger_set_rate_i(rate);
+		adc_filters_setup_i();
+		spectrum_rate_changed_i();
+		chSysUnlock();
+	}
+
+	if (init || oilp != m_oilp_on) {
+		m_oilp_on = oilp;
+		if (!init)
+			adcStopConversion(&SDADCD1);
+		adc_start_sdadc1();
+	}
+
+	if (init || flow != m_flow_on) {
+		m_flow_on = flow;
+		if (flow)
+			adc_start_sdadc3();
+		else if (!init)
+			adc_stop_sdadc3();
+	}
+
+	m_rate = rate;
+}
+
+/* ISR load over ~1 s windows */
+static void adc_update_load(void)
+{
+	static rtcnt_t start;
+	static uint32_t start_cycles;
+	rtcnt_t now = chSysGetRealtimeCounterX();
+	rtcnt_t elapsed = now - start;
+	uint32_t cycles = 0;
+
+	if (elapsed < STM32_HCLK)
+		return;
+
+	for (size_t i = 0; i < ISR_MAX; i++)
+		cycles += m_isr_cycles[i];
+
+	m_isr_load = (uint64_t)(cycles - start_cycles) * 10000 / elapsed;
+	start = now;
+	start_cycles = cycles;
+}
+
 /* -*- module thread -*- */
 
 void adc_handle_battery(void);
@@ -281,27 +572,17 @@ static THD_FUNCTION(th_adc, arg ATTR_UNUSED)
 	lpf2pObjectInit(&fo_vbat);
 	lpf2pObjectInit(&fo_flow_volt);
 
-	/* Experimental freq's:
-	 * PC13:	8.935 kHz	111 uS
-	 * PA1:		2.78 kHz	350 uS
-	 * PA2:		8.34 kHz	120 uS
-	 *
-	 * So actual sampling freq's:
-	 * 		(measured)	(calced)
-	 * ADC1:	17.78 kHz	2 * 17.1 us => 29.24 kHz
-	 * SDADC1:	5.56 kHz	16600 / 3 => 5.5(3) kHz
-	 * SDADC3:	16.68 kHz	16600 / 1 => 16.6 kHz
+	/* One trigger converts whole group on each converter,
+	 * SDADC1 group (3 channels, ~180 us) limits rate to ~5 kHz.
+	 * Previously converters were free running:
+	 * ADC1 17.78 kHz, SDADC1 5.56 kHz, SDADC3 16.68 kHz (measured).
 	 */
-
-	/* SAR ADC1 */
-	lpf2pSetCutoffFrequency(&fo_int_temp, 17780.0, 50.0);
-	lpf2pSetCutoffFrequency(&fo_vrtc, 17780.0, 50.0);
-	/* SD ADC1 */
-	lpf2pSetCutoffFrequency(&fo_temp_volt, 5560.0, 10.0);
-	lpf2pSetCutoffFrequency(&fo_oilp_volt, 5560.0, 10.0);
-	lpf2pSetCutoffFrequency(&fo_vbat, 5560.0, 10.0);
-	/* SD ADC3 */
-	lpf2pSetCutoffFrequency(&fo_flow_volt, 16680.0, 50.0);
+	m_rate = gp_adc_rate;
+	adc_trigger_start(m_rate);
+	adc_filters_calc(m_trigger_rate);
+	chSysLock();
+	adc_filters_setup_i();
+	chSysUnlock();
 
 	/* ADC1 */
 	adcStart(&ADCD1, NULL);
@@ -313,23 +594,28 @@ static THD_FUNCTION(th_adc, arg ATTR_UNUSED)
 	adcStart(&SDADCD1, &sdadc1cfg);
 	adcSTM32Calibrate(&SDADCD1);
 
-	/* SDADC3 */
-	adcStart(&SDADCD3, &sdadc3cfg);
-	adcSTM32Calibrate(&SDADCD3);
-
-	/* Start continous conversions */
+	/* Start conversions, wait triggers.
+	 * SDADC1 group and SDADC3 selected by gating.
+	 */
 	adcStartConversion(&ADCD1, &adc1group, p_int_temp_vrtc_samples, 1);
-	adcStartConversion(&SDADCD1, &sdadc1group, p_temp_oilp_vbat_samples, 1);
-	adcStartConversion(&SDADCD3, &sdadc3group, p_flow_samples, 1);
+	adc_update_gating(true);
 
 	alert_component(ALS_ADC, AL_NORMAL);
+	sv_register(SV_TASK_ADC);
 	while (true) {
 		chThdSleepMilliseconds(20);
+		sv_checkin(SV_TASK_ADC);
 
 		adc_handle_battery();
 		adc_handle_temperature();
 		adc_handle_oilp();
 		adc_handle_flow();
+
+		adc_update_gating(false);
+		adc_update_load();
+
+		alarm_evaluate();
+		bbox_record();
 	}
 
 	return MSG_OK;
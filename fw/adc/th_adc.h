@@ -24,28 +24,81 @@
 #define TH_ADC_H
 
 #include "fw_common.h"
+#include "crankbins.h"
 
 void adc_init(void);
 
+enum adc_converter {
+	ADC_CONV_ADC1 = 0,	//!< int temp, V rtc
+	ADC_CONV_SDADC1,	//!< V bat, temp, oil
+	ADC_CONV_SDADC3		//!< flow
+};
+
+//! Conversion block time stamp
+typedef struct {
+	uint32_t seq;		//!< blocks converted since start
+	rtcnt_t rtc;		//!< trigger time (realtime counter)
+} adc_timestamp_t;
+
+void adc_get_timestamp(enum adc_converter conv, adc_timestamp_t *ts);
+float adc_get_rate(void);
+uint32_t adc_get_isr_load(void);
+
 /* subsystem functions */
 
 uint32_t batt_get_voltage(void);
-bool batt_check_voltage(void);
+float batt_get_min_voltage(void);
 bool batt_get_remaining(uint32_t *out);
+void batt_pfail_check_isr(float raw_vbat);
+bool batt_pfail_is_active(void);
 
 int32_t cpu_get_temperature(void);
 bool cpu_get_rtc_voltage(uint32_t *out);
 
 int32_t temp_get_temperature(void);
-bool temp_check_temperature(void);
 
+bool oilp_is_enabled(void);
 bool oilp_get_pressure(int32_t *out);
 bool oilp_get_temperature(int32_t *out);
 
+bool flow_is_enabled(void);
 bool flow_get_flow(uint32_t *out);
 uint32_t flow_get_used_ml(void);
-bool flow_check_fuel(void);
 bool flow_get_remaining(uint32_t *out);
+bool flow_get_remaining_ml(int32_t *out);
+
+enum crank_channel {
+	CRANK_CH_FLOW = 0,
+	CRANK_CH_OILP,
+	CRANK_NCH
+};
+
+bool crank_is_enabled(enum crank_channel ch);
+void crank_edge_isr(rtcnt_t edge, uint32_t period_us, bool rev_start);
+void crank_reset_isr(void);
+void crank_sample_isr(enum crank_channel ch, float value, rtcnt_t t);
+bool crank_get_revolution(enum crank_channel ch, float out[CRANK_BINS], uint32_t *seq);
+bool crank_get_cycle_average(enum crank_channel ch, float *out);
+
+#define SPECTRUM_MIN_WINDOW		64
+#define SPECTRUM_MAX_WINDOW		512
+#define SPECTRUM_MAX_DECIMATION		64
+
+//! note: same order as SpectrumRequest.Channel
+enum spectrum_channel {
+	SPECTRUM_CH_FLOW = 0,
+	SPECTRUM_CH_OILP,
+	SPECTRUM_NCH
+};
+
+bool spectrum_start(enum spectrum_channel ch, uint32_t window, uint32_t decimation);
+void spectrum_sample_isr(enum spectrum_channel ch, float value);
+void spectrum_rate_changed_i(void);
+bool spectrum_is_capturing(enum spectrum_channel ch);
+bool spectrum_is_ready(void);
+const float *spectrum_compute(enum spectrum_channel *ch, uint32_t *window,
+		float *sample_rate, uint32_t *nbins);
+void spectrum_release(void);
 
 // get raw adc values
 float adc_getraw_temp(void);
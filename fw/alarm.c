@@ -0,0 +1,353 @@
+/**
+ * @file       alarm.c
+ * @brief      Alarm rules engine
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "alarm.h"
+#include "miniecu.pb.h"
+#include "th_rpm.h"
+#include "adc/th_adc.h"
+#include "hw/ectl_pads.h"
+#include "hw/rtc_time.h"
+#include "alert_led.h"
+#include "log/blackbox.h"
+#include "param_table.h"
+#include <math.h>
+#include <string.h>
+
+/*
+ * Rules are evaluated once per ADC thread decimated sample (20 ms).
+ *
+ * Rule becomes active when condition holds for debounce time,
+ * and released only when value goes back beyond threshold +- hysteresis.
+ * Status flags are OR of all active rules, action called once on activation.
+ *
+ * Built-in rules replaces old *_check_*() functions,
+ * thresholds taken from parameters (NAN threshold disables rule).
+ * Two user rules configured by ALRMn_* parameters.
+ */
+
+/* -*- parameters -*- */
+float gp_temp_overheat;
+float gp_cpu_overheat;
+int32_t gp_rpm_limit;
+int32_t gp_flow_low_ml;		// mL
+
+extern int32_t gp_flow_tank_ml;	// adc_flow.c
+
+#define USER_RULE_PARAMS(n)			\
+	uint8_t gp_alrm ## n ## _chan;		\
+	uint8_t gp_alrm ## n ## _cmp;		\
+	float gp_alrm ## n ## _thresh;		\
+	float gp_alrm ## n ## _hyst;		\
+	int32_t gp_alrm ## n ## _debounce;	\
+	uint8_t gp_alrm ## n ## _flag;		\
+	uint8_t gp_alrm ## n ## _action;
+
+USER_RULE_PARAMS(1)
+USER_RULE_PARAMS(2)
+
+#undef USER_RULE_PARAMS
+
+/* -*- rule table -*- */
+
+/* user rules take channel, condition and action as ALRMn_* value,
+ * ALRM2_* have same values as ALRM1_* */
+enum alarm_channel {
+	ALCH_NONE = ALRM1_CHAN__Disabled,
+	ALCH_VBAT = ALRM1_CHAN__VBAT,	//!< [V]
+	ALCH_TEMP = ALRM1_CHAN__TEMP,	//!< engine temperature [C°]
+	ALCH_OILT = ALRM1_CHAN__OILT,	//!< OIL_P NTC temperature [C°]
+	ALCH_CPUT = ALRM1_CHAN__CPUT,	//!< chip temperature [C°]
+	ALCH_RPM = ALRM1_CHAN__RPM,
+	ALCH_FUEL = ALRM1_CHAN__FUEL,	//!< remaining fuel [mL]
+	ALCH_MAX
+};
+
+enum alarm_cmp {
+	ALCMP_ABOVE = ALRM1_CMP__Above,
+	ALCMP_BELOW = ALRM1_CMP__Below
+};
+
+enum alarm_action {
+	ALACT_NONE = ALRM1_ACTION__None,
+	ALACT_IGNITION_OFF = ALRM1_ACTION__IgnitionOff
+};
+
+struct alarm_rule {
+	uint8_t channel;	//!< @see alarm_channel
+	uint8_t cmp;		//!< @see alarm_cmp
+	uint8_t action;		//!< @see alarm_action
+	uint32_t flag;		//!< miniecu_Status_Flags
+	float threshold;
+	float hysteresis;
+	systime_t debounce;
+};
+
+struct alarm_state {
+	bool active;
+	bool pending;
+	systime_t since;	//!< pending start time
+};
+
+struct alarm_builtin {
+	uint8_t channel;
+	uint8_t cmp;
+	uint32_t flag;
+	float hysteresis;
+	uint32_t debounce_ms;
+	float (*threshold)(void);
+};
+
+static float thr_vbat(void)
+{
+	return batt_get_min_voltage();
+}
+
+static float thr_temp(void)
+{
+	return gp_temp_overheat;
+}
+
+static float thr_cput(void)
+{
+	return gp_cpu_overheat;
+}
+
+static float thr_rpm(void)
+{
+	return gp_rpm_limit;
+}
+
+static float thr_fuel(void)
+{
+	if (gp_flow_low_ml == 0 || gp_flow_tank_ml == 0)
+		return NAN;
+
+	return gp_flow_low_ml;
+}
+
+static const struct alarm_builtin m_builtin[] = {
+	{ ALCH_VBAT, ALCMP_BELOW, miniecu_Status_Flags_UNDERVOLTAGE, 0.2, 2000, thr_vbat },
+	{ ALCH_TEMP, ALCMP_ABOVE, miniecu_Status_Flags_OVERHEAT, 3.0, 1000, thr_temp },
+	{ ALCH_CPUT, ALCMP_ABOVE, miniecu_Status_Flags_OVERHEAT, 3.0, 1000, thr_cput },
+	{ ALCH_RPM, ALCMP_ABOVE, miniecu_Status_Flags_HIGH_RPM, 200, 200, thr_rpm },
+	{ ALCH_FUEL, ALCMP_BELOW, miniecu_Status_Flags_LOW_FUEL, 0, 5000, thr_fuel },
+};
+
+#define ALARM_USER_RULES	2
+#define ALARM_MAX_RULES		(ARRAY_SIZE(m_builtin) + ALARM_USER_RULES)
+
+static const uint32_t m_user_flags[] = {
+	[ALRM1_FLAG__Error] = miniecu_Status_Flags_ERROR,
+	[ALRM1_FLAG__Undervoltage] = miniecu_Status_Flags_UNDERVOLTAGE,
+	[ALRM1_FLAG__Overheat] = miniecu_Status_Flags_OVERHEAT,
+	[ALRM1_FLAG__LowFuel] = miniecu_Status_Flags_LOW_FUEL,
+	[ALRM1_FLAG__LowOilPressure] = miniecu_Status_Flags_LOW_OIL_PRESSURE,
+	[ALRM1_FLAG__HighRPM] = miniecu_Status_Flags_HIGH_RPM
+};
+
+/* -*- module variables -*- */
+
+static struct alarm_rule m_rules[ALARM_MAX_RULES];
+static struct alarm_state m_state[ALARM_MAX_RULES];
+static size_t m_nrules;
+static uint32_t m_rules_gen = ~0;
+static volatile uint32_t m_flags;
+
+static void alarm_add_user_rule(size_t *n, uint8_t chan, uint8_t cmp, float thresh,
+		float hyst, int32_t debounce_ms, uint8_t flag, uint8_t action)
+{
+	if (chan == ALCH_NONE || chan >= ALCH_MAX || flag >= ARRAY_SIZE(m_user_flags))
+		return;
+
+	struct alarm_rule *r = &m_rules[(*n)++];
+	r->channel = chan;
+	r->cmp = cmp;
+	r->action = action;
+	r->flag = m_user_flags[flag];
+	r->threshold = thresh;
+	r->hysteresis = hyst;
+	r->debounce = MS2ST(debounce_ms);
+}
+
+/**
+ * Rebuild rule table from parameters.
+ * State kept for rules which stay on the same place with same channel.
+ */
+static void alarm_build_rules(void)
+{
+	struct alarm_rule prev[ALARM_MAX_RULES];
+	size_t prev_n = m_nrules;
+	size_t i, n;
+	uint32_t gen;
+
+	memcpy(prev, m_rules, sizeof(prev));
+
+	do {
+		gen = param_read_begin();
+		n = 0;
+
+		for (i = 0; i < ARRAY_SIZE(m_builtin); i++) {
+			const struct alarm_builtin *b = &m_builtin[i];
+			struct alarm_rule *r = &m_rules[n++];
+
+			r->channel = b->channel;
+			r->cmp = b->cmp;
+			r->action = ALACT_NONE;
+			r->flag = b->flag;
+			r->threshold = b->threshold();
+			r->hysteresis = b->hysteresis;
+			r->debounce = MS2ST(b->debounce_ms);
+		}
+
+		alarm_add_user_rule(&n, gp_alrm1_chan, gp_alrm1_cmp, gp_alrm1_thresh,
+				gp_alrm1_hyst, gp_alrm1_debounce, gp_alrm1_flag, gp_alrm1_action);
+		alarm_add_user_rule(&n, gp_alrm2_chan, gp_alrm2_cmp, gp_alrm2_thresh,
+				gp_alrm2_hyst, gp_alrm2_debounce, gp_alrm2_flag, gp_alrm2_action);
+	} while (param_read_retry(gen));
+
+	for (i = 0; i < n; i++)
+		if (i >= prev_n || prev[i].channel != m_rules[i].channel
+				|| prev[i].flag != m_rules[i].flag)
+			memset(&m_state[i], 0, sizeof(m_state[i]));
+
+	m_nrules = n;
+	m_rules_gen = gen;
+}
+
+/**
+ * Read all channels once per pass.
+ * NAN means value not available.
+ */
+static void alarm_read_channels(float values[ALCH_MAX])
+{
+	int32_t oilt;
+
+	values[ALCH_NONE] = NAN;
+	values[ALCH_VBAT] = batt_get_voltage() / 1000.0;
+	values[ALCH_TEMP] = temp_get_temperature() / 1000.0;
+	values[ALCH_OILT] = oilp_get_temperature(&oilt)? oilt / 1000.0 : NAN;
+	values[ALCH_CPUT] = cpu_get_temperature() / 1000.0;
+	values[ALCH_RPM] = rpm_get_filtered();
+	values[ALCH_FUEL] = (gp_flow_tank_ml != 0)?
+		(float)gp_flow_tank_ml - flow_get_used_ml() : NAN;
+}
+
+static void alarm_do_action(uint8_t action)
+{
+	switch (action) {
+	case ALACT_IGNITION_OFF:
+		ctl_ignition_set(false);
+		bbox_trigger(BBOX_ALARM, action);
+		debug_printf(DP_WARN, "ALARM: ignition off");
+		break;
+
+	default:
+		break;
+	}
+}
+
+/* -*- global -*- */
+
+/**
+ * Evaluate all rules in one pass.
+ * Called from ADC thread after new decimated data arrives.
+ */
+void alarm_evaluate(void)
+{
+	float values[ALCH_MAX];
+	uint32_t flags = 0;
+	systime_t now = chVTGetSystemTimeX();
+
+	if (m_rules_gen != param_generation)
+		alarm_build_rules();
+
+	alarm_read_channels(values);
+
+	for (size_t i = 0; i < m_nrules; i++) {
+		const struct alarm_rule *r = &m_rules[i];
+		struct alarm_state *s = &m_state[i];
+		float v = values[r->channel];
+		bool cond, release;
+
+		if (isnan(v) || isnan(r->threshold)) {
+			s->active = s->pending = false;
+			continue;
+		}
+
+		if (r->cmp == ALCMP_ABOVE) {
+			cond = v > r->threshold;
+			release = v < r->threshold - r->hysteresis;
+		}
+		else {
+			cond = v < r->threshold;
+			release = v > r->threshold + r->hysteresis;
+		}
+
+		if (s->active) {
+			if (release)
+				s->active = false;
+		}
+		else if (!cond) {
+			s->pending = false;
+		}
+		else if (!s->pending) {
+			s->pending = true;
+			s->since = now;
+		}
+
+		if (!s->active && s->pending && (systime_t)(now - s->since) >= r->debounce) {
+			s->active = true;
+			s->pending = false;
+			alarm_do_action(r->action);
+		}
+
+		if (s->active)
+			flags |= r->flag;
+	}
+
+	m_flags = flags;
+}
+
+/**
+ * Return Status.Flags of active alarms
+ */
+uint32_t alarm_get_flags(void)
+{
+	return m_flags;
+}
+
+/**
+ * Return full Status.Flags: system state and active alarms
+ */
+uint32_t alarm_get_status(void)
+{
+	uint32_t flags = m_flags;
+
+	if (time_is_known())		flags |= miniecu_Status_Flags_TIME_KNOWN;
+	if (ctl_ignition_state())	flags |= miniecu_Status_Flags_IGNITION_ENABLED;
+	if (ctl_starter_state())	flags |= miniecu_Status_Flags_STARTER_ENABLED;
+	if (rpm_is_engine_running())	flags |= miniecu_Status_Flags_ENGINE_RUNNING;
+	if (rpm_is_misfiring())		flags |= miniecu_Status_Flags_MISFIRE;
+	if (alert_check_error())	flags |= miniecu_Status_Flags_ERROR;
+
+	return flags;
+}
@@ -22,12 +22,52 @@
 
 #include "alert_led.h"
 #include "hw/led.h"
+#include "log/blackbox.h"
+
+/*
+ * Black box incident for component failure: only sources which don't
+ * recover by themselves (COMM fails on every bad frame), failed for
+ * BBOX_ALERT_PERSIST, and no more than one incident per BBOX_ALERT_HOLDOFF
+ * for each source (each incident is one flash slot write, flapping source
+ * must not hide failure of another one).
+ */
+#define BBOX_ALERT_SOURCES	((1 << ALS_ADC) | (1 << ALS_RPM) | (1 << ALS_FLASH))
+#define BBOX_ALERT_PERSIST	S2ST(2)
+#define BBOX_ALERT_HOLDOFF	S2ST(600)
 
 /* local variables */
 
 static enum alert_status al_status[ALS_MAX];
+static systime_t al_fail_time[ALS_MAX];
 static THD_WORKING_AREA(wa_led, LED_WASZ);
 
+static void alert_check_bbox(void)
+{
+	static uint8_t reported;	/* sources already recorded in current failure */
+	static uint8_t holdoff;		/* sources recorded less than BBOX_ALERT_HOLDOFF ago */
+	static systime_t last_time[ALS_MAX];
+
+	for (int i = 0; i < ALS_MAX; i++) {
+		if ((holdoff & (1 << i)) && chVTTimeElapsedSinceX(last_time[i]) >= BBOX_ALERT_HOLDOFF)
+			holdoff &= ~(1 << i);
+
+		if (al_status[i] != AL_FAIL) {
+			reported &= ~(1 << i);
+			continue;
+		}
+
+		if (!(BBOX_ALERT_SOURCES & (1 << i)) || (reported & (1 << i))
+				|| chVTTimeElapsedSinceX(al_fail_time[i]) < BBOX_ALERT_PERSIST
+				|| (holdoff & (1 << i)))
+			continue;
+
+		bbox_trigger(BBOX_ALERT, i);
+		reported |= 1 << i;
+		holdoff |= 1 << i;
+		last_time[i] = chVTGetSystemTimeX();
+	}
+}
+
 /* thread */
 
 static THD_FUNCTION(th_led, arg ATTR_UNUSED)
@@ -35,6 +75,8 @@ static THD_FUNCTION(th_led, arg ATTR_UNUSED)
 	chRegSetThreadName("led");
 
 	while (true) {
+		alert_check_bbox();
+
 		enum alert_status st = AL_NORMAL;
 		for (int i = 0; i < ALS_MAX; i++) {
 			if (al_status[i] == AL_FAIL)
@@ -67,11 +109,17 @@ static THD_FUNCTION(th_led, arg ATTR_UNUSED)
 /* public interface */
 
 /** Set component status
+ *
+ * Persistent component failure freezes black box recorder
+ * (checked by @a th_led).
  */
 void alert_component(enum alert_source src, enum alert_status st)
 {
 	osalDbgAssert((src < ALS_MAX), "alert source");
 
+	if (st == AL_FAIL && al_status[src] != AL_FAIL)
+		al_fail_time[src] = chVTGetSystemTimeX();
+
 	al_status[src] = st;
 }
 
@@ -86,6 +134,18 @@ bool alert_check_error(void)
 	return false;
 }
 
+/** Get all component states, 2 bits per source
+ */
+uint16_t alert_get_states(void)
+{
+	uint16_t states = 0;
+
+	for (int i = 0; i < ALS_MAX; i++)
+		states |= al_status[i] << (i * 2);
+
+	return states;
+}
+
 /** Start alert led subsytem
  *
  * Starts @a th_led thread
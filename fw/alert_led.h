@@ -43,5 +43,6 @@ enum alert_source {
 void alert_led_init(void);
 void alert_component(enum alert_source src, enum alert_status st);
 bool alert_check_error(void);
+uint16_t alert_get_states(void);
 
 #endif /* ALERT_LED_H */
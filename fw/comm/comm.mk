@@ -1,4 +1,5 @@
 COMMSRC = ${MINIECU}/fw/comm/pbstx.c \
-	  ${MINIECU}/fw/comm/th_comm_pbstx.c
+	  ${MINIECU}/fw/comm/th_comm_pbstx.c \
+	  ${MINIECU}/fw/comm/tdma.c
 
 COMMINC =
@@ -32,8 +32,11 @@
 struct pbstx_header {
 	uint8_t seq;
 	uint16_t len;
+	uint16_t engine_id;	/* v1 only */
 } __attribute__((packed));
 
+#define PBSTX_HDR_V0_SIZE	3
+
 /**
  * Initialize PBSTX protocol object
  */
@@ -44,6 +47,9 @@ void pbstxObjectInit(PBStxDev *instp, BaseChannel *chp)
 
 	instp->chp = chp;
 	instp->rx_seq = instp->tx_seq = 0;
+	instp->rx_engine_id = PBSTX_RX_ANY;
+	instp->tx_addressed = false;
+	instp->rx_timeout = PBSTX_RX_TIMEOUT;
 	osalMutexObjectInit(&instp->tx_mutex);
 }
 
@@ -51,7 +57,7 @@ void pbstxObjectInit(PBStxDev *instp, BaseChannel *chp)
  * Receive one message
  *
  * @return MSG_OK if message parsed,
- *         MSG_RESET if error occurs
+ *         MSG_RESET if error occurs or v1 frame is not for rx_engine_id
  *         Q_TIMEOUT if timedout, in that case restart receiving with same *msg
  *
  * @todo use rx_seq to calculate missing message count
@@ -68,19 +74,33 @@ msg_t pbstxReceive(PBStxDev *instp, pbstx_message_t *msg)
 		struct pbstx_header hdr;
 
 		// 1. wait STX
-		ret = chnGetTimeout(instp->chp, SER_TIMEOUT);
+		ret = chnGetTimeout(instp->chp, instp->rx_timeout);
 		if (ret != PBSTX_STX)
 			return ret;
 
 		// 2. read header
-		ret = chnReadTimeout(instp->chp, (uint8_t*)&hdr, sizeof(hdr), SER_TIMEOUT);
+		size_t hdr_size = PBSTX_HDR_V0_SIZE;
+		ret = chnReadTimeout(instp->chp, (uint8_t*)&hdr, hdr_size, SER_TIMEOUT);
 		if (ret < 0) {
 			alert_component(ALS_COMM, AL_FAIL);
 			return ret;
 		}
 
-		instp->rx_checksum = crc16((uint8_t*)&hdr, sizeof(hdr));
-		msg->size = hdr.len;
+		msg->flags = hdr.len & ~PBSTX_LEN_MASK;
+		msg->engine_id = 0;
+		if (msg->flags & PBSTX_HDR_ADDR) {
+			ret = chnReadTimeout(instp->chp, (uint8_t*)&hdr.engine_id,
+					sizeof(hdr.engine_id), SER_TIMEOUT);
+			if (ret < 0) {
+				alert_component(ALS_COMM, AL_FAIL);
+				return ret;
+			}
+
+			hdr_size = sizeof(hdr);
+			msg->engine_id = hdr.engine_id;
+		}
+
+		msg->size = hdr.len & PBSTX_LEN_MASK;
 		msg->seq = instp->rx_seq = hdr.seq;
 
 		if (msg->size > PBSTX_PAYLOAD_BYTES) {
@@ -89,24 +109,36 @@ msg_t pbstxReceive(PBStxDev *instp, pbstx_message_t *msg)
 			return MSG_RESET;
 		}
 
-		// 3. read payload
+		/* other ECU traffic on shared link: skip payload without CRC */
+		bool foreign = instp->rx_engine_id != PBSTX_RX_ANY
+			&& (msg->flags & PBSTX_HDR_ADDR)
+			&& ((msg->flags & PBSTX_HDR_UPLINK)
+				|| (msg->engine_id != 0 && msg->engine_id != (uint32_t)instp->rx_engine_id));
+
+		// 3. read payload and crc16
 		ret = chnReadTimeout(instp->chp, msg->payload, msg->size, SER_PAYLOAD_TIMEOUT);
+		if (ret >= 0)
+			ret = chnReadTimeout(instp->chp, (uint8_t*)&msg->checksum, sizeof(msg->checksum), SER_TIMEOUT);
 		if (ret < 0) {
 			alert_component(ALS_COMM, AL_FAIL);
 			return ret;
 		}
 
-		instp->rx_checksum = crc16part(msg->payload, msg->size, instp->rx_checksum);
+		if (foreign)
+			return MSG_RESET;
 
-		// 4. read crc16
-		ret = chnReadTimeout(instp->chp, (uint8_t*)&msg->checksum, sizeof(msg->checksum), SER_TIMEOUT);
-		if (ret < 0) {
-			alert_component(ALS_COMM, AL_FAIL);
-			return ret;
-		}
+		instp->rx_checksum = crc16((uint8_t*)&hdr, hdr_size);
+		instp->rx_checksum = crc16part(msg->payload, msg->size, instp->rx_checksum);
 
-		// 5. check crc && process pkt
+		// 4. check crc && process pkt
 		if (instp->rx_checksum == msg->checksum) {
+			/* answer in header version of last frame addressed to us,
+			 * broadcast and uplink frames tell nothing about peer */
+			if (!(msg->flags & PBSTX_HDR_ADDR))
+				instp->tx_addressed = false;
+			else if (msg->engine_id != 0 && !(msg->flags & PBSTX_HDR_UPLINK))
+				instp->tx_addressed = true;
+
 			alert_component(ALS_COMM, AL_NORMAL);
 			return MSG_OK;
 		}
@@ -119,6 +151,28 @@ msg_t pbstxReceive(PBStxDev *instp, pbstx_message_t *msg)
 	return MSG_RESET;
 }
 
+/**
+ * Write frame header, start checksum
+ * Header v1 used if message has engine_id and peer understands it.
+ */
+static msg_t pbstx_write_header(PBStxDev *instp, pbstx_message_t *msg)
+{
+	uint16_t len = msg->size;
+	size_t hdr_size = 1 + PBSTX_HDR_V0_SIZE;
+
+	if (instp->tx_addressed && (msg->flags & PBSTX_HDR_ADDR)) {
+		len |= msg->flags & ~PBSTX_LEN_MASK;
+		hdr_size += sizeof(msg->engine_id);
+	}
+
+	msg->seq = instp->tx_seq++;
+	uint8_t header[] = { PBSTX_STX, msg->seq, len & 0xff, len >> 8,
+		msg->engine_id & 0xff, msg->engine_id >> 8 };
+
+	instp->tx_checksum = crc16(header + 1, hdr_size - 1);
+	return chnWriteTimeout(instp->chp, header, hdr_size, SER_TIMEOUT);
+}
+
 /**
  * Send pbstx_message_t
  *
@@ -132,15 +186,11 @@ msg_t pbstxSend(PBStxDev *instp, pbstx_message_t *msg)
 
 	chMtxLock(&instp->tx_mutex);
 
-	msg_t ret;
-	uint8_t header[] = { PBSTX_STX, instp->tx_seq++, msg->size & 0xff, msg->size >> 8 };
-
-	msg->checksum = crc16(header + 1, sizeof(header) - 1);
-	msg->checksum = crc16part(msg->payload, msg->size, msg->checksum);
-
-	ret = chnWriteTimeout(instp->chp, header, sizeof(header), SER_TIMEOUT);
+	msg_t ret = pbstx_write_header(instp, msg);
 	if (ret < 0) goto unlock_ret;
 
+	msg->checksum = crc16part(msg->payload, msg->size, instp->tx_checksum);
+
 	ret = chnWriteTimeout(instp->chp, msg->payload, msg->size, SER_PAYLOAD_TIMEOUT);
 	if (ret < 0) goto unlock_ret;
 
@@ -151,3 +201,83 @@ unlock_ret:
 	return ret;
 }
 
+/**
+ * Start frame which payload is written by pbstxSendWrite()
+ *
+ * Encoder output goes straight to the channel and checksum is updated
+ * on the way: no payload buffer copy and no second pass over payload.
+ * Payload size must be known before (nanopb sizing pass).
+ * Channel stays locked until pbstxSendEnd(), call it only if MSG_OK returned.
+ *
+ * @param msg	size, flags and engine_id for header, payload not used
+ */
+msg_t pbstxSendBegin(PBStxDev *instp, pbstx_message_t *msg)
+{
+	osalDbgCheck(instp != NULL);
+	osalDbgCheck(msg != NULL);
+	osalDbgAssert(msg->size <= PBSTX_PAYLOAD_BYTES, "message to long");
+
+	chMtxLock(&instp->tx_mutex);
+
+	msg_t ret = pbstx_write_header(instp, msg);
+	if (ret < 0) {
+		chMtxUnlock(&instp->tx_mutex);
+		return ret;
+	}
+
+	instp->tx_remaining = msg->size;
+	return MSG_OK;
+}
+
+/**
+ * Write part of payload
+ *
+ * @return MSG_RESET if more than announced size
+ */
+msg_t pbstxSendWrite(PBStxDev *instp, const uint8_t *buf, size_t count)
+{
+	if (count > instp->tx_remaining)
+		return MSG_RESET;
+
+	instp->tx_checksum = crc16part(buf, count, instp->tx_checksum);
+	instp->tx_remaining -= count;
+	return chnWriteTimeout(instp->chp, buf, count, SER_PAYLOAD_TIMEOUT);
+}
+
+/**
+ * Finish frame started by pbstxSendBegin()
+ *
+ * Header already announced payload size, so on failure frame is still
+ * completed: rest of payload padded with zeros and inverted checksum
+ * sent, receiver drops frame by CRC and stays in sync with next STX.
+ *
+ * @param ok	payload complete
+ * @return MSG_RESET if frame was not ok
+ */
+msg_t pbstxSendEnd(PBStxDev *instp, bool ok)
+{
+	static const uint8_t pad[16];
+	msg_t ret = MSG_OK;
+
+	ok = ok && instp->tx_remaining == 0;
+
+	while (instp->tx_remaining > 0 && ret >= 0) {
+		size_t count = instp->tx_remaining;
+		if (count > sizeof(pad))
+			count = sizeof(pad);
+
+		instp->tx_checksum = crc16part(pad, count, instp->tx_checksum);
+		instp->tx_remaining -= count;
+		ret = chnWriteTimeout(instp->chp, pad, count, SER_PAYLOAD_TIMEOUT);
+	}
+
+	if (!ok)
+		instp->tx_checksum = ~instp->tx_checksum;
+
+	if (ret >= 0)
+		ret = chnWriteTimeout(instp->chp, (uint8_t*)&instp->tx_checksum,
+				sizeof(instp->tx_checksum), SER_TIMEOUT);
+
+	chMtxUnlock(&instp->tx_mutex);
+	return ok ? ret : MSG_RESET;
+}
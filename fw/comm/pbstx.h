@@ -29,10 +29,25 @@
 
 #define PBSTX_PAYLOAD_BYTES	256
 
+/* LEN field flags, v1 header: <STX><SEQ><LEN[2]><ENGINE_ID[2]>
+ * v0 receivers drop v1 frames as too long.
+ */
+#define PBSTX_LEN_MASK		0x01ff
+#define PBSTX_HDR_ADDR		0x8000	/* engine_id known (v1 header) */
+#define PBSTX_HDR_UPLINK	0x4000	/* ECU -> host: engine_id is source */
+
+#define PBSTX_RX_ANY		-1	/* no engine_id filter */
+#define PBSTX_RX_TIMEOUT	MS2ST(100)	/* default wait for frame start */
+
 typedef struct PBstxDev {
 	BaseChannel *chp;
 	mutex_t tx_mutex;
+	int32_t rx_engine_id;	/* v1 frames not for it skipped after header */
+	bool tx_addressed;	/* last addressed request was v1 */
+	systime_t rx_timeout;	/* wait for STX, shorter if loop has work due */
 	uint16_t rx_checksum;
+	uint16_t tx_checksum;	/* of frame being sent */
+	uint16_t tx_remaining;	/* payload bytes until pbstxSendEnd() */
 	uint8_t rx_seq;
 	uint8_t tx_seq;
 } PBStxDev;
@@ -40,6 +55,8 @@ typedef struct PBstxDev {
 typedef struct pbstx_message {
 	uint8_t seq;
 	uint16_t size;
+	uint16_t flags;		/* PBSTX_HDR_x, header v1 sent if peer supports it */
+	uint16_t engine_id;
 	uint16_t checksum;
 	uint8_t payload[PBSTX_PAYLOAD_BYTES];
 } pbstx_message_t;
@@ -48,5 +65,8 @@ typedef struct pbstx_message {
 extern void pbstxObjectInit(PBStxDev *instp, BaseChannel *chp);
 extern msg_t pbstxReceive(PBStxDev *instp, pbstx_message_t *msg);
 extern msg_t pbstxSend(PBStxDev *instp, pbstx_message_t *msg);
+extern msg_t pbstxSendBegin(PBStxDev *instp, pbstx_message_t *msg);
+extern msg_t pbstxSendWrite(PBStxDev *instp, const uint8_t *buf, size_t count);
+extern msg_t pbstxSendEnd(PBStxDev *instp, bool ok);
 
 #endif /* PBSTX_H */
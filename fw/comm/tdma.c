@@ -0,0 +1,175 @@
+/**
+ * @file       tdma.c
+ * @brief      Transmit slots on shared radio channel
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "tdma.h"
+#include "param.h"
+
+/*
+ * Several ECUs share one radio channel (SERIAL1). Unsolicited frames
+ * (Status, StatusText, replies to broadcast requests) are sent only in
+ * own slot, replies to host requests go out at once (host polls one ECU
+ * at a time).
+ *
+ *   cycle = TDMA_SLOTS * slot
+ *   slot n = (ENGINE_ID - 1) % TDMA_SLOTS, starts at n * slot of cycle
+ *
+ * Common time is host UNIX time in ms from TimeReference (host sends it
+ * periodically, broadcast reaches all ECUs at once). RTC can't be used:
+ * it is set with whole seconds. Without fresh sync slots are off and
+ * frames are sent as before.
+ *
+ * Frame must end one guard before slot end and may start one guard after
+ * slot begin. Guard covers sync error, clock drift between syncs and
+ * radio latency jitter (TDMA_GUARD_MS) plus TDMA_GUARD_CHARS character
+ * times of the link.
+ */
+
+#define TDMA_SYNC_TIMEOUT	S2ST(60)	/* 50 ppm crystal: < 3 ms off */
+#define TDMA_TICKS_PER_MS	(CH_CFG_ST_FREQUENCY / 1000)
+#define TDMA_FRAME_OVERHEAD	8	/* v1 header and CRC */
+#define TDMA_GUARD_CHARS	2
+#define TDMA_SLOT_BYTES		192	/* auto slot: Status + StatusText */
+#define UART_CHAR_BITS		10	/* 8N1 */
+
+/* global parameters */
+int32_t gp_tdma_slots;
+int32_t gp_tdma_slot_ms;
+int32_t gp_tdma_guard_ms;
+
+extern int32_t gp_engine_id;	// th_comm_pbstx.c
+extern int32_t gp_serial1_baud;	// serial1.c
+
+static bool m_synced;
+static systime_t m_sync_stamp;
+static uint64_t m_sync_ms;
+static uint64_t m_tx_end;	/* end of last unsolicited frame, common time */
+
+
+/** Link airtime of @a bytes, rounded up [ms]
+ */
+static uint32_t airtime_ms(size_t bytes)
+{
+	uint32_t baud = (gp_serial1_baud > 0)? gp_serial1_baud : SERIAL_DEFAULT_BITRATE;
+
+	return (bytes * UART_CHAR_BITS * 1000 + baud - 1) / baud;
+}
+
+static uint32_t guard_ms(void)
+{
+	return gp_tdma_guard_ms + airtime_ms(TDMA_GUARD_CHARS);
+}
+
+static uint32_t slot_ms(void)
+{
+	uint32_t guard = guard_ms();
+	uint32_t slot = gp_tdma_slot_ms;
+
+	if (slot == 0)
+		slot = airtime_ms(TDMA_SLOT_BYTES) + 2 * guard;
+
+	/* room for at least one short frame */
+	if (slot < 2 * guard + airtime_ms(TDMA_FRAME_OVERHEAD))
+		slot = 2 * guard + airtime_ms(TDMA_FRAME_OVERHEAD);
+
+	return slot;
+}
+
+/** Common time [ms], valid if synced
+ */
+static uint64_t now_ms(void)
+{
+	systime_t stamp;
+	uint64_t sync_ms;
+
+	chSysLock();
+	stamp = m_sync_stamp;
+	sync_ms = m_sync_ms;
+	chSysUnlock();
+
+	return sync_ms + chVTTimeElapsedSinceX(stamp) / TDMA_TICKS_PER_MS;
+}
+
+/** Set common time from TimeReference
+ * @param timestamp_ms	host UNIX time [ms]
+ */
+void tdma_sync(uint64_t timestamp_ms)
+{
+	chSysLock();
+	m_sync_stamp = chVTGetSystemTimeX();
+	m_sync_ms = timestamp_ms;
+	m_synced = true;
+	chSysUnlock();
+}
+
+/** Slots enabled and common time known
+ */
+bool tdma_is_active(void)
+{
+	return gp_tdma_slots > 0 && m_synced
+		&& chVTTimeElapsedSinceX(m_sync_stamp) < TDMA_SYNC_TIMEOUT;
+}
+
+/** Time until unsolicited frame may be sent
+ *
+ * @param bytes	payload size
+ * @return 0 if frame fits in own slot now (or slots inactive),
+ *         else ticks until own slot opens
+ */
+systime_t tdma_wait(size_t bytes)
+{
+	if (!tdma_is_active())
+		return 0;
+
+	uint32_t guard = guard_ms();
+	uint32_t slot = slot_ms();
+	uint32_t cycle = slot * gp_tdma_slots;
+	uint32_t slot_start = ((uint32_t)(gp_engine_id - 1) % gp_tdma_slots) * slot;
+	uint32_t airtime = airtime_ms(bytes + TDMA_FRAME_OVERHEAD);
+	uint64_t now = now_ms();
+	uint64_t start = (m_tx_end > now)? m_tx_end : now;
+
+	/* too long frame: start at slot begin, tail overruns */
+	if (airtime > slot - 2 * guard)
+		airtime = slot - 2 * guard;
+
+	/* position in own slot, [0, cycle) */
+	uint32_t pos = (start + cycle - slot_start) % cycle;
+	if (pos >= guard && pos + airtime + guard <= slot)
+		return 0;
+
+	uint32_t wait = (pos < guard)? guard - pos : cycle - pos + guard;
+	return MS2ST(wait + (start - now));
+}
+
+/** Account unsolicited frame queued to link
+ * @param bytes	payload size
+ */
+void tdma_sent(size_t bytes)
+{
+	if (!tdma_is_active())
+		return;
+
+	uint64_t now = now_ms();
+	uint64_t start = (m_tx_end > now)? m_tx_end : now;
+
+	m_tx_end = start + airtime_ms(bytes + TDMA_FRAME_OVERHEAD);
+}
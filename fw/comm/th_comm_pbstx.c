@@ -23,12 +23,19 @@
 #include "alert_led.h"
 #include "th_comm_pbstx.h"
 #include "pbstx.h"
+#include "tdma.h"
 #include "pb_encode.h"
 #include "pb_decode.h"
 #include "param.h"
 #include "adc/th_adc.h"
 #include "th_rpm.h"
 #include "command.h"
+#include "fw_update.h"
+#include "engine_map.h"
+#include "lib/pagecomp.h"
+#include "alarm.h"
+#include "supervisor.h"
+#include "hw/ext_flash.h"
 #include "hw/rtc_time.h"
 #include "hw/ectl_pads.h"
 
@@ -38,46 +45,85 @@ int32_t gp_engine_id;
 int32_t gp_status_period;
 bool gp_debug_enable_adc_raw;
 bool gp_debug_enable_memdump;
+bool gp_route_enable;
+bool gp_pbstx_v1;
 
 /* PBStx class */
 
 typedef struct {
 	PBStxDev dev;
 	pbstx_message_t msg;
+	enum sv_task sv_task;
+	bool tdma;		/* shared radio link: unsolicited frames in own slot */
 } PBStxComm;
 
 #define MAX_INSTANCES	2
 PBStxComm *m_instances[MAX_INSTANCES] = {};
 
+/* Routing table, learned from ECU messages */
+
+#define MAX_ROUTES	8
+#define ROUTE_TIMEOUT	S2ST(30)
+
+struct pbstx_route {
+	uint32_t engine_id;	//!< 0: free slot
+	int instance_id;
+	systime_t last_seen;
+};
+
+static struct pbstx_route m_routes[MAX_ROUTES];
+
+//! Instance waiting for spectrum capture
+static PBStxComm *m_spectrum_comm;
+
 /* PBStx methods */
 static void send_status(PBStxComm *self);
+static void send_spectrum(PBStxComm *self);
 static void recv_time_reference(PBStxComm *self, pb_istream_t *instream);
 static void recv_command(PBStxComm *self, pb_istream_t *instream);
 static void recv_param_request(PBStxComm *self, pb_istream_t *instream);
 static void recv_param_set(PBStxComm *self, pb_istream_t *instream);
+static void recv_param_set_batch(PBStxComm *self, pb_istream_t *instream);
 static void recv_log_request(PBStxComm *self, pb_istream_t *instream);
+static void recv_engine_map_request(PBStxComm *self, pb_istream_t *instream);
+static void recv_flash_stats_request(PBStxComm *self, pb_istream_t *instream);
+static void recv_task_stats_request(PBStxComm *self, pb_istream_t *instream);
+static void recv_spectrum_request(PBStxComm *self, pb_istream_t *instream);
 static void recv_memory_dump_request(PBStxComm *self, pb_istream_t *instream);
+static void recv_firmware_update_request(PBStxComm *self, pb_istream_t *instream);
+static void recv_firmware_update_block(PBStxComm *self, pb_istream_t *instream);
 
 /* memdump.c */
 #define MEMDUMP_SIZE	64
+#define MEMDUMP_PAGE_RAW	4096	/* max raw bytes in compressed page */
 int32_t memdump_int_ram(uint32_t address, void *buffer, size_t size);
 int32_t memdump_ext_flash(uint32_t address, void *buffer, size_t size);
 
+/* unsolicited frame waiting for own TDMA slot, only SERIAL1 uses slots */
+static pbstx_message_t m_tdma_frame;
+static bool m_tdma_pending;
+static MUTEX_DECL(m_tdma_mtx);
+
+#define STATUS_PAYLOAD_BYTES	96	/* typical, slot check before encode */
+
+/* compressor state is too big for thread stack, shared by instances */
+static PageCompressor m_pcomp;
+static MUTEX_DECL(m_pcomp_mtx);
+
 // -*- helpers -*-
 
 /**
- * This helper function encodes union-like message miniecu.Message and send
+ * This helper function encodes union-like message miniecu.Message
  *
  * Based on nanopb example using_union_messages/encode.c
  *
- * @param dev		PBStx proto object
  * @param msg		message buffer
  * @param messagetype	submessage type defenition
  * @param message	submessage struct
  *
- * @return MSG_OK on success
+ * @return true on success
  */
-static msg_t pbstxEncodeSend(PBStxDev *dev, pbstx_message_t *msg, const pb_field_t messagetype[], const void *message)
+static bool pbstxEncode(pbstx_message_t *msg, const pb_field_t messagetype[], const void *message)
 {
 	pb_ostream_t outstream = pb_ostream_from_buffer(msg->payload, PBSTX_PAYLOAD_BYTES);
 
@@ -91,10 +137,75 @@ static msg_t pbstxEncodeSend(PBStxDev *dev, pbstx_message_t *msg, const pb_field
 				goto err_out;
 
 			msg->size = outstream.bytes_written;
-			return pbstxSend(dev, msg);
+			msg->flags = PBSTX_HDR_ADDR | PBSTX_HDR_UPLINK;
+			msg->engine_id = gp_engine_id;
+			return true;
 		}
 	}
 
+err_out:
+	alert_component(ALS_COMM, AL_FAIL);
+	return false;
+}
+
+/* nanopb output stream: frame payload straight to channel */
+static bool pbstx_ostream_cb(pb_ostream_t *stream, const uint8_t *buf, size_t count)
+{
+	return pbstxSendWrite(stream->state, buf, count) == (msg_t)count;
+}
+
+/**
+ * Encode and send miniecu.Message
+ *
+ * Same wire format as @a pbstxEncode + @a pbstxSend, but in one pass:
+ * submessage size from sizing pass (pb_encode_submessage() does it too),
+ * then header, then encoder writes payload to channel while checksum
+ * is updated. @a msg gets header fields only.
+ * If encoding fails after header is sent, frame is padded and sent
+ * with bad checksum (pbstxSendEnd()), so receiver keeps sync.
+ *
+ * @param dev		PBStx proto object
+ * @param msg		header of sent frame
+ *
+ * @return MSG_OK on success
+ */
+static msg_t pbstxEncodeSend(PBStxDev *dev, pbstx_message_t *msg, const pb_field_t messagetype[], const void *message)
+{
+	pb_ostream_t sizing = PB_OSTREAM_SIZING;
+	pb_ostream_t prefix = PB_OSTREAM_SIZING;
+	const pb_field_t *field;
+	msg_t ret;
+
+	for (field = miniecu_Message_fields; field->tag != 0; field++)
+		if (field->ptr == messagetype)
+			break;
+
+	if (field->tag == 0 || !pb_encode(&sizing, messagetype, message))
+		goto err_out;
+
+	/* union tag and submessage length */
+	pb_encode_tag_for_field(&prefix, field);
+	pb_encode_varint(&prefix, sizing.bytes_written);
+	if (prefix.bytes_written + sizing.bytes_written > PBSTX_PAYLOAD_BYTES)
+		goto err_out;
+
+	msg->size = prefix.bytes_written + sizing.bytes_written;
+	msg->flags = PBSTX_HDR_ADDR | PBSTX_HDR_UPLINK;
+	msg->engine_id = gp_engine_id;
+
+	ret = pbstxSendBegin(dev, msg);
+	if (ret != MSG_OK)
+		return ret;
+
+	pb_ostream_t outstream = { pbstx_ostream_cb, dev, msg->size, 0 };
+	bool ok = pb_encode_tag_for_field(&outstream, field)
+		&& pb_encode_varint(&outstream, sizing.bytes_written)
+		&& pb_encode(&outstream, messagetype, message);
+
+	ret = pbstxSendEnd(dev, ok);
+	if (ok)
+		return ret;
+
 err_out:
 	alert_component(ALS_COMM, AL_FAIL);
 	return MSG_RESET;
@@ -102,28 +213,83 @@ err_out:
 
 /**
  * Variation of @a pbstxEncodeSend for PBStxComm objects
+ * Each send is progress for supervisor (long memdump, emap replies).
  */
 static msg_t pbstxEncodeSendComm(PBStxComm *self, const pb_field_t messagetype[], const void *message)
 {
+	sv_checkin(self->sv_task);
 	return pbstxEncodeSend(&self->dev, &self->msg, messagetype, message);
 }
 
+/**
+ * Queue encoded unsolicited message for own TDMA slot.
+ * Only one frame waits, newer are dropped
+ * (debug_printf() bursts are summarized by rate limit anyway).
+ *
+ * @return MSG_OK if queued, MSG_TIMEOUT if dropped
+ */
+static msg_t pbstxDefer(const pbstx_message_t *msg)
+{
+	msg_t ret = MSG_TIMEOUT;
+
+	chMtxLock(&m_tdma_mtx);
+	if (!m_tdma_pending) {
+		m_tdma_frame.size = msg->size;
+		m_tdma_frame.flags = msg->flags;
+		m_tdma_frame.engine_id = msg->engine_id;
+		memcpy(m_tdma_frame.payload, msg->payload, msg->size);
+		m_tdma_pending = true;
+		ret = MSG_OK;
+	}
+	chMtxUnlock(&m_tdma_mtx);
+
+	return ret;
+}
+
+/**
+ * Send deferred frame if it fits in own slot now
+ *
+ * @return ticks until slot opens, 0 if nothing waits
+ */
+static systime_t pbstxSendDeferred(PBStxComm *self)
+{
+	systime_t wait = 0;
+
+	chMtxLock(&m_tdma_mtx);
+	if (m_tdma_pending) {
+		wait = tdma_wait(m_tdma_frame.size);
+		if (wait == 0) {
+			pbstxSend(&self->dev, &m_tdma_frame);
+			tdma_sent(m_tdma_frame.size);
+			m_tdma_pending = false;
+		}
+	}
+	chMtxUnlock(&m_tdma_mtx);
+
+	return wait;
+}
+
 /**
  * Encode and send message via all available channels
  *
+ * @param unsolicited	not a reply: waits for TDMA slot on shared link
+ *
  * @return MSG_OK if no errors on send.
  *         or last send error.
  */
-static msg_t pbstxEncodeSendBroadcast(pbstx_message_t *msg, const pb_field_t messagetype[], const void *message)
+static msg_t pbstxEncodeSendBroadcast(pbstx_message_t *msg, const pb_field_t messagetype[], const void *message,
+		bool unsolicited)
 {
 	msg_t ret = MSG_OK;
 	msg_t sret;
 
-	msg->size = 0; // force encode
+	if (!pbstxEncode(msg, messagetype, message))
+		return MSG_RESET;
+
 	for (int i = 0; i < MAX_INSTANCES; i++)
 		if (m_instances[i] != NULL) {
-			if (msg->size == 0)
-				sret = pbstxEncodeSend(&m_instances[i]->dev, msg, messagetype, message);
+			if (unsolicited && m_instances[i]->tdma && tdma_is_active())
+				sret = pbstxDefer(msg);
 			else
 				sret = pbstxSend(&m_instances[i]->dev, msg);
 
@@ -176,6 +342,189 @@ static bool pbstxDecodeMessage(pb_istream_t *stream, const pb_field_t messagetyp
 	return status;
 }
 
+// -*- routing -*-
+
+static bool route_get_varint(const uint8_t **p, const uint8_t *end, uint32_t *out)
+{
+	uint32_t v = 0;
+
+	for (int shift = 0; shift < 32 && *p < end; shift += 7) {
+		uint8_t b = *(*p)++;
+
+		v |= (uint32_t)(b & 0x7f) << shift;
+		if (!(b & 0x80)) {
+			*out = v;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Get miniecu.Message field tag and engine_id without decoding.
+ *
+ * All submessages have engine_id = 1 as first field,
+ * so it's first key after outer tag and length.
+ */
+static bool route_peek(const pbstx_message_t *msg, uint32_t *tag, uint32_t *engine_id)
+{
+	const uint8_t *p = msg->payload;
+	const uint8_t *end = msg->payload + msg->size;
+	uint32_t key, len;
+
+	if (!route_get_varint(&p, end, &key) || (key & 0x07) != PB_WT_STRING)
+		return false;
+
+	*tag = key >> 3;
+	if (!route_get_varint(&p, end, &len) || !route_get_varint(&p, end, &key)
+			|| key != ((1 << 3) | PB_WT_VARINT))
+		return false;
+
+	return route_get_varint(&p, end, engine_id);
+}
+
+/**
+ * Messages which only ECU sends
+ */
+static bool route_is_ecu_message(uint32_t tag)
+{
+	static const pb_field_t * const ecu_messages[] = {
+		miniecu_Status_fields,
+		miniecu_ParamValue_fields,
+		miniecu_LogEntry_fields,
+		miniecu_EngineMap_fields,
+		miniecu_FlashStats_fields,
+		miniecu_FlashSectorErases_fields,
+		miniecu_Spectrum_fields,
+		miniecu_TaskStats_fields,
+		miniecu_StatusText_fields,
+		miniecu_MemoryDumpPage_fields,
+		miniecu_FirmwareUpdateStatus_fields
+	};
+	const pb_field_t *field;
+
+	for (field = miniecu_Message_fields; field->tag != 0; field++) {
+		if (field->tag != tag)
+			continue;
+
+		for (size_t i = 0; i < ARRAY_SIZE(ecu_messages); i++)
+			if (field->ptr == ecu_messages[i])
+				return true;
+
+		break;
+	}
+
+	return false;
+}
+
+static void route_learn(uint32_t engine_id, int instance_id)
+{
+	systime_t now = osalOsGetSystemTimeX();
+	struct pbstx_route *slot = NULL;
+
+	chSysLock();
+	for (size_t i = 0; i < MAX_ROUTES; i++) {
+		struct pbstx_route *r = &m_routes[i];
+
+		if (r->engine_id == engine_id) {
+			slot = r;
+			break;
+		}
+
+		/* else use free or oldest slot */
+		if (slot == NULL || r->engine_id == 0
+				|| (slot->engine_id != 0 && now - r->last_seen > now - slot->last_seen))
+			slot = r;
+	}
+
+	slot->engine_id = engine_id;
+	slot->instance_id = instance_id;
+	slot->last_seen = now;
+	chSysUnlock();
+}
+
+/**
+ * @return instance id or -1 if route unknown
+ */
+static int route_lookup(uint32_t engine_id)
+{
+	int ret = -1;
+
+	chSysLock();
+	for (size_t i = 0; i < MAX_ROUTES; i++) {
+		struct pbstx_route *r = &m_routes[i];
+
+		if (r->engine_id == engine_id
+				&& chVTTimeElapsedSinceX(r->last_seen) < ROUTE_TIMEOUT) {
+			ret = r->instance_id;
+			break;
+		}
+	}
+	chSysUnlock();
+
+	return ret;
+}
+
+/**
+ * Resend received frame as is (only header and crc recalculated)
+ *
+ * @param from	source instance
+ * @param to	destination instance, -1: all except source
+ */
+static void route_send(pbstx_message_t *msg, int from, int to)
+{
+	for (int i = 0; i < MAX_INSTANCES; i++) {
+		if (i == from || (to >= 0 && i != to))
+			continue;
+
+		if (m_instances[i] != NULL)
+			pbstxSend(&m_instances[i]->dev, msg);
+	}
+}
+
+/**
+ * Forward message to other instances if it's not only for us
+ *
+ * @return true if message don't need local processing
+ */
+static bool route_message(PBStxComm *self, int instance_id)
+{
+	uint32_t tag, engine_id;
+
+	if (!route_peek(&self->msg, &tag, &engine_id))
+		return false;
+
+	if (engine_id == (unsigned)gp_engine_id)
+		return false;
+
+	bool uplink = route_is_ecu_message(tag);
+
+	/* v0 frame: add header for links speaking v1 */
+	if (!(self->msg.flags & PBSTX_HDR_ADDR)) {
+		self->msg.flags = PBSTX_HDR_ADDR | (uplink ? PBSTX_HDR_UPLINK : 0);
+		self->msg.engine_id = engine_id;
+	}
+
+	/* ECU -> host: remember where ECU lives, pass to other links */
+	if (uplink) {
+		route_learn(engine_id, instance_id);
+		route_send(&self->msg, instance_id, -1);
+		return true;
+	}
+
+	/* broadcast: process and pass */
+	if (engine_id == 0) {
+		route_send(&self->msg, instance_id, -1);
+		return false;
+	}
+
+	/* host -> ECU, or response (Command, TimeReference) coming from ECU side */
+	int to = route_lookup(engine_id);
+	route_send(&self->msg, instance_id, (to == instance_id)? -1 : to);
+	return true;
+}
+
 /**
  * @brief Send STATUS_TEXT message
  * @param severity message level
@@ -183,7 +532,7 @@ static bool pbstxDecodeMessage(pb_istream_t *stream, const pb_field_t messagetyp
  *
  * NOTE: baed on @a chsnprintf()
  */
-void debug_printf(enum severity severity, char *fmt, ...)
+void debug_printf_nolimit(enum severity severity, char *fmt, ...)
 {
 	va_list ap;
 	MemoryStream ms;
@@ -203,7 +552,96 @@ void debug_printf(enum severity severity, char *fmt, ...)
 	/* final zero */
 	chSequentialStreamPut(chp, 0);
 
-	pbstxEncodeSendBroadcast(&msg, miniecu_StatusText_fields, &st);
+	pbstxEncodeSendBroadcast(&msg, miniecu_StatusText_fields, &st, true);
+}
+
+/* call sites with suppressed messages */
+static struct dp_ratelimit *m_dp_suppressed;
+
+#define DP_SUMMARY_PREFIX	40	/* StatusText.text is 64 */
+
+/**
+ * @brief debug_printf() slow path: refill bucket or count suppressed message
+ * @return true if message may be sent
+ */
+bool debug_ratelimitI(struct dp_ratelimit *rl, enum severity severity, const char *fmt)
+{
+	systime_t elapsed = chVTTimeElapsedSinceX(rl->stamp);
+
+	if (rl->fmt == NULL) {
+		rl->fmt = fmt;
+		rl->severity = severity;
+		rl->tokens = DP_RATELIMIT_BURST;
+		rl->stamp = chVTGetSystemTimeX();
+	}
+	else if (elapsed >= DP_RATELIMIT_PERIOD) {
+		systime_t n = elapsed / DP_RATELIMIT_PERIOD;
+
+		rl->tokens = (rl->tokens + n < DP_RATELIMIT_BURST)? rl->tokens + n : DP_RATELIMIT_BURST;
+		rl->stamp += n * DP_RATELIMIT_PERIOD;
+	}
+
+	if (rl->tokens > 0) {
+		rl->tokens--;
+		return true;
+	}
+
+	if (rl->suppressed++ == 0) {
+		rl->next = m_dp_suppressed;
+		m_dp_suppressed = rl;
+	}
+	else if (rl->suppressed == 0) {
+		rl->suppressed = UINT16_MAX;	/* saturate */
+	}
+
+	return false;
+}
+
+/**
+ * @brief Report call sites whose burst is over
+ *
+ * Burst is over when a token stayed unused for a whole period.
+ * Summary bypasses the limit: one per site and burst.
+ * Arguments are gone, so summary holds format text up to first conversion.
+ */
+void debug_ratelimit_flush(void)
+{
+	struct dp_ratelimit **pp, *rl;
+	const char *fmt;
+	uint16_t cnt;
+	uint8_t severity;
+	char prefix[DP_SUMMARY_PREFIX];
+	size_t len;
+
+	for (;;) {
+		chSysLock();
+		for (pp = &m_dp_suppressed; (rl = *pp) != NULL; pp = &rl->next) {
+			if (chVTTimeElapsedSinceX(rl->stamp) >= DP_RATELIMIT_PERIOD)
+				break;
+		}
+		if (rl == NULL) {
+			chSysUnlock();
+			return;
+		}
+
+		*pp = rl->next;
+		fmt = rl->fmt;
+		cnt = rl->suppressed;
+		severity = rl->severity;
+		rl->suppressed = 0;
+		chSysUnlock();
+
+		len = strcspn(fmt, "%");
+		if (len > sizeof(prefix) - 1)
+			len = sizeof(prefix) - 1;
+		while (len > 0 && (fmt[len - 1] == ' ' || fmt[len - 1] == ':' || fmt[len - 1] == '='))
+			len--;
+
+		memcpy(prefix, fmt, len);
+		prefix[len] = '\0';
+
+		debug_printf_nolimit((enum severity)severity, "%s ... repeated %u times", prefix, cnt);
+	}
 }
 
 
@@ -217,10 +655,12 @@ static THD_FUNCTION(th_comm_pbstx, arg)
 	msg_t ret;
 	int instance_id;
 	systime_t send_time = 0;
+	systime_t rx_timeout;
 	PBStxComm self;
 
 	chRegSetThreadName("pbstx");
 	pbstxObjectInit(&self.dev, (BaseChannel*)arg);
+	self.tdma = (arg == (void *)&SERIAL1_SD);
 
 	// store instance m_instances for broadcast messages
 	for (instance_id = 0; instance_id < MAX_INSTANCES; instance_id++) {
@@ -232,19 +672,60 @@ static THD_FUNCTION(th_comm_pbstx, arg)
 	if (instance_id >= MAX_INSTANCES)
 		return MSG_RESET;
 
+	self.sv_task = SV_TASK_COMM0 + instance_id;
+	sv_register(self.sv_task);
 	alert_component(ALS_COMM, AL_NORMAL);
 
 	//debug_printf(DP_DEBUG, "pbstx%d: started", instance_id);
 	while (!chThdShouldTerminateX()) {
+		sv_checkin(self.sv_task);
+		rx_timeout = PBSTX_RX_TIMEOUT;
+
 		if (chVTTimeElapsedSinceX(send_time) >= MS2ST(gp_status_period)) {
-			send_status(&self);
-			send_time = osalOsGetSystemTimeX();
+			/* shared radio link: Status waits for own slot */
+			systime_t wait = (self.tdma)? tdma_wait(STATUS_PAYLOAD_BYTES) : 0;
+			if (wait == 0) {
+				send_status(&self);
+				if (self.tdma && tdma_is_active()) {
+					/* slot delay: keep period on average */
+					tdma_sent(self.msg.size);
+					send_time += MS2ST(gp_status_period);
+					if (chVTTimeElapsedSinceX(send_time) >= MS2ST(gp_status_period))
+						send_time = osalOsGetSystemTimeX();
+				}
+				else {
+					send_time = osalOsGetSystemTimeX();
+				}
+			}
+			else if (wait < rx_timeout) {
+				rx_timeout = wait;
+			}
+		}
+
+		if (self.tdma) {
+			systime_t wait = pbstxSendDeferred(&self);
+			if (wait > 0 && wait < rx_timeout)
+				rx_timeout = wait;
 		}
 
+		/* FFT computed here, below ADC, RPM and log threads */
+		if (m_spectrum_comm == &self && spectrum_is_ready())
+			send_spectrum(&self);
+
+		/* router needs all frames, else v1 frames for others dropped early */
+		self.dev.rx_engine_id = gp_route_enable ? PBSTX_RX_ANY : gp_engine_id;
+		if (gp_pbstx_v1)
+			self.dev.tx_addressed = true;
+		/* wake up for slot */
+		self.dev.rx_timeout = rx_timeout;
+
 		ret = pbstxReceive(&self.dev, &self.msg);
 		if (ret != MSG_OK)
 			continue;
 
+		if (gp_route_enable && route_message(&self, instance_id))
+			continue;
+
 		pb_istream_t instream = pb_istream_from_buffer(self.msg.payload, self.msg.size);
 		const pb_field_t *field = pbstxDecodeType(&instream);
 
@@ -252,19 +733,39 @@ static THD_FUNCTION(th_comm_pbstx, arg)
 			recv_param_request(&self, &instream);
 		else if (field == miniecu_ParamSet_fields)
 			recv_param_set(&self, &instream);
+		else if (field == miniecu_ParamSetBatch_fields)
+			recv_param_set_batch(&self, &instream);
 		else if (field == miniecu_TimeReference_fields)
 			recv_time_reference(&self, &instream);
 		else if (field == miniecu_Command_fields)
 			recv_command(&self, &instream);
 		else if (field == miniecu_LogRequest_fields)
 			recv_log_request(&self, &instream);
+		else if (field == miniecu_EngineMapRequest_fields)
+			recv_engine_map_request(&self, &instream);
+		else if (field == miniecu_FlashStatsRequest_fields)
+			recv_flash_stats_request(&self, &instream);
+		else if (field == miniecu_SpectrumRequest_fields)
+			recv_spectrum_request(&self, &instream);
+		else if (field == miniecu_TaskStatsRequest_fields)
+			recv_task_stats_request(&self, &instream);
 		else if (field == miniecu_MemoryDumpRequest_fields && gp_debug_enable_memdump)
 			recv_memory_dump_request(&self, &instream);
+		else if (field == miniecu_FirmwareUpdateRequest_fields)
+			recv_firmware_update_request(&self, &instream);
+		else if (field == miniecu_FirmwareUpdateBlock_fields)
+			recv_firmware_update_block(&self, &instream);
 	}
 
+	sv_unregister(self.sv_task);
 	if (m_instances[instance_id] != NULL)
 		m_instances[instance_id] = NULL;
 
+	if (m_spectrum_comm == &self) {
+		m_spectrum_comm = NULL;
+		spectrum_release();
+	}
+
 	debug_printf(DP_DEBUG, "pbstx%d: terminated", instance_id);
 	return MSG_OK;
 }
@@ -288,21 +789,10 @@ thread_t *pbstxCreate(void *chn, size_t size, tprio_t prio)
 static void send_status(PBStxComm *self)
 {
 	miniecu_Status status = miniecu_Status_init_default;
-	uint32_t flags = 0;
-
-	if (time_is_known())		flags |= miniecu_Status_Flags_TIME_KNOWN;
-	if (ctl_ignition_state())	flags |= miniecu_Status_Flags_IGNITION_ENABLED;
-	if (ctl_starter_state())	flags |= miniecu_Status_Flags_STARTER_ENABLED;
-	if (rpm_is_engine_running())	flags |= miniecu_Status_Flags_ENGINE_RUNNING;
-
-	if (alert_check_error())	flags |= miniecu_Status_Flags_ERROR;
-	if (batt_check_voltage())	flags |= miniecu_Status_Flags_UNDERVOLTAGE;
-	if (temp_check_temperature())	flags |= miniecu_Status_Flags_OVERHEAT;
-	if (rpm_check_limit())		flags |= miniecu_Status_Flags_HIGH_RPM;
-	if (flow_check_fuel())		flags |= miniecu_Status_Flags_LOW_FUEL;
+	CombustionStats cs;
 
 	status.engine_id = gp_engine_id;
-	status.status = flags;
+	status.status = alarm_get_status();
 
 	/* time */
 	status.system_time = time_get_systime();
@@ -325,6 +815,8 @@ static void send_status(PBStxComm *self)
 	status.cpu.has_temperature = true;
 	status.cpu.temperature = cpu_get_temperature();
 	status.cpu.has_rtc_vbat = cpu_get_rtc_voltage(&status.cpu.rtc_vbat);
+	status.cpu.has_adc_load = true;
+	status.cpu.adc_load = adc_get_isr_load();
 
 	/* Oil pressure */
 	//status.has_oil_pressure = oilp_get_pressure(&status.oil_pressure);
@@ -335,6 +827,16 @@ static void send_status(PBStxComm *self)
 		status.fuel.has_remaining = flow_get_remaining(&status.fuel.remaining);
 	}
 
+	/* Combustion stability */
+	if ((status.has_combustion = rpm_get_combustion(&cs, &status.combustion.pulse_time_max)) == true) {
+		status.combustion.cycles = cs.cycles;
+		status.combustion.misfires = cs.misfires;
+		status.combustion.has_cov = cs.cov >= 0.0f;
+		status.combustion.cov = cs.cov;
+		status.combustion.peak_acceleration = cs.alpha_max;
+		status.combustion.peak_deceleration = cs.alpha_min;
+	}
+
 	if (gp_debug_enable_adc_raw) {
 		status.has_adc_raw = true;
 
@@ -356,6 +858,47 @@ static void send_status(PBStxComm *self)
 	pbstxEncodeSendComm(self, miniecu_Status_fields, &status);
 }
 
+static void send_spectrum(PBStxComm *self)
+{
+	miniecu_Spectrum spec_msg;
+	enum spectrum_channel ch;
+	uint32_t window, nbins;
+	float sample_rate, max = 0.0;
+
+	m_spectrum_comm = NULL;
+
+	const float *amp = spectrum_compute(&ch, &window, &sample_rate, &nbins);
+	if (amp == NULL) {
+		spectrum_release();
+		return;
+	}
+
+	for (size_t i = 0; i < nbins; i++)
+		if (amp[i] > max)
+			max = amp[i];
+
+	/* 16-bit magnitudes: ~96 dB range below maximum */
+	spec_msg.engine_id = gp_engine_id;
+	spec_msg.channel = ch;
+	spec_msg.sample_rate = sample_rate;
+	spec_msg.window = window;
+	spec_msg.scale = (max > 0.0)? max / UINT16_MAX : 1.0;
+
+	for (uint32_t bin = 0; bin < nbins; bin += spec_msg.magnitude_count) {
+		spec_msg.bin_offset = bin;
+		spec_msg.magnitude_count = nbins - bin;
+		if (spec_msg.magnitude_count > ARRAY_SIZE(spec_msg.magnitude))
+			spec_msg.magnitude_count = ARRAY_SIZE(spec_msg.magnitude);
+
+		for (size_t i = 0; i < spec_msg.magnitude_count; i++)
+			spec_msg.magnitude[i] = amp[bin + i] / spec_msg.scale + 0.5f;
+
+		pbstxEncodeSendComm(self, miniecu_Spectrum_fields, &spec_msg);
+	}
+
+	spectrum_release();
+}
+
 static void recv_time_reference(PBStxComm *self, pb_istream_t *instream)
 {
 	miniecu_TimeReference time_ref;
@@ -374,12 +917,22 @@ static void recv_time_reference(PBStxComm *self, pb_istream_t *instream)
 	if (time_ref.has_timediff)
 		return;
 
+	bool broadcast = time_ref.engine_id == 0;
+	tdma_sync(time_ref.timestamp_ms);
+
 	time_ref.engine_id = gp_engine_id;
 	time_ref.has_system_time = true;
 	time_ref.system_time = time_get_systime();
 	time_ref.has_timediff = true;
 	time_ref.timediff = time_set_timestamp(time_ref.timestamp_ms);
 
+	/* all ECUs answer broadcast: in own slot on shared link */
+	if (broadcast && self->tdma && tdma_is_active()) {
+		if (pbstxEncode(&self->msg, miniecu_TimeReference_fields, &time_ref))
+			pbstxDefer(&self->msg);
+		return;
+	}
+
 	pbstxEncodeSendComm(self, miniecu_TimeReference_fields, &time_ref);
 }
 
@@ -413,7 +966,7 @@ static void recv_command(PBStxComm *self, pb_istream_t *instream)
  */
 static void send_param_value(pbstx_message_t *msg, miniecu_ParamValue *pv_msg)
 {
-	pbstxEncodeSendBroadcast(msg, miniecu_ParamValue_fields, pv_msg);
+	pbstxEncodeSendBroadcast(msg, miniecu_ParamValue_fields, pv_msg, false);
 }
 
 static void recv_param_request(PBStxComm *self, pb_istream_t *instream)
@@ -499,6 +1052,44 @@ static void recv_param_set(PBStxComm *self, pb_istream_t *instream)
 	send_param_value(&self->msg, &param_value);
 }
 
+static void recv_param_set_batch(PBStxComm *self, pb_istream_t *instream)
+{
+	miniecu_ParamSetBatch batch;
+	miniecu_ParamValue param_value;
+	const char *ids[PARAM_BATCH_MAX];
+	miniecu_ParamType *values[PARAM_BATCH_MAX];
+	size_t i, idx, count = param_count();
+
+	if (!pbstxDecodeMessage(instream, miniecu_ParamSetBatch_fields, &batch)) {
+		alert_component(ALS_COMM, AL_FAIL);
+		return;
+	}
+
+	if (batch.engine_id != (unsigned)gp_engine_id)
+		return;
+
+	for (i = 0; i < batch.items_count; i++) {
+		ids[i] = batch.items[i].param_id;
+		values[i] = &batch.items[i].value;
+	}
+
+	/* errors reported by param_set_batch(),
+	 * answer with current values anyway, so host see that nothing changed */
+	param_set_batch(ids, values, batch.items_count);
+
+	for (i = 0; i < batch.items_count; i++) {
+		if (param_get(ids[i], &param_value.value, &idx) != PARAM_OK)
+			continue;
+
+		param_value.engine_id = gp_engine_id;
+		param_value.param_index = idx;
+		param_value.param_count = count;
+		strncpy(param_value.param_id, ids[i], PT_ID_SIZE);
+
+		send_param_value(&self->msg, &param_value);
+	}
+}
+
 static void recv_log_request(PBStxComm *self, pb_istream_t *instream)
 {
 	miniecu_LogRequest log_req;
@@ -511,6 +1102,215 @@ static void recv_log_request(PBStxComm *self, pb_istream_t *instream)
 	/* TODO */
 }
 
+static void recv_engine_map_request(PBStxComm *self, pb_istream_t *instream)
+{
+	miniecu_EngineMapRequest emap_req;
+	miniecu_EngineMap emap_msg;
+	static const miniecu_EngineMap_Type types[] = {
+		miniecu_EngineMap_Type_RPM_TEMPERATURE,
+		miniecu_EngineMap_Type_RPM_BATTERY
+	};
+
+	if (!pbstxDecodeMessage(instream, miniecu_EngineMapRequest_fields, &emap_req)) {
+		alert_component(ALS_COMM, AL_FAIL);
+		return;
+	}
+
+	if (emap_req.engine_id != (unsigned)gp_engine_id)
+		return;
+
+	if (emap_req.has_reset && emap_req.reset) {
+		emap_reset();
+		return;
+	}
+
+	/* map don't fit to one frame, so send several row groups */
+	for (size_t i = 0; i < ARRAY_SIZE(types); i++) {
+		uint32_t row = 0;
+
+		while (emap_fill_message(&emap_msg, types[i], row)) {
+			emap_msg.engine_id = gp_engine_id;
+			row += emap_msg.counts_count / emap_msg.cols;
+
+			pbstxEncodeSendComm(self, miniecu_EngineMap_fields, &emap_msg);
+		}
+	}
+}
+
+static void recv_flash_stats_request(PBStxComm *self, pb_istream_t *instream)
+{
+	miniecu_FlashStatsRequest stats_req;
+	miniecu_FlashStats stats_msg;
+	miniecu_FlashSectorErases erases_msg;
+	struct flash_op_stats st;
+	uint32_t nr_sectors = 0;
+
+	if (!pbstxDecodeMessage(instream, miniecu_FlashStatsRequest_fields, &stats_req)) {
+		alert_component(ALS_COMM, AL_FAIL);
+		return;
+	}
+
+	if (stats_req.engine_id != (unsigned)gp_engine_id)
+		return;
+
+	if (stats_req.has_reset && stats_req.reset) {
+		flash_stats_reset();
+		return;
+	}
+
+	for (int part = 0; part < FLASH_NR_PARTS; part++) {
+		for (int op = 0; op < FLASH_NR_OPS; op++) {
+			flash_get_stats(part, op, &st);
+
+			stats_msg.engine_id = gp_engine_id;
+			stats_msg.partition = part;
+			stats_msg.operation = op;
+			stats_msg.count = st.count;
+			stats_msg.errors = st.errors;
+			stats_msg.bytes = st.bytes;
+			stats_msg.time_total = st.time_total;
+			stats_msg.time_max = st.time_max;
+			stats_msg.latency_hist_count = FLASH_HIST_BINS;
+			for (size_t i = 0; i < FLASH_HIST_BINS; i++)
+				stats_msg.latency_hist[i] = st.hist[i];
+			flash_get_part_sectors(part, &stats_msg.first_sector, &stats_msg.nr_sectors);
+			stats_msg.connect_failures = flash_get_connect_failures();
+
+			pbstxEncodeSendComm(self, miniecu_FlashStats_fields, &stats_msg);
+		}
+
+		if (part == FLASH_PART_CHIP)
+			nr_sectors = stats_msg.nr_sectors;
+	}
+
+	for (uint32_t sector = 0; sector < nr_sectors; sector += erases_msg.counts_count) {
+		erases_msg.engine_id = gp_engine_id;
+		erases_msg.sector_offset = sector;
+		erases_msg.counts_count = flash_get_erase_counts(sector,
+				erases_msg.counts, ARRAY_SIZE(erases_msg.counts));
+		if (erases_msg.counts_count == 0)
+			break;
+
+		pbstxEncodeSendComm(self, miniecu_FlashSectorErases_fields, &erases_msg);
+	}
+}
+
+static void recv_task_stats_request(PBStxComm *self, pb_istream_t *instream)
+{
+	miniecu_TaskStatsRequest stats_req;
+	miniecu_TaskStats stats_msg;
+	struct sv_task_stats st;
+
+	if (!pbstxDecodeMessage(instream, miniecu_TaskStatsRequest_fields, &stats_req)) {
+		alert_component(ALS_COMM, AL_FAIL);
+		return;
+	}
+
+	if (stats_req.engine_id != (unsigned)gp_engine_id)
+		return;
+
+	if (stats_req.has_reset && stats_req.reset) {
+		sv_stats_reset();
+		return;
+	}
+
+	for (int task = 0; task < SV_NTASKS; task++) {
+		sv_get_stats(task, &st);
+
+		stats_msg.engine_id = gp_engine_id;
+		stats_msg.task = task;
+		stats_msg.active = st.active;
+		stats_msg.deadline = st.deadline;
+		stats_msg.misses = st.misses;
+		stats_msg.worst_interval = st.worst_interval;
+		stats_msg.watchdog_resets = st.watchdog_resets;
+		stats_msg.last_reset = st.last_reset;
+
+		pbstxEncodeSendComm(self, miniecu_TaskStats_fields, &stats_msg);
+	}
+}
+
+static void recv_spectrum_request(PBStxComm *self, pb_istream_t *instream)
+{
+	miniecu_SpectrumRequest spec_req;
+
+	if (!pbstxDecodeMessage(instream, miniecu_SpectrumRequest_fields, &spec_req)) {
+		alert_component(ALS_COMM, AL_FAIL);
+		return;
+	}
+
+	if (spec_req.engine_id != (unsigned)gp_engine_id)
+		return;
+
+	/* nanopb sets defaults for missing optional fields */
+	if (!spectrum_start(spec_req.channel, spec_req.window, spec_req.decimation)) {
+		debug_printf(DP_ERROR, "Spectrum: bad request or capture busy");
+		return;
+	}
+
+	m_spectrum_comm = self;
+}
+
+static void send_memory_dump_page(PBStxComm *self, miniecu_MemoryDumpPage *page_msg,
+		uint32_t address)
+{
+	page_msg->address = address;
+	page_msg->raw_size = m_pcomp.raw_len;
+	page_msg->page.size = m_pcomp.out_len;
+
+	pbstxEncodeSendComm(self, miniecu_MemoryDumpPage_fields, page_msg);
+}
+
+/**
+ * Compressed variant: raw data read by blocks into compressor,
+ * page sent when next block doesn't fit.
+ */
+static void memory_dump_compressed(PBStxComm *self, miniecu_MemoryDumpRequest *dump_req,
+		int32_t (*memdump)(uint32_t address, void *buffer, size_t size))
+{
+	miniecu_MemoryDumpPage page_msg;
+	uint32_t address = dump_req->address;
+	uint32_t page_address = address;
+	int32_t bytes_rem = dump_req->size;
+
+	page_msg.engine_id = gp_engine_id;
+	page_msg.stream_id = dump_req->stream_id;
+	page_msg.has_compression = true;
+	page_msg.compression = dump_req->compression;
+	page_msg.has_raw_size = true;
+
+	chMtxLock(&m_pcomp_mtx);
+	pcompObjectInit(&m_pcomp, (enum pcomp_codec)dump_req->compression);
+	pcompPageBegin(&m_pcomp, page_msg.page.bytes, sizeof(page_msg.page.bytes));
+
+	while (bytes_rem > 0) {
+		int32_t ret = memdump(address, pcompBlockBuffer(&m_pcomp),
+				(bytes_rem > PCOMP_BLOCK)? PCOMP_BLOCK : bytes_rem);
+
+		if (ret <= 0) {
+			debug_printf(DP_ERROR, "MemDump: read error");
+			break;
+		}
+
+		if (m_pcomp.raw_len + ret > MEMDUMP_PAGE_RAW || !pcompBlock(&m_pcomp, ret)) {
+			send_memory_dump_page(self, &page_msg, page_address);
+			page_address += m_pcomp.raw_len;
+
+			/* fresh page always takes one block */
+			pcompPageBegin(&m_pcomp, page_msg.page.bytes, sizeof(page_msg.page.bytes));
+			pcompBlock(&m_pcomp, ret);
+		}
+
+		address += ret;
+		bytes_rem -= ret;
+	}
+
+	if (m_pcomp.raw_len > 0)
+		send_memory_dump_page(self, &page_msg, page_address);
+
+	chMtxUnlock(&m_pcomp_mtx);
+}
+
 static void recv_memory_dump_request(PBStxComm *self, pb_istream_t *instream)
 {
 	miniecu_MemoryDumpRequest dump_req;
@@ -542,6 +1342,18 @@ static void recv_memory_dump_request(PBStxComm *self, pb_istream_t *instream)
 		return;
 	};
 
+	if (dump_req.has_compression && dump_req.compression != miniecu_MemoryDumpRequest_Compression_NONE) {
+		if (dump_req.compression > miniecu_MemoryDumpRequest_Compression_LZ) {
+			debug_printf(DP_ERROR, "MemDump: unknown compression");
+			return;
+		}
+
+		memory_dump_compressed(self, &dump_req, memdump);
+		return;
+	}
+
+	page_msg.has_compression = false;
+	page_msg.has_raw_size = false;
 	while (bytes_rem > 0) {
 		int32_t ret = memdump(address,
 				page_msg.page.bytes,
@@ -563,3 +1375,46 @@ static void recv_memory_dump_request(PBStxComm *self, pb_istream_t *instream)
 		pbstxEncodeSendComm(self, miniecu_MemoryDumpPage_fields, &page_msg);
 	}
 }
+
+static void recv_firmware_update_request(PBStxComm *self, pb_istream_t *instream)
+{
+	miniecu_FirmwareUpdateRequest fwu_req;
+	miniecu_FirmwareUpdateStatus fwu_status;
+
+	if (!pbstxDecodeMessage(instream, miniecu_FirmwareUpdateRequest_fields, &fwu_req)) {
+		alert_component(ALS_COMM, AL_FAIL);
+		return;
+	}
+
+	if (fwu_req.engine_id != (unsigned)gp_engine_id)
+		return;
+
+	fw_update_request(&fwu_req, &fwu_status);
+	fwu_status.engine_id = gp_engine_id;
+	pbstxEncodeSendComm(self, miniecu_FirmwareUpdateStatus_fields, &fwu_status);
+
+	if (fwu_status.state == miniecu_FirmwareUpdateStatus_State_APPLYING) {
+		/* let status go out */
+		chThdSleepMilliseconds(200);
+		fw_update_apply();
+	}
+}
+
+static void recv_firmware_update_block(PBStxComm *self, pb_istream_t *instream)
+{
+	miniecu_FirmwareUpdateBlock fwu_blk;
+	miniecu_FirmwareUpdateStatus fwu_status;
+
+	if (!pbstxDecodeMessage(instream, miniecu_FirmwareUpdateBlock_fields, &fwu_blk)) {
+		alert_component(ALS_COMM, AL_FAIL);
+		return;
+	}
+
+	if (fwu_blk.engine_id != (unsigned)gp_engine_id)
+		return;
+
+	if (fw_update_block(&fwu_blk, &fwu_status)) {
+		fwu_status.engine_id = gp_engine_id;
+		pbstxEncodeSendComm(self, miniecu_FirmwareUpdateStatus_fields, &fwu_status);
+	}
+}
@@ -27,6 +27,6 @@
 
 /* public functions */
 thread_t *pbstxCreate(void *chn, size_t size, tprio_t prio);
-/* debug_printf() defined in fw_common.h */
+/* debug_printf() and rate limit defined in fw_common.h */
 
 #endif /* TH_COMM_PBSTX_H */
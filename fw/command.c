@@ -24,6 +24,8 @@
 #include "alert_led.h"
 #include "hw/ectl_pads.h"
 #include "hw/ext_flash.h"
+#include "log/blackbox.h"
+#include "log/th_log.h"
 #include "miniecu.pb.h"
 #include "param.h"
 
@@ -35,6 +37,7 @@ uint32_t command_request(uint32_t cmdid)
 		// TODO: stop other modules (if needed)
 		ctl_ignition_set(false);
 		ctl_starter_set(false);
+		bbox_trigger(BBOX_EMERGENCY_STOP, 0);
 		break;
 
 	case miniecu_Command_Operation_IGNITION_ENABLE:
@@ -71,13 +74,11 @@ uint32_t command_request(uint32_t cmdid)
 		return miniecu_Command_Response_ACK;
 
 	case miniecu_Command_Operation_DO_ERASE_CONFIG:
-		mtdErase(&FLASHD1_config, 0, UINT32_MAX);
+		flash_erase(&FLASHD1_config, 0, UINT32_MAX);
 		return miniecu_Command_Response_ACK;
 
-	// XXX TODO: call flash log thread to do work
 	case miniecu_Command_Operation_DO_ERASE_LOG:
-		mtdErase(&FLASHD1_error, 0, UINT32_MAX);
-		mtdErase(&FLASHD1_log, 0, UINT32_MAX);
+		log_erase_request();
 		return miniecu_Command_Response_ACK;
 
 	case miniecu_Command_Operation_DO_REBOOT:
@@ -0,0 +1,315 @@
+/**
+ * @file       engine_map.c
+ * @brief      Engine operating map histograms
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "engine_map.h"
+#include "alert_led.h"
+#include "th_rpm.h"
+#include "adc/th_adc.h"
+#include "hw/ext_flash.h"
+#include "lib_crc16.h"
+#include <string.h>
+
+/*
+ * Two maps with common RPM rows, counters in RPM thread update periods (0.1 s).
+ * Values out of range counted in first/last bin.
+ */
+
+#define EMAP_RPM_BINS		12
+#define EMAP_RPM_STEP		1000		/* [RPM] */
+#define EMAP_TEMP_BINS		8
+#define EMAP_TEMP_MIN		-20000		/* [mC°] */
+#define EMAP_TEMP_STEP		20000
+#define EMAP_VBAT_BINS		8
+#define EMAP_VBAT_MIN		4000		/* [mV] */
+#define EMAP_VBAT_STEP		1000
+
+#define EMAP_MAGIC		0x50414d45	/* "EMAP" */
+#define EMAP_ERASES_MAGIC	0x53455245	/* "ERES" */
+#define EMAP_SAVE_PERIOD	S2ST(10 * 60)
+#define EMAP_SLOTS		2		/* one record per erase sector, ping-pong */
+
+/** Flash record
+ */
+struct emap_record {
+	uint32_t magic;
+	uint32_t seq;
+	uint32_t rpm_temp[EMAP_RPM_BINS][EMAP_TEMP_BINS];
+	uint32_t rpm_vbat[EMAP_RPM_BINS][EMAP_VBAT_BINS];
+	uint16_t crc;
+};
+
+/** Flash sector erase counters, stored in same slot after map record
+ * (seq same as map record). Newest valid one loaded, if none counts start from zero.
+ */
+struct emap_erases_record {
+	uint32_t magic;
+	uint32_t seq;
+	uint16_t counts[FLASH_MAX_SECTORS];
+	uint16_t crc;
+};
+
+#define EMAP_REC_PAGES	((sizeof(struct emap_record) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE)
+#define EMAP_ERASES_PAGES	((sizeof(struct emap_erases_record) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE)
+#define EMAP_BUF_PAGES	((EMAP_REC_PAGES > EMAP_ERASES_PAGES)? EMAP_REC_PAGES : EMAP_ERASES_PAGES)
+
+/* -*- module variables -*- */
+
+static uint32_t m_rpm_temp[EMAP_RPM_BINS][EMAP_TEMP_BINS];
+static uint32_t m_rpm_vbat[EMAP_RPM_BINS][EMAP_VBAT_BINS];
+static uint32_t m_seq;
+static bool m_dirty;
+static systime_t m_save_time;
+static uint32_t m_erase_total;	/* flash_get_erase_total() at last save */
+
+static union {
+	struct emap_record rec;
+	struct emap_erases_record erases;
+	uint8_t pages[EMAP_BUF_PAGES * FLASH_PAGE_SIZE];
+} m_save;
+
+static inline unsigned emap_bin(int32_t value, int32_t min, int32_t step, unsigned nbins)
+{
+	if (value < min)
+		return 0;
+
+	unsigned bin = (value - min) / step;
+	return (bin < nbins)? bin : nbins - 1;
+}
+
+static uint16_t emap_record_crc(const struct emap_record *rec)
+{
+	return crc16((const uint8_t *)rec, offsetof(struct emap_record, crc));
+}
+
+static uint16_t emap_erases_crc(const struct emap_erases_record *rec)
+{
+	return crc16((const uint8_t *)rec, offsetof(struct emap_erases_record, crc));
+}
+
+/* -*- global -*- */
+
+/**
+ * Count one update period in current bands.
+ * Called from RPM thread while engine running.
+ */
+void emap_update(uint32_t rpm)
+{
+	unsigned row = emap_bin(rpm, 0, EMAP_RPM_STEP, EMAP_RPM_BINS);
+	unsigned tcol = emap_bin(temp_get_temperature(), EMAP_TEMP_MIN, EMAP_TEMP_STEP, EMAP_TEMP_BINS);
+	unsigned vcol = emap_bin(batt_get_voltage(), EMAP_VBAT_MIN, EMAP_VBAT_STEP, EMAP_VBAT_BINS);
+
+	chSysLock();
+	m_rpm_temp[row][tcol]++;
+	m_rpm_vbat[row][vcol]++;
+	m_dirty = true;
+	chSysUnlock();
+}
+
+/**
+ * Load last valid record from stats partition.
+ * Flash should be connected.
+ */
+void emap_load(void)
+{
+	uint32_t best_seq = 0;
+	bool found = false;
+
+	for (unsigned slot = 0; slot < EMAP_SLOTS; slot++) {
+		if (flash_read(&FLASHD1_stats, slot * EPAGES, m_save.pages, EMAP_REC_PAGES) != HAL_SUCCESS) {
+			alert_component(ALS_FLASH, AL_FAIL);
+			return;
+		}
+
+		if (m_save.rec.magic != EMAP_MAGIC
+				|| m_save.rec.crc != emap_record_crc(&m_save.rec)
+				|| (found && m_save.rec.seq < best_seq))
+			continue;
+
+		found = true;
+		best_seq = m_save.rec.seq;
+
+		chSysLock();
+		memcpy(m_rpm_temp, m_save.rec.rpm_temp, sizeof(m_rpm_temp));
+		memcpy(m_rpm_vbat, m_save.rec.rpm_vbat, sizeof(m_rpm_vbat));
+		chSysUnlock();
+	}
+
+	m_seq = best_seq;
+	m_save_time = osalOsGetSystemTimeX();
+
+	/* record of last save may be missing if power lost between writes */
+	uint32_t erases_seq = 0;
+	int erases_slot = -1;
+
+	for (unsigned slot = 0; slot < EMAP_SLOTS; slot++) {
+		if (flash_read(&FLASHD1_stats, slot * EPAGES + EMAP_REC_PAGES,
+					m_save.pages, EMAP_ERASES_PAGES) != HAL_SUCCESS) {
+			alert_component(ALS_FLASH, AL_FAIL);
+			return;
+		}
+
+		if (m_save.erases.magic != EMAP_ERASES_MAGIC
+				|| m_save.erases.crc != emap_erases_crc(&m_save.erases)
+				|| (erases_slot >= 0 && m_save.erases.seq < erases_seq))
+			continue;
+
+		erases_seq = m_save.erases.seq;
+		erases_slot = slot;
+	}
+
+	if (erases_slot >= 0) {
+		if (flash_read(&FLASHD1_stats, erases_slot * EPAGES + EMAP_REC_PAGES,
+					m_save.pages, EMAP_ERASES_PAGES) != HAL_SUCCESS) {
+			alert_component(ALS_FLASH, AL_FAIL);
+			return;
+		}
+
+		flash_restore_erase_counts(m_save.erases.counts);
+	}
+}
+
+static void emap_save(void)
+{
+	unsigned slot = (m_seq + 1) % EMAP_SLOTS;
+
+	memset(m_save.pages, 0xff, sizeof(m_save.pages));
+	m_save.rec.magic = EMAP_MAGIC;
+	m_save.rec.seq = m_seq + 1;
+
+	chSysLock();
+	memcpy(m_save.rec.rpm_temp, m_rpm_temp, sizeof(m_rpm_temp));
+	memcpy(m_save.rec.rpm_vbat, m_rpm_vbat, sizeof(m_rpm_vbat));
+	m_dirty = false;
+	chSysUnlock();
+
+	m_save.rec.crc = emap_record_crc(&m_save.rec);
+	m_save_time = osalOsGetSystemTimeX();
+
+	/* old record in other slot stays valid if we fail here */
+	if (flash_erase(&FLASHD1_stats, slot * EPAGES, EPAGES) != HAL_SUCCESS
+			|| flash_write(&FLASHD1_stats, slot * EPAGES, m_save.pages, EMAP_REC_PAGES) != HAL_SUCCESS) {
+		alert_component(ALS_FLASH, AL_FAIL);
+		debug_printf(DP_ERROR, "EMAP: save failed");
+		return;
+	}
+
+	m_seq++;
+
+	/* erase counters after slot erase, so it is counted too */
+	memset(m_save.pages, 0xff, sizeof(m_save.pages));
+	m_save.erases.magic = EMAP_ERASES_MAGIC;
+	m_save.erases.seq = m_seq;
+	m_erase_total = flash_get_erase_total();
+	flash_save_erase_counts(m_save.erases.counts);
+	m_save.erases.crc = emap_erases_crc(&m_save.erases);
+
+	if (flash_write(&FLASHD1_stats, slot * EPAGES + EMAP_REC_PAGES, m_save.pages,
+				EMAP_ERASES_PAGES) != HAL_SUCCESS) {
+		alert_component(ALS_FLASH, AL_FAIL);
+		debug_printf(DP_ERROR, "EMAP: erase counters save failed");
+	}
+}
+
+/**
+ * Save maps periodically and after engine stop.
+ * Changed flash erase counters alone saved only periodically
+ * (save erases stats sector itself).
+ * Called from log thread.
+ */
+void emap_checkpoint(void)
+{
+	bool erases = flash_get_erase_total() != m_erase_total;
+	bool period = chVTTimeElapsedSinceX(m_save_time) >= EMAP_SAVE_PERIOD;
+
+	if ((m_dirty && (period || !rpm_is_engine_running()))
+			|| (erases && period))
+		emap_save();
+}
+
+/**
+ * Save maps and erase counters now if changed (power fail).
+ * Called from log thread.
+ */
+void emap_flush(void)
+{
+	if (m_dirty || flash_get_erase_total() != m_erase_total)
+		emap_save();
+}
+
+void emap_reset(void)
+{
+	chSysLock();
+	memset(m_rpm_temp, 0, sizeof(m_rpm_temp));
+	memset(m_rpm_vbat, 0, sizeof(m_rpm_vbat));
+	m_dirty = true;
+	chSysUnlock();
+}
+
+/**
+ * Fill EngineMap message with rows from row_offset
+ *
+ * @return false if no rows left
+ */
+bool emap_fill_message(miniecu_EngineMap *msg, miniecu_EngineMap_Type type, uint32_t row_offset)
+{
+	const uint32_t *counts;
+	uint32_t cols;
+
+	if (row_offset >= EMAP_RPM_BINS)
+		return false;
+
+	switch (type) {
+	case miniecu_EngineMap_Type_RPM_TEMPERATURE:
+		counts = &m_rpm_temp[0][0];
+		cols = EMAP_TEMP_BINS;
+		msg->col_min = EMAP_TEMP_MIN;
+		msg->col_step = EMAP_TEMP_STEP;
+		break;
+
+	case miniecu_EngineMap_Type_RPM_BATTERY:
+		counts = &m_rpm_vbat[0][0];
+		cols = EMAP_VBAT_BINS;
+		msg->col_min = EMAP_VBAT_MIN;
+		msg->col_step = EMAP_VBAT_STEP;
+		break;
+
+	default:
+		return false;
+	}
+
+	uint32_t nrows = ARRAY_SIZE(msg->counts) / cols;
+	if (nrows > EMAP_RPM_BINS - row_offset)
+		nrows = EMAP_RPM_BINS - row_offset;
+
+	msg->type = type;
+	msg->rpm_step = EMAP_RPM_STEP;
+	msg->rows = EMAP_RPM_BINS;
+	msg->cols = cols;
+	msg->row_offset = row_offset;
+	msg->counts_count = nrows * cols;
+
+	chSysLock();
+	memcpy(msg->counts, counts + row_offset * cols, msg->counts_count * sizeof(uint32_t));
+	chSysUnlock();
+
+	return true;
+}
@@ -16,6 +16,10 @@ FWSRC = ${MINIECU}/fw/main.c \
 	${ADCSRC} \
 	${MINIECU}/fw/memdump.c \
 	${MINIECU}/fw/command.c \
+	${MINIECU}/fw/fw_update.c \
+	${MINIECU}/fw/engine_map.c \
+	${MINIECU}/fw/alarm.c \
+	${MINIECU}/fw/supervisor.c \
 	${MINIECU}/fw/th_rpm.c \
 
 # Required include directories
@@ -54,8 +54,51 @@ enum severity {
 	DP_FAIL
 };
 
-void debug_printf(enum severity severity, char *fmt, ...)
+/* debug_printf() rate limit: token bucket per call site */
+#define DP_RATELIMIT_BURST	4
+#define DP_RATELIMIT_PERIOD	MS2ST(1000)	/* one token per period */
+
+struct dp_ratelimit {
+	struct dp_ratelimit *next;	/* list of sites with suppressed messages */
+	const char *fmt;		/* NULL until first use */
+	systime_t stamp;		/* last refill */
+	uint16_t suppressed;
+	uint8_t tokens;
+	uint8_t severity;
+};
+
+void debug_printf_nolimit(enum severity severity, char *fmt, ...)
 	__attribute__((format (printf, 2, 3)));
+bool debug_ratelimitI(struct dp_ratelimit *rl, enum severity severity, const char *fmt);
+void debug_ratelimit_flush(void);
+
+/** Check call site bucket, fast path: token available in current period
+ */
+static inline bool debug_ratelimit(struct dp_ratelimit *rl, enum severity severity, const char *fmt)
+{
+	bool pass;
+
+	chSysLock();
+	if (rl->tokens > 0 && chVTTimeElapsedSinceX(rl->stamp) < DP_RATELIMIT_PERIOD) {
+		rl->tokens--;
+		pass = true;
+	}
+	else {
+		pass = debug_ratelimitI(rl, severity, fmt);
+	}
+	chSysUnlock();
+
+	return pass;
+}
+
+/** Send StatusText, bursts from one call site are limited and summarized
+ * by debug_ratelimit_flush()
+ */
+#define debug_printf(severity, fmt, ...) do {					\
+	static struct dp_ratelimit _dp_rl;					\
+	if (debug_ratelimit(&_dp_rl, (severity), (fmt)))			\
+		debug_printf_nolimit((severity), (fmt), ##__VA_ARGS__);		\
+} while (0)
 
 /* flash-mtd driver messages */
 //#define MTD_DEBUG(fmt, args...)		debug_printf(DP_DEBUG, fmt, args)
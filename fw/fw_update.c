@@ -0,0 +1,538 @@
+/**
+ * @file       fw_update.c
+ * @brief      Firmware update over PBStx
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "fw_update.h"
+#include "alert_led.h"
+#include "th_rpm.h"
+#include "hw/ext_flash.h"
+#include "hw/ectl_pads.h"
+#include "lib_crc16.h"
+#include "lib_crc32.h"
+#include <string.h>
+
+/*
+ * Update sequence:
+ * 1. BEGIN: host sends image size and CRC-32.
+ *    If staging partition holds same image, transfer resumes
+ *    from last completely written sector.
+ * 2. Blocks: written strictly in order, ack (status) after each page.
+ * 3. VERIFY: whole image CRC-32 check.
+ * 4. APPLY: RAM routine copies image to internal flash and resets MCU.
+ */
+
+/* -*- staging format -*- */
+
+#define FWU_MAGIC		0x55574650	/* "PFWU" */
+#define FWU_HEADER_PAGE		0
+#define FWU_DATA_PAGE		EPAGES		/* image starts from second sector */
+#define FWU_SECTOR_SIZE		(EPAGES * FLASH_PAGE_SIZE)
+#define FWU_MAX_IMAGE		((FWSTAGE_NR_PAGES - FWU_DATA_PAGE) * FLASH_PAGE_SIZE)
+#define FWU_NR_SECTORS		(FWU_MAX_IMAGE / FWU_SECTOR_SIZE)
+
+/** Header page of staging partition.
+ * Changed only by clearing bits, so it may be programmed again without erase.
+ */
+struct fwu_header {
+	uint32_t magic;
+	uint32_t image_size;
+	uint32_t image_crc32;
+	uint32_t verified;			//!< 0: image checked
+	uint8_t sector_map[FWU_NR_SECTORS / 8];	//!< cleared bit: sector written
+};
+
+/* -*- module variables -*- */
+
+static MUTEX_DECL(m_fwu_mtx);
+static miniecu_FirmwareUpdateStatus_State m_state = miniecu_FirmwareUpdateStatus_State_IDLE;
+static struct fwu_header m_hdr;
+static uint32_t m_next_offset;
+static uint32_t m_nak_offset = UINT32_MAX;
+static uint8_t m_page_buf[FLASH_PAGE_SIZE];
+
+/* -*- staging partition -*- */
+
+static bool fwu_write_header(void)
+{
+	memset(m_page_buf, 0xff, sizeof(m_page_buf));
+	memcpy(m_page_buf, &m_hdr, sizeof(m_hdr));
+
+	return flash_write(&FLASHD1_fwstage, FWU_HEADER_PAGE, m_page_buf, 1) == HAL_SUCCESS;
+}
+
+static bool fwu_read_header(void)
+{
+	if (flash_read(&FLASHD1_fwstage, FWU_HEADER_PAGE, m_page_buf, 1) != HAL_SUCCESS)
+		return false;
+
+	memcpy(&m_hdr, m_page_buf, sizeof(m_hdr));
+	return m_hdr.magic == FWU_MAGIC
+		&& m_hdr.image_size > 0
+		&& m_hdr.image_size <= FWU_MAX_IMAGE;
+}
+
+/** Invalidate staged image (clear magic)
+ */
+static void fwu_invalidate(void)
+{
+	m_hdr.magic = 0;
+	fwu_write_header();
+	m_state = miniecu_FirmwareUpdateStatus_State_IDLE;
+}
+
+/** Image offset after last completely written sector
+ */
+static uint32_t fwu_written_offset(void)
+{
+	uint32_t sector;
+
+	for (sector = 0; sector < FWU_NR_SECTORS; sector++)
+		if (m_hdr.sector_map[sector / 8] & (1 << (sector % 8)))
+			break;
+
+	uint32_t offset = sector * FWU_SECTOR_SIZE;
+	return (offset > m_hdr.image_size)? m_hdr.image_size : offset;
+}
+
+/** Write filled page buffer, update header after sector end
+ */
+static bool fwu_write_page(uint32_t page)
+{
+	uint32_t sector = page / EPAGES;
+	bool last_page = (page + 1) * FLASH_PAGE_SIZE >= m_hdr.image_size;
+
+	if (page % EPAGES == 0) {
+		if (flash_erase(&FLASHD1_fwstage, FWU_DATA_PAGE + page, EPAGES) != HAL_SUCCESS)
+			return false;
+	}
+
+	if (flash_write(&FLASHD1_fwstage, FWU_DATA_PAGE + page, m_page_buf, 1) != HAL_SUCCESS)
+		return false;
+
+	if (page % EPAGES == EPAGES - 1 || last_page) {
+		m_hdr.sector_map[sector / 8] &= ~(1 << (sector % 8));
+		if (!fwu_write_header())
+			return false;
+	}
+
+	memset(m_page_buf, 0xff, sizeof(m_page_buf));
+	return true;
+}
+
+static bool fwu_check_image(void)
+{
+	uint32_t crc = 0;
+	uint32_t offset = 0;
+
+	while (offset < m_hdr.image_size) {
+		uint32_t sz = m_hdr.image_size - offset;
+		if (sz > FLASH_PAGE_SIZE)
+			sz = FLASH_PAGE_SIZE;
+
+		if (flash_read(&FLASHD1_fwstage, FWU_DATA_PAGE + offset / FLASH_PAGE_SIZE,
+					m_page_buf, 1) != HAL_SUCCESS)
+			return false;
+
+		crc = crc32part(m_page_buf, sz, crc);
+		offset += sz;
+	}
+
+	return crc == m_hdr.image_crc32;
+}
+
+/* -*- request handlers -*- */
+
+static miniecu_FirmwareUpdateStatus_Result fwu_begin(const miniecu_FirmwareUpdateRequest *req)
+{
+	if (!req->has_image_size || !req->has_image_crc32
+			|| req->image_size == 0 || req->image_size > FWU_MAX_IMAGE)
+		return miniecu_FirmwareUpdateStatus_Result_BAD_REQUEST;
+
+	if (flash_connect() != MSG_OK)
+		return miniecu_FirmwareUpdateStatus_Result_FLASH_ERROR;
+
+	memset(m_page_buf, 0xff, sizeof(m_page_buf));
+	m_nak_offset = UINT32_MAX;
+
+	/* resume previous transfer */
+	if (fwu_read_header()
+			&& m_hdr.image_size == req->image_size
+			&& m_hdr.image_crc32 == req->image_crc32) {
+		m_next_offset = fwu_written_offset();
+
+		if (m_next_offset < m_hdr.image_size)
+			m_state = miniecu_FirmwareUpdateStatus_State_RECEIVING;
+		else if (m_hdr.verified == 0)
+			m_state = miniecu_FirmwareUpdateStatus_State_VERIFIED;
+		else
+			m_state = miniecu_FirmwareUpdateStatus_State_RECEIVED;
+
+		debug_printf(DP_INFO, "FWU: resume from %u", (unsigned)m_next_offset);
+		return miniecu_FirmwareUpdateStatus_Result_OK;
+	}
+
+	/* new transfer, data sectors erased before write */
+	memset(&m_hdr, 0xff, sizeof(m_hdr));
+	m_hdr.magic = FWU_MAGIC;
+	m_hdr.image_size = req->image_size;
+	m_hdr.image_crc32 = req->image_crc32;
+	m_next_offset = 0;
+	m_state = miniecu_FirmwareUpdateStatus_State_IDLE;
+
+	if (flash_erase(&FLASHD1_fwstage, FWU_HEADER_PAGE, EPAGES) != HAL_SUCCESS
+			|| !fwu_write_header()) {
+		alert_component(ALS_FLASH, AL_FAIL);
+		return miniecu_FirmwareUpdateStatus_Result_FLASH_ERROR;
+	}
+
+	m_state = miniecu_FirmwareUpdateStatus_State_RECEIVING;
+	return miniecu_FirmwareUpdateStatus_Result_OK;
+}
+
+static miniecu_FirmwareUpdateStatus_Result fwu_verify(void)
+{
+	if (m_state != miniecu_FirmwareUpdateStatus_State_RECEIVED
+			&& m_state != miniecu_FirmwareUpdateStatus_State_VERIFIED)
+		return miniecu_FirmwareUpdateStatus_Result_BAD_REQUEST;
+
+	if (!fwu_check_image()) {
+		debug_printf(DP_ERROR, "FWU: image CRC mismatch");
+		fwu_invalidate();
+		return miniecu_FirmwareUpdateStatus_Result_VERIFY_FAILED;
+	}
+
+	m_hdr.verified = 0;
+	if (!fwu_write_header())
+		return miniecu_FirmwareUpdateStatus_Result_FLASH_ERROR;
+
+	m_state = miniecu_FirmwareUpdateStatus_State_VERIFIED;
+	return miniecu_FirmwareUpdateStatus_Result_OK;
+}
+
+static miniecu_FirmwareUpdateStatus_Result fwu_apply_check(void)
+{
+	if (m_state != miniecu_FirmwareUpdateStatus_State_VERIFIED)
+		return miniecu_FirmwareUpdateStatus_Result_BAD_REQUEST;
+
+	/* never reflash running engine */
+	if (rpm_is_engine_running() || ctl_ignition_state() || ctl_starter_state())
+		return miniecu_FirmwareUpdateStatus_Result_ENGINE_RUNNING;
+
+	m_state = miniecu_FirmwareUpdateStatus_State_APPLYING;
+	return miniecu_FirmwareUpdateStatus_Result_OK;
+}
+
+static void fwu_fill_status(miniecu_FirmwareUpdateStatus *status,
+		miniecu_FirmwareUpdateStatus_Result result)
+{
+	status->state = m_state;
+	status->result = result;
+	status->next_offset = m_next_offset;
+	status->has_image_size = m_state != miniecu_FirmwareUpdateStatus_State_IDLE;
+	status->image_size = m_hdr.image_size;
+}
+
+/* -*- global -*- */
+
+/**
+ * Handle FirmwareUpdateRequest
+ * Status message always should be sent back.
+ * If state is APPLYING caller should send status and call @a fw_update_apply().
+ */
+void fw_update_request(const miniecu_FirmwareUpdateRequest *req,
+		miniecu_FirmwareUpdateStatus *status)
+{
+	miniecu_FirmwareUpdateStatus_Result result = miniecu_FirmwareUpdateStatus_Result_OK;
+
+	chMtxLock(&m_fwu_mtx);
+
+	switch (req->operation) {
+	case miniecu_FirmwareUpdateRequest_Operation_STATUS:
+		break;
+
+	case miniecu_FirmwareUpdateRequest_Operation_BEGIN:
+		result = fwu_begin(req);
+		break;
+
+	case miniecu_FirmwareUpdateRequest_Operation_VERIFY:
+		result = fwu_verify();
+		break;
+
+	case miniecu_FirmwareUpdateRequest_Operation_APPLY:
+		result = fwu_apply_check();
+		break;
+
+	case miniecu_FirmwareUpdateRequest_Operation_ABORT:
+		if (m_state != miniecu_FirmwareUpdateStatus_State_IDLE)
+			fwu_invalidate();
+		break;
+
+	default:
+		result = miniecu_FirmwareUpdateStatus_Result_BAD_REQUEST;
+		break;
+	}
+
+	fwu_fill_status(status, result);
+	chMtxUnlock(&m_fwu_mtx);
+}
+
+/**
+ * Handle FirmwareUpdateBlock
+ *
+ * @return true if status should be sent:
+ *         after page write (ack) or once for out of order block (nak).
+ */
+bool fw_update_block(const miniecu_FirmwareUpdateBlock *blk,
+		miniecu_FirmwareUpdateStatus *status)
+{
+	miniecu_FirmwareUpdateStatus_Result result = miniecu_FirmwareUpdateStatus_Result_OK;
+	bool send = false;
+
+	chMtxLock(&m_fwu_mtx);
+
+	if (m_state != miniecu_FirmwareUpdateStatus_State_RECEIVING) {
+		result = miniecu_FirmwareUpdateStatus_Result_BAD_REQUEST;
+		send = true;
+	}
+	else if (blk->offset != m_next_offset
+			|| blk->crc16 != crc16(blk->data.bytes, blk->data.size)) {
+		/* go back N: host resends from next_offset */
+		result = miniecu_FirmwareUpdateStatus_Result_RETRY;
+		send = m_nak_offset != m_next_offset;
+		m_nak_offset = m_next_offset;
+	}
+	else if (blk->data.size == 0 || blk->offset + blk->data.size > m_hdr.image_size) {
+		result = miniecu_FirmwareUpdateStatus_Result_BAD_REQUEST;
+		send = true;
+	}
+	else {
+		const uint8_t *data = blk->data.bytes;
+		size_t size = blk->data.size;
+
+		while (size > 0) {
+			uint32_t off = m_next_offset % FLASH_PAGE_SIZE;
+			size_t sz = FLASH_PAGE_SIZE - off;
+			if (sz > size)
+				sz = size;
+
+			memcpy(m_page_buf + off, data, sz);
+			data += sz;
+			size -= sz;
+			m_next_offset += sz;
+
+			if (m_next_offset % FLASH_PAGE_SIZE == 0 || m_next_offset == m_hdr.image_size) {
+				if (!fwu_write_page((m_next_offset - 1) / FLASH_PAGE_SIZE)) {
+					alert_component(ALS_FLASH, AL_FAIL);
+					debug_printf(DP_ERROR, "FWU: write failed");
+					/* host should BEGIN again */
+					m_state = miniecu_FirmwareUpdateStatus_State_IDLE;
+					result = miniecu_FirmwareUpdateStatus_Result_FLASH_ERROR;
+					break;
+				}
+
+				send = true;
+			}
+		}
+
+		if (m_state == miniecu_FirmwareUpdateStatus_State_RECEIVING
+				&& m_next_offset == m_hdr.image_size)
+			m_state = miniecu_FirmwareUpdateStatus_State_RECEIVED;
+	}
+
+	fwu_fill_status(status, result);
+	chMtxUnlock(&m_fwu_mtx);
+	return send;
+}
+
+/* -*- RAM resident image copy -*- */
+
+/*
+ * Internal flash is erased during copy, so these functions placed
+ * in .data (copied to RAM at startup) and can't call anything in flash.
+ */
+#define RAMFUNC		__attribute__((section(".data.ramfunc"), noinline, long_call))
+
+#define INT_FLASH_BASE		0x08000000
+#define INT_FLASH_PAGE_SIZE	2048
+#define INT_FLASH_KEY1		0x45670123
+#define INT_FLASH_KEY2		0xCDEF89AB
+#define APPLY_RETRIES		3
+
+#define SST25_CMD_READ		0x03
+#define SST25_CMD_WRDI		0x04
+#define SST25_CMD_RDSR		0x05
+#define SST25_SR_BUSY		0x01
+
+static RAMFUNC uint8_t ram_spi_xfer(uint8_t b)
+{
+	while (!(SPI1->SR & SPI_SR_TXE));
+	*(volatile uint8_t *)&SPI1->DR = b;
+	while (!(SPI1->SR & SPI_SR_RXNE));
+	return *(volatile uint8_t *)&SPI1->DR;
+}
+
+static RAMFUNC void ram_sst25_cmd(uint8_t cmd)
+{
+	palClearPad(GPIOB, GPIOB_FLASH_CS);
+	ram_spi_xfer(cmd);
+	palSetPad(GPIOB, GPIOB_FLASH_CS);
+}
+
+static RAMFUNC void ram_sst25_wait(void)
+{
+	palClearPad(GPIOB, GPIOB_FLASH_CS);
+	ram_spi_xfer(SST25_CMD_RDSR);
+	while (ram_spi_xfer(0xff) & SST25_SR_BUSY)
+		IWDG->KR = 0xAAAA;
+	palSetPad(GPIOB, GPIOB_FLASH_CS);
+}
+
+static RAMFUNC void ram_sst25_read(uint32_t addr, uint8_t *buf, size_t len)
+{
+	palClearPad(GPIOB, GPIOB_FLASH_CS);
+	ram_spi_xfer(SST25_CMD_READ);
+	ram_spi_xfer(addr >> 16);
+	ram_spi_xfer(addr >> 8);
+	ram_spi_xfer(addr);
+	while (len--)
+		*buf++ = ram_spi_xfer(0xff);
+	palSetPad(GPIOB, GPIOB_FLASH_CS);
+}
+
+static RAMFUNC void ram_flash_wait(void)
+{
+	while (FLASH->SR & FLASH_SR_BSY);
+	FLASH->SR = FLASH_SR_EOP | FLASH_SR_PGERR | FLASH_SR_WRPERR;
+}
+
+static RAMFUNC void ram_flash_erase_page(uint32_t addr)
+{
+	FLASH->CR |= FLASH_CR_PER;
+	FLASH->AR = addr;
+	FLASH->CR |= FLASH_CR_STRT;
+	ram_flash_wait();
+	FLASH->CR &= ~FLASH_CR_PER;
+}
+
+static RAMFUNC void ram_flash_program(uint32_t addr, const uint8_t *buf, size_t len)
+{
+	FLASH->CR |= FLASH_CR_PG;
+	for (size_t i = 0; i < len; i += 2) {
+		*(volatile uint16_t *)(addr + i) = buf[i] | (buf[i + 1] << 8);
+		ram_flash_wait();
+	}
+	FLASH->CR &= ~FLASH_CR_PG;
+}
+
+static RAMFUNC uint32_t ram_crc32(const uint8_t *src, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+
+	while (len--) {
+		/* supervisor stopped, IWDG still runs */
+		if ((len & 0xfff) == 0)
+			IWDG->KR = 0xAAAA;
+
+		crc ^= *src++;
+		for (int i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+/* image in internal flash is broken, only DFU (BOOT0) can restore it:
+ * don't reset into it, blink Fail pattern (Green + Red) and keep IWDG fed
+ */
+static RAMFUNC ATTR_NORETURN void ram_halt(void)
+{
+	palSetPad(GPIOA, GPIOA_LED_R);
+	while (true) {
+		for (volatile uint32_t i = 0; i < 1000000; i++)
+			IWDG->KR = 0xAAAA;
+
+		palTogglePad(GPIOA, GPIOA_LED_G);
+	}
+}
+
+static RAMFUNC ATTR_NORETURN void ram_apply(uint32_t src, uint32_t size, uint32_t crc)
+{
+	bool ok = false;
+
+	/* abort any transfer, SPI1 master, 8-bit, fPCLK/8 */
+	palSetPad(GPIOB, GPIOB_FLASH_CS);
+	RCC->APB2ENR |= RCC_APB2ENR_SPI1EN;
+	SPI1->CR1 = 0;
+	SPI1->CR2 = SPI_CR2_DS_2 | SPI_CR2_DS_1 | SPI_CR2_DS_0 | SPI_CR2_FRXTH;
+	SPI1->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_1 | SPI_CR1_SPE;
+
+	/* finish possible interrupted write (as bbox_halt_flush()) */
+	ram_sst25_cmd(SST25_CMD_WRDI);
+	ram_sst25_wait();
+
+	FLASH->KEYR = INT_FLASH_KEY1;
+	FLASH->KEYR = INT_FLASH_KEY2;
+
+	for (int retry = 0; retry < APPLY_RETRIES; retry++) {
+		for (uint32_t off = 0; off < size; off += FLASH_PAGE_SIZE) {
+			IWDG->KR = 0xAAAA;
+			if (off % INT_FLASH_PAGE_SIZE == 0)
+				ram_flash_erase_page(INT_FLASH_BASE + off);
+
+			/* staged last page padded by 0xff, so odd size is ok */
+			ram_sst25_read(src + off, m_page_buf, FLASH_PAGE_SIZE);
+			ram_flash_program(INT_FLASH_BASE + off, m_page_buf,
+					(size - off > FLASH_PAGE_SIZE)? FLASH_PAGE_SIZE : size - off);
+		}
+
+		if (ram_crc32((const uint8_t *)INT_FLASH_BASE, size) == crc) {
+			ok = true;
+			break;
+		}
+	}
+
+	FLASH->CR |= FLASH_CR_LOCK;
+	if (!ok)
+		ram_halt();
+
+	__DSB();
+	SCB->AIRCR = (0x5FA << SCB_AIRCR_VECTKEY_Pos) | SCB_AIRCR_SYSRESETREQ_Msk;
+	while (true);
+}
+
+/**
+ * Copy verified image to internal flash and reboot.
+ * If power lost during copy or copy fails verification only
+ * DFU (BOOT0) can restore firmware.
+ */
+void fw_update_apply(void)
+{
+	chMtxLock(&m_fwu_mtx);
+	osalDbgAssert(m_state == miniecu_FirmwareUpdateStatus_State_APPLYING, "not verified");
+
+	/* we don't return, so don't care about threads,
+	 * but wait until flash driver finishes current operation
+	 */
+	spiAcquireBus(&SPID1);
+	chSysDisable();
+	ram_apply((FWSTAGE_START_PAGE + FWU_DATA_PAGE) * FLASH_PAGE_SIZE,
+			m_hdr.image_size, m_hdr.image_crc32);
+}
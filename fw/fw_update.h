@@ -0,0 +1,36 @@
+/**
+ * @file       fw_update.h
+ * @brief      Firmware update over PBStx
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef FW_UPDATE_H
+#define FW_UPDATE_H
+
+#include "fw_common.h"
+#include "miniecu.pb.h"
+
+/* subsystem functions */
+void fw_update_request(const miniecu_FirmwareUpdateRequest *req,
+		miniecu_FirmwareUpdateStatus *status);
+bool fw_update_block(const miniecu_FirmwareUpdateBlock *blk,
+		miniecu_FirmwareUpdateStatus *status);
+void fw_update_apply(void) ATTR_NORETURN;
+
+#endif /* FW_UPDATE_H */
@@ -22,6 +22,7 @@
 
 #include "alert_led.h"
 #include "ext_flash.h"
+#include <string.h>
 
 /* -*- global -*- */
 
@@ -30,6 +31,8 @@ SST25Driver FLASHD1;
 
 SST25Driver FLASHD1_config;	//!< Config partition
 SST25Driver FLASHD1_error;	//!< Error log partition
+SST25Driver FLASHD1_fwstage;	//!< Firmware update staging partition
+SST25Driver FLASHD1_stats;	//!< Engine statistics partition
 SST25Driver FLASHD1_log;	//!< Log partition
 
 
@@ -50,23 +53,88 @@ static const SST25Config flash1_cfg = {
 	.spicfg = &spi1_cfg
 };
 
-//! SST25 pages per erase sector
-#define EPAGES	(4096/256)
-
 /** SST25 partition table
  *
  * Partitions:
  * - config: 16 KiB
  * - error: 64 KiB
- * - log: chip size - config - error
+ * - fwstage: 4 KiB header + 256 KiB image
+ * - stats: 8 KiB
+ * - log: chip size - config - error - fwstage - stats
  */
 static const struct sst25_partition init_parts[] = {
 	{ &FLASHD1_config, { .name = "config", .start_page = 0, .nr_pages = EPAGES * 4 /* 16 KiB */ } },
-	{ &FLASHD1_error, { .name = "error", .start_page = EPAGES * 4, .nr_pages = EPAGES * 16 /* 64 KiB */ } },
-	{ &FLASHD1_log, { .name = "log", .start_page = EPAGES * 4 + EPAGES * 16, .nr_pages = UINT32_MAX /* all above */ } },
+	{ &FLASHD1_error, { .name = "error", .start_page = ERROR_START_PAGE, .nr_pages = ERROR_NR_PAGES } },
+	{ &FLASHD1_fwstage, { .name = "fwstage", .start_page = FWSTAGE_START_PAGE, .nr_pages = FWSTAGE_NR_PAGES } },
+	{ &FLASHD1_stats, { .name = "stats", .start_page = FWSTAGE_START_PAGE + FWSTAGE_NR_PAGES, .nr_pages = EPAGES * 2 /* 8 KiB */ } },
+	{ &FLASHD1_log, { .name = "log", .start_page = FWSTAGE_START_PAGE + FWSTAGE_NR_PAGES + EPAGES * 2, .nr_pages = UINT32_MAX /* all above */ } },
 	{ NULL }
 };
 
+/* -*- statistics -*- */
+
+struct flash_part_stats {
+	SST25Driver *drv;
+	uint32_t start_page;
+	struct flash_op_stats ops[FLASH_NR_OPS];
+};
+
+//! note: order same as enum flash_part, start pages from init_parts
+static struct flash_part_stats m_part_stats[FLASH_NR_PARTS] = {
+	{ .drv = &FLASHD1_config, .start_page = 0 },
+	{ .drv = &FLASHD1_error, .start_page = ERROR_START_PAGE },
+	{ .drv = &FLASHD1_fwstage, .start_page = FWSTAGE_START_PAGE },
+	{ .drv = &FLASHD1_stats, .start_page = FWSTAGE_START_PAGE + FWSTAGE_NR_PAGES },
+	{ .drv = &FLASHD1_log, .start_page = FWSTAGE_START_PAGE + FWSTAGE_NR_PAGES + EPAGES * 2 },
+	{ .drv = &FLASHD1, .start_page = 0 },
+};
+
+//! Histogram bin upper bounds [0.1 ms], last bin: above
+static const uint32_t m_hist_bounds[FLASH_HIST_BINS - 1] = {
+	1, 2, 5, 10, 20, 50, 100, 200, 500, 1000
+};
+
+static uint16_t m_erase_counts[FLASH_MAX_SECTORS];
+static uint32_t m_erase_total;	//!< counted erases since boot
+static uint32_t m_connect_failures;
+
+static struct flash_part_stats *flash_find_part(SST25Driver *drv)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(m_part_stats); i++)
+		if (m_part_stats[i].drv == drv)
+			return &m_part_stats[i];
+
+	return NULL;
+}
+
+static void flash_account(SST25Driver *drv, enum flash_op op, uint32_t bytes,
+		systime_t start, bool result)
+{
+	struct flash_part_stats *ps = flash_find_part(drv);
+	uint32_t dt = ST2US(chVTTimeElapsedSinceX(start)) / 100;
+	size_t bin;
+
+	if (ps == NULL)
+		return;
+
+	for (bin = 0; bin < ARRAY_SIZE(m_hist_bounds); bin++)
+		if (dt < m_hist_bounds[bin])
+			break;
+
+	struct flash_op_stats *st = &ps->ops[op];
+
+	chSysLock();
+	st->count++;
+	st->bytes += bytes;
+	st->time_total += dt;
+	if (dt > st->time_max)
+		st->time_max = dt;
+	st->hist[bin]++;
+	if (result != HAL_SUCCESS)
+		st->errors++;
+	chSysUnlock();
+}
+
 
 /* -*- initializer -*- */
 
@@ -75,6 +143,8 @@ void flash_init(void)
 	sst25ObjectInit(&FLASHD1);
 	sst25ObjectInit(&FLASHD1_config);
 	sst25ObjectInit(&FLASHD1_error);
+	sst25ObjectInit(&FLASHD1_fwstage);
+	sst25ObjectInit(&FLASHD1_stats);
 	sst25ObjectInit(&FLASHD1_log);
 	sst25Start(&FLASHD1, &flash1_cfg);
 }
@@ -83,6 +153,7 @@ msg_t flash_connect(void)
 {
 	if (blkGetDriverState(&FLASHD1) != BLK_ACTIVE) {
 		if (blkConnect(&FLASHD1) != HAL_SUCCESS) {
+			m_connect_failures++;
 			alert_component(ALS_FLASH, AL_FAIL);
 			debug_printf(DP_FAIL, "FLASH connection failed");
 			return MSG_RESET;
@@ -94,3 +165,139 @@ msg_t flash_connect(void)
 	alert_component(ALS_FLASH, AL_NORMAL);
 	return MSG_OK;
 }
+
+/* -*- flash access -*- */
+
+bool flash_read(SST25Driver *drv, uint32_t page, uint8_t *buf, uint32_t n)
+{
+	systime_t start = osalOsGetSystemTimeX();
+	bool ret = blkRead(drv, page, buf, n);
+
+	flash_account(drv, FLASH_OP_READ, n * FLASH_PAGE_SIZE, start, ret);
+	return ret;
+}
+
+bool flash_write(SST25Driver *drv, uint32_t page, const uint8_t *buf, uint32_t n)
+{
+	systime_t start = osalOsGetSystemTimeX();
+	bool ret = blkWrite(drv, page, buf, n);
+
+	flash_account(drv, FLASH_OP_WRITE, n * FLASH_PAGE_SIZE, start, ret);
+	return ret;
+}
+
+/**
+ * Erase pages, n may be UINT32_MAX (to partition end).
+ * Counts erases of each sector for wear tracking.
+ */
+bool flash_erase(SST25Driver *drv, uint32_t page, uint32_t n)
+{
+	struct flash_part_stats *ps = flash_find_part(drv);
+	uint32_t part_pages = mtdGetSize(drv) / FLASH_PAGE_SIZE;
+	systime_t start = osalOsGetSystemTimeX();
+	bool ret = mtdErase(drv, page, n);
+
+	if (page >= part_pages)
+		n = 0;
+	else if (n > part_pages - page)
+		n = part_pages - page;
+
+	flash_account(drv, FLASH_OP_ERASE, n * FLASH_PAGE_SIZE, start, ret);
+
+	if (ps != NULL && ret == HAL_SUCCESS) {
+		uint32_t first = (ps->start_page + page) / EPAGES;
+		uint32_t last = (ps->start_page + page + n + EPAGES - 1) / EPAGES;
+
+		chSysLock();
+		for (uint32_t sector = first; sector < last && sector < FLASH_MAX_SECTORS; sector++)
+			if (m_erase_counts[sector] < UINT16_MAX)
+				m_erase_counts[sector]++;
+		m_erase_total++;
+		chSysUnlock();
+	}
+
+	return ret;
+}
+
+/* -*- statistics -*- */
+
+void flash_get_stats(enum flash_part part, enum flash_op op, struct flash_op_stats *st)
+{
+	osalDbgCheck(part < FLASH_NR_PARTS && op < FLASH_NR_OPS);
+
+	chSysLock();
+	memcpy(st, &m_part_stats[part].ops[op], sizeof(*st));
+	chSysUnlock();
+}
+
+void flash_get_part_sectors(enum flash_part part, uint32_t *first_sector, uint32_t *nr_sectors)
+{
+	osalDbgCheck(part < FLASH_NR_PARTS);
+
+	*first_sector = m_part_stats[part].start_page / EPAGES;
+	*nr_sectors = (blkGetDriverState(&FLASHD1) == BLK_ACTIVE)?
+		mtdGetSize(m_part_stats[part].drv) / FLASH_PAGE_SIZE / EPAGES : 0;
+}
+
+uint32_t flash_get_connect_failures(void)
+{
+	return m_connect_failures;
+}
+
+/**
+ * Copy sector erase counters (stored in stats partition, see engine_map.c).
+ *
+ * @return number of counters copied
+ */
+uint32_t flash_get_erase_counts(uint32_t first_sector, uint32_t *counts, uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 0; i < n && first_sector + i < FLASH_MAX_SECTORS; i++)
+		counts[i] = m_erase_counts[first_sector + i];
+
+	return i;
+}
+
+/**
+ * Number of erases since boot, changes when counters should be saved.
+ */
+uint32_t flash_get_erase_total(void)
+{
+	return m_erase_total;
+}
+
+/**
+ * Copy all sector erase counters for saving.
+ */
+void flash_save_erase_counts(uint16_t counts[FLASH_MAX_SECTORS])
+{
+	chSysLock();
+	memcpy(counts, m_erase_counts, sizeof(m_erase_counts));
+	chSysUnlock();
+}
+
+/**
+ * Add saved sector erase counters to counted since boot.
+ */
+void flash_restore_erase_counts(const uint16_t counts[FLASH_MAX_SECTORS])
+{
+	chSysLock();
+	for (size_t i = 0; i < FLASH_MAX_SECTORS; i++) {
+		uint32_t sum = m_erase_counts[i] + counts[i];
+		m_erase_counts[i] = (sum < UINT16_MAX)? sum : UINT16_MAX;
+	}
+	chSysUnlock();
+}
+
+/**
+ * Clear operation statistics, erase counters kept.
+ */
+void flash_stats_reset(void)
+{
+	chSysLock();
+	for (size_t i = 0; i < ARRAY_SIZE(m_part_stats); i++)
+		memset(m_part_stats[i].ops, 0, sizeof(m_part_stats[i].ops));
+	m_connect_failures = 0;
+	chSysUnlock();
+}
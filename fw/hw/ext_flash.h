@@ -26,14 +26,76 @@
 #include "fw_common.h"
 #include "flash-mtd.h"
 
+//! SST25 page size
+#define FLASH_PAGE_SIZE		256
+//! SST25 pages per erase sector
+#define EPAGES			(4096/FLASH_PAGE_SIZE)
+
+//! Error log partition: 64 KiB
+#define ERROR_START_PAGE	(EPAGES * 4)
+#define ERROR_NR_PAGES		(EPAGES * 16)
+
+//! Firmware staging partition: header sector + 256 KiB (F373 flash size)
+#define FWSTAGE_START_PAGE	(ERROR_START_PAGE + ERROR_NR_PAGES)
+#define FWSTAGE_NR_PAGES	(EPAGES + EPAGES * 64)
+
+//! Sector erase counters (SST25VF016B: 2 MiB)
+#define FLASH_MAX_SECTORS	512
+//! Latency histogram bins, see m_hist_bounds
+#define FLASH_HIST_BINS		11
+
+//! Partition index, same order as FlashStats.Partition
+enum flash_part {
+	FLASH_PART_CONFIG = 0,
+	FLASH_PART_ERROR,
+	FLASH_PART_FWSTAGE,
+	FLASH_PART_STATS,
+	FLASH_PART_LOG,
+	FLASH_PART_CHIP,	//!< FLASHD1, whole chip access
+	FLASH_NR_PARTS
+};
+
+//! Operation index, same order as FlashStats.Operation
+enum flash_op {
+	FLASH_OP_READ = 0,
+	FLASH_OP_WRITE,
+	FLASH_OP_ERASE,
+	FLASH_NR_OPS
+};
+
+struct flash_op_stats {
+	uint32_t count;
+	uint32_t errors;
+	uint32_t bytes;
+	uint32_t time_total;		//!< [0.1 ms]
+	uint32_t time_max;		//!< [0.1 ms]
+	uint32_t hist[FLASH_HIST_BINS];
+};
 
 extern SST25Driver FLASHD1;
 extern SST25Driver FLASHD1_config;
 extern SST25Driver FLASHD1_error;
+extern SST25Driver FLASHD1_fwstage;
+extern SST25Driver FLASHD1_stats;
 extern SST25Driver FLASHD1_log;
 
 
 void flash_init(void);
 msg_t flash_connect(void);
 
+/* timed and counted blk/mtd calls */
+bool flash_read(SST25Driver *drv, uint32_t page, uint8_t *buf, uint32_t n);
+bool flash_write(SST25Driver *drv, uint32_t page, const uint8_t *buf, uint32_t n);
+bool flash_erase(SST25Driver *drv, uint32_t page, uint32_t n);
+
+/* statistics */
+void flash_get_stats(enum flash_part part, enum flash_op op, struct flash_op_stats *st);
+void flash_get_part_sectors(enum flash_part part, uint32_t *first_sector, uint32_t *nr_sectors);
+uint32_t flash_get_connect_failures(void);
+uint32_t flash_get_erase_counts(uint32_t first_sector, uint32_t *counts, uint32_t n);
+uint32_t flash_get_erase_total(void);
+void flash_save_erase_counts(uint16_t counts[FLASH_MAX_SECTORS]);
+void flash_restore_erase_counts(const uint16_t counts[FLASH_MAX_SECTORS]);
+void flash_stats_reset(void);
+
 #endif /* HW_EXT_FLASH_H */
@@ -0,0 +1,228 @@
+/**
+ * @file       combustion.c
+ * @brief      Combustion stability monitor
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "combustion.h"
+#include <math.h>
+#include <string.h>
+
+/*
+ * Per-pulse analysis of crankshaft speed.
+ *
+ * Angular velocity taken over segment of W pulses (1/8 revolution):
+ * capture has 1 µs resolution, single tooth period at 20000 RPM with
+ * 64 pulses is only 47 µs. Segment time is difference of edge times,
+ * so quantization error does not sum up.
+ *
+ * Misfire: speed compared with speed at same crank angle one combustion
+ * cycle before, so tooth spacing errors and unknown cycle phase cancel out.
+ * Missing power stroke makes this ratio drop for about one cycle (until
+ * next power stroke ends). Counted on threshold crossing, and once more
+ * for each further cycle it stays below (consecutive misfires).
+ *
+ * Stability: cyclic speed fluctuation (w_max - w_min) / w_mean of each
+ * cycle, its coefficient of variation over CMON_COV_CYCLES.
+ *
+ * Work per pulse is constant: no loops, four float divisions.
+ * Host model and test: tools/misfirebench.py
+ */
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+static inline uint32_t cmon_hist(const CombustionMonitor *instp, uint32_t lag)
+{
+	uint32_t i = (instp->idx >= lag)? instp->idx - lag : instp->idx + instp->len - lag;
+
+	return instp->time[i];
+}
+
+static void cmon_cycle_reset(CombustionMonitor *instp)
+{
+	instp->pulse = 0;
+	instp->omega_min = INFINITY;
+	instp->omega_max = 0.0f;
+	instp->alpha_min = 0.0f;
+	instp->alpha_max = 0.0f;
+}
+
+static void cmon_cycle_end(CombustionMonitor *instp)
+{
+	bool valid = instp->omega_max > 0.0f;
+	float delta;
+
+	if (!valid) {
+		cmon_cycle_reset(instp);
+		return;
+	}
+
+	instp->stats.cycles++;
+	instp->stats.alpha_max = instp->alpha_max;
+	instp->stats.alpha_min = instp->alpha_min;
+
+	delta = 2.0f * (instp->omega_max - instp->omega_min) / (instp->omega_max + instp->omega_min);
+	instp->win_sum += delta;
+	instp->win_sumsq += delta * delta;
+	if (++instp->win_n >= CMON_COV_CYCLES) {
+		float mean = instp->win_sum / CMON_COV_CYCLES;
+		float var = instp->win_sumsq / CMON_COV_CYCLES - mean * mean;
+
+		instp->stats.cov = (mean > 0.0f)? 100.0f * sqrtf((var > 0.0f)? var : 0.0f) / mean : 0.0f;
+		instp->win_n = 0;
+		instp->win_sum = 0.0f;
+		instp->win_sumsq = 0.0f;
+	}
+
+	cmon_cycle_reset(instp);
+}
+
+static void cmon_misfire_check(CombustionMonitor *instp, float rel)
+{
+	if (!instp->in_misfire) {
+		if (rel < -instp->misfire_thr) {
+			instp->stats.misfires++;
+			instp->in_misfire = true;
+			instp->misfire_len = 0;
+		}
+	}
+	else if (rel > -instp->misfire_thr / 2) {
+		instp->in_misfire = false;
+	}
+	else if (++instp->misfire_len >= instp->cycle_pulses + instp->cycle_pulses / 2) {
+		instp->stats.misfires++;
+		instp->misfire_len -= instp->cycle_pulses;
+	}
+}
+
+/* -*- public -*- */
+
+void cmonObjectInit(CombustionMonitor *instp)
+{
+	memset(instp, 0, sizeof(*instp));
+	instp->stats.cov = -1.0f;
+	cmon_cycle_reset(instp);
+}
+
+/**
+ * Check that combustion cycle fits history buffer
+ */
+bool cmonIsSupported(uint32_t pulses_per_rev, uint32_t revs_per_cycle)
+{
+	uint32_t cycle_pulses = pulses_per_rev * revs_per_cycle;
+
+	return cycle_pulses >= 2 && cycle_pulses <= CMON_MAX_PULSES;
+}
+
+/**
+ * Set crank geometry and misfire threshold, resets analysis.
+ * @param misfire_thr  relative speed drop [0..1]
+ * @return false if cycle does not fit history buffer (analysis disabled)
+ */
+bool cmonSetup(CombustionMonitor *instp, uint32_t pulses_per_rev, uint32_t revs_per_cycle,
+		float misfire_thr)
+{
+	uint32_t cycle_pulses = pulses_per_rev * revs_per_cycle;
+	uint32_t seg_pulses = pulses_per_rev / 8;
+
+	if (!cmonIsSupported(pulses_per_rev, revs_per_cycle)) {
+		/* cmonPulse() does nothing until valid setup */
+		instp->cycle_pulses = 0;
+		instp->stats.cov = -1.0f;
+		cmonReset(instp);
+		return false;
+	}
+
+	if (seg_pulses < 1)
+		seg_pulses = 1;
+
+	instp->cycle_pulses = cycle_pulses;
+	instp->seg_pulses = seg_pulses;
+	instp->len = cycle_pulses + seg_pulses + 1;
+	instp->k_omega = 2.0f * M_PI * 1e6f * seg_pulses / pulses_per_rev;
+	instp->misfire_thr = misfire_thr;
+
+	cmonReset(instp);
+	return true;
+}
+
+/**
+ * Drop history (capture timeout), counters are kept.
+ */
+void cmonReset(CombustionMonitor *instp)
+{
+	instp->idx = 0;
+	instp->filled = 0;
+	instp->in_misfire = false;
+	instp->win_n = 0;
+	instp->win_sum = 0.0f;
+	instp->win_sumsq = 0.0f;
+	cmon_cycle_reset(instp);
+}
+
+/**
+ * Process one capture period.
+ * @return true at end of combustion cycle
+ */
+bool cmonPulse(CombustionMonitor *instp, uint32_t period_us)
+{
+	uint32_t w = instp->seg_pulses;
+
+	if (instp->cycle_pulses == 0)
+		return false;
+
+	instp->now += period_us;
+	if (++instp->idx >= instp->len)
+		instp->idx = 0;
+	instp->time[instp->idx] = instp->now;
+	if (instp->filled < instp->len)
+		instp->filled++;
+
+	if (instp->filled > w) {
+		uint32_t seg = instp->now - cmon_hist(instp, w);
+		float omega = instp->k_omega / seg;
+
+		if (omega < instp->omega_min) instp->omega_min = omega;
+		if (omega > instp->omega_max) instp->omega_max = omega;
+
+		if (instp->filled > 2 * w) {
+			uint32_t prev = cmon_hist(instp, w) - cmon_hist(instp, 2 * w);
+			float alpha = (omega - instp->k_omega / prev) * 2e6f / (seg + prev);
+
+			if (alpha < instp->alpha_min) instp->alpha_min = alpha;
+			if (alpha > instp->alpha_max) instp->alpha_max = alpha;
+		}
+
+		if (instp->filled == instp->len) {
+			uint32_t p = instp->cycle_pulses;
+			uint32_t cycle = cmon_hist(instp, p) - cmon_hist(instp, p + w);
+
+			cmon_misfire_check(instp, ((float)cycle - (float)seg) / seg);
+		}
+	}
+
+	if (++instp->pulse >= instp->cycle_pulses) {
+		cmon_cycle_end(instp);
+		return true;
+	}
+
+	return false;
+}
@@ -0,0 +1,81 @@
+/**
+ * @file       combustion.h
+ * @brief      Combustion stability monitor
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef COMBUSTION_H
+#define COMBUSTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CMON_MAX_PULSES		128	//!< pulses per combustion cycle (64 x 2 revolutions)
+#define CMON_MAX_SEGMENT	8	//!< pulses per speed segment
+#define CMON_COV_CYCLES		32	//!< cycles in CoV window
+#define CMON_RING_SIZE		(CMON_MAX_PULSES + CMON_MAX_SEGMENT + 1)
+
+/* note: same layout in tools/misfirebench.py */
+typedef struct {
+	uint32_t cycles;	//!< analysed combustion cycles
+	uint32_t misfires;	//!< detected misfires
+	float cov;		//!< CoV of cyclic speed fluctuation [%], < 0 until first window
+	float alpha_max;	//!< last cycle peak acceleration [rad/s²]
+	float alpha_min;	//!< last cycle peak deceleration [rad/s²]
+} CombustionStats;
+
+typedef struct {
+	CombustionStats stats;	//!< first: host test reads it at offset 0
+
+	/* configuration */
+	uint32_t cycle_pulses;
+	uint32_t seg_pulses;
+	uint32_t len;
+	float k_omega;
+	float misfire_thr;
+
+	/* edge time history, 1 µs, wraps */
+	uint32_t time[CMON_RING_SIZE];
+	uint32_t now;
+	uint32_t idx;
+	uint32_t filled;
+
+	/* current cycle */
+	uint32_t pulse;
+	uint32_t misfire_len;
+	bool in_misfire;
+	float omega_min;
+	float omega_max;
+	float alpha_min;
+	float alpha_max;
+
+	/* CoV window */
+	uint32_t win_n;
+	float win_sum;
+	float win_sumsq;
+} CombustionMonitor;
+
+void cmonObjectInit(CombustionMonitor *instp);
+bool cmonIsSupported(uint32_t pulses_per_rev, uint32_t revs_per_cycle);
+bool cmonSetup(CombustionMonitor *instp, uint32_t pulses_per_rev, uint32_t revs_per_cycle,
+		float misfire_thr);
+void cmonReset(CombustionMonitor *instp);
+bool cmonPulse(CombustionMonitor *instp, uint32_t period_us);
+
+#endif /* COMBUSTION_H */
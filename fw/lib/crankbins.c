@@ -0,0 +1,143 @@
+/**
+ * @file       crankbins.c
+ * @brief      Crank angle binning of fixed rate samples
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "crankbins.h"
+#include <math.h>
+#include <string.h>
+
+/*
+ * Fixed rate samples placed by crank angle: sample angle interpolated
+ * from last capture edge and last pulse period, both time stamped by
+ * same free running counter.
+ *
+ * Angle origin is first pulse of counted revolution, so with several
+ * pulses per revolution it is arbitrary, but fixed while engine runs.
+ */
+
+/**
+ * Forget position (engine stopped)
+ */
+void cbinPositionReset(CrankPosition *posp)
+{
+	memset(posp, 0, sizeof(*posp));
+}
+
+/**
+ * Capture edge.
+ *
+ * @param edge		edge time
+ * @param period	time from previous edge
+ * @param rev_start	edge starts new revolution
+ * @return true if previous revolution is complete (publish it),
+ *         false on any other edge or first revolution start (discard)
+ */
+bool cbinEdge(CrankPosition *posp, uint32_t edge, uint32_t period, bool rev_start)
+{
+	bool complete = false;
+
+	if (rev_start) {
+		complete = posp->synced;
+		posp->synced = true;
+		posp->pulse = 0;
+	}
+	else
+		posp->pulse++;
+
+	posp->edge = edge;
+	posp->period = period;
+	return complete;
+}
+
+/**
+ * Angle bin of sample.
+ *
+ * @param t		sample trigger time
+ * @return bin index or -1 if sample dropped
+ *         (not synced, triggered before last edge or while engine stops)
+ */
+int cbinIndex(const CrankPosition *posp, uint32_t t, uint32_t pulses_per_rev)
+{
+	int32_t elapsed = t - posp->edge;
+
+	if (!posp->synced || posp->period == 0 || elapsed < 0
+			|| (uint32_t)elapsed >= 2 * posp->period || pulses_per_rev == 0)
+		return -1;
+
+	float frac = (float)elapsed / posp->period;
+	if (frac > 1.0)
+		frac = 1.0;
+
+	unsigned bin = (posp->pulse + frac) * CRANK_BINS / pulses_per_rev;
+	if (bin >= CRANK_BINS)
+		bin = CRANK_BINS - 1;
+
+	return bin;
+}
+
+void cbinClear(CrankBins *binsp)
+{
+	memset(binsp, 0, sizeof(*binsp));
+}
+
+void cbinAdd(CrankBins *binsp, int bin, float value)
+{
+	if (bin < 0 || bin >= CRANK_BINS)
+		return;
+
+	binsp->sum[bin] += value;
+	binsp->cnt[bin]++;
+}
+
+/**
+ * Finish revolution: bin averages to out, empty bins hold previous bin
+ * (first bins hold last filled bin). Accumulator cleared.
+ *
+ * @return cycle average, time weighted (all samples), NAN if none
+ */
+float cbinFinish(CrankBins *binsp, float out[CRANK_BINS])
+{
+	float total = 0.0;
+	uint32_t count = 0;
+	float last = NAN;
+
+	for (size_t i = 0; i < CRANK_BINS; i++) {
+		total += binsp->sum[i];
+		count += binsp->cnt[i];
+	}
+
+	for (size_t i = CRANK_BINS; i > 0; i--) {
+		if (binsp->cnt[i - 1] > 0) {
+			last = binsp->sum[i - 1] / binsp->cnt[i - 1];
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < CRANK_BINS; i++) {
+		if (binsp->cnt[i] > 0)
+			last = binsp->sum[i] / binsp->cnt[i];
+
+		out[i] = last;
+	}
+
+	cbinClear(binsp);
+	return (count > 0)? total / count : NAN;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file       crankbins.h
+ * @brief      Crank angle binning of fixed rate samples
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef CRANKBINS_H
+#define CRANKBINS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//! Crank angle bins per revolution (15°)
+#define CRANK_BINS	24
+
+//! Crank position from last capture edge, times in free running ticks (wraps)
+typedef struct {
+	uint32_t edge;		//!< last edge time
+	uint32_t period;	//!< last pulse period
+	uint32_t pulse;		//!< pulse number in revolution
+	bool synced;		//!< revolution start seen
+} CrankPosition;
+
+//! Accumulator of one revolution
+typedef struct {
+	float sum[CRANK_BINS];
+	uint16_t cnt[CRANK_BINS];
+} CrankBins;
+
+void cbinPositionReset(CrankPosition *posp);
+bool cbinEdge(CrankPosition *posp, uint32_t edge, uint32_t period, bool rev_start);
+int cbinIndex(const CrankPosition *posp, uint32_t t, uint32_t pulses_per_rev);
+void cbinClear(CrankBins *binsp);
+void cbinAdd(CrankBins *binsp, int bin, float value);
+float cbinFinish(CrankBins *binsp, float out[CRANK_BINS]);
+
+#endif /* CRANKBINS_H */
@@ -1,5 +1,10 @@
 FWLIBSRC = ${MINIECU}/fw/lib/lib_crc16.c \
+	   ${MINIECU}/fw/lib/lib_crc32.c \
 	   ${MINIECU}/fw/lib/ntc.c \
-	   ${MINIECU}/fw/lib/lowpassfilter2p.c
+	   ${MINIECU}/fw/lib/lowpassfilter2p.c \
+	   ${MINIECU}/fw/lib/rfft.c \
+	   ${MINIECU}/fw/lib/combustion.c \
+	   ${MINIECU}/fw/lib/crankbins.c \
+	   ${MINIECU}/fw/lib/pagecomp.c
 
 FWLIBINC = ${MINIECU}/fw/lib
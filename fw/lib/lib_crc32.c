@@ -0,0 +1,55 @@
+/**
+ * @file       lib_crc32.c
+ * @brief      CRC-32 (IEEE 802.3, same as zlib.crc32)
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "lib_crc32.h"
+
+/* Reflected polynomial 0xedb88320, half-byte table:
+ * 64 bytes of flash instead of 1 KiB, fast enough for image checks.
+ */
+static const uint32_t crc32_tab[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+/**
+ * Continue CRC calculation on a part of the buffer.
+ * Start with crc32val = 0.
+ */
+uint32_t crc32part(const uint8_t *src, size_t len, uint32_t crc32val)
+{
+	uint32_t crc = ~crc32val;
+
+	while (len--) {
+		crc ^= *src++;
+		crc = (crc >> 4) ^ crc32_tab[crc & 0x0f];
+		crc = (crc >> 4) ^ crc32_tab[crc & 0x0f];
+	}
+
+	return ~crc;
+}
+
+uint32_t crc32(const uint8_t *src, size_t len)
+{
+	return crc32part(src, len, 0);
+}
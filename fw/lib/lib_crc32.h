@@ -0,0 +1,32 @@
+/**
+ * @file       lib_crc32.h
+ * @brief      CRC-32 (IEEE 802.3, same as zlib.crc32)
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef LIB_CRC32_H
+#define LIB_CRC32_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t crc32part(const uint8_t *src, size_t len, uint32_t crc32val);
+uint32_t crc32(const uint8_t *src, size_t len);
+
+#endif /* LIB_CRC32_H */
@@ -68,6 +68,19 @@ void lpf2pSetCutoffFrequency(LowPassFilter2p *instp, float sample_freq, float cu
 	instp->a2 = (1.0f - 2.0f * cosf(M_PI_4) * ohm + ohm * ohm) / c;
 }
 
+/* Take coefficients calculated on other instance, filter state kept
+ * (so slow calculation may be done outside of lock)
+ */
+void lpf2pCopyCoefficients(LowPassFilter2p *instp, const LowPassFilter2p *src)
+{
+	instp->cutoff_freq = src->cutoff_freq;
+	instp->a1 = src->a1;
+	instp->a2 = src->a2;
+	instp->b0 = src->b0;
+	instp->b1 = src->b1;
+	instp->b2 = src->b2;
+}
+
 float lpf2pApply(LowPassFilter2p *instp, float sample)
 {
 	if (instp->cutoff_freq <= 0.0f) {
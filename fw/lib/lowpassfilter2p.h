@@ -56,6 +56,7 @@ typedef struct {
 
 void lpf2pObjectInit(LowPassFilter2p *instp);
 void lpf2pSetCutoffFrequency(LowPassFilter2p *instp, float sample_freq, float cutoff_freq);
+void lpf2pCopyCoefficients(LowPassFilter2p *instp, const LowPassFilter2p *src);
 float lpf2pApply(LowPassFilter2p *instp, float sample);
 float lpf2pReset(LowPassFilter2p *instp, float sample);
 
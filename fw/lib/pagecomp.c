@@ -0,0 +1,232 @@
+/**
+ * @file       pagecomp.c
+ * @brief      Bulk transfer page compressor
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "pagecomp.h"
+#include <string.h>
+
+/*
+ * Raw data compressed block by block into page sized output.
+ * Each page decodes alone (lost page loses only its range),
+ * so window and hash reset on page start.
+ *
+ * Token stream, same control byte for both codecs:
+ *   0LLLLLLL <L+1 bytes>		literals, 1..128
+ *   1NNNNNNN <value>		RLE: value repeated N+3 times
+ *   1NNNNNNN <distance-1>	LZ: copy N+3 bytes from distance 1..256 back,
+ *				may overlap (distance 1 is a run)
+ *
+ * Matches do not cross blocks, so LZ window is only previous
+ * and current block: 256 bytes + 512 bytes hash table.
+ * Decoder: tools/miniecu/pagecomp.py, test: tools/pagecompbench.py
+ */
+
+#define MIN_MATCH	3
+#define MAX_MATCH	(0x7f + MIN_MATCH)
+#define MAX_LITERALS	0x80
+
+static inline uint32_t pcomp_hash(const uint8_t *p)
+{
+	uint32_t v = (p[0] << 16) | (p[1] << 8) | p[2];
+
+	return (v * 2654435761u) >> (32 - PCOMP_HASH_BITS);
+}
+
+static size_t pcomp_match_len(const uint8_t *a, const uint8_t *b, size_t max)
+{
+	size_t n = 0;
+
+	while (n < max && a[n] == b[n])
+		n++;
+
+	return n;
+}
+
+static bool pcomp_emit_literals(PageCompressor *instp, const uint8_t *src, size_t len)
+{
+	while (len > 0) {
+		size_t n = (len > MAX_LITERALS)? MAX_LITERALS : len;
+
+		if (instp->out_len + 1 + n > instp->out_size)
+			return false;
+
+		instp->out[instp->out_len++] = n - 1;
+		memcpy(instp->out + instp->out_len, src, n);
+		instp->out_len += n;
+		src += n;
+		len -= n;
+	}
+
+	return true;
+}
+
+static bool pcomp_emit_pair(PageCompressor *instp, size_t len, uint8_t arg)
+{
+	if (instp->out_len + 2 > instp->out_size)
+		return false;
+
+	instp->out[instp->out_len++] = 0x80 | (len - MIN_MATCH);
+	instp->out[instp->out_len++] = arg;
+	return true;
+}
+
+static bool pcomp_block_rle(PageCompressor *instp, const uint8_t *cur, size_t len)
+{
+	size_t lit = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		size_t max = (len - i > MAX_MATCH)? MAX_MATCH : len - i;
+		size_t run = 1 + pcomp_match_len(cur + i + 1, cur + i, max - 1);
+
+		if (run < MIN_MATCH) {
+			i++;
+			continue;
+		}
+
+		if (!pcomp_emit_literals(instp, cur + lit, i - lit)
+				|| !pcomp_emit_pair(instp, run, cur[i]))
+			return false;
+
+		i += run;
+		lit = i;
+	}
+
+	return pcomp_emit_literals(instp, cur + lit, len - lit);
+}
+
+static bool pcomp_block_lz(PageCompressor *instp, const uint8_t *cur, size_t len)
+{
+	size_t lit = 0;
+	size_t i = 0;
+
+	while (i < len) {
+		size_t max = (len - i > MAX_MATCH)? MAX_MATCH : len - i;
+		size_t back = instp->hist_len + i;
+		size_t best_len = 0, best_dist = 0;
+
+		if (back > PCOMP_MAX_DISTANCE)
+			back = PCOMP_MAX_DISTANCE;
+
+		if (max >= MIN_MATCH && back > 0) {
+			uint32_t h = pcomp_hash(cur + i);
+			uint32_t pos = instp->raw_len + i + 1;
+			size_t dist = pos - instp->hash[h];
+
+			instp->hash[h] = pos;
+
+			/* hash candidate, may be stale or collision */
+			if (dist <= back && dist < pos) {
+				best_len = pcomp_match_len(cur + i, cur + i - dist, max);
+				best_dist = dist;
+			}
+
+			/* runs always checked */
+			if (best_len < max) {
+				size_t run = pcomp_match_len(cur + i, cur + i - 1, max);
+
+				if (run > best_len) {
+					best_len = run;
+					best_dist = 1;
+				}
+			}
+		}
+
+		if (best_len < MIN_MATCH) {
+			i++;
+			continue;
+		}
+
+		if (!pcomp_emit_literals(instp, cur + lit, i - lit)
+				|| !pcomp_emit_pair(instp, best_len, best_dist - 1))
+			return false;
+
+		/* index skipped positions */
+		for (size_t j = i + 1; j < i + best_len && j + MIN_MATCH <= len; j++)
+			instp->hash[pcomp_hash(cur + j)] = instp->raw_len + j + 1;
+
+		i += best_len;
+		lit = i;
+	}
+
+	return pcomp_emit_literals(instp, cur + lit, len - lit);
+}
+
+/* -*- public -*- */
+
+void pcompObjectInit(PageCompressor *instp, enum pcomp_codec codec)
+{
+	memset(instp, 0, sizeof(*instp));
+	instp->codec = codec;
+}
+
+/**
+ * Start new page, drops window.
+ * @param out_size  at least PCOMP_MIN_OUT
+ */
+void pcompPageBegin(PageCompressor *instp, uint8_t *out, size_t out_size)
+{
+	instp->out = out;
+	instp->out_size = out_size;
+	instp->out_len = 0;
+	instp->raw_len = 0;
+	instp->hist_len = 0;
+	memset(instp->hash, 0, sizeof(instp->hash));
+}
+
+/**
+ * Compress block placed in @a pcompBlockBuffer to current page.
+ * @return false if page full: output unchanged, block kept in buffer
+ */
+bool pcompBlock(PageCompressor *instp, size_t len)
+{
+	uint8_t *cur = pcompBlockBuffer(instp);
+	size_t out_len = instp->out_len;
+	bool ret;
+
+	if (len == 0)
+		return true;
+	if (len > PCOMP_BLOCK)
+		return false;
+
+	switch (instp->codec) {
+	case PCOMP_RLE:
+		ret = pcomp_block_rle(instp, cur, len);
+		break;
+	case PCOMP_LZ:
+		ret = pcomp_block_lz(instp, cur, len);
+		break;
+	default:
+		ret = pcomp_emit_literals(instp, cur, len);
+		break;
+	}
+
+	if (!ret) {
+		instp->out_len = out_len;
+		return false;
+	}
+
+	/* current block becomes window, aligned to its end */
+	memmove(cur - len, cur, len);
+	instp->hist_len = len;
+	instp->raw_len += len;
+	return true;
+}
@@ -0,0 +1,72 @@
+/**
+ * @file       pagecomp.h
+ * @brief      Bulk transfer page compressor
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef PAGECOMP_H
+#define PAGECOMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PCOMP_BLOCK		128	//!< max raw bytes per block
+#define PCOMP_HASH_BITS		8
+#define PCOMP_MAX_DISTANCE	256
+#define PCOMP_MIN_OUT		(PCOMP_BLOCK + 1)	//!< incompressible block on fresh page
+
+/* NOTE same as in miniecu.MemoryDumpRequest.Compression */
+enum pcomp_codec {
+	PCOMP_NONE = 0,
+	PCOMP_RLE,
+	PCOMP_LZ
+};
+
+typedef struct {
+	enum pcomp_codec codec;
+
+	/* previous block (window) | current block */
+	uint8_t buf[2 * PCOMP_BLOCK];
+	size_t hist_len;
+
+	/* LZ: last page offset + 1 of each 3-byte hash, 0: none */
+	uint16_t hash[1 << PCOMP_HASH_BITS];
+
+	/* current page */
+	uint32_t raw_len;
+	uint8_t *out;
+	size_t out_size;
+	size_t out_len;
+} PageCompressor;
+
+void pcompObjectInit(PageCompressor *instp, enum pcomp_codec codec);
+void pcompPageBegin(PageCompressor *instp, uint8_t *out, size_t out_size);
+bool pcompBlock(PageCompressor *instp, size_t len);
+
+/**
+ * Buffer for next raw block, up to PCOMP_BLOCK bytes.
+ * Kept by @a pcompPageBegin, so rejected block may be retried on new page.
+ */
+static inline uint8_t *pcompBlockBuffer(PageCompressor *instp)
+{
+	return instp->buf + PCOMP_BLOCK;
+}
+
+#endif /* PAGECOMP_H */
@@ -0,0 +1,148 @@
+/**
+ * @file       rfft.c
+ * @brief      Real FFT
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "rfft.h"
+#include <math.h>
+
+/*
+ * Radix-2 real FFT: n real samples packed as n/2 complex values,
+ * complex FFT, then split to real spectrum.
+ * Twiddles calculated by sinf/cosf (n - 1 calls per transform),
+ * no tables in RAM. Host benchmark: tools/rfftbench.py
+ */
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+static void cfft_bitreverse(float *z, size_t h)
+{
+	size_t j = 0;
+
+	for (size_t i = 0; i < h - 1; i++) {
+		if (i < j) {
+			float tr = z[2 * i], ti = z[2 * i + 1];
+			z[2 * i] = z[2 * j];
+			z[2 * i + 1] = z[2 * j + 1];
+			z[2 * j] = tr;
+			z[2 * j + 1] = ti;
+		}
+
+		size_t m = h >> 1;
+		while (m >= 1 && j >= m) {
+			j -= m;
+			m >>= 1;
+		}
+		j += m;
+	}
+}
+
+/**
+ * In-place complex FFT of h values (interleaved re, im)
+ */
+static void cfft(float *z, size_t h)
+{
+	cfft_bitreverse(z, h);
+
+	for (size_t len = 2; len <= h; len <<= 1) {
+		float step = -2.0f * (float)M_PI / len;
+
+		for (size_t j = 0; j < len / 2; j++) {
+			float wr = cosf(step * j);
+			float wi = sinf(step * j);
+
+			for (size_t i = j; i < h; i += len) {
+				size_t k = i + len / 2;
+				float tr = z[2 * k] * wr - z[2 * k + 1] * wi;
+				float ti = z[2 * k] * wi + z[2 * k + 1] * wr;
+
+				z[2 * k] = z[2 * i] - tr;
+				z[2 * k + 1] = z[2 * i + 1] - ti;
+				z[2 * i] += tr;
+				z[2 * i + 1] += ti;
+			}
+		}
+	}
+}
+
+/**
+ * Apply periodic Hann window
+ */
+void rfft_hann(float *x, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		x[i] *= 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / n);
+}
+
+/**
+ * In-place real FFT, n power of 2 (>= 4)
+ *
+ * Output packed: x[0] = X[0], x[1] = X[n/2] (both real),
+ * x[2k], x[2k + 1] = re, im of X[k] for k = 1..n/2-1
+ */
+void rfft(float *x, size_t n)
+{
+	size_t h = n / 2;
+
+	cfft(x, h);
+
+	/* split: X[k] = E[k] + W^k O[k] */
+	float z0r = x[0], z0i = x[1];
+	x[0] = z0r + z0i;
+	x[1] = z0r - z0i;
+
+	for (size_t k = 1; k <= h / 2; k++) {
+		size_t j = h - k;
+		float ar = x[2 * k], ai = x[2 * k + 1];
+		float br = x[2 * j], bi = x[2 * j + 1];
+
+		/* E = (Zk + conj(Zj)) / 2, O = (Zk - conj(Zj)) / 2i */
+		float er = 0.5f * (ar + br), ei = 0.5f * (ai - bi);
+		float or_ = 0.5f * (ai + bi), oi = -0.5f * (ar - br);
+
+		float a = -2.0f * (float)M_PI * k / n;
+		float wr = cosf(a), wi = sinf(a);
+		float tr = or_ * wr - oi * wi;
+		float ti = or_ * wi + oi * wr;
+
+		/* X[j] = conj(E) - conj(W^k O) by symmetry */
+		x[2 * k] = er + tr;
+		x[2 * k + 1] = ei + ti;
+		x[2 * j] = er - tr;
+		x[2 * j + 1] = -ei + ti;
+	}
+}
+
+/**
+ * Convert packed spectrum to single sided amplitude x[0..n/2],
+ * scaled for Hann windowed sinusoid (coherent gain 0.5).
+ */
+void rfft_magnitude(float *x, size_t n)
+{
+	float nyquist = fabsf(x[1]);
+
+	x[0] = fabsf(x[0]) * 2.0f / n;
+	for (size_t k = 1; k < n / 2; k++)
+		x[k] = sqrtf(x[2 * k] * x[2 * k] + x[2 * k + 1] * x[2 * k + 1]) * 4.0f / n;
+
+	x[n / 2] = nyquist * 2.0f / n;
+}
@@ -0,0 +1,32 @@
+/**
+ * @file       rfft.h
+ * @brief      Real FFT
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef LIB_RFFT_H
+#define LIB_RFFT_H
+
+#include <stddef.h>
+
+void rfft_hann(float *x, size_t n);
+void rfft(float *x, size_t n);
+void rfft_magnitude(float *x, size_t n);
+
+#endif /* LIB_RFFT_H */
@@ -0,0 +1,395 @@
+/**
+ * @file       blackbox.c
+ * @brief      Black box pre-fault recorder
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "blackbox.h"
+#include "alert_led.h"
+#include "alarm.h"
+#include "th_rpm.h"
+#include "adc/th_adc.h"
+#include "hw/ext_flash.h"
+#include "hw/rtc_time.h"
+#include "lib_crc16.h"
+#include <string.h>
+
+/*
+ * RAM ring records last BBOX_SAMPLES ADC thread samples (20 ms)
+ * and last BBOX_REVS crankshaft revolution periods.
+ *
+ * Trigger only freezes rings (safe in any context), then log thread
+ * writes whole RAM record to next pre-erased slot of error partition.
+ * On system halt kernel is dead, so record written by polled SPI
+ * to same pre-erased slot.
+ *
+ * Slot is two erase sectors, oldest incident overwritten.
+ */
+
+#define BBOX_SAMPLES		256		/* 5.12 s */
+#define BBOX_REVS		256
+#define BBOX_MAGIC		0x584f4242	/* "BBOX" */
+#define BBOX_SLOT_PAGES		(EPAGES * 2)
+#define BBOX_SLOTS		(ERROR_NR_PAGES / BBOX_SLOT_PAGES)
+
+/** Sample, 20 bytes
+ */
+struct bbox_sample {
+	uint32_t systime;	//!< [ticks]
+	uint16_t rpm;
+	uint16_t vbat;		//!< [mV]
+	int16_t temp;		//!< engine [0.1 C°]
+	int16_t oilt;		//!< OIL_P NTC [0.1 C°], INT16_MIN if disabled
+	int16_t cput;		//!< chip [0.1 C°]
+	uint16_t flags;		//!< miniecu.Status.Flags
+	uint16_t alerts;	//!< 2 bits per alert_source (enum alert_status)
+	uint16_t fuel_used;	//!< [mL]
+} __attribute__((packed));
+
+/** Incident header, rings follows
+ */
+struct bbox_header {
+	uint32_t magic;
+	uint32_t seq;
+	uint8_t reason;		//!< enum bbox_reason
+	uint8_t detail;
+	uint16_t sample_size;	//!< sizeof(struct bbox_sample)
+	uint16_t sample_head;	//!< index of oldest sample
+	uint16_t nr_samples;
+	uint16_t rev_head;	//!< index of oldest revolution
+	uint16_t nr_revs;
+	uint32_t systime;	//!< freeze time [ticks]
+	uint64_t timestamp_ms;	//!< UNIX time of freeze, 0 if unknown
+	uint16_t crc;		//!< crc16 of rings
+	uint16_t reserved;
+} __attribute__((packed));
+
+struct bbox_record {
+	struct bbox_header hdr;
+	struct bbox_sample samples[BBOX_SAMPLES];
+	uint32_t revs[BBOX_REVS];	//!< revolution period [us]
+} __attribute__((packed));
+
+#define BBOX_REC_PAGES	((sizeof(struct bbox_record) + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE)
+
+/* -*- module variables -*- */
+
+/* record written directly from RAM ring */
+static union {
+	struct bbox_record rec;
+	uint8_t pages[BBOX_REC_PAGES * FLASH_PAGE_SIZE];
+} m_bbox;
+
+static volatile bool m_frozen;
+static volatile bool m_slot_erased;	//!< m_slot ready for write
+static unsigned m_slot;
+static unsigned m_wipe_slot = BBOX_SLOTS;	//!< next slot to erase on partition wipe
+static uint32_t m_seq;
+static uint16_t m_sample_idx;
+static uint16_t m_rev_idx;
+
+static void bbox_freeze(enum bbox_reason reason, uint8_t detail)
+{
+	struct bbox_header *hdr = &m_bbox.rec.hdr;
+
+	m_frozen = true;
+
+	hdr->magic = BBOX_MAGIC;
+	hdr->seq = m_seq;
+	hdr->reason = reason;
+	hdr->detail = detail;
+	hdr->sample_size = sizeof(struct bbox_sample);
+	hdr->sample_head = (hdr->nr_samples < BBOX_SAMPLES)? 0 : m_sample_idx;
+	hdr->rev_head = (hdr->nr_revs < BBOX_REVS)? 0 : m_rev_idx;
+	hdr->systime = osalOsGetSystemTimeX();
+}
+
+static uint16_t bbox_rings_crc(void)
+{
+	return crc16((const uint8_t *)m_bbox.rec.samples,
+			sizeof(m_bbox.rec) - sizeof(m_bbox.rec.hdr));
+}
+
+static void bbox_unfreeze(void)
+{
+	chSysLock();
+	memset(&m_bbox.rec.hdr, 0, sizeof(m_bbox.rec.hdr));
+	m_sample_idx = 0;
+	m_rev_idx = 0;
+	m_frozen = false;
+	chSysUnlock();
+}
+
+static bool bbox_erase_slot(unsigned slot)
+{
+	if (flash_erase(&FLASHD1_error, slot * BBOX_SLOT_PAGES, BBOX_SLOT_PAGES) != HAL_SUCCESS) {
+		alert_component(ALS_FLASH, AL_FAIL);
+		return false;
+	}
+
+	if (slot == m_slot)
+		m_slot_erased = true;
+
+	return true;
+}
+
+/* -*- global -*- */
+
+/**
+ * Record ADC thread sample.
+ */
+void bbox_record(void)
+{
+	struct bbox_sample s;
+	int32_t oilt;
+
+	if (m_frozen)
+		return;
+
+	s.systime = osalOsGetSystemTimeX();
+	s.rpm = rpm_get_filtered();
+	s.vbat = batt_get_voltage();
+	s.temp = temp_get_temperature() / 100;
+	s.oilt = oilp_get_temperature(&oilt)? oilt / 100 : INT16_MIN;
+	s.cput = cpu_get_temperature() / 100;
+	s.flags = alarm_get_status();
+	s.alerts = alert_get_states();
+	s.fuel_used = flow_get_used_ml();
+
+	chSysLock();
+	if (!m_frozen) {
+		memcpy(&m_bbox.rec.samples[m_sample_idx], &s, sizeof(s));
+		m_sample_idx = (m_sample_idx + 1) % BBOX_SAMPLES;
+		if (m_bbox.rec.hdr.nr_samples < BBOX_SAMPLES)
+			m_bbox.rec.hdr.nr_samples++;
+	}
+	chSysUnlock();
+}
+
+/**
+ * Record revolution period.
+ * Called from ICU ISR.
+ */
+void bbox_record_revolution(uint32_t period_us)
+{
+	if (m_frozen)
+		return;
+
+	m_bbox.rec.revs[m_rev_idx] = period_us;
+	m_rev_idx = (m_rev_idx + 1) % BBOX_REVS;
+	if (m_bbox.rec.hdr.nr_revs < BBOX_REVS)
+		m_bbox.rec.hdr.nr_revs++;
+}
+
+/**
+ * Freeze rings, flushed later by log thread.
+ * Safe to call from any context, incidents during flush are ignored.
+ */
+void bbox_trigger(enum bbox_reason reason, uint8_t detail)
+{
+	syssts_t sts = chSysGetStatusAndLockX();
+
+	if (!m_frozen)
+		bbox_freeze(reason, detail);
+
+	chSysRestoreStatusX(sts);
+}
+
+/**
+ * Find last incident slot and prepare next one.
+ * Called from log thread, flash should be connected.
+ */
+void bbox_init(void)
+{
+	struct bbox_header *hdr;
+	uint8_t page[FLASH_PAGE_SIZE];
+	bool found = false;
+
+	for (unsigned slot = 0; slot < BBOX_SLOTS; slot++) {
+		if (flash_read(&FLASHD1_error, slot * BBOX_SLOT_PAGES, page, 1) != HAL_SUCCESS) {
+			alert_component(ALS_FLASH, AL_FAIL);
+			return;
+		}
+
+		hdr = (struct bbox_header *)page;
+		if (hdr->magic != BBOX_MAGIC || (found && hdr->seq < m_seq))
+			continue;
+
+		found = true;
+		m_seq = hdr->seq;
+		m_slot = slot;
+	}
+
+	if (found) {
+		m_seq++;
+		m_slot = (m_slot + 1) % BBOX_SLOTS;
+	}
+
+	bbox_erase_slot(m_slot);
+}
+
+/**
+ * Write frozen record and prepare next slot.
+ * Called from log thread.
+ */
+void bbox_flush(void)
+{
+	if (!m_frozen)
+		return;
+
+	m_bbox.rec.hdr.timestamp_ms = time_is_known()? time_get_timestamp() : 0;
+	m_bbox.rec.hdr.crc = bbox_rings_crc();
+
+	if (!m_slot_erased && !bbox_erase_slot(m_slot))
+		goto drop;
+
+	m_slot_erased = false;
+	if (flash_write(&FLASHD1_error, m_slot * BBOX_SLOT_PAGES, m_bbox.pages, BBOX_REC_PAGES) != HAL_SUCCESS) {
+		alert_component(ALS_FLASH, AL_FAIL);
+		goto drop;
+	}
+
+	debug_printf(DP_WARN, "BBOX: incident #%" PRIu32 " reason %u saved to slot %u",
+			m_seq, m_bbox.rec.hdr.reason, m_slot);
+
+	m_seq++;
+	m_slot = (m_slot + 1) % BBOX_SLOTS;
+	bbox_unfreeze();
+	return;
+
+drop:
+	debug_printf(DP_ERROR, "BBOX: incident #%" PRIu32 " lost", m_seq);
+	bbox_unfreeze();
+}
+
+/**
+ * Erase next slot (after flush or wipe).
+ * Called from log thread in idle time.
+ *
+ * @return true if slot erased, false if nothing to do
+ */
+bool bbox_preerase(void)
+{
+	if (!m_slot_erased)
+		return bbox_erase_slot(m_slot);
+
+	/* slots before m_slot written after wipe */
+	while (m_wipe_slot < BBOX_SLOTS) {
+		unsigned slot = m_wipe_slot++;
+
+		if (slot > m_slot)
+			return bbox_erase_slot(slot);
+	}
+
+	return false;
+}
+
+/**
+ * Discard incident records: restart at slot 0,
+ * slots erased by bbox_preerase().
+ */
+void bbox_wipe(void)
+{
+	m_slot = 0;
+	m_slot_erased = false;
+	m_wipe_slot = 1;
+}
+
+/* -*- halt path -*- */
+
+/*
+ * Kernel halted and interrupts disabled: SPI driver state ignored,
+ * slot must be pre-erased. Byte program is slow (~20 us per byte),
+ * but safety actions already done by halt hook.
+ */
+
+#define SST25_CMD_WRITE		0x02
+#define SST25_CMD_WRDI		0x04
+#define SST25_CMD_RDSR		0x05
+#define SST25_CMD_WREN		0x06
+#define SST25_SR_BUSY		0x01
+
+static uint8_t halt_spi_xfer(uint8_t b)
+{
+	while (!(SPI1->SR & SPI_SR_TXE));
+	*(volatile uint8_t *)&SPI1->DR = b;
+	while (!(SPI1->SR & SPI_SR_RXNE));
+	return *(volatile uint8_t *)&SPI1->DR;
+}
+
+static void halt_sst25_cmd(uint8_t cmd)
+{
+	palClearPad(GPIOB, GPIOB_FLASH_CS);
+	halt_spi_xfer(cmd);
+	palSetPad(GPIOB, GPIOB_FLASH_CS);
+}
+
+static void halt_sst25_wait(void)
+{
+	palClearPad(GPIOB, GPIOB_FLASH_CS);
+	halt_spi_xfer(SST25_CMD_RDSR);
+	while (halt_spi_xfer(0xff) & SST25_SR_BUSY);
+	palSetPad(GPIOB, GPIOB_FLASH_CS);
+}
+
+static void halt_sst25_write(uint32_t addr, const uint8_t *buf, size_t len)
+{
+	for (; len > 0; len--, addr++, buf++) {
+		halt_sst25_cmd(SST25_CMD_WREN);
+
+		palClearPad(GPIOB, GPIOB_FLASH_CS);
+		halt_spi_xfer(SST25_CMD_WRITE);
+		halt_spi_xfer(addr >> 16);
+		halt_spi_xfer(addr >> 8);
+		halt_spi_xfer(addr);
+		halt_spi_xfer(*buf);
+		palSetPad(GPIOB, GPIOB_FLASH_CS);
+
+		halt_sst25_wait();
+	}
+}
+
+/**
+ * Write record from system halt hook.
+ */
+void bbox_halt_flush(void)
+{
+	if (!m_slot_erased)
+		return;
+
+	if (!m_frozen)
+		bbox_freeze(BBOX_HALT, 0);
+
+	m_bbox.rec.hdr.timestamp_ms = 0;
+	m_bbox.rec.hdr.crc = bbox_rings_crc();
+	m_slot_erased = false;
+
+	/* abort any transfer, SPI1 master, 8-bit, fPCLK/8 */
+	palSetPad(GPIOB, GPIOB_FLASH_CS);
+	SPI1->CR1 = 0;
+	SPI1->CR2 = SPI_CR2_DS_2 | SPI_CR2_DS_1 | SPI_CR2_DS_0 | SPI_CR2_FRXTH;
+	SPI1->CR1 = SPI_CR1_MSTR | SPI_CR1_SSM | SPI_CR1_SSI | SPI_CR1_BR_1 | SPI_CR1_SPE;
+
+	/* finish possible interrupted write */
+	halt_sst25_cmd(SST25_CMD_WRDI);
+	halt_sst25_wait();
+
+	halt_sst25_write((ERROR_START_PAGE + m_slot * BBOX_SLOT_PAGES) * FLASH_PAGE_SIZE,
+			m_bbox.pages, sizeof(m_bbox.rec));
+}
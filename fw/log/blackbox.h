@@ -0,0 +1,47 @@
+/**
+ * @file       blackbox.h
+ * @brief      Black box pre-fault recorder
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef BLACKBOX_H
+#define BLACKBOX_H
+
+#include "fw_common.h"
+
+enum bbox_reason {
+	BBOX_NONE = 0,
+	BBOX_ALERT,		//!< component failed, detail: alert_source
+	BBOX_EMERGENCY_STOP,	//!< Command EMERGENCY_STOP
+	BBOX_ALARM,		//!< alarm rule action, detail: action
+	BBOX_HALT,		//!< system halt (written from halt hook)
+	BBOX_WATCHDOG		//!< task missed deadline, detail: sv_task
+};
+
+/* subsystem functions */
+void bbox_record(void);
+void bbox_record_revolution(uint32_t period_us);
+void bbox_trigger(enum bbox_reason reason, uint8_t detail);
+void bbox_init(void);
+void bbox_flush(void);
+bool bbox_preerase(void);
+void bbox_wipe(void);
+void bbox_halt_flush(void);
+
+#endif /* BLACKBOX_H */
@@ -1,3 +1,5 @@
-LOGSRC = ${MINIECU}/fw/log/th_log.c
+LOGSRC = ${MINIECU}/fw/log/th_log.c \
+	 ${MINIECU}/fw/log/blackbox.c \
+	 ${MINIECU}/fw/log/log_flash.c
 
 LOGINC =
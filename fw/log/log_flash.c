@@ -0,0 +1,338 @@
+/**
+ * @file       log_flash.c
+ * @brief      Compact log record storage
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "log_flash.h"
+#include "alert_led.h"
+#include "hw/ext_flash.h"
+#include "hw/rtc_time.h"
+#include "param_table.h"
+#include <string.h>
+
+#define LOG_SYNC_MAX		64	/* 1 + 5 + 5 + 5 + 10 + 5 * LOG_NCH */
+#define LOG_RECORD_MAX		LOG_SYNC_MAX
+#define LOG_PREERASE		2	/* sectors kept erased ahead of write head */
+
+/* -*- parameters -*- */
+extern int32_t gp_engine_id;	// th_comm_pbstx.c
+
+/* -*- module variables -*- */
+
+static uint8_t m_page[FLASH_PAGE_SIZE];	//!< page being filled
+static size_t m_page_pos;
+static uint32_t m_head;			//!< page number of m_page
+static uint32_t m_nr_pages;		//!< ring size, whole sectors
+static uint32_t m_seq;			//!< current sector sequence number
+static int32_t m_prev[LOG_NCH];
+static uint32_t m_prev_time;		//!< [ms]
+static bool m_need_sync;
+static bool m_ready;
+static uint32_t m_erased_ahead;		//!< erased sectors after head sector
+static uint32_t m_wipe_left;		//!< sectors left to erase on partition wipe
+
+/* -*- encoding -*- */
+
+static size_t put_varint(uint8_t *p, uint64_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = v | 0x80;
+		v >>= 7;
+	}
+
+	p[n++] = v;
+	return n;
+}
+
+static size_t put_zigzag(uint8_t *p, int64_t v)
+{
+	return put_varint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static uint32_t get_varint32(const uint8_t *p, size_t len)
+{
+	uint32_t v = 0;
+
+	for (size_t i = 0; i < len && i < 5; i++) {
+		v |= (uint32_t)(p[i] & 0x7f) << (7 * i);
+		if (!(p[i] & 0x80))
+			break;
+	}
+
+	return v;
+}
+
+static size_t log_encode_sync(uint8_t *p, const int32_t value[LOG_NCH], uint32_t now)
+{
+	size_t n = 0;
+
+	p[n++] = LOG_TAG_SYNC;
+	n += put_varint(p + n, m_seq);
+	n += put_varint(p + n, gp_engine_id);
+	n += put_varint(p + n, now);
+	n += put_varint(p + n, time_is_known()? time_get_timestamp() : 0);
+
+	for (size_t i = 0; i < LOG_NCH; i++)
+		n += put_zigzag(p + n, value[i]);
+
+	return n;
+}
+
+static size_t log_encode_delta(uint8_t *p, const int32_t value[LOG_NCH], uint32_t now)
+{
+	uint8_t mask = 0;
+	size_t n = 1;
+
+	n += put_varint(p + n, now - m_prev_time);
+
+	for (size_t i = 0; i < LOG_NCH; i++) {
+		if (value[i] == m_prev[i])
+			continue;
+
+		mask |= 1 << i;
+		n += put_zigzag(p + n, (int64_t)value[i] - m_prev[i]);
+	}
+
+	p[0] = mask;
+	return n;
+}
+
+/* -*- flash ring -*- */
+
+static bool log_erase_sector(uint32_t page)
+{
+	if (flash_erase(&FLASHD1_log, page, EPAGES) != HAL_SUCCESS) {
+		alert_component(ALS_FLASH, AL_FAIL);
+		debug_printf(DP_ERROR, "LOG: erase failed");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Write current page and move to next one.
+ * New sector started with SYNC, normally it is already erased
+ * by log_flash_preerase().
+ */
+static bool log_next_page(void)
+{
+	bool ret = true;
+
+	if (flash_write(&FLASHD1_log, m_head, m_page, 1) != HAL_SUCCESS) {
+		alert_component(ALS_FLASH, AL_FAIL);
+		debug_printf(DP_ERROR, "LOG: write failed");
+		ret = false;
+	}
+
+	memset(m_page, LOG_TAG_ERASED, sizeof(m_page));
+	m_page_pos = 0;
+	m_head = (m_head + 1) % m_nr_pages;
+
+	if (m_head % EPAGES == 0) {
+		m_seq++;
+		m_need_sync = true;
+		if (m_erased_ahead > 0)
+			m_erased_ahead--;
+		else if (!log_erase_sector(m_head))
+			ret = false;
+	}
+
+	return ret;
+}
+
+/* -*- global -*- */
+
+/**
+ * Find write head: last page in sector with greatest sequence number.
+ * Called from log thread, flash should be connected.
+ */
+void log_flash_init(void)
+{
+	uint8_t page[FLASH_PAGE_SIZE];
+	uint32_t sector, best_sector = 0;
+	bool found = false;
+
+	m_nr_pages = mtdGetSize(&FLASHD1_log) / FLASH_PAGE_SIZE / EPAGES * EPAGES;
+	if (m_nr_pages == 0)
+		return;
+
+	for (sector = 0; sector < m_nr_pages / EPAGES; sector++) {
+		if (flash_read(&FLASHD1_log, sector * EPAGES, page, 1) != HAL_SUCCESS) {
+			alert_component(ALS_FLASH, AL_FAIL);
+			return;
+		}
+
+		if (page[0] != LOG_TAG_SYNC)
+			continue;
+
+		uint32_t seq = get_varint32(page + 1, sizeof(page) - 1);
+		if (found && seq < m_seq)
+			continue;
+
+		found = true;
+		m_seq = seq;
+		best_sector = sector;
+	}
+
+	memset(m_page, LOG_TAG_ERASED, sizeof(m_page));
+	m_page_pos = 0;
+	m_need_sync = true;
+	m_erased_ahead = 0;
+
+	if (!found) {
+		m_seq = 0;
+		m_head = 0;
+		if (!log_erase_sector(m_head))
+			return;
+	}
+	else {
+		/* first empty page in last sector */
+		for (m_head = best_sector * EPAGES + 1; m_head % EPAGES != 0; m_head++) {
+			if (flash_read(&FLASHD1_log, m_head, page, 1) != HAL_SUCCESS) {
+				alert_component(ALS_FLASH, AL_FAIL);
+				return;
+			}
+
+			if (page[0] == LOG_TAG_ERASED)
+				break;
+		}
+
+		if (m_head % EPAGES == 0) {
+			m_head %= m_nr_pages;
+			m_seq++;
+			if (!log_erase_sector(m_head))
+				return;
+		}
+	}
+
+	debug_printf(DP_INFO, "LOG: head page %" PRIu32 " seq %" PRIu32, m_head, m_seq);
+	m_ready = true;
+}
+
+/**
+ * Append record, page written when filled.
+ * Called from log thread.
+ */
+void log_flash_append(const int32_t value[LOG_NCH])
+{
+	uint8_t rec[LOG_RECORD_MAX];
+	size_t len = 0;
+	uint32_t now = time_get_systime();
+
+	if (!m_ready)
+		return;
+
+	if (!m_need_sync) {
+		len = log_encode_delta(rec, value, now);
+		if (m_page_pos + len > FLASH_PAGE_SIZE)
+			log_next_page();
+	}
+
+	/* sector start or restart */
+	if (m_need_sync) {
+		if (m_page_pos + LOG_SYNC_MAX > FLASH_PAGE_SIZE)
+			log_next_page();
+
+		len = log_encode_sync(rec, value, now);
+		m_need_sync = false;
+	}
+
+	memcpy(m_page + m_page_pos, rec, len);
+	m_page_pos += len;
+
+	memcpy(m_prev, value, sizeof(m_prev));
+	m_prev_time = now;
+}
+
+/**
+ * Write partially filled page (power fail).
+ * Page filled later is written again, programmed bytes are same.
+ */
+void log_flash_commit(void)
+{
+	if (!m_ready || m_page_pos == 0)
+		return;
+
+	if (flash_write(&FLASHD1_log, m_head, m_page, 1) != HAL_SUCCESS) {
+		alert_component(ALS_FLASH, AL_FAIL);
+		debug_printf(DP_ERROR, "LOG: commit failed");
+	}
+}
+
+/**
+ * Request SYNC record (time reference changed, partition erased)
+ */
+void log_flash_sync(void)
+{
+	m_need_sync = true;
+}
+
+/**
+ * Erase one sector ahead of write head.
+ * Called from log thread in idle time, one sector per call,
+ * so other flash users wait for one sector erase at most.
+ *
+ * @return true if sector erased, false if nothing to do
+ */
+bool log_flash_preerase(void)
+{
+	uint32_t nr_sectors = m_nr_pages / EPAGES;
+	uint32_t sector;
+
+	if (!m_ready || m_erased_ahead + 1 >= nr_sectors)
+		return false;
+
+	if (m_erased_ahead >= LOG_PREERASE && m_wipe_left == 0)
+		return false;
+
+	sector = (m_head / EPAGES + 1 + m_erased_ahead) % nr_sectors;
+	if (!log_erase_sector(sector * EPAGES))
+		return false;
+
+	m_erased_ahead++;
+	if (m_wipe_left > 0)
+		m_wipe_left--;
+
+	return true;
+}
+
+/**
+ * Discard log: restart at partition begin,
+ * rest of sectors erased by log_flash_preerase().
+ */
+void log_flash_wipe(void)
+{
+	if (!m_ready)
+		return;
+
+	memset(m_page, LOG_TAG_ERASED, sizeof(m_page));
+	m_page_pos = 0;
+	m_head = 0;
+	m_seq++;
+	m_need_sync = true;
+	m_erased_ahead = 0;
+	m_wipe_left = m_nr_pages / EPAGES - 1;
+
+	if (!log_erase_sector(m_head))
+		m_ready = false;
+}
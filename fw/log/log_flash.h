@@ -0,0 +1,74 @@
+/**
+ * @file       log_flash.h
+ * @brief      Compact log record storage
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef LOG_FLASH_H
+#define LOG_FLASH_H
+
+#include "fw_common.h"
+
+/*
+ * Log partition format (decoder: tools/miniecu/logcodec.py)
+ *
+ * Partition is a ring of 4 KiB sectors, each sector starts with SYNC
+ * record, so decoding can start at any sector. SYNC also written
+ * on logger start and time reference change.
+ * Records never cross page boundary, page tail padded by 0xff.
+ *
+ * SYNC:  LOG_TAG_SYNC,
+ *        varint sector sequence number,
+ *        varint engine_id,
+ *        varint system time [ms],
+ *        varint UNIX time [ms] (0 if unknown),
+ *        zigzag varint value[LOG_NCH]
+ *
+ * DELTA: mask (bit 7 clear, bit n set: channel n changed),
+ *        varint time delta [ms],
+ *        zigzag varint (value - previous value) for changed channels
+ *
+ * 0xff:  erased/padding, continue on next page
+ */
+
+#define LOG_FORMAT_VERSION	1
+#define LOG_TAG_SYNC		(0x80 | LOG_FORMAT_VERSION)
+#define LOG_TAG_ERASED		0xff
+
+/* note: same order in host decoder */
+enum log_channel {
+	LOG_CH_STATUS = 0,		//!< Status.Flags
+	LOG_CH_RPM,
+	LOG_CH_BATT_VOLTAGE,		//!< [mV]
+	LOG_CH_BATT_REMAINING,		//!< [%], -1 if unknown
+	LOG_CH_TEMP_ENGINE,		//!< [mC°]
+	LOG_CH_TEMP_INTERNAL,		//!< [mC°]
+	LOG_CH_FUEL_REMAINING,		//!< [mL], -1 if unknown
+	LOG_NCH				//!< max 7 (delta mask bits)
+};
+
+/* subsystem functions */
+void log_flash_init(void);
+void log_flash_append(const int32_t value[LOG_NCH]);
+void log_flash_sync(void);
+void log_flash_commit(void);
+bool log_flash_preerase(void);
+void log_flash_wipe(void);
+
+#endif /* LOG_FLASH_H */
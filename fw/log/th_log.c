@@ -22,25 +22,231 @@
 
 #include "alert_led.h"
 #include "th_log.h"
-#include "flash-mtd.h"
+#include "engine_map.h"
+#include "blackbox.h"
+#include "log_flash.h"
+#include "alarm.h"
+#include "supervisor.h"
+#include "th_rpm.h"
+#include "adc/th_adc.h"
+#include "hw/ext_flash.h"
+#include "hw/rtc_time.h"
+#include "hw/ectl_pads.h"
+#include "param_table.h"
+#include <string.h>
 
 #define INIT_TIMEOUT	MS2ST(5000)
+#define LOG_TICK_MS	100		/* dense profile period */
+#define LOG_TICK	MS2ST(LOG_TICK_MS)
+#define LOG_ERASE_TIME	MS2ST(LOG_TICK_MS / 2)	/* idle erase budget per tick */
+#define LOG_START_DENSE	S2ST(30)	/* dense logging after engine start/stop */
+#define LOG_PFAIL_PRIO	(ADC_PRIO + 1)	/* commit before anything else */
+#define LOG_EV_PFAIL	EVENT_MASK(0)
+#define LOG_EV_ERASE	EVENT_MASK(1)
+
+/* -*- parameters -*- */
+int32_t gp_log_run_period;
+int32_t gp_log_stop_period;
 
 /* -*- local data -*- */
 static MUTEX_DECL(m_init_mtx);
 static CONDVAR_DECL(m_log_init_done);
 static THD_WORKING_AREA(wa_log, LOG_WASZ);
+static thread_t *m_log_thread;
+
+
+/*
+ * Logging profiles:
+ * - DENSE: every tick during engine start/stop, starter and alarms
+ * - RUNNING: LOG_RUN_PERIOD
+ * - STOPPED: LOG_STOP_PERIOD heartbeat
+ * In any profile record written at once if status changed or value
+ * moved more than channel step since last record.
+ * Records carry time delta, so rate change is seamless for decoder.
+ */
+
+enum log_profile {
+	LOG_PROF_STOPPED = 0,
+	LOG_PROF_RUNNING,
+	LOG_PROF_DENSE
+};
+
+/* note: order same as enum log_channel, 0: any change */
+static const int32_t m_channel_step[LOG_NCH] = {
+	0,		/* status */
+	250,		/* rpm */
+	250,		/* batt voltage [mV] */
+	5,		/* batt remaining [%] */
+	2000,		/* temp engine [mC°] */
+	2000,		/* temp internal [mC°] */
+	100		/* fuel remaining [mL] */
+};
+
+static int32_t m_logged[LOG_NCH];
+static systime_t m_logged_time;
+static bool m_logged_valid;
+
+/* -*- local -*- */
+
+static enum log_profile log_select_profile(void)
+{
+	static bool was_running;
+	static systime_t change_time;
+	bool running = rpm_is_engine_running();
+
+	if (running != was_running) {
+		was_running = running;
+		change_time = osalOsGetSystemTimeX();
+	}
+
+	if (ctl_starter_state() || alarm_get_flags() != 0
+			|| chVTTimeElapsedSinceX(change_time) < LOG_START_DENSE)
+		return LOG_PROF_DENSE;
+
+	return (running)? LOG_PROF_RUNNING : LOG_PROF_STOPPED;
+}
+
+static bool log_values_changed(const int32_t value[LOG_NCH])
+{
+	for (size_t i = 0; i < LOG_NCH; i++) {
+		int32_t diff = value[i] - m_logged[i];
+
+		if (diff < 0)
+			diff = -diff;
+
+		if ((m_channel_step[i] == 0 && diff != 0)
+				|| (m_channel_step[i] != 0 && diff >= m_channel_step[i]))
+			return true;
+	}
+
+	return false;
+}
+
+static void log_sample(bool force)
+{
+	int32_t value[LOG_NCH];
+	uint32_t batt_rem;
+	systime_t period;
+
+	value[LOG_CH_STATUS] = alarm_get_status();
+	value[LOG_CH_RPM] = rpm_get_filtered();
+	value[LOG_CH_BATT_VOLTAGE] = batt_get_voltage();
+	value[LOG_CH_BATT_REMAINING] = batt_get_remaining(&batt_rem)? (int32_t)batt_rem : -1;
+	value[LOG_CH_TEMP_ENGINE] = temp_get_temperature();
+	value[LOG_CH_TEMP_INTERNAL] = cpu_get_temperature();
+	if (!flow_get_remaining_ml(&value[LOG_CH_FUEL_REMAINING]))
+		value[LOG_CH_FUEL_REMAINING] = -1;
+
+	switch (log_select_profile()) {
+	case LOG_PROF_DENSE:
+		period = 0;
+		break;
+	case LOG_PROF_RUNNING:
+		period = MS2ST(gp_log_run_period);
+		break;
+	case LOG_PROF_STOPPED:
+	default:
+		period = MS2ST(gp_log_stop_period);
+		break;
+	}
+
+	if (!force && m_logged_valid && chVTTimeElapsedSinceX(m_logged_time) < period
+			&& !log_values_changed(value))
+		return;
+
+	log_flash_append(value);
+
+	memcpy(m_logged, value, sizeof(m_logged));
+	m_logged_time = osalOsGetSystemTimeX();
+	m_logged_valid = true;
+}
+
+/**
+ * Supply is falling: commit in order of importance
+ * while hold-up capacitors last (see tools/holdup.py).
+ */
+static void log_power_fail(void)
+{
+	tprio_t prio = chThdSetPriority(LOG_PFAIL_PRIO);
 
+	log_sample(true);
+	log_flash_commit();
+	emap_flush();
+
+	chThdSetPriority(prio);
+	debug_printf(DP_WARN, "LOG: power fail, data committed");
+}
+
+/**
+ * Erase ahead of log head and incident slots in rest of tick.
+ * Sector erase can't be suspended on SST25, so work split by sectors:
+ * power fail and other flash users wait for one erase at most.
+ */
+static void log_idle_erase(systime_t tick_start)
+{
+	while (chVTTimeElapsedSinceX(tick_start) < LOG_ERASE_TIME) {
+		if (chEvtGetAndClearEvents(LOG_EV_PFAIL)) {
+			log_power_fail();
+			return;
+		}
+
+		if (!bbox_preerase() && !log_flash_preerase())
+			return;
+	}
+}
 
 /* -*- thread -*- */
 static THD_FUNCTION(th_log, arg ATTR_UNUSED)
 {
-	/* TODO */
+	bool time_known = false;
+	systime_t tick_start;
+
+	chRegSetThreadName("log");
+
+	if (flash_connect() == MSG_OK) {
+		emap_load();
+		bbox_init();
+		log_flash_init();
+	}
 
 	chCondSignal(&m_log_init_done);
+	sv_register(SV_TASK_LOG);
+	tick_start = osalOsGetSystemTimeX();
 	while (true) {
-		/* TODO */
-		chThdSleepMilliseconds(1000);
+		systime_t elapsed = chVTTimeElapsedSinceX(tick_start);
+		eventmask_t ev = chEvtWaitAnyTimeout(LOG_EV_PFAIL | LOG_EV_ERASE,
+				(elapsed < LOG_TICK)? LOG_TICK - elapsed : TIME_IMMEDIATE);
+
+		sv_checkin(SV_TASK_LOG);
+
+		if (ev & LOG_EV_PFAIL)
+			log_power_fail();
+
+		if (ev & LOG_EV_ERASE) {
+			bbox_wipe();
+			log_flash_wipe();
+			debug_printf(DP_INFO, "LOG: erasing");
+		}
+
+		if (chVTTimeElapsedSinceX(tick_start) < LOG_TICK)
+			continue;
+
+		tick_start = osalOsGetSystemTimeX();
+
+		/* noncritical work stopped until supply restored */
+		if (batt_pfail_is_active())
+			continue;
+
+		/* new time reference: absolute timestamp in SYNC */
+		if (time_is_known() != time_known) {
+			time_known = time_is_known();
+			log_flash_sync();
+		}
+
+		log_sample(false);
+		bbox_flush();
+		emap_checkpoint();
+		log_idle_erase(tick_start);
 	}
 
 	return MSG_OK;
@@ -51,9 +257,29 @@ static THD_FUNCTION(th_log, arg ATTR_UNUSED)
 
 void log_init(void)
 {
-	chThdCreateStatic(wa_log, sizeof(wa_log), LOG_PRIO, th_log, NULL);
+	m_log_thread = chThdCreateStatic(wa_log, sizeof(wa_log), LOG_PRIO, th_log, NULL);
 
 	chMtxLock(&m_init_mtx);
 	chCondWaitTimeout(&m_log_init_done, INIT_TIMEOUT);
 	chMtxUnlock(&m_init_mtx);
 }
+
+/**
+ * Wake log thread for power fail commit.
+ * I-class, called from SDADC ISR.
+ */
+void log_power_fail_i(void)
+{
+	if (m_log_thread != NULL)
+		chEvtSignalI(m_log_thread, LOG_EV_PFAIL);
+}
+
+/**
+ * Request erase of log and error partitions.
+ * Done by log thread in background.
+ */
+void log_erase_request(void)
+{
+	if (m_log_thread != NULL)
+		chEvtSignal(m_log_thread, LOG_EV_ERASE);
+}
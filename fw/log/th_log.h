@@ -26,5 +26,7 @@
 #include "fw_common.h"
 
 void log_init(void);
+void log_power_fail_i(void);
+void log_erase_request(void);
 
 #endif /* TH_LOG_H */
@@ -19,7 +19,9 @@
 #include "comm/th_comm_pbstx.h"
 #include "adc/th_adc.h"
 #include "log/th_log.h"
+#include "log/blackbox.h"
 #include "th_rpm.h"
+#include "supervisor.h"
 #include "param.h"
 #include "hw/led.h"
 #include "hw/usb_vcom.h"
@@ -27,12 +29,11 @@
 #include "hw/ext_flash.h"
 #include "hw/ectl_pads.h"
 #include "param_table.h"
-#include <string.h>
 
 
 /* -*- main parameters -*- */
 bool gp_rtc_init_ignore_alert_led;
-char gp_serial1_proto[PT_STRING_SIZE];
+uint8_t gp_serial1_proto;
 
 
 /* -*- main module -*- */
@@ -49,6 +50,9 @@ void system_halt_hook(void)
 
 	/* indication */
 	led_halt_state();
+
+	/* save pre-fault state */
+	bbox_halt_flush();
 }
 
 /**
@@ -56,13 +60,8 @@ void system_halt_hook(void)
  */
 static void serial1_comm_create(void)
 {
-#define SERIAL1_PROTO_IS(proto) \
-	(strcasecmp(gp_serial1_proto, SERIAL1_PROTO__ ## proto) == 0)
-
-	if (SERIAL1_PROTO_IS(PBStx))
+	if (gp_serial1_proto == SERIAL1_PROTO__PBStx)
 		pbstxCreate(&SERIAL1_SD, PBSTX_WASZ, PBSTX_PRIO);
-
-#undef SERIAL1_PROTO_IS
 }
 
 /*
@@ -79,6 +78,7 @@ int main(void) {
 	 */
 	halInit();
 	chSysInit();
+	sv_init();
 
 	sdStart(&SERIAL1_SD, NULL);
 	alert_led_init();
@@ -116,6 +116,9 @@ int main(void) {
 			chThdTerminate(usb_comm);
 		}
 
+		// "... repeated N times" of debug_printf() bursts
+		debug_ratelimit_flush();
+
 		chThdSleepMilliseconds(500);
 	}
 }
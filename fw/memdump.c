@@ -46,7 +46,7 @@ int32_t memdump_ext_flash(uint32_t address, void *buffer, size_t size)
 
 		if (sz > (signed)size - size_ret)
 			sz = size - size_ret;
-		if (blkRead(&FLASHD1, page, rd_buff, 1) != HAL_SUCCESS)
+		if (flash_read(&FLASHD1, page, rd_buff, 1) != HAL_SUCCESS)
 			return -1;
 
 		memcpy(buffer, rd_buff + off, sz);
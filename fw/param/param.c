@@ -29,59 +29,76 @@
 
 /* -*- local functions -*- */
 
-static void _pr_set(const struct param_entry *obj, void *val)
+static void _pr_set(const struct param_entry *obj, const void *val)
 {
 	switch (obj->type) {
 	case PT_BOOL:
-		*((bool *)obj->variable) = *((bool *)val);
+		*((bool *)obj->variable) = *((const bool *)val);
 		break;
 	case PT_INT32:
-		*((int32_t *)obj->variable) = *((int32_t *)val);
+		*((int32_t *)obj->variable) = *((const int32_t *)val);
 		break;
 	case PT_FLOAT:
-		*((float *)obj->variable) = *((float *)val);
+		*((float *)obj->variable) = *((const float *)val);
 		break;
 	case PT_STRING:
 		strncpy(obj->variable, val, PT_STRING_SIZE);
 		break;
+	case PT_ENUM:
+		*((uint8_t *)obj->variable) = *((const int32_t *)val);
+		break;
 	};
 }
 
-static msg_t _pr_set_bool(const struct param_entry *obj, miniecu_ParamType *value)
+static msg_t _pr_check_bool(const struct param_entry *obj ATTR_UNUSED,
+		miniecu_ParamType *value, union param_default *out)
 {
 	if (value->has_u_bool) {
-		_pr_set(obj, &value->u_bool);
+		out->b = value->u_bool;
 		return PARAM_OK;
 	}
 	else if (value->has_u_int32) {
-		bool b_val = value->u_int32 != 0;
-		_pr_set(obj, &b_val);
+		out->b = value->u_int32 != 0;
 		return PARAM_OK;
 	}
 
 	return PARAM_ETYPE;
 }
 
-static msg_t _pr_set_int32(const struct param_entry *obj, miniecu_ParamType *value)
+static msg_t _pr_check_int32(const struct param_entry *obj,
+		miniecu_ParamType *value, union param_default *out)
 {
 	if (value->has_u_int32) {
 		if (obj->min.i > value->u_int32 || value->u_int32 > obj->max.i)
 			return PARAM_LIMIT;
 
-		_pr_set(obj, &value->u_int32);
+		out->i = value->u_int32;
 		return PARAM_OK;
 	}
 
 	return PARAM_ETYPE;
 }
 
-static msg_t _pr_set_float(const struct param_entry *obj, miniecu_ParamType *value)
+static msg_t _pr_check_float(const struct param_entry *obj,
+		miniecu_ParamType *value, union param_default *out)
 {
 	if (value->has_u_float) {
 		if (obj->min.f > value->u_float || value->u_float > obj->max.f)
 			return PARAM_LIMIT;
 
-		_pr_set(obj, &value->u_float);
+		out->f = value->u_float;
+		return PARAM_OK;
+	}
+
+	return PARAM_ETYPE;
+
+}
+
+static msg_t _pr_check_string(const struct param_entry *obj ATTR_UNUSED,
+		miniecu_ParamType *value, union param_default *out)
+{
+	if (value->has_u_string) {
+		strncpy(out->s, value->u_string, PT_STRING_SIZE);
 		return PARAM_OK;
 	}
 
@@ -89,15 +106,70 @@ static msg_t _pr_set_float(const struct param_entry *obj, miniecu_ParamType *val
 
 }
 
-static msg_t _pr_set_string(const struct param_entry *obj, miniecu_ParamType *value)
+/**
+ * Enum accepts value name (as string params before)
+ * or index (used in flash storage).
+ */
+static msg_t _pr_check_enum(const struct param_entry *obj,
+		miniecu_ParamType *value, union param_default *out)
 {
 	if (value->has_u_string) {
-		_pr_set(obj, &value->u_string);
+		for (int32_t i = 0; i <= obj->max.i; i++) {
+			if (strncasecmp(obj->names[i], value->u_string, PT_STRING_SIZE) == 0) {
+				out->i = i;
+				return PARAM_OK;
+			}
+		}
+
+		return PARAM_LIMIT;
+	}
+	else if (value->has_u_int32) {
+		if (obj->min.i > value->u_int32 || value->u_int32 > obj->max.i)
+			return PARAM_LIMIT;
+
+		out->i = value->u_int32;
 		return PARAM_OK;
 	}
 
 	return PARAM_ETYPE;
+}
+
+/**
+ * Validate new value and convert it to storage representation.
+ * Parameter variable is not touched.
+ */
+static msg_t _pr_check(const struct param_entry *p, miniecu_ParamType *value,
+		union param_default *out)
+{
+	msg_t ret = PARAM_ETYPE;
+
+	if (p->flags & PT_RDONLY)
+		return PARAM_LIMIT;
+
+	switch (p->type) {
+	case PT_BOOL:
+		ret = _pr_check_bool(p, value, out);
+		break;
+	case PT_INT32:
+		ret = _pr_check_int32(p, value, out);
+		break;
+	case PT_FLOAT:
+		ret = _pr_check_float(p, value, out);
+		break;
+	case PT_STRING:
+		ret = _pr_check_string(p, value, out);
+		break;
+	case PT_ENUM:
+		ret = _pr_check_enum(p, value, out);
+		break;
+	}
+
+	if (ret == PARAM_ETYPE)
+		debug_printf(DP_ERROR, "wrong type: %s", p->id);
+	else if (ret == PARAM_LIMIT)
+		debug_printf(DP_ERROR, "out of range: %s", p->id);
 
+	return ret;
 }
 
 static const struct param_entry *_prt_find(const char *id, size_t *idx)
@@ -113,37 +185,45 @@ static const struct param_entry *_prt_find(const char *id, size_t *idx)
 	return NULL;
 }
 
-static void _pr_set_ParamType(miniecu_ParamType *value, const struct param_entry *obj)
+/**
+ * Fill ParamType union from parameter variable
+ * @param compact	store enum as index (for flash storage)
+ */
+static void _pr_set_ParamType(miniecu_ParamType *value, const struct param_entry *obj,
+		bool compact)
 {
+	value->has_u_bool = false;
+	value->has_u_int32 = false;
+	value->has_u_float = false;
+	value->has_u_string = false;
+
 	switch (obj->type) {
 	case PT_BOOL:
 		value->has_u_bool = true;
-		value->has_u_int32 = false;
-		value->has_u_float = false;
-		value->has_u_string = false;
 		value->u_bool = *((bool *)obj->variable);
 		break;
 	case PT_INT32:
-		value->has_u_bool = false;
 		value->has_u_int32 = true;
-		value->has_u_float = false;
-		value->has_u_string = false;
 		value->u_int32 = *((int32_t *)obj->variable);
 		break;
 	case PT_FLOAT:
-		value->has_u_bool = false;
-		value->has_u_int32 = false;
 		value->has_u_float = true;
-		value->has_u_string = false;
 		value->u_float = *((float *)obj->variable);
 		break;
 	case PT_STRING:
-		value->has_u_bool = false;
-		value->has_u_int32 = false;
-		value->has_u_float = false;
 		value->has_u_string = true;
 		strncpy(value->u_string, obj->variable, PT_STRING_SIZE);
 		break;
+	case PT_ENUM:
+		if (compact) {
+			value->has_u_int32 = true;
+			value->u_int32 = *((uint8_t *)obj->variable);
+		}
+		else {
+			value->has_u_string = true;
+			strncpy(value->u_string, obj->names[*((uint8_t *)obj->variable)], PT_STRING_SIZE);
+		}
+		break;
 	};
 }
 
@@ -157,44 +237,175 @@ static THD_FUNCTION(th_param_load, arg ATTR_UNUSED)
 
 /* -*- global -*- */
 
-msg_t param_set(const char *id, miniecu_ParamType *value)
+volatile uint32_t param_generation;
+
+/**
+ * Enter parameter update section.
+ * Used for param variables and values derived from them in change callbacks.
+ */
+void param_lock(void)
 {
-	msg_t ret = 0;
-	size_t idx;
-	const struct param_entry *p = _prt_find(id, &idx);
+	chSysLock();
+}
 
-	if (p == NULL)
-		return PARAM_NOTEXIST;
+/**
+ * Leave parameter update section and publish new generation.
+ */
+void param_unlock(void)
+{
+	param_generation++;
+	chSysUnlock();
+}
 
-	if (p->flags & PT_RDONLY)
+struct param_batch {
+	const struct param_entry **p;
+	union param_default *staged;
+	size_t count;
+};
+
+/* batches are serialized: derived values staged by validate_cb stay valid until apply */
+static MUTEX_DECL(m_batch_mtx);
+
+/**
+ * Value of parameter after batch would be applied
+ *
+ * For validate_cb: staged value if parameter is in batch, else current.
+ * Enum staged as int32_t index.
+ *
+ * @param batch		batch, NULL: current values
+ * @param variable	parameter variable (gp_xxx)
+ */
+const void *param_batch_value(const struct param_batch *batch, const void *variable)
+{
+	if (batch != NULL)
+		for (size_t i = 0; i < batch->count; i++)
+			if (batch->p[i]->variable == variable)
+				return &batch->staged[i];
+
+	return variable;
+}
+
+/**
+ * Set a group of parameters atomically.
+ *
+ * All values are validated first: own limits, then validate_cb of
+ * affected parameters (cross-parameter rules) against staged values.
+ * If any of them fails nothing is changed.
+ * Then variables are updated and apply_cb publishes derived values
+ * in one critical section (readers see either old or new config,
+ * see @a param_read_begin()). After that each affected change
+ * callback is called once.
+ *
+ * @param id	parameter names
+ * @param value	new values
+ * @param count	number of items (<= @a PARAM_BATCH_MAX)
+ * @return PARAM_OK or error of first failed item
+ */
+msg_t param_set_batch(const char * const id[], miniecu_ParamType * const value[], size_t count)
+{
+	const struct param_entry *p[PARAM_BATCH_MAX];
+	union param_default staged[PARAM_BATCH_MAX];
+	struct param_batch batch = { p, staged, count };
+	msg_t ret = PARAM_OK;
+	size_t i, j, idx;
+
+	if (count > PARAM_BATCH_MAX)
 		return PARAM_LIMIT;
 
-	switch (p->type) {
-	case PT_BOOL:
-		ret = _pr_set_bool(p, value);
-		break;
-	case PT_INT32:
-		ret = _pr_set_int32(p, value);
-		break;
-	case PT_FLOAT:
-		ret = _pr_set_float(p, value);
-		break;
-	case PT_STRING:
-		ret = _pr_set_string(p, value);
-		break;
+	chMtxLock(&m_batch_mtx);
+
+	/* 1. validate */
+	for (i = 0; i < count; i++) {
+		p[i] = _prt_find(id[i], &idx);
+		if (p[i] == NULL) {
+			ret = PARAM_NOTEXIST;
+			goto unlock_ret;
+		}
+
+		ret = _pr_check(p[i], value[i], &staged[i]);
+		if (ret != PARAM_OK)
+			goto unlock_ret;
 	}
 
-	if (ret == PARAM_OK && p->change_cb != NULL)
-		p->change_cb(p);
+	for (i = 0; i < count; i++) {
+		if (p[i]->validate_cb == NULL)
+			continue;
 
-	if (ret == PARAM_ETYPE)
-		debug_printf(DP_ERROR, "wrong type: %s", p->id);
-	else if (ret == PARAM_LIMIT)
-		debug_printf(DP_ERROR, "out of range: %s", p->id);
+		for (j = 0; j < i; j++)
+			if (p[j]->validate_cb == p[i]->validate_cb)
+				break;
+
+		if (j == i && !p[i]->validate_cb(&batch)) {
+			ret = PARAM_LIMIT;
+			goto unlock_ret;
+		}
+	}
+
+	/* 2. apply */
+	param_lock();
+	for (i = 0; i < count; i++)
+		_pr_set(p[i], &staged[i]);
+
+	for (i = 0; i < count; i++) {
+		if (p[i]->apply_cb == NULL)
+			continue;
+
+		for (j = 0; j < i; j++)
+			if (p[j]->apply_cb == p[i]->apply_cb)
+				break;
+
+		if (j == i)
+			p[i]->apply_cb(p[i]);
+	}
+	param_unlock();
+
+	/* 3. call each callback once */
+	for (i = 0; i < count; i++) {
+		if (p[i]->change_cb == NULL)
+			continue;
+
+		for (j = 0; j < i; j++)
+			if (p[j]->change_cb == p[i]->change_cb)
+				break;
+
+		if (j == i)
+			p[i]->change_cb(p[i]);
+	}
+
+unlock_ret:
+	chMtxUnlock(&m_batch_mtx);
+	return ret;
+}
+
+/**
+ * Run validate_cb and apply_cb on current values, same as batch would.
+ * For derived values initialization: serialized with batches,
+ * so values staged by validate_cb are not overwritten before apply.
+ *
+ * @return validate_cb result, apply_cb not called if false
+ */
+bool param_apply_current(bool (*validate_cb)(const struct param_batch *batch),
+		void (*apply_cb)(const struct param_entry *self))
+{
+	bool ret;
+
+	chMtxLock(&m_batch_mtx);
+	ret = validate_cb(NULL);
+	if (ret) {
+		param_lock();
+		apply_cb(NULL);
+		param_unlock();
+	}
+	chMtxUnlock(&m_batch_mtx);
 
 	return ret;
 }
 
+msg_t param_set(const char *id, miniecu_ParamType *value)
+{
+	return param_set_batch(&id, &value, 1);
+}
+
 msg_t param_get(const char *id, miniecu_ParamType *value, size_t *idx)
 {
 	const struct param_entry *p = _prt_find(id, idx);
@@ -202,7 +413,7 @@ msg_t param_get(const char *id, miniecu_ParamType *value, size_t *idx)
 	if (p == NULL)
 		return PARAM_NOTEXIST;
 
-	_pr_set_ParamType(value, p);
+	_pr_set_ParamType(value, p, false);
 	return PARAM_OK;
 }
 
@@ -212,7 +423,21 @@ msg_t param_get_by_idx(size_t idx, char *id, miniecu_ParamType *value)
 		return PARAM_NOTEXIST;
 
 	strncpy(id, parameter_table[idx].id, PT_ID_SIZE);
-	_pr_set_ParamType(value, &parameter_table[idx]);
+	_pr_set_ParamType(value, &parameter_table[idx], false);
+
+	return PARAM_OK;
+}
+
+/**
+ * Same as @a param_get_by_idx() but in compact storage representation
+ */
+msg_t param_get_storage_by_idx(size_t idx, char *id, miniecu_ParamType *value)
+{
+	if (idx >= parameter_table_size)
+		return PARAM_NOTEXIST;
+
+	strncpy(id, parameter_table[idx].id, PT_ID_SIZE);
+	_pr_set_ParamType(value, &parameter_table[idx], true);
 
 	return PARAM_OK;
 }
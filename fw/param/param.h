@@ -33,6 +33,8 @@
 #define PT_ID_SIZE	16
 #define PT_STRING_SIZE	16
 
+#define PARAM_BATCH_MAX	8	//!< same as ParamSetBatch.items max_count
+
 #define PT_RDONLY	(1<<0)	//!< Read-only flag
 #define PT_NSAVE	(1<<1)	//!< Don't save flag
 
@@ -40,7 +42,8 @@ enum param_type {
 	PT_BOOL,	// pointer to bool
 	PT_INT32,	// pointer to int32
 	PT_FLOAT,	// pointer to float
-	PT_STRING	// pointer to char[16]
+	PT_STRING,	// pointer to char[16]
+	PT_ENUM		// pointer to uint8_t, index in names table
 };
 
 union param_minmax {
@@ -55,6 +58,8 @@ union param_default {
 	char s[PT_STRING_SIZE];
 };
 
+struct param_batch;	/* staged values of param_set_batch(), see param_batch_value() */
+
 /**
  * Entry for parameter table
  */
@@ -75,6 +80,12 @@ struct param_entry {
 	uint8_t flags;
 	//! optional callback
 	void (*change_cb)(const struct param_entry *self);
+	//! optional check of staged values (cross-parameter rules), false rejects batch
+	bool (*validate_cb)(const struct param_batch *batch);
+	//! optional update of derived values, called in batch critical section (must not block)
+	void (*apply_cb)(const struct param_entry *self);
+	//! value names (only for enum), max is last index
+	const char * const *names;
 };
 
 #ifndef PB_MINIECU_PB_H_INCLUDED
@@ -82,9 +93,44 @@ struct _miniecu_ParamType;
 typedef struct _miniecu_Paramtype miniecu_ParamType;
 #endif /* PB_MINIECU_PB_H_INCLUDED */
 
+extern volatile uint32_t param_generation;
+
+/**
+ * Start reading group of parameters (seqlock like).
+ *
+ * @code
+ * do {
+ *	gen = param_read_begin();
+ *	a = gp_a; b = gp_b;
+ * } while (param_read_retry(gen));
+ * @endcode
+ */
+static inline uint32_t param_read_begin(void)
+{
+	uint32_t gen = param_generation;
+	__asm__ volatile ("" ::: "memory");
+	return gen;
+}
+
+/**
+ * Check that parameters was not changed while reading.
+ */
+static inline bool param_read_retry(uint32_t gen)
+{
+	__asm__ volatile ("" ::: "memory");
+	return gen != param_generation;
+}
+
+void param_lock(void);
+void param_unlock(void);
 msg_t param_set(const char *id, miniecu_ParamType *value);
+msg_t param_set_batch(const char * const id[], miniecu_ParamType * const value[], size_t count);
+const void *param_batch_value(const struct param_batch *batch, const void *variable);
+bool param_apply_current(bool (*validate_cb)(const struct param_batch *batch),
+		void (*apply_cb)(const struct param_entry *self));
 msg_t param_get(const char *id, miniecu_ParamType *value, size_t *idx);
 msg_t param_get_by_idx(size_t idx, char *id, miniecu_ParamType *value);
+msg_t param_get_storage_by_idx(size_t idx, char *id, miniecu_ParamType *value);
 msg_t param_get_flags_by_idx(size_t idx);
 size_t param_count(void);
 void param_init(void);
@@ -58,7 +58,7 @@ static bool pb_istream_read_next(pb_istream_t *stream)
 
 	state->buffer.eos = state->buffer.offset = 0;
 
-	if (blkRead(&FLASHD1_config, state->page, state->buffer.buffer, 1) != HAL_SUCCESS)
+	if (flash_read(&FLASHD1_config, state->page, state->buffer.buffer, 1) != HAL_SUCCESS)
 		return false;
 
 	state->buffer.eos = mtdGetPageSize(&FLASHD1_config);
@@ -103,7 +103,12 @@ static bool pb_ostream_finalize(pb_ostream_t *stream)
 	/* fill tail */
 	while (chSequentialStreamPut(chp, 0xFF) == MSG_OK);
 
-	if (blkWrite(&FLASHD1_config, state->page, state->buffer.buffer, 1) != HAL_SUCCESS)
+	/* erase only sectors in use */
+	if (state->page % EPAGES == 0)
+		if (flash_erase(&FLASHD1_config, state->page, EPAGES) != HAL_SUCCESS)
+			return false;
+
+	if (flash_write(&FLASHD1_config, state->page, state->buffer.buffer, 1) != HAL_SUCCESS)
 		return false;
 
 	state->page += 1;
@@ -169,7 +174,7 @@ static bool encode_repeated_ParamStorage(pb_ostream_t *stream,
 			continue;
 
 		memset(&storage, 0, sizeof(storage));
-		if (param_get_by_idx(idx, storage.param_id, &storage.value) != PARAM_OK)
+		if (param_get_storage_by_idx(idx, storage.param_id, &storage.value) != PARAM_OK)
 			continue;
 
 		uint16_t crc = crc16((uint8_t*)storage.param_id, PT_ID_SIZE);
@@ -239,10 +244,7 @@ void param_save(void)
 	msObjectInit(&state.buffer, wr_buff, sizeof(wr_buff), 0);
 	pb_ostream_t ostream = { pb_ostream_cb, &state, mtdGetSize(&FLASHD1_config), 0 };
 
-	/* erase flash */
-	mtdErase(&FLASHD1_config, 0, UINT32_MAX);
-
-	/* write header */
+	/* write header, sectors erased on demand by pb_ostream_finalize() */
 	header.counter = ++gp_param_save_cnt;
 	if (!pb_write(&ostream, (const uint8_t *)&header, sizeof(header)))
 		return;
@@ -26,13 +26,15 @@
 #include "param.h"
 
 
-#define PARAM_BOOL(_id, _var, _default, _flags, _change_cb)			\
-	{ (_id), PT_BOOL, &(_var), {.b=(_default)}, {.i=0}, {.i=1}, (_flags), (_change_cb) }
-#define PARAM_INT32(_id, _var, _default, _min, _max, _flags, _change_cb)	\
-	{ (_id), PT_INT32, &(_var), {.i=(_default)}, {.i=(_min)}, {.i=(_max)}, (_flags), (_change_cb) }
-#define PARAM_FLOAT(_id, _var, _default, _min, _max, _flags, _change_cb)	\
-	{ (_id), PT_FLOAT, &(_var), {.f=(_default)}, {.f=(_min)}, {.f=(_max)}, (_flags), (_change_cb) }
-#define PARAM_STRING(_id, _var, _default, _flags, _change_cb)			\
-	{ (_id), PT_STRING, &(_var), {.s=(_default)}, {.i=0}, {.i=PT_STRING_SIZE}, (_flags), (_change_cb) }
+#define PARAM_BOOL(_id, _var, _default, _flags, _change_cb, _validate_cb, _apply_cb) \
+	{ (_id), PT_BOOL, &(_var), {.b=(_default)}, {.i=0}, {.i=1}, (_flags), (_change_cb), (_validate_cb), (_apply_cb), NULL }
+#define PARAM_INT32(_id, _var, _default, _min, _max, _flags, _change_cb, _validate_cb, _apply_cb) \
+	{ (_id), PT_INT32, &(_var), {.i=(_default)}, {.i=(_min)}, {.i=(_max)}, (_flags), (_change_cb), (_validate_cb), (_apply_cb), NULL }
+#define PARAM_FLOAT(_id, _var, _default, _min, _max, _flags, _change_cb, _validate_cb, _apply_cb) \
+	{ (_id), PT_FLOAT, &(_var), {.f=(_default)}, {.f=(_min)}, {.f=(_max)}, (_flags), (_change_cb), (_validate_cb), (_apply_cb), NULL }
+#define PARAM_STRING(_id, _var, _default, _flags, _change_cb, _validate_cb, _apply_cb) \
+	{ (_id), PT_STRING, &(_var), {.s=(_default)}, {.i=0}, {.i=PT_STRING_SIZE}, (_flags), (_change_cb), (_validate_cb), (_apply_cb), NULL }
+#define PARAM_ENUM(_id, _var, _default, _names, _flags, _change_cb, _validate_cb, _apply_cb) \
+	{ (_id), PT_ENUM, &(_var), {.i=(_default)}, {.i=0}, {.i=ARRAY_SIZE(_names)-1}, (_flags), (_change_cb), (_validate_cb), (_apply_cb), (_names) }
 
 #endif /* PARAM_INTERNAL_H */
@@ -0,0 +1,292 @@
+/**
+ * @file       supervisor.c
+ * @brief      Task deadline supervisor
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "supervisor.h"
+#include "log/blackbox.h"
+
+/*
+ * Each critical thread registers and checks in from its loop.
+ * Supervisor thread (highest application priority) reloads IWDG
+ * only while every registered task checked in within its deadline.
+ *
+ * Overdue task: miss counted, task id stored in RTC backup register,
+ * IWDG no longer fed. If task recovers, feeding resumes.
+ * If not, after SV_HALT_MS controlled halt: blackbox incident
+ * (BBOX_WATCHDOG, detail: task) and ignition off by halt hook,
+ * then IWDG resets MCU. Watchdog reset counted per task at next boot.
+ *
+ * Without supervisor thread running (ISR storm, kernel lockup)
+ * IWDG resets too, backup record tells last overdue task if any.
+ */
+
+#define SV_PERIOD_MS		50
+#define SV_HALT_MS		500	/* overdue time before controlled halt */
+/* minimum timeout, > SV_HALT_MS + SV_PERIOD_MS + halt hook bbox flush.
+ * LSI is 30..60 kHz (40 typical), so reload is sized for fastest LSI:
+ * actual timeout 1..2 s.
+ */
+#define IWDG_TIMEOUT_MS		1000
+#define LSI_FREQ_MAX		60000
+#define IWDG_KR_RELOAD		0xAAAA
+#define IWDG_KR_UNLOCK		0x5555
+#define IWDG_KR_START		0xCCCC
+
+/* RTC backup registers, kept over reset while Vrtc present */
+#define BKP_REG(n)		((&RTC->BKP0R)[(n)])
+#define SV_BKP_RECORD		BKP_REG(0)		/* magic | pending | task */
+#define SV_BKP_RESETS(task)	BKP_REG(1 + (task))	/* watchdog resets per task */
+#define SV_BKP_MAGIC		0x53560000		/* "SV" */
+#define SV_BKP_MAGIC_MASK	0xffff0000
+#define SV_BKP_PENDING		0x00000100
+#define SV_BKP_TASK_MASK	0x000000ff
+
+/* check-in deadlines [ms], longer than longest legal blocking in task loop */
+static const uint16_t m_deadline_ms[SV_NTASKS] = {
+	[SV_TASK_ADC] = 200,	/* 20 ms loop, SDADC calibration on gating change */
+	[SV_TASK_RPM] = 500,	/* 100 ms loop */
+	[SV_TASK_LOG] = 2000,	/* 100 ms tick, waits flash mutex (fw verify, param save) */
+	[SV_TASK_COMM0] = 2000,	/* 100 ms receive timeout, send timeouts, flash requests */
+	[SV_TASK_COMM1] = 2000,
+};
+
+struct sv_task_state {
+	bool active;
+	bool overdue;		//!< miss already counted for current interval
+	systime_t last_checkin;
+	systime_t worst_interval;
+	uint32_t misses;
+};
+
+static THD_WORKING_AREA(wa_sv, SV_WASZ);
+static struct sv_task_state m_tasks[SV_NTASKS];
+static int m_last_reset_task = -1;
+
+
+static inline void iwdg_reload(void)
+{
+	IWDG->KR = IWDG_KR_RELOAD;
+}
+
+/**
+ * Start IWDG, can't be stopped until reset.
+ * Counter frozen while core halted by debugger.
+ */
+static void iwdg_start(void)
+{
+	DBGMCU->APB1FZ |= DBGMCU_APB1_FZ_DBG_IWDG_STOP;
+
+	IWDG->KR = IWDG_KR_START;
+	IWDG->KR = IWDG_KR_UNLOCK;
+	IWDG->PR = IWDG_PR_PR_1 | IWDG_PR_PR_0;	/* LSI / 32 */
+	IWDG->RLR = LSI_FREQ_MAX / 32 * IWDG_TIMEOUT_MS / 1000 - 1;	/* 1874 < 4096 */
+	while (IWDG->SR & (IWDG_SR_PVU | IWDG_SR_RVU))
+		;
+
+	iwdg_reload();
+}
+
+/**
+ * Count watchdog reset of task recorded before reset.
+ * Backup domain access enabled by HAL init.
+ */
+static void sv_check_reset_cause(void)
+{
+	uint32_t rec = SV_BKP_RECORD;
+	uint32_t task = rec & SV_BKP_TASK_MASK;
+
+	if ((RCC->CSR & RCC_CSR_IWDGRSTF)
+			&& (rec & SV_BKP_MAGIC_MASK) == SV_BKP_MAGIC
+			&& (rec & SV_BKP_PENDING)
+			&& task < SV_NTASKS) {
+		SV_BKP_RESETS(task)++;
+		m_last_reset_task = task;
+	}
+
+	SV_BKP_RECORD = 0;
+	RCC->CSR |= RCC_CSR_RMVF;
+}
+
+/**
+ * Find overdue tasks, count each missed deadline once.
+ * @return most overdue task or -1
+ */
+static int sv_find_overdue(systime_t *overdue)
+{
+	int late = -1;
+
+	*overdue = 0;
+
+	chSysLock();
+	for (int i = 0; i < SV_NTASKS; i++) {
+		struct sv_task_state *t = &m_tasks[i];
+		systime_t deadline = MS2ST(m_deadline_ms[i]);
+		systime_t elapsed;
+
+		if (!t->active)
+			continue;
+
+		elapsed = chVTTimeElapsedSinceX(t->last_checkin);
+		if (elapsed <= deadline)
+			continue;
+
+		if (!t->overdue) {
+			t->overdue = true;
+			t->misses++;
+		}
+
+		if (late < 0 || elapsed - deadline > *overdue) {
+			late = i;
+			*overdue = elapsed - deadline;
+		}
+	}
+	chSysUnlock();
+
+	return late;
+}
+
+static THD_FUNCTION(th_sv, arg ATTR_UNUSED)
+{
+	int recorded = -1;
+
+	chRegSetThreadName("sv");
+
+	while (true) {
+		systime_t overdue;
+		int late;
+
+		chThdSleepMilliseconds(SV_PERIOD_MS);
+
+		late = sv_find_overdue(&overdue);
+		if (late < 0) {
+			if (recorded >= 0) {
+				SV_BKP_RECORD = 0;
+				recorded = -1;
+			}
+
+			iwdg_reload();
+			continue;
+		}
+
+		/* IWDG not fed: reset unless task recovers */
+		if (late != recorded) {
+			SV_BKP_RECORD = SV_BKP_MAGIC | SV_BKP_PENDING | late;
+			recorded = late;
+		}
+
+		if (overdue >= MS2ST(SV_HALT_MS)) {
+			/* full IWDG period (>= IWDG_TIMEOUT_MS) for halt hook */
+			bbox_trigger(BBOX_WATCHDOG, late);
+			iwdg_reload();
+			chSysHalt("watchdog");
+		}
+	}
+
+	return MSG_OK;
+}
+
+/* -*- public functions -*- */
+
+/**
+ * Start monitoring of task, call from task thread.
+ */
+void sv_register(enum sv_task task)
+{
+	osalDbgCheck(task < SV_NTASKS);
+
+	chSysLock();
+	m_tasks[task].last_checkin = osalOsGetSystemTimeX();
+	m_tasks[task].overdue = false;
+	m_tasks[task].active = true;
+	chSysUnlock();
+}
+
+/**
+ * Stop monitoring of task (thread exits).
+ */
+void sv_unregister(enum sv_task task)
+{
+	osalDbgCheck(task < SV_NTASKS);
+
+	chSysLock();
+	m_tasks[task].active = false;
+	chSysUnlock();
+}
+
+/**
+ * Task made progress.
+ * Late check-in counted as miss if supervisor not yet noticed it.
+ */
+void sv_checkin(enum sv_task task)
+{
+	struct sv_task_state *t = &m_tasks[task];
+	systime_t now = osalOsGetSystemTimeX();
+	systime_t interval;
+
+	chSysLock();
+	interval = now - t->last_checkin;
+	if (interval > t->worst_interval)
+		t->worst_interval = interval;
+
+	if (interval > MS2ST(m_deadline_ms[task]) && !t->overdue)
+		t->misses++;
+
+	t->overdue = false;
+	t->last_checkin = now;
+	chSysUnlock();
+}
+
+void sv_get_stats(enum sv_task task, struct sv_task_stats *st)
+{
+	struct sv_task_state *t = &m_tasks[task];
+
+	chSysLock();
+	st->active = t->active;
+	st->misses = t->misses;
+	st->worst_interval = ST2MS(t->worst_interval);
+	chSysUnlock();
+
+	st->deadline = m_deadline_ms[task];
+	st->watchdog_resets = SV_BKP_RESETS(task);
+	st->last_reset = m_last_reset_task == (int)task;
+}
+
+/**
+ * Clear miss counters and worst intervals.
+ * Watchdog reset counters kept.
+ */
+void sv_stats_reset(void)
+{
+	chSysLock();
+	for (int i = 0; i < SV_NTASKS; i++) {
+		m_tasks[i].misses = 0;
+		m_tasks[i].worst_interval = 0;
+	}
+	chSysUnlock();
+}
+
+void sv_init(void)
+{
+	sv_check_reset_cause();
+	iwdg_start();
+
+	chThdCreateStatic(wa_sv, sizeof(wa_sv), SV_PRIO, th_sv, NULL);
+}
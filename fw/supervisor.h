@@ -0,0 +1,55 @@
+/**
+ * @file       supervisor.h
+ * @brief      Task deadline supervisor
+ * @author     Vladimir Ermakov Copyright (C) 2014.
+ * @see        The GNU Public License (GPL) Version 3
+ */
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include "fw_common.h"
+
+/* NOTE same order as in miniecu.TaskStats.Task */
+enum sv_task {
+	SV_TASK_ADC = 0,
+	SV_TASK_RPM,
+	SV_TASK_LOG,
+	SV_TASK_COMM0,		//!< PBStx instance 0
+	SV_TASK_COMM1,		//!< PBStx instance 1
+	SV_NTASKS
+};
+
+struct sv_task_stats {
+	bool active;		//!< registered, deadline monitored
+	uint32_t deadline;	//!< [ms]
+	uint32_t misses;	//!< check-in intervals longer than deadline
+	uint32_t worst_interval;	//!< [ms]
+	uint32_t watchdog_resets;	//!< resets caused by this task (RTC backup domain)
+	bool last_reset;	//!< last watchdog reset caused by this task
+};
+
+/* subsystem functions */
+void sv_register(enum sv_task task);
+void sv_unregister(enum sv_task task);
+void sv_checkin(enum sv_task task);
+void sv_get_stats(enum sv_task task, struct sv_task_stats *st);
+void sv_stats_reset(void);
+void sv_init(void);
+
+#endif /* SUPERVISOR_H */
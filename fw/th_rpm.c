@@ -22,6 +22,10 @@
 
 #include "alert_led.h"
 #include "th_rpm.h"
+#include "engine_map.h"
+#include "supervisor.h"
+#include "log/blackbox.h"
+#include "adc/th_adc.h"
 #include "param.h"
 #include <string.h>
 
@@ -31,19 +35,27 @@
 
 /* -*- module settings -*- */
 int32_t gp_pulses_per_revolution;
-int32_t gp_rpm_limit;
 int32_t gp_rpm_min_idle;
+int32_t gp_rpm_cycle_revs;
+float gp_rpm_misfire_thr;
 
 /* -*- private data -*- */
 
 #define PERIODS_MAX		24
 #define UPDATE_TIMEOUT_US	2000000
+#define MISFIRE_HOLD_MS		2000
 
 static float m_curr_rpm;
 static uint32_t m_periods_us[PERIODS_MAX];
 static systime_t m_last_update;
 static uint32_t m_periods_cnt;
 static uint32_t m_periods_idx;
+static uint32_t m_rev_period_us;
+static uint32_t m_rev_pulses;
+static CombustionMonitor m_cmon;
+static rtcnt_t m_cmon_time_max;
+static uint32_t m_misfires_seen;
+static systime_t m_misfire_time;
 static THD_WORKING_AREA(wa_rpm, RPM_WASZ);
 
 static void period_handler(ICUDriver *icup);
@@ -62,14 +74,20 @@ static const ICUConfig tim2_cfg = {
 
 /* -*- public functions -*- */
 
-uint32_t rpm_get_filtered(void)
+/**
+ * Warn about crank geometry unsupported by combustion monitor
+ * (called from setting thread, RPM thread stack is too small to print)
+ */
+void on_change_rpm_cycle(const struct param_entry *p ATTR_UNUSED)
 {
-	return m_curr_rpm;
+	if (!cmonIsSupported(gp_pulses_per_revolution, gp_rpm_cycle_revs))
+		debug_printf(DP_WARN, "RPM: combustion cycle of %d pulses not supported",
+				gp_pulses_per_revolution * gp_rpm_cycle_revs);
 }
 
-bool rpm_check_limit(void)
+uint32_t rpm_get_filtered(void)
 {
-	return m_curr_rpm > gp_rpm_limit;
+	return m_curr_rpm;
 }
 
 bool rpm_is_engine_running(void)
@@ -78,6 +96,33 @@ bool rpm_is_engine_running(void)
 		&& m_curr_rpm > gp_rpm_min_idle;
 }
 
+/**
+ * Combustion stability and misfire counters
+ * @param pulse_time_ns  worst capture handler time (all per-pulse work)
+ * @return false if no cycle analysed yet
+ */
+bool rpm_get_combustion(CombustionStats *stats, uint32_t *pulse_time_ns)
+{
+	rtcnt_t time_max;
+
+	chSysLock();
+	*stats = m_cmon.stats;
+	time_max = m_cmon_time_max;
+	chSysUnlock();
+
+	*pulse_time_ns = time_max * 1000 / (STM32_HCLK / 1000000);
+	return stats->cycles > 0;
+}
+
+/**
+ * Misfire detected within MISFIRE_HOLD_MS
+ */
+bool rpm_is_misfiring(void)
+{
+	return m_misfires_seen > 0
+		&& chVTTimeElapsedSinceX(m_misfire_time) < MS2ST(MISFIRE_HOLD_MS);
+}
+
 /* -*- local -*- */
 
 static void empty_handler(ICUDriver *icup ATTR_UNUSED)
@@ -86,10 +131,32 @@ static void empty_handler(ICUDriver *icup ATTR_UNUSED)
 
 static void period_handler(ICUDriver *icup)
 {
+	/* whole handler must fit in 47 us (20000 RPM with 64 pulses) */
+	rtcnt_t t0 = chSysGetRealtimeCounterX();
+	/* counter reset by edge, so it holds time since edge */
+	rtcnt_t edge = t0 - icup->tim->CNT * (STM32_HCLK / 1000000);
+	uint32_t period = icuGetPeriodX(icup);
+	bool rev_start = false;
+
 	// store period in circular buffer
 	m_periods_cnt = (m_periods_cnt < PERIODS_MAX)? m_periods_cnt + 1 : PERIODS_MAX;
 	m_periods_idx = (m_periods_idx >= PERIODS_MAX)? 0 : m_periods_idx;
-	m_periods_us[m_periods_idx++] = icuGetPeriodX(icup);
+	m_periods_us[m_periods_idx++] = period;
+
+	// sum pulses of one revolution for black box
+	m_rev_period_us += period;
+	if (++m_rev_pulses >= (uint32_t)gp_pulses_per_revolution) {
+		bbox_record_revolution(m_rev_period_us);
+		m_rev_period_us = 0;
+		m_rev_pulses = 0;
+		rev_start = true;
+	}
+
+	crank_edge_isr(edge, period, rev_start);
+	cmonPulse(&m_cmon, period);
+	rtcnt_t dt = chSysGetRealtimeCounterX() - t0;
+	if (dt > m_cmon_time_max)
+		m_cmon_time_max = dt;
 
 	m_last_update = osalOsGetSystemTimeX();
 }
@@ -99,6 +166,10 @@ static void overflow_handler(ICUDriver *icup ATTR_UNUSED)
 	// clear buffer if overflow
 	m_periods_cnt = 0;
 	m_periods_idx = 0;
+	m_rev_period_us = 0;
+	m_rev_pulses = 0;
+	crank_reset_isr();
+	cmonReset(&m_cmon);
 }
 
 static uint32_t get_period_average(void)
@@ -111,6 +182,39 @@ static uint32_t get_period_average(void)
 	return acc / m_periods_cnt;
 }
 
+/**
+ * Apply crank geometry parameters to combustion monitor
+ */
+static void rpm_cmon_update(void)
+{
+	static int32_t ppr, revs;
+	static float thr;
+
+	if (ppr == gp_pulses_per_revolution && revs == gp_rpm_cycle_revs
+			&& thr == gp_rpm_misfire_thr)
+		return;
+
+	ppr = gp_pulses_per_revolution;
+	revs = gp_rpm_cycle_revs;
+	thr = gp_rpm_misfire_thr;
+
+	/* unsupported cycle reported by on_change_rpm_cycle(),
+	 * cmonSetup() disables analysis */
+	chSysLock();
+	cmonSetup(&m_cmon, ppr, revs, thr / 100.0f);
+	chSysUnlock();
+}
+
+static void rpm_misfire_update(void)
+{
+	uint32_t misfires = m_cmon.stats.misfires;
+
+	if (misfires != m_misfires_seen) {
+		m_misfires_seen = misfires;
+		m_misfire_time = osalOsGetSystemTimeX();
+	}
+}
+
 static THD_FUNCTION(th_rpm, arg ATTR_UNUSED)
 {
 	chRegSetThreadName("rpm");
@@ -118,6 +222,8 @@ static THD_FUNCTION(th_rpm, arg ATTR_UNUSED)
 	// setup initial values
 	m_periods_idx = 0;
 	m_periods_cnt = 0;
+	cmonObjectInit(&m_cmon);
+	rpm_cmon_update();
 
 	/* Start input capture
 	 *
@@ -130,9 +236,11 @@ static THD_FUNCTION(th_rpm, arg ATTR_UNUSED)
 	icuEnableNotifications(&ICUD2);
 
 	alert_component(ALS_RPM, AL_NORMAL);
+	sv_register(SV_TASK_RPM);
 	while (true) {
 		// Update rate: 10 Hz
 		chThdSleepMilliseconds(100);
+		sv_checkin(SV_TASK_RPM);
 
 		uint32_t period = get_period_average();
 		systime_t elapsed_time = chVTTimeElapsedSinceX(m_last_update);
@@ -144,6 +252,12 @@ static THD_FUNCTION(th_rpm, arg ATTR_UNUSED)
 			m_curr_rpm = 60.0f * 1e6 / (period * gp_pulses_per_revolution);
 		else
 			m_curr_rpm = 0.0f;
+
+		if (rpm_is_engine_running())
+			emap_update(m_curr_rpm);
+
+		rpm_cmon_update();
+		rpm_misfire_update();
 	}
 
 	return MSG_OK;
@@ -24,10 +24,12 @@
 #define TH_RPM_H
 
 #include "fw_common.h"
+#include "combustion.h"
 
 void rpm_init(void);
 uint32_t rpm_get_filtered(void);
-bool rpm_check_limit(void);
 bool rpm_is_engine_running(void);
+bool rpm_get_combustion(CombustionStats *stats, uint32_t *pulse_time_ns);
+bool rpm_is_misfiring(void);
 
 #endif /* TH_ADC_H */
@@ -8,15 +8,21 @@ import logging
 import threading
 from miniecu import PBStx, ReceiveError, msgs
 from miniecu.utils import wrap_logger, wrap_msg, make_ParamSet, make_Command, \
-    value_ParamType
+    make_ParamSetBatch, value_ParamType
 from models import ParamManager, StatusManager, StatusTextManager, CommandManger, \
     TimeRefManager
 
 log = logging.getLogger(__name__)
 
+RECEIVE_TIMEOUT = 0.5   # [s] terminate check
+
 
 class CommThread(threading.Thread):
-    def __init__(self, port, baud=57600, engine_id=1, log_db=None, log_name=None):
+    """
+    Receives messages from ECU port or from other PBStx-like source
+    (miniecu.playback.LogPlayer) and dispatches them to models.
+    """
+    def __init__(self, port=None, baud=57600, engine_id=1, log_db=None, log_name=None, source=None):
         super(CommThread, self).__init__(name="CommThread")
         self.daemon = True
         self.terminate = threading.Event()
@@ -30,7 +36,10 @@ class CommThread(threading.Thread):
         )
 
         self.engine_id = engine_id
-        self.pbstx = wrap_logger(PBStx(port, baud), log_db, log_name, "%s:%s" % (port, baud))
+        if source is not None:
+            self.pbstx = source
+        else:
+            self.pbstx = wrap_logger(PBStx(port, baud), log_db, log_name, "%s:%s" % (port, baud))
         self.start()
 
     def __del__(self):
@@ -42,8 +51,9 @@ class CommThread(threading.Thread):
     def run(self):
         while not self.terminate.is_set():
             try:
-                m = self.pbstx.receive()
-                self.dispatch_message(m)
+                m = self.pbstx.receive(RECEIVE_TIMEOUT)
+                if m is not None:
+                    self.dispatch_message(m)
             except ReceiveError as ex:
                 log.error(repr(ex))
 
@@ -78,6 +88,10 @@ class CommThread(threading.Thread):
     def param_set(self, param_id, value):
         self.pbstx.send(make_ParamSet(self.engine_id, param_id, value))
 
+    def param_set_batch(self, items):
+        for m in make_ParamSetBatch(self.engine_id, items):
+            self.pbstx.send(m)
+
     def param_request(self, param_id=None, param_index=None):
         pr = msgs.ParamRequest(engine_id=self.engine_id)
         if param_id:    pr.param_id = param_id
@@ -118,8 +118,7 @@ class ParamManager(object):
 
         self.missing_ids = set((p.param_index for p in to_sync))
         self._event.clear()
-        for p in to_sync:
-            CommManager().param_set(p.param_id, p.value)
+        CommManager().param_set_batch([(p.param_id, p.value) for p in to_sync])
 
         self._event.wait(10.0)
         if len(self.missing_ids):
@@ -8,11 +8,13 @@ from ui.builder import get_builder
 from ui.conn_dlg import ConnDialog
 from ui.param_item import ParamBoxRow
 from ui.gauge_meter import GtkGauge
+from ui.playback import PlaybackDialog, PlaybackBar
 from ui.status_utils import pb_to_kv_pairs, status_str
 
 from models import CommManager, ParamManager, StatusManager, StatusTextManager, \
     CommandManger, TimeRefManager
 from comm import msgs, CommThread
+from miniecu.playback import LogPlayer
 
 
 class CCGuiApplication(object):
@@ -84,6 +86,11 @@ class CCGuiApplication(object):
         self.status_bar = builder.get_object('status_bar')
         self.ignition_switch = builder.get_object('ignition_switch')
         self.starter_switch = builder.get_object('starter_switch')
+        self.playback_box = builder.get_object('playback_box')
+
+        # log playback
+        self.player = None
+        self.playback_bar = None
 
         # param widgets
         self.param_rows = {}
@@ -104,13 +111,25 @@ class CCGuiApplication(object):
             args = dialog.get_result_destroy()
             self.create_comm(*args)
 
+    def on_playback_activate(self, *args):
+        logging.debug("onPlayback")
+        dialog = PlaybackDialog(self.window)
+        if dialog.run() == Gtk.ResponseType.OK:
+            log_db, log_id = dialog.get_result_destroy()
+            if log_id is not None:
+                self.create_playback(log_db, log_id)
+        else:
+            dialog.get_result_destroy()
+
     def on_disconnect_activate(self, *args):
         logging.debug("onDisConnect")
+        self.clear_playback()
         CommManager().clear()
         logging.info("DEV: closed")
 
     def create_comm(self, port, baudrate, engine_id, log_db, log_name):
         try:
+            self.clear_playback()
             CommManager().clear()
             CommManager().register(CommThread(port, baudrate, engine_id, log_db, log_name))
             logging.info("DEV: %s: opened", port)
@@ -119,6 +138,34 @@ class CCGuiApplication(object):
         except serial.SerialException as ex:
             logging.error("DEV: %s: %s", port, repr(ex))
 
+    def create_playback(self, log_db, log_id):
+        try:
+            self.clear_playback()
+            CommManager().clear()
+            self.player = LogPlayer(log_db, log_id)
+        except Exception as ex:
+            logging.error("LOG: %s: %d: %s", log_db, log_id, repr(ex))
+            return
+
+        # recorded messages only: ECU is not there to answer requests
+        CommManager().register(CommThread(source=self.player))
+        logging.info("LOG: %s: %d: playback", log_db, log_id)
+
+        self.playback_bar = PlaybackBar(self.player)
+        self.playback_box.pack_start(self.playback_bar, True, True, 0)
+        self.playback_bar.show_all()
+        self.playback_box.show()
+
+    def clear_playback(self):
+        if self.player is None:
+            return
+
+        self.player.stop()
+        self.player = None
+        self.playback_bar.destroy()
+        self.playback_bar = None
+        self.playback_box.hide()
+
     def on_param_request_clicked(self, *args):
         logging.debug("onParamRequest")
 
@@ -0,0 +1,145 @@
+# -*- python -*-
+
+import logging
+from os import path
+from gi.repository import Gtk, GObject
+from miniecu.playback import list_logs, SPEED_MIN, SPEED_MAX
+
+log = logging.getLogger(__name__)
+
+UPDATE_MS = 200
+
+
+def time_str(t):
+    t = int(t)
+    return "%d:%02d:%02d" % (t // 3600, t // 60 % 60, t % 60)
+
+
+class PlaybackDialog(object):
+    """Select recorded log: database file and log in it"""
+    def __init__(self, parent=None):
+        self.dialog = Gtk.Dialog("Playback", parent, 0,
+                                 (Gtk.STOCK_CANCEL, Gtk.ResponseType.CANCEL,
+                                  Gtk.STOCK_OK, Gtk.ResponseType.OK))
+        self.dialog.set_default_size(480, -1)
+
+        grid = Gtk.Grid(column_spacing=10, row_spacing=6, border_width=10)
+        self.dialog.get_content_area().add(grid)
+
+        db_filter = Gtk.FileFilter()
+        db_filter.set_name("SQLite log")
+        db_filter.add_pattern("*.dblog")
+        db_filter.add_pattern("*.db")
+        db_filter.add_pattern("*.sqlite")
+
+        self.db_file = Gtk.FileChooserButton(title="Log database")
+        self.db_file.add_filter(db_filter)
+        self.db_file.connect('file-set', self.on_db_file_set)
+
+        self.log_store = Gtk.ListStore(int, str)
+        self.log_combo = Gtk.ComboBox.new_with_model(self.log_store)
+        text_renderer = Gtk.CellRendererText()
+        self.log_combo.pack_start(text_renderer, True)
+        self.log_combo.add_attribute(text_renderer, 'text', 1)
+        self.log_combo.set_hexpand(True)
+
+        grid.attach(Gtk.Label("Database:", halign=Gtk.Align.END), 0, 0, 1, 1)
+        grid.attach(self.db_file, 1, 0, 1, 1)
+        grid.attach(Gtk.Label("Log:", halign=Gtk.Align.END), 0, 1, 1, 1)
+        grid.attach(self.log_combo, 1, 1, 1, 1)
+
+    def on_db_file_set(self, *args):
+        self.log_store.clear()
+        try:
+            for log_id, name, start_date, count in list_logs(self.log_db):
+                self.log_store.append([log_id, "#%d %s  %s  (%d msgs)" % (
+                    log_id, start_date, name or '', count)])
+        except Exception as ex:
+            log.error("LOG: %s: %s", self.log_db, repr(ex))
+            return
+
+        # most recent session
+        if len(self.log_store):
+            self.log_combo.set_active(len(self.log_store) - 1)
+
+    @property
+    def log_db(self):
+        return 'sqlite:///' + path.abspath(self.db_file.get_filename())
+
+    def run(self):
+        self.dialog.show_all()
+        return self.dialog.run()
+
+    def get_result_destroy(self):
+        log_db = None
+        log_id = None
+        it = self.log_combo.get_active_iter()
+        if it is not None and self.db_file.get_filename():
+            log_db = self.log_db
+            log_id = self.log_store[it][0]
+
+        self.dialog.destroy()
+        return (log_db, log_id)
+
+
+class PlaybackBar(Gtk.Box):
+    """Play/pause, position slider and speed of LogPlayer"""
+    def __init__(self, player):
+        Gtk.Box.__init__(self, orientation=Gtk.Orientation.HORIZONTAL, spacing=10)
+        self.player = player
+        self._updating = False
+
+        self.play_button = Gtk.ToggleButton(label="Pause")
+        self.play_button.set_active(True)
+        self.play_button.connect('toggled', self.on_play_toggled)
+
+        adj = Gtk.Adjustment(0, 0, max(player.duration, 1.0), 1, 60, 0)
+        self.position_scale = Gtk.Scale(orientation=Gtk.Orientation.HORIZONTAL, adjustment=adj)
+        self.position_scale.set_draw_value(False)
+        self.position_scale.set_hexpand(True)
+        self.position_scale.connect('value-changed', self.on_position_changed)
+
+        self.time_label = Gtk.Label()
+
+        speed_adj = Gtk.Adjustment(player.speed, SPEED_MIN, SPEED_MAX, 1, 10, 0)
+        self.speed_spin = Gtk.SpinButton(adjustment=speed_adj)
+        self.speed_spin.connect('value-changed', self.on_speed_changed)
+
+        self.pack_start(self.play_button, False, False, 0)
+        self.pack_start(self.position_scale, True, True, 0)
+        self.pack_start(self.time_label, False, False, 0)
+        self.pack_start(Gtk.Label("Speed x"), False, False, 0)
+        self.pack_start(self.speed_spin, False, False, 0)
+
+        self.update()
+        self._timer_id = GObject.timeout_add(UPDATE_MS, self.update)
+
+    def destroy(self):
+        GObject.source_remove(self._timer_id)
+        Gtk.Box.destroy(self)
+
+    def update(self):
+        pos = self.player.position
+        self._updating = True
+        self.position_scale.set_value(pos)
+        self._updating = False
+
+        self.time_label.set_text("%s / %s" % (time_str(pos), time_str(self.player.duration)))
+        if self.player.finished and self.play_button.get_active():
+            self.play_button.set_active(False)
+        return True
+
+    def on_play_toggled(self, button):
+        if button.get_active():
+            self.player.play()
+            button.set_label("Pause")
+        else:
+            self.player.pause()
+            button.set_label("Play")
+
+    def on_position_changed(self, scale):
+        if not self._updating:
+            self.player.seek(scale.get_value())
+
+    def on_speed_changed(self, spin):
+        self.player.speed = spin.get_value()
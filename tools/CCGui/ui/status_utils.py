@@ -28,6 +28,7 @@ def _status(val):
         (msgs.Status.OVERHEAT, 'OVERHEAT'),
         (msgs.Status.LOW_FUEL, 'LOW-FUEL'),
         (msgs.Status.HIGH_RPM, 'HIGH-RPM'),
+        (msgs.Status.MISFIRE, 'MISFIRE'),
     ):
         if val & flag:
             flags.append(name)
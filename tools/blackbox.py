@@ -0,0 +1,103 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Decode black box incidents from error partition dump
+
+Dump partition with memdump.py:
+    memdump.py /dev/ttyACM0 -t 1 -a 0x4000 -s 0x10000 > error.bin
+"""
+
+from __future__ import print_function
+
+import sys
+import struct
+import argparse
+from miniecu import msgs
+from miniecu.xmodem_crc16 import xmodem_crc16
+
+SLOT_SIZE = 8192
+MAGIC = 0x584f4242
+HEADER = struct.Struct('<IIBBHHHHHIQHH')
+SAMPLE = struct.Struct('<IHHhhhHHH')
+TICK_S = 0.0001
+
+REASONS = ['NONE', 'ALERT', 'EMERGENCY_STOP', 'ALARM', 'HALT', 'WATCHDOG']
+ALERT_SOURCES = ['COMM', 'ADC', 'RTC', 'RPM', 'FLASH']
+ALERT_STATES = ['I', 'F', 'N']
+SAMPLES = 256
+REVS = 256
+
+
+def flags_str(flags):
+    names = [name for name, v in msgs.Status.Flags.items() if v and flags & v]
+    return '|'.join(names)
+
+
+def alerts_str(alerts):
+    return ''.join(ALERT_STATES[(alerts >> (i * 2)) & 3] for i in range(len(ALERT_SOURCES)))
+
+
+def ring(data, head, count, size):
+    for i in range(count):
+        yield data[(head + i) % size]
+
+
+def decode_slot(buf, slot, fd=sys.stdout):
+    (magic, seq, reason, detail, sample_size, sample_head, nr_samples,
+     rev_head, nr_revs, systime, timestamp_ms, crc, _) = HEADER.unpack_from(buf)
+
+    if magic != MAGIC:
+        return None
+
+    body = buf[HEADER.size:HEADER.size + sample_size * SAMPLES + 4 * REVS]
+    crc_ok = xmodem_crc16(body) == crc
+
+    reason_s = REASONS[reason] if reason < len(REASONS) else str(reason)
+    if reason == 1 and detail < len(ALERT_SOURCES):
+        reason_s += ' ' + ALERT_SOURCES[detail]
+    elif reason == 5 and detail in msgs.TaskStats.Task.values():
+        reason_s += ' ' + msgs.TaskStats.Task.Name(detail)
+
+    print("# incident #%d slot %d: %s at %.2f s, timestamp %d%s" % (
+        seq, slot, reason_s, systime * TICK_S, timestamp_ms,
+        '' if crc_ok else ' (CRC ERROR)'), file=fd)
+
+    samples = [SAMPLE.unpack_from(body, i * sample_size) for i in range(SAMPLES)]
+    print("t[s]\trpm\tvbat[V]\ttemp[C]\toilt[C]\tcpu[C]\tfuel[mL]\talerts\tflags", file=fd)
+    for st, rpm, vbat, temp, oilt, cput, flags, alerts, fuel in ring(samples, sample_head, nr_samples, SAMPLES):
+        print("%.3f\t%d\t%.3f\t%.1f\t%s\t%.1f\t%d\t%s\t%s" % (
+            (st - systime) * TICK_S, rpm, vbat / 1000.0, temp / 10.0,
+            '-' if oilt == -32768 else '%.1f' % (oilt / 10.0),
+            cput / 10.0, fuel, alerts_str(alerts), flags_str(flags)), file=fd)
+
+    revs = struct.unpack_from('<%dI' % REVS, body, sample_size * SAMPLES)
+    print("# revolution periods [us], oldest first", file=fd)
+    print(' '.join(str(p) for p in ring(revs, rev_head, nr_revs, REVS)), file=fd)
+    print(file=fd)
+
+    return seq
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("dump", help="error partition dump", type=argparse.FileType('rb'))
+    args = parser.parse_args()
+
+    data = args.dump.read()
+    found = []
+    for slot in range(len(data) // SLOT_SIZE):
+        buf = data[slot * SLOT_SIZE:(slot + 1) * SLOT_SIZE]
+        if len(buf) >= HEADER.size and HEADER.unpack_from(buf)[0] == MAGIC:
+            found.append((HEADER.unpack_from(buf)[1], slot, buf))
+
+    for seq, slot, buf in sorted(found):
+        decode_slot(buf, slot)
+
+    if not found:
+        print("no incidents", file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,194 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Crank-synchronous sampling test of fw/lib/crankbins.c
+
+Builds the binning code with host C compiler as shared library and feeds
+it synthetic pulse edges and fixed rate ADC samples, the same way
+fw/adc/adc_crank.c does from capture and SDADC ISRs (72 MHz time stamps).
+Compares angle domain arrays and cycle averages with the generated waveform.
+"""
+
+from __future__ import print_function, division
+
+import sys
+import math
+import ctypes
+import random
+import argparse
+from hostbuild import add_build_args, build
+
+CRANK_BINS = 24     # crankbins.h
+TICK_HZ = 72e6      # STM32_HCLK, realtime counter
+
+
+class CrankPosition(ctypes.Structure):
+    # note: same layout as CrankPosition in crankbins.h
+    _fields_ = [
+        ('edge', ctypes.c_uint32),
+        ('period', ctypes.c_uint32),
+        ('pulse', ctypes.c_uint32),
+        ('synced', ctypes.c_bool),
+    ]
+
+
+class CrankBins(ctypes.Structure):
+    # note: same layout as CrankBins in crankbins.h
+    _fields_ = [
+        ('sum', ctypes.c_float * CRANK_BINS),
+        ('cnt', ctypes.c_uint16 * CRANK_BINS),
+    ]
+
+
+def build_cbin(args):
+    lib = build(args, 'cbin', ['lib/crankbins.c'], ['lib'])
+    lib.cbinEdge.restype = ctypes.c_bool
+    lib.cbinEdge.argtypes = [ctypes.POINTER(CrankPosition), ctypes.c_uint32, ctypes.c_uint32, ctypes.c_bool]
+    lib.cbinIndex.restype = ctypes.c_int
+    lib.cbinIndex.argtypes = [ctypes.POINTER(CrankPosition), ctypes.c_uint32, ctypes.c_uint32]
+    lib.cbinAdd.argtypes = [ctypes.POINTER(CrankBins), ctypes.c_int, ctypes.c_float]
+    lib.cbinFinish.restype = ctypes.c_float
+    lib.cbinFinish.argtypes = [ctypes.POINTER(CrankBins), ctypes.POINTER(ctypes.c_float * CRANK_BINS)]
+    return lib
+
+
+def ticks(t):
+    return int(round(t * TICK_HZ)) & 0xffffffff
+
+
+class CrankSampler(object):
+    """Single channel of adc_crank.c calling the compiled library"""
+
+    def __init__(self, lib, ppr):
+        self.lib = lib
+        self.ppr = ppr
+        self.pos = CrankPosition()
+        self.acc = CrankBins()
+        self.revs = []      # (bins, cycle average)
+        lib.cbinPositionReset(ctypes.byref(self.pos))
+        lib.cbinClear(ctypes.byref(self.acc))
+
+    def edge_isr(self, t, period, rev_start):
+        if self.lib.cbinEdge(ctypes.byref(self.pos), ticks(t), ticks(period), rev_start):
+            out = (ctypes.c_float * CRANK_BINS)()
+            avg = self.lib.cbinFinish(ctypes.byref(self.acc), ctypes.byref(out))
+            self.revs.append((list(out), avg))
+        elif rev_start:
+            self.lib.cbinClear(ctypes.byref(self.acc))
+
+    def sample_isr(self, value, t):
+        bin = self.lib.cbinIndex(ctypes.byref(self.pos), ticks(t), self.ppr)
+        self.lib.cbinAdd(ctypes.byref(self.acc), bin, value)
+
+
+def crank_angle(t, rpm0, rpm_slope):
+    """Crank angle [rev] at time t, linear RPM ramp"""
+    return (rpm0 * t + rpm_slope * t * t / 2) / 60.0
+
+
+def waveform(angle, harmonic, amplitude, offset):
+    """Signal periodic with crank rotation"""
+    return offset + amplitude * math.sin(2 * math.pi * harmonic * angle)
+
+
+def simulate(lib, args):
+    sampler = CrankSampler(lib, args.ppr)
+    events = []
+
+    # pulse generator: edges at angle k / ppr (solve ramp for time)
+    t_end = args.duration
+    k = 1
+    prev = 0.0
+    while True:
+        a = k / args.ppr
+        if args.rpm_slope:
+            v = args.rpm / 60.0
+            acc = args.rpm_slope / 60.0
+            t = (-v + math.sqrt(v * v + 2 * acc * a)) / acc
+        else:
+            t = a * 60.0 / args.rpm
+
+        if t > t_end:
+            break
+
+        events.append((t, 0, t - prev, k % args.ppr == 0))
+        prev = t
+        k += 1
+
+    # waveform generator: fixed rate ADC, sample at trigger time
+    rnd = random.Random(1)
+    n = int(t_end * args.rate)
+    for i in range(n):
+        t = i / args.rate
+        angle = crank_angle(t, args.rpm, args.rpm_slope)
+        v = waveform(angle, args.harmonic, args.amplitude, args.offset)
+        v += rnd.uniform(-args.noise, args.noise)
+        events.append((t, 1, v, None))
+
+    # ISR order: edge first if same time
+    for ev in sorted(events, key=lambda e: (e[0], e[1])):
+        if ev[1] == 0:
+            sampler.edge_isr(ev[0], ev[2], ev[3])
+        else:
+            sampler.sample_isr(ev[2], ev[0])
+
+    return sampler
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("--rpm", help="start RPM", type=float, default=3000.0)
+    parser.add_argument("--rpm-slope", help="RPM change [RPM/s]", type=float, default=0.0)
+    parser.add_argument("--ppr", help="RPM_NPULSES", type=int, default=1)
+    parser.add_argument("--rate", help="ADC_RATE [Hz]", type=float, default=4000.0)
+    parser.add_argument("--harmonic", help="waveform periods per revolution", type=float, default=2.0)
+    parser.add_argument("--amplitude", help="waveform amplitude [V]", type=float, default=0.5)
+    parser.add_argument("--offset", help="waveform mean [V]", type=float, default=1.5)
+    parser.add_argument("--noise", help="added noise amplitude [V]", type=float, default=0.0)
+    parser.add_argument("-t", "--duration", help="simulated time [s]", type=float, default=1.0)
+    parser.add_argument("-b", "--bins", help="print bins of last revolution", action='store_true')
+    add_build_args(parser)
+    args = parser.parse_args()
+
+    sampler = simulate(build_cbin(args), args)
+    if not sampler.revs:
+        print("no complete revolution")
+        sys.exit(1)
+
+    # expected bin value: waveform mean over bin angle span
+    expect = []
+    for i in range(CRANK_BINS):
+        a0 = i / CRANK_BINS
+        pts = [waveform(a0 + j / (CRANK_BINS * 16.0), args.harmonic, args.amplitude, args.offset)
+               for j in range(16)]
+        expect.append(sum(pts) / len(pts))
+
+    bin_err = max(abs(b - e) for bins, avg in sampler.revs for b, e in zip(bins, expect))
+    avg_err = max(abs(avg - args.offset) for bins, avg in sampler.revs)
+
+    # fixed rate block average over same time, for comparison
+    block = max(1, int(args.rate * 60.0 / args.rpm))
+    fixed = []
+    for s in range(0, int(args.duration * args.rate) - block, block):
+        vals = [waveform(crank_angle(i / args.rate, args.rpm, args.rpm_slope),
+                         args.harmonic, args.amplitude, args.offset) for i in range(s, s + block)]
+        fixed.append(sum(vals) / block)
+    fixed_err = max(abs(v - args.offset) for v in fixed) if fixed else float('nan')
+
+    print("revolutions: %d, samples per revolution: %.1f" % (
+        len(sampler.revs), args.rate * 60.0 / args.rpm))
+    print("max bin error: %.4f V" % bin_err)
+    print("max cycle average error: %.4f V" % avg_err)
+    print("max fixed block average error: %.4f V" % fixed_err)
+
+    if args.bins:
+        print()
+        print("bin\tangle\tvalue\texpected")
+        for i, (v, e) in enumerate(zip(sampler.revs[-1][0], expect)):
+            print("%d\t%.0f\t%.4f\t%.4f" % (i, i * 360.0 / CRANK_BINS, v, e))
+
+
+if __name__ == '__main__':
+    main()
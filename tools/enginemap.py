@@ -0,0 +1,111 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Download engine operating map (time in RPM x temperature/battery bands)
+"""
+
+from __future__ import print_function
+
+import sys
+import argparse
+from miniecu import msgs, PBStx, ReceiveError
+from miniecu.utils import wrap_msg, wrap_logger
+
+EMT = msgs.EngineMap
+
+COLUMN_FMT = {
+    EMT.RPM_TEMPERATURE: ("°C", 1000.0),
+    EMT.RPM_BATTERY: ("V", 1000.0),
+}
+
+
+class EngineMapTable(object):
+    def __init__(self, msg):
+        self.type = msg.type
+        self.rpm_step = msg.rpm_step
+        self.col_min = msg.col_min
+        self.col_step = msg.col_step
+        self.rows = msg.rows
+        self.cols = msg.cols
+        self.counts = [None] * (self.rows * self.cols)
+
+    def update(self, msg):
+        start = msg.row_offset * self.cols
+        self.counts[start:start + len(msg.counts)] = msg.counts
+
+    @property
+    def complete(self):
+        return None not in self.counts
+
+    def dump(self, fd=sys.stdout):
+        unit, scale = COLUMN_FMT[self.type]
+        print("# %s, time in hours" % EMT.Type.Name(self.type), file=fd)
+
+        hdr = ["RPM \\ %s" % unit]
+        for c in range(self.cols):
+            # first and last bins also count out of range values
+            if c == 0:
+                hdr.append("<%g" % ((self.col_min + self.col_step) / scale))
+            else:
+                hdr.append(">=%g" % ((self.col_min + c * self.col_step) / scale))
+        print("\t".join(hdr), file=fd)
+
+        for r in range(self.rows):
+            row = self.counts[r * self.cols:(r + 1) * self.cols]
+            line = [">=%d" % (r * self.rpm_step)]
+            line.extend("%.2f" % (v / 36000.0) for v in row)
+            print("\t".join(line), file=fd)
+
+        print(file=fd)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("device", help="com port device file")
+    parser.add_argument("baudrate", help="com port baudrate", type=int, nargs='?', default=57600)
+    parser.add_argument("-i", "--id", help="engine id", type=int, default=1)
+    parser.add_argument("--reset", help="clear maps on ECU", action='store_true')
+    parser.add_argument("-v", "--verbose", help="verbose io print", action='store_true')
+    parser.add_argument("-l", "--log-db", help="logging to sql db")
+    parser.add_argument("-n", "--log-name", help="log name")
+
+    args = parser.parse_args()
+
+    pbstx = PBStx(args.device, args.baudrate)
+    pbstx = wrap_logger(pbstx, args.log_db, args.log_name, "%s @ %s" % (args.device, args.baudrate))
+
+    req = msgs.EngineMapRequest(engine_id=args.id)
+    if args.reset:
+        req.reset = True
+        pbstx.send(wrap_msg(req))
+        return
+
+    pbstx.send(wrap_msg(req))
+
+    tables = {}
+    while len(tables) < len(COLUMN_FMT) or not all(t.complete for t in tables.values()):
+        try:
+            m = pbstx.receive(5.0)
+            if m is None:
+                print("timeout", file=sys.stderr)
+                sys.exit(1)
+
+            if m.HasField('engine_map') and m.engine_map.engine_id == args.id:
+                em = m.engine_map
+                if em.type not in tables:
+                    tables[em.type] = EngineMapTable(em)
+
+                tables[em.type].update(em)
+            elif m.HasField('status_text') or args.verbose:
+                print(m, file=sys.stderr)
+        except ReceiveError as ex:
+            print(repr(ex), file=sys.stderr)
+
+    for k in sorted(tables.keys()):
+        tables[k].dump()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,120 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Download external flash I/O statistics and sector erase counts
+"""
+
+from __future__ import print_function, division
+
+import sys
+import argparse
+from miniecu import msgs, PBStx, ReceiveError
+from miniecu.utils import wrap_msg, wrap_logger
+
+FS = msgs.FlashStats
+
+# latency_hist bin upper bounds [0.1 ms], last bin: above
+HIST_BOUNDS = (1, 2, 5, 10, 20, 50, 100, 200, 500, 1000)
+NR_STATS = len(FS.Partition.keys()) * len(FS.Operation.keys())
+
+
+def hist_header():
+    hdr = ["<%g" % (b / 10.0) for b in HIST_BOUNDS]
+    hdr.append(">=%g" % (HIST_BOUNDS[-1] / 10.0))
+    return hdr
+
+
+def dump_stats(stats, fd=sys.stdout):
+    print("# connect failures: %d" % stats[0].connect_failures, file=fd)
+    print("\t".join(["partition", "op", "count", "errors", "KiB",
+                     "mean ms", "max ms"] + hist_header()), file=fd)
+
+    for st in stats:
+        mean = st.time_total / 10.0 / st.count if st.count else 0.0
+        line = [FS.Partition.Name(st.partition), FS.Operation.Name(st.operation),
+                str(st.count), str(st.errors), "%.1f" % (st.bytes / 1024.0),
+                "%.2f" % mean, "%.1f" % (st.time_max / 10.0)]
+        line.extend(str(v) for v in st.latency_hist)
+        print("\t".join(line), file=fd)
+
+    print(file=fd)
+
+
+def dump_erases(stats, counts, fd=sys.stdout):
+    print("# sector erases (total, kept in stats partition)", file=fd)
+    print("partition\tsectors\ttotal\tmin\tmax", file=fd)
+
+    for st in stats:
+        if st.operation != FS.ERASE or st.partition == FS.CHIP:
+            continue
+
+        part = counts[st.first_sector:st.first_sector + st.nr_sectors]
+        if not part:
+            continue
+
+        print("%s\t%d-%d\t%d\t%d\t%d" % (
+            FS.Partition.Name(st.partition), st.first_sector, st.first_sector + len(part) - 1,
+            sum(part), min(part), max(part)), file=fd)
+
+    print(file=fd)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("device", help="com port device file")
+    parser.add_argument("baudrate", help="com port baudrate", type=int, nargs='?', default=57600)
+    parser.add_argument("-i", "--id", help="engine id", type=int, default=1)
+    parser.add_argument("--reset", help="clear operation statistics on ECU", action='store_true')
+    parser.add_argument("-s", "--sectors", help="print erase count of each sector", action='store_true')
+    parser.add_argument("-v", "--verbose", help="verbose io print", action='store_true')
+    parser.add_argument("-l", "--log-db", help="logging to sql db")
+    parser.add_argument("-n", "--log-name", help="log name")
+
+    args = parser.parse_args()
+
+    pbstx = PBStx(args.device, args.baudrate)
+    pbstx = wrap_logger(pbstx, args.log_db, args.log_name, "%s @ %s" % (args.device, args.baudrate))
+
+    req = msgs.FlashStatsRequest(engine_id=args.id)
+    if args.reset:
+        req.reset = True
+        pbstx.send(wrap_msg(req))
+        return
+
+    pbstx.send(wrap_msg(req))
+
+    stats = []
+    counts = None
+    while counts is None or None in counts:
+        try:
+            m = pbstx.receive(5.0)
+            if m is None:
+                print("timeout", file=sys.stderr)
+                sys.exit(1)
+
+            if m.HasField('flash_stats') and m.flash_stats.engine_id == args.id:
+                stats.append(m.flash_stats)
+                if len(stats) == NR_STATS:
+                    chip = [st for st in stats if st.partition == FS.CHIP][0]
+                    counts = [None] * chip.nr_sectors
+            elif m.HasField('flash_sector_erases') and m.flash_sector_erases.engine_id == args.id:
+                se = m.flash_sector_erases
+                counts[se.sector_offset:se.sector_offset + len(se.counts)] = se.counts
+            elif m.HasField('status_text') or args.verbose:
+                print(m, file=sys.stderr)
+        except ReceiveError as ex:
+            print(repr(ex), file=sys.stderr)
+
+    dump_stats(stats)
+    dump_erases(stats, counts)
+
+    if args.sectors:
+        print("sector\terases")
+        for i, c in enumerate(counts):
+            print("%d\t%d" % (i, c))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,325 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+PBStx frame costs: receive of foreign traffic (v0 vs v1), send (buffered vs streamed)
+
+Builds fw/comm/pbstx.c with host C compiler against a memory channel
+stub, feeds it one channel second of traffic from N ECUs and the host
+(Status of each ECU, requests to each ECU) and measures the work ECU #1
+spends per second: pbstxReceive() plus, for accepted frames, a protobuf
+wire walk standing for nanopb decode (ext/nanopb is a submodule).
+
+v0: every frame is CRC checked and decoded before engine_id is known.
+v1: frames of other ECUs are dropped after the header.
+
+Send: encoder output (nanopb writes, one per field) either copied to
+payload buffer then pbstxSend() (CRC pass, copy to output queue), or
+streamed by pbstxSendBegin/Write/End() to output queue with CRC on the
+way. Both must give the same bytes.
+"""
+
+from __future__ import print_function, division
+
+import time
+import ctypes
+import random
+import struct
+import argparse
+from hostbuild import add_build_args, build
+
+STX = 0xae
+HDR_ADDR = 0x8000
+HDR_UPLINK = 0x4000
+
+STATUS_BYTES = 72       # typical miniecu.Status with fuel and combustion
+REQUEST_BYTES = 12      # ParamRequest, Command, TimeReference
+REPEAT = 20
+TX_REPEAT = 200000
+PBSTX_FRAME_MAX = 1 + 5 + 256 + 2
+
+STUB_FW_COMMON = r'''
+#ifndef FW_COMMON_H
+#define FW_COMMON_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+typedef int32_t msg_t;
+typedef uint32_t systime_t;
+typedef struct { int dummy; } mutex_t;
+typedef struct { const uint8_t *p, *end; uint8_t *out; size_t out_len; } BaseChannel;
+#define MSG_OK		0
+#define MSG_TIMEOUT	-1
+#define MSG_RESET	-2
+#define MS2ST(ms)	(ms)
+#define osalDbgCheck(c)		(void)(c)
+#define osalDbgAssert(c, r)	(void)(c)
+#define osalMutexObjectInit(m)	(void)(m)
+#define chMtxLock(m)		(void)(m)
+#define chMtxUnlock(m)		(void)(m)
+#define chThdShouldTerminateX()	false
+static inline msg_t chnGetTimeout(BaseChannel *c, systime_t t)
+{
+	return (c->p < c->end) ? *c->p++ : MSG_TIMEOUT;
+}
+static inline msg_t chnReadTimeout(BaseChannel *c, uint8_t *b, size_t n, systime_t t)
+{
+	if ((size_t)(c->end - c->p) < n)
+		return MSG_TIMEOUT;
+	memcpy(b, c->p, n);
+	c->p += n;
+	return n;
+}
+/* byte by byte, like oqWriteTimeout() */
+static inline msg_t chnWriteTimeout(BaseChannel *c, const uint8_t *b, size_t n, systime_t t)
+{
+	if (c->out != NULL)
+		for (size_t i = 0; i < n; i++)
+			c->out[c->out_len++] = b[i];
+	return n;
+}
+#endif
+'''
+
+STUB_ALERT = r'''
+#define alert_component(c, s)	do {} while (0)
+'''
+
+BENCH_SRC = r'''
+#include "pbstx.h"
+
+/* stands for pbstxDecodeType() + pb_decode(): walk all keys and varints */
+static uint32_t wire_walk(const uint8_t *p, const uint8_t *end)
+{
+	uint32_t acc = 0;
+
+	while (p < end) {
+		uint32_t v = 0;
+		for (int shift = 0; p < end && shift < 35; shift += 7) {
+			uint8_t b = *p++;
+			v |= (uint32_t)(b & 0x7f) << shift;
+			if (!(b & 0x80))
+				break;
+		}
+		acc += v;
+	}
+	return acc;
+}
+
+size_t bench(const uint8_t *buf, size_t len, int32_t rx_engine_id, int repeat, uint32_t *sink)
+{
+	static PBStxDev dev;
+	static pbstx_message_t msg;
+	BaseChannel chn;
+	size_t accepted = 0;
+
+	for (int r = 0; r < repeat; r++) {
+		chn.p = buf;
+		chn.end = buf + len;
+		pbstxObjectInit(&dev, &chn);
+		dev.rx_engine_id = rx_engine_id;
+
+		while (chn.p < chn.end) {
+			msg_t ret = pbstxReceive(&dev, &msg);
+			if (ret == MSG_OK) {
+				*sink += wire_walk(msg.payload, msg.payload + msg.size);
+				accepted++;
+			}
+			else if (ret == MSG_TIMEOUT) {
+				break;
+			}
+		}
+	}
+
+	return accepted / repeat;
+}
+
+/* chunks: sizes of encoder writes, out: channel bytes of last frame */
+size_t tx_bench(const uint8_t *payload, const uint16_t *chunks, size_t nchunks,
+		int streamed, int repeat, uint8_t *out)
+{
+	static PBStxDev dev;
+	static pbstx_message_t msg;
+	BaseChannel chn = { NULL, NULL, out, 0 };
+	size_t size = 0;
+
+	for (size_t i = 0; i < nchunks; i++)
+		size += chunks[i];
+
+	for (int r = 0; r < repeat; r++) {
+		pbstxObjectInit(&dev, &chn);
+		dev.tx_addressed = true;
+		chn.out_len = 0;
+
+		msg.flags = PBSTX_HDR_ADDR | PBSTX_HDR_UPLINK;
+		msg.engine_id = 1;
+		const uint8_t *p = payload;
+
+		if (streamed) {
+			msg.size = size;
+			pbstxSendBegin(&dev, &msg);
+			for (size_t i = 0; i < nchunks; p += chunks[i++])
+				pbstxSendWrite(&dev, p, chunks[i]);
+			pbstxSendEnd(&dev, true);
+		}
+		else {
+			/* pb_ostream_from_buffer() callback */
+			msg.size = 0;
+			for (size_t i = 0; i < nchunks; p += chunks[i++]) {
+				memcpy(msg.payload + msg.size, p, chunks[i]);
+				msg.size += chunks[i];
+			}
+			pbstxSend(&dev, &msg);
+		}
+	}
+
+	return chn.out_len;
+}
+'''
+
+
+def build_frame(args):
+    lib = build(args, 'framebench', ['comm/pbstx.c', 'lib/lib_crc16.c'], ['comm', 'lib'],
+                {'fw_common.h': STUB_FW_COMMON, 'alert_led.h': STUB_ALERT,
+                 'miniecu.pb.h': '', 'bench.c': BENCH_SRC})
+    lib.bench.restype = ctypes.c_size_t
+    lib.bench.argtypes = [ctypes.c_char_p, ctypes.c_size_t, ctypes.c_int32, ctypes.c_int,
+                          ctypes.POINTER(ctypes.c_uint32)]
+    lib.tx_bench.restype = ctypes.c_size_t
+    lib.tx_bench.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_uint16), ctypes.c_size_t,
+                             ctypes.c_int, ctypes.c_int, ctypes.c_char_p]
+    return lib
+
+
+def _crc16_table():
+    tab = []
+    for i in range(256):
+        crc = i << 8
+        for k in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+        tab.append(crc & 0xffff)
+    return tab
+
+
+CRC16_TAB = _crc16_table()
+
+
+def crc16(data, crc=0):
+    """same as fw/lib/lib_crc16.c and miniecu/xmodem_crc16.py"""
+    for b in bytearray(data):
+        crc = (CRC16_TAB[crc >> 8] ^ (crc << 8) ^ b) & 0xffff
+    return crc
+
+
+def frame(seq, payload, v1, engine_id, uplink):
+    if v1:
+        flags = HDR_ADDR | (HDR_UPLINK if uplink else 0)
+        hdr = struct.pack('<BHH', seq & 0xff, len(payload) | flags, engine_id)
+    else:
+        hdr = struct.pack('<BH', seq & 0xff, len(payload))
+
+    body = hdr + bytes(payload)
+    return bytearray([STX]) + body + struct.pack('<H', crc16(body))
+
+
+def payload(rnd, size, engine_id):
+    # outer tag, length, engine_id field, then varint/fixed fields
+    buf = bytearray([0x0a, size - 2, 0x08, engine_id])
+    while len(buf) < size:
+        buf += bytearray([0x10 + (len(buf) % 15) * 8, rnd.randint(0, 0x7f)])
+    return buf[:size]
+
+
+def channel_second(rnd, n_ecus, v1, status_hz, request_hz):
+    """Frames on the channel in one second, in random order"""
+    frames = []
+    for eid in range(1, n_ecus + 1):
+        # ECU #1 does not hear itself
+        for i in range(status_hz if eid != 1 else 0):
+            frames.append((payload(rnd, STATUS_BYTES, eid), eid, True))
+        for i in range(request_hz):
+            frames.append((payload(rnd, REQUEST_BYTES, eid), eid, False))
+    rnd.shuffle(frames)
+
+    buf = bytearray()
+    for seq, (p, eid, uplink) in enumerate(frames):
+        buf += frame(seq, p, v1, eid, uplink)
+    return bytes(buf), len(frames)
+
+
+def run(lib, buf, rx_engine_id, repeat):
+    sink = ctypes.c_uint32()
+    t0 = time.time()
+    accepted = lib.bench(buf, len(buf), rx_engine_id, repeat, ctypes.byref(sink))
+    dt = (time.time() - t0) / repeat
+    return accepted, dt
+
+
+def encoder_writes(buf):
+    """nanopb write sizes: key varint, then value varint"""
+    chunks = []
+    i = 0
+    while i < len(buf):
+        n = 1
+        while buf[i + n - 1] & 0x80 and i + n < len(buf):
+            n += 1
+        chunks.append(n)
+        i += n
+    return chunks
+
+
+def run_tx(lib, size, repeat):
+    buf = bytes(payload(random.Random(size), size, 1))
+    chunks = encoder_writes(bytearray(buf))
+    arr = (ctypes.c_uint16 * len(chunks))(*chunks)
+    res = []
+    for streamed in (0, 1):
+        out = ctypes.create_string_buffer(PBSTX_FRAME_MAX)
+        n = lib.tx_bench(buf, arr, len(chunks), streamed, 1, out)
+        frame_bytes = out.raw[:n]
+        t0 = time.time()
+        lib.tx_bench(buf, arr, len(chunks), streamed, repeat, out)
+        res.append((frame_bytes, (time.time() - t0) / repeat))
+
+    (f0, t0), (f1, t1) = res
+    if f0 != f1:
+        raise RuntimeError("streamed frame differs, payload %d" % size)
+    return len(chunks), t0, t1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    add_build_args(parser)
+    parser.add_argument("-s", "--status-hz", help="Status rate of each ECU", type=int, default=5)
+    parser.add_argument("-r", "--request-hz", help="host requests to each ECU", type=int, default=2)
+    parser.add_argument("-n", "--ecus", help="ECU counts", default="1,2,4,8,16,32")
+    parser.add_argument("--tx-sizes", help="payload sizes for send bench", default="12,72,160,256")
+    args = parser.parse_args()
+
+    lib = build_frame(args)
+
+    print("%7s %7s  %11s %11s  %6s" % ("payload", "writes", "buf ns/fr", "stream ns/fr", "ratio"))
+    for size in (int(x) for x in args.tx_sizes.split(',')):
+        writes, t0, t1 = run_tx(lib, size, TX_REPEAT)
+        print("%7d %7d  %11.0f %11.0f  %6.2f" % (size, writes, t0 * 1e9, t1 * 1e9, t1 / t0))
+    print()
+
+    print("%5s %8s %7s  %9s %9s  %9s %9s  %6s" % (
+        "ECUs", "frames/s", "bytes/s", "v0 acc", "v0 us/s", "v1 acc", "v1 us/s", "v1/v0"))
+
+    for n in (int(x) for x in args.ecus.split(',')):
+        res = []
+        for v1 in (False, True):
+            buf, frames = channel_second(random.Random(n), n, v1, args.status_hz, args.request_hz)
+            accepted, dt = run(lib, buf, 1, REPEAT)
+            res.append((accepted, dt * 1e6))
+
+        (a0, t0), (a1, t1) = res
+        print("%5d %8d %7d  %9d %9.1f  %9d %9.1f  %6.2f" % (
+            n, frames, len(buf), a0, t0, a1, t1, t1 / t0))
+
+
+if __name__ == '__main__':
+    main()
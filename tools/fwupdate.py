@@ -0,0 +1,192 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Firmware update over PBStx
+
+Streams raw binary image (build/miniecu_v2/miniecu_v2.bin) to ECU staging
+flash, verifies it and optionally applies. Interrupted transfer resumes
+from last written sector when started again with the same image.
+"""
+
+from __future__ import print_function
+
+import sys
+import time
+import zlib
+import argparse
+from miniecu import msgs, PBStx, ReceiveError
+from miniecu.utils import wrap_msg, wrap_logger
+from miniecu.xmodem_crc16 import xmodem_crc16
+
+Op = msgs.FirmwareUpdateRequest
+St = msgs.FirmwareUpdateStatus
+
+BLOCK_SIZE = 128    # FirmwareUpdateBlock.data max_size
+
+
+class UpdateError(Exception):
+    pass
+
+
+class FirmwareUpdater(object):
+    def __init__(self, pbstx, engine_id, image, window=8, timeout=2.0, retries=10, verbose=False):
+        self.pbstx = pbstx
+        self.engine_id = engine_id
+        self.image = image
+        self.image_crc32 = zlib.crc32(image) & 0xffffffff
+        self.window = window
+        self.timeout = timeout
+        self.retries = retries
+        self.verbose = verbose
+
+    def request(self, operation, timeout=None, **kvargs):
+        req = msgs.FirmwareUpdateRequest(engine_id=self.engine_id, operation=operation, **kvargs)
+
+        for i in range(self.retries):
+            self.pbstx.send(wrap_msg(req))
+            st = self.wait_status(timeout or self.timeout)
+            if st is not None:
+                return st
+
+        raise UpdateError("no response to %s" % Op.Operation.Name(operation))
+
+    def wait_status(self, timeout):
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            try:
+                m = self.pbstx.receive(deadline - time.time())
+            except ReceiveError as ex:
+                print(repr(ex), file=sys.stderr)
+                continue
+
+            if m is None:
+                break
+            elif m.HasField('firmware_update_status'):
+                st = m.firmware_update_status
+                if st.engine_id == self.engine_id:
+                    if self.verbose:
+                        print(st, file=sys.stderr)
+                    return st
+            elif m.HasField('status_text') or self.verbose:
+                print(m, file=sys.stderr)
+
+        return None
+
+    def send_block(self, offset):
+        data = self.image[offset:offset + BLOCK_SIZE]
+        blk = msgs.FirmwareUpdateBlock(
+            engine_id=self.engine_id,
+            offset=offset,
+            data=data,
+            crc16=xmodem_crc16(data))
+        self.pbstx.send(wrap_msg(blk))
+        return offset + len(data)
+
+    def begin(self):
+        # erase may take a while
+        st = self.request(Op.BEGIN, timeout=10.0,
+                          image_size=len(self.image), image_crc32=self.image_crc32)
+        if st.result != St.OK:
+            raise UpdateError("BEGIN failed: %s" % St.Result.Name(st.result))
+
+        return st
+
+    def transfer(self):
+        """Go-back-N transfer: status carries cumulative ack"""
+        st = self.begin()
+        acked = st.next_offset
+        if acked > 0:
+            print("resume from %d" % acked, file=sys.stderr)
+
+        size = len(self.image)
+        sent = acked
+        fails = 0
+        while acked < size:
+            while sent < size and sent < acked + self.window * BLOCK_SIZE:
+                sent = self.send_block(sent)
+
+            st = self.wait_status(self.timeout)
+            if st is None:
+                fails += 1
+                if fails > self.retries:
+                    raise UpdateError("link lost at %d" % acked)
+
+                # ask where ECU is, it may be rebooted
+                st = self.begin()
+                acked = sent = st.next_offset
+                continue
+
+            if st.result == St.RETRY:
+                sent = st.next_offset
+            elif st.result != St.OK:
+                raise UpdateError("transfer failed: %s" % St.Result.Name(st.result))
+
+            fails = 0
+            acked = st.next_offset
+            if sent < acked:
+                sent = acked
+
+            print("\r%d / %d" % (acked, size), end='', file=sys.stderr)
+
+        print(file=sys.stderr)
+
+    def verify(self):
+        st = self.request(Op.VERIFY, timeout=10.0)
+        if st.result != St.OK or st.state != St.VERIFIED:
+            raise UpdateError("VERIFY failed: %s" % St.Result.Name(st.result))
+
+    def apply(self):
+        st = self.request(Op.APPLY)
+        if st.result != St.OK or st.state != St.APPLYING:
+            raise UpdateError("APPLY failed: %s" % St.Result.Name(st.result))
+
+    def abort(self):
+        self.request(Op.ABORT)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("device", help="com port device file")
+    parser.add_argument("baudrate", help="com port baudrate", type=int, nargs='?', default=57600)
+    parser.add_argument("-i", "--id", help="engine id", type=int, default=1)
+    parser.add_argument("-f", "--image", help="firmware binary image", type=argparse.FileType('rb'))
+    parser.add_argument("-w", "--window", help="blocks sent without ack", type=int, default=8)
+    parser.add_argument("-a", "--apply", help="apply image after transfer (ECU reboots)", action='store_true')
+    parser.add_argument("--abort", help="abort update and invalidate staged image", action='store_true')
+    parser.add_argument("-v", "--verbose", help="verbose io print", action='store_true')
+    parser.add_argument("-l", "--log-db", help="logging to sql db")
+    parser.add_argument("-n", "--log-name", help="log name")
+
+    args = parser.parse_args()
+
+    pbstx = PBStx(args.device, args.baudrate)
+    pbstx.ser.setTimeout(0.2)
+    pbstx = wrap_logger(pbstx, args.log_db, args.log_name, "%s @ %s" % (args.device, args.baudrate))
+
+    image = args.image.read() if args.image is not None else ''
+    updater = FirmwareUpdater(pbstx, args.id, image, window=args.window, verbose=args.verbose)
+
+    try:
+        if args.abort:
+            updater.abort()
+            return
+
+        if not image:
+            parser.error("image required")
+
+        updater.transfer()
+        updater.verify()
+        print("image verified, crc32: 0x%08x" % updater.image_crc32, file=sys.stderr)
+
+        if args.apply:
+            updater.apply()
+            print("applying, ECU reboots", file=sys.stderr)
+    except UpdateError as ex:
+        print(str(ex), file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,76 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Power fail hold-up budget
+
+Models supply capacitor discharge after battery disconnect
+(constant load current) and checks which power fail commit steps
+(fw/log/th_log.c log_power_fail()) complete before brown-out.
+"""
+
+from __future__ import print_function, division
+
+import argparse
+
+PFAIL_TIME_US = 1000        # adc_batt.c
+PFAIL_MIN_SAMPLES = 2
+SPI_HZ = 18e6
+PAGE_SIZE = 256
+EMAP_REC_PAGES = 4          # engine_map.c record
+
+
+def page_program_ms(args):
+    # command + data transfer, AAI programs one word per t_bp
+    xfer = (PAGE_SIZE + 6) * 8 / SPI_HZ * 1e3
+    return xfer + PAGE_SIZE / 2 * args.t_bp_us / 1e3
+
+
+def pfail_samples(rate):
+    return max(PFAIL_MIN_SAMPLES, int(rate * PFAIL_TIME_US / 1000000))
+
+
+def commit_steps(args):
+    page = page_program_ms(args)
+    samples = pfail_samples(args.adc_rate)
+    return (
+        ("detect (%d raw samples)" % samples, samples / args.adc_rate * 1e3),
+        ("wake log thread", args.wake_ms),
+        ("final record + log page", page),
+        ("engine map erase", args.erase_ms),
+        ("engine map write", EMAP_REC_PAGES * page),
+    )
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("-c", "--cap-uf", help="hold-up capacitance [uF]", type=float, default=470.0)
+    parser.add_argument("-i", "--load-ma", help="ECU load current [mA]", type=float, default=60.0)
+    parser.add_argument("--v-pfail", help="BATT_PFAIL threshold [V]", type=float, default=3.8)
+    parser.add_argument("--v-min", help="brown-out voltage (regulator dropout) [V]", type=float, default=3.5)
+    parser.add_argument("--t-bp-us", help="SST25 word program time [us]", type=float, default=10.0)
+    parser.add_argument("--erase-ms", help="SST25 sector erase time [ms]", type=float, default=25.0)
+    parser.add_argument("--adc-rate", help="ADC rate at failure, ADC_IDLE_RATE if engine stopped [Hz]",
+                        type=float, default=2000.0)
+    parser.add_argument("--wake-ms", help="ISR to log thread latency [ms]", type=float, default=0.1)
+    args = parser.parse_args()
+
+    slew = args.load_ma / args.cap_uf      # V/ms
+    holdup_ms = (args.v_pfail - args.v_min) / slew
+
+    print("discharge %.3f V/ms, hold-up %.2f ms (%.2f V -> %.2f V)" % (
+        slew, holdup_ms, args.v_pfail, args.v_min))
+    print()
+    print("step\tend [ms]\tV at end\tmin C [uF]\tresult")
+
+    t = 0.0
+    for name, dur in commit_steps(args):
+        t += dur
+        v = args.v_pfail - slew * t
+        min_cap = args.load_ma * t / (args.v_pfail - args.v_min)
+        print("%-24s\t%.2f\t%.2f\t%.0f\t%s" % (name, t, v, min_cap, "ok" if t <= holdup_ms else "LOST"))
+
+
+if __name__ == '__main__':
+    main()
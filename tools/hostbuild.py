@@ -0,0 +1,49 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Build firmware C sources with host compiler for ctypes benches and checks
+"""
+
+from __future__ import print_function
+
+import os
+import ctypes
+import tempfile
+import subprocess
+
+TOOLS_DIR = os.path.dirname(os.path.abspath(__file__))
+FW_DIR = os.path.join(TOOLS_DIR, '..', 'fw')
+
+
+def add_build_args(parser):
+    parser.add_argument("--cc", help="host compiler", default=os.environ.get('CC', 'cc'))
+    parser.add_argument("--cflags", help="compiler flags", default="-O2 -std=gnu99")
+
+
+def build(args, name, sources, include_dirs=(), files=None, libs=('-lm', )):
+    """Compile shared library and load it
+
+    sources, include_dirs: paths relative to fw/
+    files: {name: text} written to build directory (also on include path),
+           *.c compiled too
+    """
+    tmp = tempfile.mkdtemp()
+    srcs = [os.path.join(FW_DIR, src) for src in sources]
+
+    for fname, text in sorted((files or {}).items()):
+        path = os.path.join(tmp, fname)
+        with open(path, 'w') as fd:
+            fd.write(text)
+        if fname.endswith('.c'):
+            srcs.append(path)
+
+    lib = os.path.join(tmp, 'lib%s.so' % name)
+    cmd = [args.cc] + args.cflags.split() + ['-shared', '-fPIC', '-I', tmp]
+    for inc in include_dirs:
+        cmd += ['-I', os.path.join(FW_DIR, inc)]
+    cmd += ['-o', lib] + srcs + list(libs)
+
+    subprocess.check_call(cmd)
+    return ctypes.CDLL(lib)
@@ -0,0 +1,301 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Align Status of several ECUs/logs to one timebase and resample
+
+Reads logs recorded by wrap_logger(), maps each ECU boot's system_time to
+host UNIX time (miniecu/timealign.py), resamples chosen Status fields onto
+a uniform grid and writes one merged tab separated table.
+
+Rows are streamed twice by primary key ranges: the first pass collects
+clock fit data, the second one interpolates into a disk backed grid.
+Memory does not depend on log size.
+"""
+
+from __future__ import print_function, division
+
+import os
+import sys
+import csv
+import shutil
+import numbers
+import calendar
+import argparse
+import tempfile
+import numpy as np
+
+from miniecu.sql_log import Logger, Log, LogData
+from miniecu import msgs
+from miniecu.timealign import BootTracker, ClockFit, Resampler
+
+STATUS_TAG = msgs.Message.DESCRIPTOR.fields_by_name['status'].number
+TIMEREF_TAG = msgs.Message.DESCRIPTOR.fields_by_name['time_reference'].number
+
+BATCH = 10000           # rows per query
+CHUNK = 4096            # samples per Resampler.feed()
+OUT_CHUNK = 65536       # grid rows per write
+MAX_RTT = 2.0           # [s] older TimeReference requests are dropped
+MAX_PENDING = 64
+
+
+class Source(object):
+    """One ECU in one log"""
+    def __init__(self, db, log_id, engine_id):
+        self.db = db
+        self.log_id = log_id
+        self.engine_id = engine_id
+        self.fits = {}      # boot -> ClockFit
+        self.col = None
+
+    @property
+    def name(self):
+        return "%s:%d:%d" % (os.path.splitext(os.path.basename(self.db))[0],
+                             self.log_id, self.engine_id)
+
+
+def host_time(d):
+    """naive UTC datetime -> UNIX time [s]"""
+    return calendar.timegm(d.utctimetuple()) + d.microsecond / 1e6
+
+
+def status_field(status, path):
+    v = status
+    for name in path:
+        v = getattr(v, name)
+    return v
+
+
+def iter_rows(logger, log_id, tags):
+    s = logger.ScopedSession()
+    last = 0
+    while True:
+        rows = s.query(LogData.id, LogData.sys_date, LogData.direction, LogData.pb_message) \
+            .filter(LogData.log_id == log_id, LogData.id > last, LogData.pb_tag_id.in_(tags)) \
+            .order_by(LogData.id) \
+            .limit(BATCH) \
+            .all()
+
+        if not rows:
+            break
+
+        for row in rows:
+            yield row
+        last = rows[-1][0]
+
+    s.close()
+
+
+def collect_fits(logger, db, log_id, sources):
+    """Pass 1: fit data of each ECU boot"""
+    trackers = {}
+    pending = {}    # TimeReference.timestamp_ms -> request sys_date
+
+    def fit(engine_id, system_time):
+        src = sources.get((db, log_id, engine_id))
+        if src is None:
+            src = sources[(db, log_id, engine_id)] = Source(db, log_id, engine_id)
+            trackers[engine_id] = BootTracker()
+
+        boot, dev_ms = trackers[engine_id].update(system_time)
+        f = src.fits.get(boot)
+        if f is None:
+            f = src.fits[boot] = ClockFit()
+        return f, dev_ms
+
+    for row_id, sys_date, direction, pb_message in iter_rows(logger, log_id, (STATUS_TAG, TIMEREF_TAG)):
+        msg = msgs.Message()
+        msg.ParseFromString(pb_message)
+
+        if msg.HasField('status') and direction == 'RECV':
+            st = msg.status
+            f, dev_ms = fit(st.engine_id, st.system_time)
+            f.add_receive(dev_ms, host_time(sys_date), sys_date.microsecond == 0)
+            if st.HasField('timestamp_ms'):
+                f.add_rtc(dev_ms, st.timestamp_ms / 1000.0)
+
+        elif msg.HasField('time_reference'):
+            tr = msg.time_reference
+            if direction == 'SEND':
+                pending[tr.timestamp_ms] = sys_date
+                if len(pending) > MAX_PENDING:
+                    del pending[min(pending)]
+                continue
+
+            if not tr.HasField('timediff') or not tr.HasField('system_time'):
+                continue
+
+            # request answered by ECU at ~ half of round trip
+            rtt = 0.0
+            sent = pending.get(tr.timestamp_ms)
+            if sent is not None and (sent.microsecond or sys_date.microsecond):
+                rtt = host_time(sys_date) - host_time(sent)
+                if not 0 <= rtt <= MAX_RTT:
+                    continue
+
+            f, dev_ms = fit(tr.engine_id, tr.system_time)
+            f.add_reference(dev_ms, tr.timestamp_ms / 1000.0 + rtt / 2)
+
+
+def resample(logger, db, log_id, sources, fields, grid, t0, args):
+    """Pass 2: interpolate Status fields of each ECU into its grid columns"""
+    trackers = {}
+    state = {}      # engine_id -> (Resampler, boot, times, values)
+    paths = [f.split('.') for f in fields]
+    nf = len(fields)
+
+    def flush(engine_id):
+        rs, boot, times, values = state[engine_id]
+        if times:
+            t = sources[(db, log_id, engine_id)].fits[boot](times)
+            rs.feed(t, np.array(values, dtype=np.float64).reshape(-1, nf))
+            del times[:]
+            del values[:]
+
+    for row_id, sys_date, direction, pb_message in iter_rows(logger, log_id, (STATUS_TAG, )):
+        if direction != 'RECV':
+            continue
+
+        msg = msgs.Message()
+        msg.ParseFromString(pb_message)
+        st = msg.status
+        src = sources.get((db, log_id, st.engine_id))
+        if src is None or src.col is None:
+            continue
+
+        if st.engine_id not in state:
+            trackers[st.engine_id] = BootTracker()
+            c0 = src.col
+            rs = Resampler(grid[:, c0:c0 + nf], t0, args.step / 1000.0, args.max_gap,
+                           [f in args.hold for f in fields])
+            state[st.engine_id] = (rs, 0, [], [])
+
+        boot, dev_ms = trackers[st.engine_id].update(st.system_time)
+        if boot not in src.fits:
+            continue
+
+        rs, cur_boot, times, values = state[st.engine_id]
+        if boot != cur_boot:
+            flush(st.engine_id)
+            rs.reset()
+            state[st.engine_id] = (rs, boot, times, values)
+
+        times.append(dev_ms)
+        values.extend(status_field(st, p) for p in paths)
+        if len(times) >= CHUNK:
+            flush(st.engine_id)
+
+    for engine_id in state:
+        flush(engine_id)
+
+
+def parse_log_spec(spec):
+    """file.dblog[:id[,id...]]"""
+    db, sep, ids = spec.rpartition(':')
+    if not sep or not ids.replace(',', '').isdigit():
+        return spec, None
+    return db, [int(i) for i in ids.split(',')]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("-v", "--verbose", action='store_true', help="print clock fits")
+    parser.add_argument("-f", "--fields", help="Status fields, comma separated",
+                        default="rpm,temperature.engine1,battery.voltage,status")
+    parser.add_argument("--hold", help="fields not interpolated (flags, counters)",
+                        default="status")
+    parser.add_argument("-s", "--step", help="grid step [ms]", type=int, default=100)
+    parser.add_argument("-g", "--max-gap", help="don't interpolate over longer gaps [s]",
+                        type=float, default=2.0)
+    parser.add_argument("-o", "--output", help="output table", type=argparse.FileType('w'),
+                        default=sys.stdout)
+    parser.add_argument("--tmpdir", help="directory for grid file", default=None)
+    parser.add_argument("logs", help="log db, optionally :log_id[,log_id...]", nargs='+')
+    args = parser.parse_args()
+
+    fields = args.fields.split(',')
+    args.hold = args.hold.split(',')
+    for f in fields:
+        try:
+            v = status_field(msgs.Status(), f.split('.'))
+        except AttributeError:
+            v = None
+        if not isinstance(v, numbers.Real):
+            parser.error("unknown Status field: %s" % f)
+
+    logs = []
+    for spec in args.logs:
+        db, ids = parse_log_spec(spec)
+        logger = Logger('sqlite:///' + os.path.abspath(db))
+        if ids is None:
+            s = logger.ScopedSession()
+            ids = [i for i, in s.query(Log.id).order_by(Log.id)]
+            s.close()
+        logs.extend((logger, db, i) for i in ids)
+
+    sources = {}
+    for logger, db, log_id in logs:
+        collect_fits(logger, db, log_id, sources)
+
+    # solve clock fits, grid bounds
+    t_min, t_max = None, None
+    ncols = 0
+    for key in sorted(sources):
+        src = sources[key]
+        for boot in sorted(src.fits):
+            f = src.fits[boot]
+            if f.dev_min is None or not f.solve():
+                del src.fits[boot]
+                continue
+
+            a, b = f([f.dev_min, f.dev_max])
+            t_min = a if t_min is None else min(t_min, a)
+            t_max = b if t_max is None else max(t_max, b)
+            if args.verbose:
+                print("%s boot %d: %s, offset %.3f s, drift %+.1f ppm, %.0f s" % (
+                    src.name, boot, f.source, f.offset, f.drift_ppm, b - a), file=sys.stderr)
+
+        if src.fits:
+            src.col = ncols
+            ncols += len(fields)
+
+    if t_min is None:
+        print("no Status messages", file=sys.stderr)
+        sys.exit(1)
+
+    step = args.step / 1000.0
+    t0 = np.floor(t_min / step) * step
+    n = int((t_max - t0) / step) + 1
+
+    tmpdir = tempfile.mkdtemp(dir=args.tmpdir)
+    try:
+        grid = np.memmap(os.path.join(tmpdir, 'grid.f64'), dtype=np.float64, mode='w+',
+                         shape=(n, ncols))
+        for i in range(0, n, OUT_CHUNK):
+            grid[i:i + OUT_CHUNK] = np.nan
+
+        for logger, db, log_id in logs:
+            resample(logger, db, log_id, sources, fields, grid, t0, args)
+
+        used = [sources[k] for k in sorted(sources) if sources[k].col is not None]
+        wr = csv.writer(args.output, dialect='excel-tab')
+        args.output.write('# Step: {} ms\tSources: {}\n'.format(
+            args.step, ' '.join(s.name for s in used)))
+        wr.writerow(['time'] + ['%s.%s' % (s.name, f) for s in used for f in fields])
+
+        for i in range(0, n, OUT_CHUNK):
+            block = np.asarray(grid[i:i + OUT_CHUNK])
+            times = t0 + step * np.arange(i, i + len(block))
+            for t, row in zip(times, block):
+                if np.isnan(row).all():
+                    continue
+                wr.writerow(['%.3f' % t] + ['NaN' if np.isnan(v) else '%.6g' % v for v in row])
+
+        del grid
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,151 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Measure compact log format ratio against LogEntry protobuf records
+
+Replays Status recordings exported to CSV (tests/flow_*.csv) through
+log encoder, checks round trip and prints bytes per record.
+With --adaptive records are filtered like fw/log/th_log.c logging
+profiles and bytes per hour of recording are compared.
+"""
+
+from __future__ import print_function, division
+
+import csv
+import math
+import argparse
+from miniecu import msgs
+from miniecu.logcodec import LogEncoder, decode_stream, to_log_entry, CHANNELS
+
+CSV_COLUMNS = (
+    'status',
+    'rpm',
+    'battery.voltage',
+    'battery.remaining',
+    'temperature.engine1',
+    'cpu.temperature',
+    'fuel.remaining',
+)
+
+
+# Status.Flags
+STARTER_ENABLED = 8
+ENGINE_RUNNING = 16
+ALARM_FLAGS = 0xff80 & ~128     # alarms, without ERROR
+
+# same as th_log.c m_channel_step, 0: any change
+CHANNEL_STEP = (0, 250, 250, 5, 2000, 2000, 100)
+DENSE_MS = 100
+START_DENSE_MS = 30000
+
+
+class AdaptiveFilter(object):
+    """Mirror of th_log.c profile selection"""
+
+    def __init__(self, run_period=200, stop_period=10000):
+        self.run_period = run_period
+        self.stop_period = stop_period
+        self.logged = None
+        self.logged_time = 0
+        self.was_running = False
+        self.change_time = -START_DENSE_MS
+
+    def period(self, time_ms, status):
+        running = bool(status & ENGINE_RUNNING)
+        if running != self.was_running:
+            self.was_running = running
+            self.change_time = time_ms
+
+        if status & (STARTER_ENABLED | ALARM_FLAGS) or time_ms - self.change_time < START_DENSE_MS:
+            return DENSE_MS
+        return self.run_period if running else self.stop_period
+
+    def changed(self, values):
+        for v, p, step in zip(values, self.logged, CHANNEL_STEP):
+            d = abs(v - p)
+            if (step == 0 and d) or (step and d >= step):
+                return True
+        return False
+
+    def __call__(self, time_ms, values):
+        period = self.period(time_ms, values[0])
+        if self.logged is not None and time_ms - self.logged_time < period \
+                and not self.changed(values):
+            return False
+
+        self.logged = values
+        self.logged_time = time_ms
+        return True
+
+
+def varint_size(v):
+    n = 1
+    while v >= 0x80:
+        v >>= 7
+        n += 1
+    return n
+
+
+def csv_value(row, column):
+    v = float(row[column])
+    return -1 if math.isnan(v) else int(v)
+
+
+def read_csv(fd):
+    lines = (l for l in fd if not l.startswith('#'))
+    for row in csv.DictReader(lines, delimiter='\t'):
+        yield int(row['system_time']), [csv_value(row, c) for c in CSV_COLUMNS]
+
+
+def measure(fd, adaptive=False):
+    enc = LogEncoder()
+    records = list(read_csv(fd))
+    duration_h = (records[-1][0] - records[0][0]) / 3600000.0
+    pb_size = 0
+
+    if adaptive:
+        records = [r for r in records if adaptive(*r)]
+
+    for i, (time_ms, values) in enumerate(records):
+        enc.append(values, time_ms)
+        rec = dict(zip(CHANNELS, values), engine_id=1, time_ms=time_ms, timestamp_ms=0)
+        sz = to_log_entry(rec, i).ByteSize()
+        pb_size += sz + varint_size(sz)     # length delimited stream
+
+    data = enc.data()
+    decoded = list(decode_stream(data))
+    if [(r['time_ms'], [r[c] for c in CHANNELS]) for r in decoded] != records:
+        raise ValueError("round trip mismatch")
+
+    # partially filled last page counted by used bytes
+    used = len(data.rstrip(b'\xff'))
+    return len(records), pb_size, used, duration_h
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("csv", help="Status recordings (CSV)", nargs='+', type=argparse.FileType('r'))
+    parser.add_argument("-a", "--adaptive", help="apply logging profiles", action='store_true')
+    parser.add_argument("--run-period", help="LOG_RUN_PERIOD [ms]", type=int, default=200)
+    parser.add_argument("--stop-period", help="LOG_STOP_PERIOD [ms]", type=int, default=10000)
+    args = parser.parse_args()
+
+    total_n = total_pb = total_log = total_h = 0
+    print("file\trecords\tLogEntry B/rec\tcompact B/rec\tratio\tcompact B/h")
+    for fd in args.csv:
+        adaptive = AdaptiveFilter(args.run_period, args.stop_period) if args.adaptive else None
+        n, pb, log, hours = measure(fd, adaptive)
+        total_n += n
+        total_pb += pb
+        total_log += log
+        total_h += hours
+        print("%s\t%d\t%.1f\t%.1f\t%.2f\t%.0f" % (fd.name, n, pb / n, log / n, pb / log, log / hours))
+
+    print("total\t%d\t%.1f\t%.1f\t%.2f\t%.0f" % (total_n, total_pb / total_n, total_log / total_n,
+                                               total_pb / total_log, total_log / total_h))
+
+
+if __name__ == '__main__':
+    main()
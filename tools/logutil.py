@@ -5,6 +5,7 @@ import argparse
 from prettytable import PrettyTable
 from miniecu.sql_log import Logger, Log, PBTag, LogData
 from miniecu import msgs
+from miniecu.logcodec import decode_partition, CHANNELS
 
 
 def pb_to_kv_pairs(pb, prefix=()):
@@ -89,6 +90,16 @@ def do_csv_export(args):
         wr.writerow(row)
 
 
+def do_flash_export(args):
+    """Export log partition dump (memdump.py -t 1) to CSV"""
+    wr = csv.writer(args.csv_file, dialect='excel-tab')
+    header = ('seq', 'engine_id', 'time_ms', 'timestamp_ms') + CHANNELS
+    wr.writerow(header)
+
+    for rec in decode_partition(args.dump.read()):
+        wr.writerow([rec[k] for k in header])
+
+
 def main(argv=None):
     parser = argparse.ArgumentParser(description="sql log tool")
     parser.add_argument('-v', '--verbose', action='store_true', help="verbose output")
@@ -109,6 +120,11 @@ def main(argv=None):
     csvexport_args.add_argument('log_id')
     csvexport_args.add_argument('csv_file', type=argparse.FileType('w'))
 
+    flashexport_args = subarg.add_parser('flashexport', help=do_flash_export.__doc__)
+    flashexport_args.set_defaults(func=do_flash_export)
+    flashexport_args.add_argument('dump', type=argparse.FileType('rb'))
+    flashexport_args.add_argument('csv_file', type=argparse.FileType('w'))
+
     args = parser.parse_args(argv)
     args.func(args)
 
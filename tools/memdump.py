@@ -9,6 +9,13 @@ import argparse
 import random
 from miniecu import msgs, PBStx, ReceiveError
 from miniecu.utils import make_ParamSet, wrap_msg, wrap_logger
+from miniecu.pagecomp import decompress, DecodeError
+
+COMPRESSION = {
+    'none': msgs.MemoryDumpRequest.NONE,
+    'rle': msgs.MemoryDumpRequest.RLE,
+    'lz': msgs.MemoryDumpRequest.LZ,
+}
 
 
 def main():
@@ -22,6 +29,8 @@ def main():
     parser.add_argument("-t", "--type", help="memory type [0:RAM, 1:SST25]", type=int, default=0)
     parser.add_argument("-a", "--address", help="address", type=autoint, default=0)
     parser.add_argument("-s", "--size", help="size", type=autoint, default=0)
+    parser.add_argument("-c", "--compression", help="page compression (older firmware sends raw)",
+                        choices=sorted(COMPRESSION.keys()), default='lz')
     parser.add_argument("-v", "--verbose", help="verbose io print", action='store_true')
     parser.add_argument("-l", "--log-db", help="logging to sql db")
     parser.add_argument("-n", "--log-name", help="log name")
@@ -41,7 +50,8 @@ def main():
         type=args.type,
         stream_id=stream_id,
         address=args.address,
-        size=args.size))
+        size=args.size,
+        compression=COMPRESSION[args.compression]))
 
     print('=' * 40, file=sys.stderr)
     print(dump_request, file=sys.stderr)
@@ -59,12 +69,20 @@ def main():
                     print("wrong stream_id", file=sys.stderr)
                     continue
 
+                data = page.page
+                if page.HasField('compression'):
+                    try:
+                        data = decompress(page.compression, data, page.raw_size)
+                    except DecodeError as ex:
+                        print('page 0x%08x: %s' % (page.address, ex), file=sys.stderr)
+                        continue
+
                 idx = page.address - args.address
                 if len(buf) < idx:
                     print('page missing, lost %d bytes' % (idx - len(buf)), file=sys.stderr)
-                    buf.zfill(idx)
+                    buf.extend(bytearray(idx - len(buf)))
 
-                buf.extend(page.page)
+                buf.extend(data)
 
                 if args.verbose:
                     print(m, file=sys.stderr)
@@ -0,0 +1,242 @@
+# -*- python -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Compact log record format codec
+
+Mirrors fw/log/log_flash.[ch]:
+
+    SYNC:  0x81, varint seq, varint engine_id, varint time_ms,
+           varint timestamp_ms, zigzag varint value[NCH]
+    DELTA: mask (bit 7 clear), varint dt_ms,
+           zigzag varint (value - prev) for each channel set in mask
+    0xff:  padding, continue on next page
+
+Each 4 KiB sector starts with SYNC, records never cross page boundary.
+"""
+
+__all__ = (
+    'CHANNELS',
+    'LogEncoder',
+    'LogDecodeError',
+    'decode_stream',
+    'decode_partition',
+    'to_log_entry',
+)
+
+PAGE_SIZE = 256
+SECTOR_SIZE = 4096
+
+FORMAT_VERSION = 1
+TAG_SYNC = 0x80 | FORMAT_VERSION
+TAG_ERASED = 0xff
+SYNC_MAX = 64
+
+# note: same order as enum log_channel
+CHANNELS = (
+    'status',
+    'rpm',
+    'batt_voltage',
+    'batt_remaining',
+    'temp_engine',
+    'temp_internal',
+    'fuel_remaining_ml',
+)
+NCH = len(CHANNELS)
+
+
+class LogDecodeError(Exception):
+    pass
+
+
+def put_varint(buf, v):
+    while v >= 0x80:
+        buf.append((v & 0x7f) | 0x80)
+        v >>= 7
+    buf.append(v)
+
+
+def put_zigzag(buf, v):
+    put_varint(buf, ((v << 1) ^ (v >> 63)) & 0xffffffffffffffff)
+
+
+def get_varint(data, pos):
+    v = 0
+    shift = 0
+    while True:
+        if pos >= len(data):
+            raise LogDecodeError("truncated varint")
+        b = data[pos]
+        pos += 1
+        v |= (b & 0x7f) << shift
+        shift += 7
+        if not b & 0x80:
+            return v, pos
+
+
+def get_zigzag(data, pos):
+    v, pos = get_varint(data, pos)
+    return (v >> 1) ^ -(v & 1), pos
+
+
+class LogEncoder(object):
+    """Host side encoder, produces same byte stream as ECU"""
+
+    def __init__(self, engine_id=1, seq=0):
+        self.engine_id = engine_id
+        self.seq = seq
+        self.pages = []
+        self.page = bytearray()
+        self.prev = None
+        self.prev_time = 0
+        self.need_sync = True
+
+    def _next_page(self):
+        self.page.extend(b'\xff' * (PAGE_SIZE - len(self.page)))
+        self.pages.append(self.page)
+        self.page = bytearray()
+        if len(self.pages) % (SECTOR_SIZE // PAGE_SIZE) == 0:
+            self.seq += 1
+            self.need_sync = True
+
+    def _sync(self, values, time_ms, timestamp_ms):
+        rec = bytearray([TAG_SYNC])
+        put_varint(rec, self.seq)
+        put_varint(rec, self.engine_id)
+        put_varint(rec, time_ms)
+        put_varint(rec, timestamp_ms)
+        for v in values:
+            put_zigzag(rec, v)
+        return rec
+
+    def _delta(self, values, time_ms):
+        rec = bytearray([0])
+        put_varint(rec, time_ms - self.prev_time)
+        for i, (v, p) in enumerate(zip(values, self.prev)):
+            if v != p:
+                rec[0] |= 1 << i
+                put_zigzag(rec, v - p)
+        return rec
+
+    def append(self, values, time_ms, timestamp_ms=0):
+        values = [int(v) for v in values]
+        if not self.need_sync:
+            rec = self._delta(values, time_ms)
+            if len(self.page) + len(rec) > PAGE_SIZE:
+                self._next_page()
+
+        if self.need_sync:
+            if len(self.page) + SYNC_MAX > PAGE_SIZE:
+                self._next_page()
+            rec = self._sync(values, time_ms, timestamp_ms)
+            self.need_sync = False
+
+        self.page.extend(rec)
+        self.prev = values
+        self.prev_time = time_ms
+
+    def sync(self):
+        self.need_sync = True
+
+    def data(self):
+        """Written pages and current page (padded)"""
+        tail = self.page + bytearray(b'\xff' * (PAGE_SIZE - len(self.page))) if self.page else bytearray()
+        return bytes(bytearray().join(self.pages) + tail)
+
+
+def _decode_page(page, state):
+    """Decode one page, state carries sync/prev values between pages"""
+    pos = 0
+    while pos < len(page):
+        tag = page[pos]
+        if tag == TAG_ERASED:
+            break
+
+        if tag == TAG_SYNC:
+            seq, pos = get_varint(page, pos + 1)
+            engine_id, pos = get_varint(page, pos)
+            time_ms, pos = get_varint(page, pos)
+            timestamp_ms, pos = get_varint(page, pos)
+            values = []
+            for i in range(NCH):
+                v, pos = get_zigzag(page, pos)
+                values.append(v)
+
+            state.update(seq=seq, engine_id=engine_id, time_ms=time_ms,
+                         sync_time_ms=time_ms, sync_timestamp_ms=timestamp_ms,
+                         values=values)
+
+        elif tag & 0x80:
+            raise LogDecodeError("unknown record tag 0x%02x" % tag)
+
+        else:
+            dt, pos = get_varint(page, pos + 1)
+            deltas = {}
+            for i in range(NCH):
+                if tag & (1 << i):
+                    deltas[i], pos = get_zigzag(page, pos)
+
+            # record before first SYNC can't be restored, skip it
+            if 'values' not in state:
+                continue
+
+            state['time_ms'] += dt
+            state['values'] = [v + deltas.get(i, 0) for i, v in enumerate(state['values'])]
+
+        timestamp_ms = 0
+        if state['sync_timestamp_ms']:
+            timestamp_ms = state['sync_timestamp_ms'] + state['time_ms'] - state['sync_time_ms']
+
+        rec = dict(zip(CHANNELS, state['values']))
+        rec.update(engine_id=state['engine_id'], time_ms=state['time_ms'],
+                   timestamp_ms=timestamp_ms, seq=state['seq'])
+        yield rec
+
+
+def decode_stream(data):
+    """Decode sequential pages (e.g. LogEncoder.data())"""
+    data = bytearray(data)
+    state = {}
+    for off in range(0, len(data), PAGE_SIZE):
+        for rec in _decode_page(data[off:off + PAGE_SIZE], state):
+            yield rec
+
+
+def decode_partition(data):
+    """
+    Decode log partition dump: sectors ordered by SYNC sequence number,
+    decoding errors drop rest of sector only.
+    """
+    data = bytearray(data)
+    sectors = []
+    for off in range(0, len(data) - SECTOR_SIZE + 1, SECTOR_SIZE):
+        if data[off] == TAG_SYNC:
+            seq, _ = get_varint(data, off + 1)
+            sectors.append((seq, off))
+
+    for seq, off in sorted(sectors):
+        state = {}
+        try:
+            for poff in range(off, off + SECTOR_SIZE, PAGE_SIZE):
+                for rec in _decode_page(data[poff:poff + PAGE_SIZE], state):
+                    yield rec
+        except LogDecodeError:
+            continue
+
+
+def to_log_entry(rec, entry_id=0):
+    """Convert decoded record to miniecu.LogEntry message"""
+    from pbstx import msgs
+
+    return msgs.LogEntry(
+        engine_id=rec['engine_id'],
+        id=entry_id,
+        timestamp_ms=rec['timestamp_ms'] or rec['time_ms'],
+        status=rec['status'],
+        engine_powered_time=0,
+        batt_voltage=rec['batt_voltage'],
+        batt_remaining=rec['batt_remaining'],
+        temp_engine=rec['temp_engine'],
+        temp_internal=rec['temp_internal'],
+        fuel_remaining_ml=rec['fuel_remaining_ml'],
+        rpm=rec['rpm'])
@@ -0,0 +1,62 @@
+# -*- python -*-
+
+"""
+Decoder for compressed MemoryDumpPage (fw/lib/pagecomp.c)
+
+Token stream:
+    0LLLLLLL <L+1 bytes>        literals
+    1NNNNNNN <value>            RLE: value repeated N+3 times
+    1NNNNNNN <distance-1>       LZ: copy N+3 bytes from distance back
+"""
+
+NONE = 0
+RLE = 1
+LZ = 2
+
+MIN_MATCH = 3
+
+
+class DecodeError(Exception):
+    pass
+
+
+def decompress(codec, data, raw_size=None):
+    data = bytearray(data)
+    if codec == NONE:
+        return data
+
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        c = data[i]
+        i += 1
+        if c < 0x80:
+            n = c + 1
+            if i + n > len(data):
+                raise DecodeError("literals past end")
+            out.extend(data[i:i + n])
+            i += n
+            continue
+
+        if i >= len(data):
+            raise DecodeError("truncated token")
+
+        n = (c & 0x7f) + MIN_MATCH
+        arg = data[i]
+        i += 1
+        if codec == RLE:
+            out.extend(bytearray([arg]) * n)
+        elif codec == LZ:
+            dist = arg + 1
+            if dist > len(out):
+                raise DecodeError("distance %d beyond output %d" % (dist, len(out)))
+            # byte by byte: overlapping copy
+            for k in range(n):
+                out.append(out[-dist])
+        else:
+            raise DecodeError("unknown codec %d" % codec)
+
+    if raw_size is not None and len(out) != raw_size:
+        raise DecodeError("size %d, expected %d" % (len(out), raw_size))
+
+    return out
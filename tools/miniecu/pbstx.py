@@ -8,6 +8,11 @@ Simple protocol for transfer PB messages defined in miniecu.proto.
 
 Message format:
    <STX><SEQ><LEN[2]><PAYLOAD[LEN]><CRC[2]>
+   <STX><SEQ><LEN[2]><ENGINE_ID[2]><PAYLOAD[LEN]><CRC[2]>   (v1)
+
+v1 is flagged in LEN high bits. ENGINE_ID is destination ECU (0: all)
+or source if UPLINK flag is set, so ECUs on a shared link drop frames
+for others after the header.
 """
 
 __all__ = (
@@ -19,6 +24,7 @@ __all__ = (
 import serial
 import threading
 import struct
+import time
 from xmodem_crc16 import xmodem_crc16
 
 try:
@@ -39,13 +45,22 @@ class PBStx(object):
     DHEADER = '<BH'     # Decode header: SEQ, LEN
     MAX_LEN = 256
     CRCFMT = '<H'       # CRC16 (xmodem)
-
-    def __init__(self, port, baud=57600, sysid=240):
+    V1HEADER = '<H'     # ENGINE_ID
+    LEN_MASK = 0x01ff
+    HDR_ADDR = 0x8000   # v1 header
+    HDR_UPLINK = 0x4000
+
+    def __init__(self, port, baud=57600, sysid=240, addressed=None):
+        """
+        addressed: send v1 frames; None: after ECU sent one
+        """
         self.terminate = threading.Event()
         self.ser = serial.Serial(port, baud)
         self.ser.setTimeout(2.0)
         self._tx_seq = 0
         self._rx_seq = 0
+        self._auto_v1 = addressed is None
+        self.addressed = bool(addressed)
 
     def __del__(self):
         self.terminate.set()
@@ -58,7 +73,13 @@ class PBStx(object):
         if len(payload) > PBStx.MAX_LEN:
             raise ValueError("Serialized {} too long: {}".format(repr(pbobj), len(payload)))
 
-        buf = struct.pack(PBStx.EHEADER, PBStx.STX, self._tx_seq, len(payload))
+        engine_id = self._engine_id(pbobj)
+        if self.addressed and engine_id is not None:
+            buf = struct.pack(PBStx.EHEADER, PBStx.STX, self._tx_seq & 0xff,
+                              len(payload) | PBStx.HDR_ADDR)
+            buf += struct.pack(PBStx.V1HEADER, engine_id)
+        else:
+            buf = struct.pack(PBStx.EHEADER, PBStx.STX, self._tx_seq & 0xff, len(payload))
         buf += payload
 
         tx_crc = xmodem_crc16(buf[1:])
@@ -67,7 +88,8 @@ class PBStx(object):
         self._tx_seq += 1
         self.ser.write(buf)
 
-    def receive(self):
+    def receive(self, timeout=None):
+        """Receive message, returns None if timeout passed"""
         seq = 0
         len_ = 0
         payload = bytearray()
@@ -75,17 +97,24 @@ class PBStx(object):
         rx_crc = 0
         hdr_len = struct.calcsize(PBStx.DHEADER)
         crc_len = struct.calcsize(PBStx.CRCFMT)
+        deadline = time.time() + timeout if timeout is not None else None
 
         while not self.terminate.is_set():
             # 1. wait start marker
             c = self.ser.read(1)
             if len(c) == 0 or ord(c[0]) != PBStx.STX:
+                if deadline is not None and time.time() > deadline:
+                    return None
                 continue
 
             # 2. read header
             buf = self._read_or_die(hdr_len)
-            rx_crc = xmodem_crc16(buf)
             seq, len_ = struct.unpack(PBStx.DHEADER, buf)
+            flags = len_ & ~PBStx.LEN_MASK
+            len_ &= PBStx.LEN_MASK
+            if flags & PBStx.HDR_ADDR:
+                buf += self._read_or_die(struct.calcsize(PBStx.V1HEADER))
+            rx_crc = xmodem_crc16(buf)
 
             # 3. read payload
             payload = self._read_or_die(len_)
@@ -97,6 +126,8 @@ class PBStx(object):
 
             # 5. check crc
             if crc == rx_crc:
+                if self._auto_v1 and flags & PBStx.HDR_ADDR:
+                    self.addressed = True
                 return self._deserialize(seq, payload)
             else:
                 raise ReceiveError("CRC mismatch: 0x{:04x} != 0x{:04x}".format(
@@ -109,6 +140,14 @@ class PBStx(object):
 
         return buf
 
+    @staticmethod
+    def _engine_id(pbobj):
+        """engine_id of message, first field of all submessages"""
+        fields = pbobj.ListFields()
+        if fields and hasattr(fields[0][1], 'engine_id'):
+            return fields[0][1].engine_id & 0xffff
+        return None
+
     def _deserialize(self, seq, payload):
         pb = msgs.Message()
         pb.ParseFromString(payload)
@@ -0,0 +1,260 @@
+# -*- python -*-
+
+"""
+Playback of sessions recorded by wrap_logger()
+
+LogPlayer looks like PBStx to its user: receive() returns recorded
+messages when they are due on playback clock, send() is dropped.
+Times of all received messages are indexed once when log opened,
+so seek is one bisect and one primary key range query.
+"""
+
+from __future__ import division
+
+import time
+import bisect
+import logging
+import threading
+from sqlalchemy import func
+from sql_log import Logger, Log, LogData, msgs
+
+log = logging.getLogger(__name__)
+
+SPEED_MIN = 1.0
+SPEED_MAX = 100.0
+BATCH = 256         # messages fetched per query
+POLL = 0.2          # [s] max wait, control changes wake earlier
+MAX_LAG = 0.5       # [s] wall time behind clock: skip older Status
+STATUS_TAG = msgs.Message.DESCRIPTOR.fields_by_name['status'].number
+
+
+def list_logs(log_db):
+    """
+    Logs in database: (id, name, start_date, message count)
+    """
+    logger = Logger(log_db)
+    s = logger.ScopedSession()
+    q = s.query(Log.id, Log.name, Log.start_date, func.count(LogData.id)) \
+        .outerjoin(LogData, LogData.log_id == Log.id) \
+        .group_by(Log.id) \
+        .order_by(Log.id)
+
+    return q.all()
+
+
+def spread_seconds(times):
+    """
+    Old logs have sys_date with 1 s resolution (SQL now()):
+    spread messages of each second evenly until next one.
+    """
+    out = []
+    i = 0
+    while i < len(times):
+        j = i
+        while j < len(times) and times[j] == times[i]:
+            j += 1
+
+        end = times[j] if j < len(times) else times[i] + 1.0
+        step = (end - times[i]) / (j - i)
+        out.extend(times[i] + k * step for k in range(j - i))
+        i = j
+
+    return out
+
+
+class LogPlayer(object):
+    """
+    Replays received messages of one log at 1x..100x speed.
+    Control methods are thread safe, receive() called by comm thread.
+    """
+    def __init__(self, log_db, log_id, speed=1.0):
+        self.logger = Logger(log_db)
+        self.terminate = threading.Event()
+        self._cond = threading.Condition()
+
+        # logs recorded before log_id index existed
+        self.logger.engine.execute(
+            'CREATE INDEX IF NOT EXISTS ix_log_data_log_id ON log_data (log_id)')
+
+        s = self.logger.ScopedSession()
+        self.log = s.query(Log).filter_by(id=log_id).one()
+        self._build_index(s)
+
+        self._speed = self._clamp_speed(speed)
+        self._playing = True
+        self._pos = 0.0
+        self._wall = time.time()
+        self._next = 0
+        self._cache_start = 0
+        self._cache = []
+
+    def _build_index(self, s):
+        q = s.query(LogData.id, LogData.sys_date, LogData.pb_tag_id) \
+            .filter(LogData.log_id == self.log.id, LogData.direction == 'RECV') \
+            .order_by(LogData.id)
+
+        self._ids = []
+        self._tags = []
+        dates = []
+        for id_, sys_date, tag in q:
+            self._ids.append(id_)
+            self._tags.append(tag)
+            dates.append(sys_date)
+
+        if not dates:
+            self._times = []
+            return
+
+        t0 = dates[0]
+        times = [(d - t0).total_seconds() for d in dates]
+        if all(d.microsecond == 0 for d in dates):
+            times = spread_seconds(times)
+
+        # clock never goes back
+        for i in range(1, len(times)):
+            if times[i] < times[i - 1]:
+                times[i] = times[i - 1]
+
+        self._times = times
+        log.info("LOG %d: %d messages, %.1f s", self.log.id, len(times), self.duration)
+
+    @staticmethod
+    def _clamp_speed(speed):
+        return min(max(float(speed), SPEED_MIN), SPEED_MAX)
+
+    def _position(self):
+        if not self._playing:
+            return self._pos
+
+        pos = self._pos + (time.time() - self._wall) * self._speed
+        return min(pos, self.duration)
+
+    def _rebase(self):
+        self._pos = self._position()
+        self._wall = time.time()
+
+    def _message(self, i):
+        if not self._cache_start <= i < self._cache_start + len(self._cache):
+            s = self.logger.ScopedSession()
+            q = s.query(LogData.pb_message) \
+                .filter(LogData.log_id == self.log.id, LogData.direction == 'RECV',
+                        LogData.id >= self._ids[i]) \
+                .order_by(LogData.id) \
+                .limit(BATCH)
+
+            self._cache = [row[0] for row in q]
+            self._cache_start = i
+            s.close()
+
+        m = msgs.Message()
+        m.ParseFromString(self._cache[i - self._cache_start])
+        return m
+
+    def _skip_lagging(self, pos):
+        """Consumer too slow for speed: drop due Status but last"""
+        end = bisect.bisect_right(self._times, pos)
+        last_status = None
+        for i in range(end - 1, self._next - 1, -1):
+            if self._tags[i] == STATUS_TAG:
+                last_status = i
+                break
+
+        while self._next < end and self._tags[self._next] == STATUS_TAG \
+                and self._next != last_status:
+            self._next += 1
+
+    # -*- PBStx interface -*-
+
+    def send(self, msg):
+        log.debug("playback: dropped %s", msg.ListFields()[0][0].name if msg.ListFields() else msg)
+
+    def receive(self, timeout=None):
+        """Next message when due, None if timeout passed"""
+        deadline = time.time() + timeout if timeout is not None else None
+
+        with self._cond:
+            while not self.terminate.is_set():
+                wait = POLL
+                if self._playing and self._next < len(self._times):
+                    pos = self._position()
+                    due = self._times[self._next]
+                    if due <= pos:
+                        if (pos - due) / self._speed > MAX_LAG:
+                            self._skip_lagging(pos)
+
+                        i = self._next
+                        self._next += 1
+                        return self._message(i)
+
+                    wait = min(wait, (due - pos) / self._speed)
+
+                if deadline is not None:
+                    left = deadline - time.time()
+                    if left <= 0:
+                        return None
+                    wait = min(wait, left)
+
+                self._cond.wait(wait)
+
+        return None
+
+    # -*- control -*-
+
+    @property
+    def duration(self):
+        return self._times[-1] if self._times else 0.0
+
+    @property
+    def position(self):
+        with self._cond:
+            return self._position()
+
+    @property
+    def finished(self):
+        with self._cond:
+            return self._next >= len(self._times)
+
+    @property
+    def playing(self):
+        return self._playing
+
+    @property
+    def speed(self):
+        return self._speed
+
+    @speed.setter
+    def speed(self, value):
+        with self._cond:
+            self._rebase()
+            self._speed = self._clamp_speed(value)
+            self._cond.notify_all()
+
+    def play(self):
+        with self._cond:
+            if self.finished:
+                self._pos = 0.0
+                self._next = 0
+
+            self._wall = time.time()
+            self._playing = True
+            self._cond.notify_all()
+
+    def pause(self):
+        with self._cond:
+            self._rebase()
+            self._playing = False
+            self._cond.notify_all()
+
+    def seek(self, pos):
+        """Jump to log time [s], next message is first at or after it"""
+        with self._cond:
+            pos = min(max(pos, 0.0), self.duration)
+            self._pos = pos
+            self._wall = time.time()
+            self._next = bisect.bisect_left(self._times, pos)
+            self._cond.notify_all()
+
+    def stop(self):
+        self.terminate.set()
+        with self._cond:
+            self._cond.notify_all()
@@ -42,7 +42,7 @@ class LogData(Base):
     """
     __tablename__ = 'log_data'
     id = Column(Integer, primary_key=True)
-    log_id = Column(Integer, ForeignKey('log.id'), nullable=False)
+    log_id = Column(Integer, ForeignKey('log.id'), nullable=False, index=True)
     sys_date = Column(DateTime(timezone=True), nullable=False, default=func.now())
     direction = Column(Enum("SEND", "RECV", name="log_direction"), nullable=False)
     dev_time_ms = Column(BigInteger, doc='ecu timestamp [ms]')
@@ -59,6 +59,7 @@ class LogData(Base):
         backref=backref('pb_tag'))
 
 
+import datetime
 from sqlalchemy import create_engine
 from sqlalchemy.orm import sessionmaker, scoped_session
 import miniecu_pb2 as msgs
@@ -117,6 +118,10 @@ class Logger(object):
             if hasattr(data, 'engine_id'):      engine_id = data.engine_id
             if hasattr(data, 'timestamp_ms'):   timestamp_ms = data.timestamp_ms
 
+        # UTC as SQLite CURRENT_TIMESTAMP, which has only 1 s resolution
+        if sys_date is None:
+            sys_date = datetime.datetime.utcnow()
+
         s = self.ScopedSession()
         s.add(
             LogData(log_id=self.log.id, sys_date=sys_date, direction=direction_,
@@ -137,7 +142,8 @@ class LoggingWrapper(object):
         self.pbstx.send(msg)
         self.logger.add_message(msg, DIR_SEND)
 
-    def receive(self):
-        msg = self.pbstx.receive()
-        self.logger.add_message(msg, DIR_RECV)
+    def receive(self, timeout=None):
+        msg = self.pbstx.receive(timeout)
+        if msg is not None:
+            self.logger.add_message(msg, DIR_RECV)
         return msg
@@ -0,0 +1,226 @@
+# -*- python -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Device time to common timebase mapping and uniform resampling
+
+Status.system_time is ECU uptime in ms (uint32). One ClockFit maps it to
+host UNIX time for one boot of one ECU:
+
+    host_s = offset + rate * dev_ms / 1000
+
+Fit data, best first:
+  - TimeReference responses: host send time + half round trip vs
+    ECU system_time at receive;
+  - Status.timestamp_ms (ECU RTC, itself set by TimeReference);
+  - receive time of Status: lower envelope of (host - device), i.e. the
+    sample with the least link delay in each window.
+
+Rate is fitted by least squares when the data spans MIN_SPAN_MS and the
+result is plausible, otherwise nominal. Offset is taken from the best
+available data.
+
+Resampler writes piecewise linear (or sample-and-hold) interpolation of
+monotonic sample chunks onto a preallocated uniform grid.
+"""
+
+from __future__ import division
+
+import numpy as np
+
+WRAP_MS = 1 << 32
+REBOOT_MS = 1000            # system_time going back more: new boot
+MIN_SPAN_MS = 60000         # fit rate only over longer span
+COARSE_SPAN_MS = 1000000    # same for whole second receive times
+ENVELOPE_WINDOW_MS = 10000  # one min-delay sample per window
+MAX_DRIFT_PPM = 1000        # implausible rate: fit failed, use nominal
+OUTLIER_MIN_S = 0.05
+
+FIT_REFERENCE = 'timeref'
+FIT_RTC = 'rtc'
+FIT_RECEIVE = 'recv'
+
+
+class BootTracker(object):
+    """Unwraps uint32 system_time and counts ECU reboots"""
+    def __init__(self):
+        self.boot = 0
+        self._prev = None
+        self._base = 0
+
+    def update(self, system_time):
+        if self._prev is not None and system_time < self._prev:
+            if self._prev - system_time > WRAP_MS // 2:
+                self._base += WRAP_MS
+            elif self._prev - system_time > REBOOT_MS:
+                self.boot += 1
+                self._base = 0
+
+        self._prev = system_time
+        return self.boot, self._base + system_time
+
+
+def _fit_line(dev_ms, host_s):
+    """
+    Least squares host_s = offset + rate * dev_s, centered for precision.
+    Refitted without outliers (e.g. buffered messages read on port open).
+    """
+    x = np.asarray(dev_ms, dtype=np.float64) / 1000.0
+    y = np.asarray(host_s, dtype=np.float64)
+    keep = np.ones(len(x), dtype=bool)
+    for it in range(3):
+        xm, ym = x[keep].mean(), y[keep].mean()
+        dx = x[keep] - xm
+        den = np.dot(dx, dx)
+        if den == 0:
+            return None
+        rate = np.dot(dx, y[keep] - ym) / den
+
+        r = y - (ym + rate * (x - xm))
+        dev = np.abs(r - np.median(r[keep]))
+        new_keep = dev <= max(3 * np.median(dev[keep]), OUTLIER_MIN_S)
+        if (new_keep == keep).all() or new_keep.sum() < 2:
+            break
+        keep = new_keep
+
+    return ym - rate * xm, rate
+
+
+def _span(pairs):
+    return pairs[-1][0] - pairs[0][0] if pairs else 0
+
+
+class ClockFit(object):
+    def __init__(self):
+        self.reference = []     # (dev_ms, host_s)
+        self.rtc = []
+        self._envelope = {}     # window -> (delay, dev_ms, host_s)
+        self._coarse = True
+        self.dev_min = None
+        self.dev_max = None
+        self.offset = None
+        self.rate = 1.0
+        self.source = None
+
+    def add_reference(self, dev_ms, host_s):
+        self.reference.append((dev_ms, host_s))
+
+    def add_rtc(self, dev_ms, host_s):
+        self.rtc.append((dev_ms, host_s))
+
+    def add_receive(self, dev_ms, host_s, coarse=False):
+        """Status receive time, coarse if host time is whole seconds"""
+        self._coarse &= coarse
+        w = dev_ms // ENVELOPE_WINDOW_MS
+        delay = host_s - dev_ms / 1000.0
+        prev = self._envelope.get(w)
+        if prev is None or delay < prev[0]:
+            self._envelope[w] = (delay, dev_ms, host_s)
+
+        if self.dev_min is None or dev_ms < self.dev_min:
+            self.dev_min = dev_ms
+        if self.dev_max is None or dev_ms > self.dev_max:
+            self.dev_max = dev_ms
+
+    def _receive_pairs(self):
+        # whole second host time: on average 0.5 s late
+        fix = 0.5 if self._coarse else 0.0
+        return [(d, h + fix) for delay, d, h in
+                (self._envelope[w] for w in sorted(self._envelope))]
+
+    def solve(self):
+        """Returns False if there is nothing to map this boot with"""
+        candidates = (
+            (FIT_REFERENCE, self.reference, MIN_SPAN_MS),
+            (FIT_RTC, self.rtc, MIN_SPAN_MS),
+            (FIT_RECEIVE, self._receive_pairs(), COARSE_SPAN_MS if self._coarse else MIN_SPAN_MS),
+        )
+        candidates = [(name, sorted(pairs), span) for name, pairs, span in candidates if pairs]
+        if not candidates:
+            return False
+
+        self.source, pairs, span = candidates[0]
+        for name, rate_pairs, span in candidates:
+            if _span(rate_pairs) < span:
+                continue
+
+            fit = _fit_line(*zip(*rate_pairs))
+            if fit is None or abs(fit[1] - 1.0) * 1e6 > MAX_DRIFT_PPM:
+                continue
+
+            offset, self.rate = fit
+            if rate_pairs is pairs:
+                self.offset = offset
+                return True
+            break
+
+        # offset from best data with fitted (or nominal) rate
+        dev, host = (np.asarray(a, dtype=np.float64) for a in zip(*pairs))
+        self.offset = float(np.median(host - self.rate * dev / 1000.0))
+        return True
+
+    @property
+    def drift_ppm(self):
+        return (self.rate - 1.0) * 1e6
+
+    def __call__(self, dev_ms):
+        return self.offset + self.rate * np.asarray(dev_ms, dtype=np.float64) / 1000.0
+
+
+class Resampler(object):
+    """
+    Fills out[i, :] (grid time t0 + i * step) from chunks of samples.
+
+    Chunks must be in time order; the last sample is carried to the next
+    chunk so intervals across chunk boundary are interpolated too. Grid
+    points in intervals longer than max_gap are left untouched (NaN).
+    """
+    def __init__(self, out, t0, step, max_gap, hold=()):
+        self.out = out
+        self.t0 = t0
+        self.step = step
+        self.max_gap = max_gap
+        self.hold = [bool(h) for h in hold] or [False] * out.shape[1]
+        self._t = None
+        self._v = None
+
+    def reset(self):
+        """Discontinuity (e.g. ECU reboot): don't interpolate across"""
+        self._t = None
+        self._v = None
+
+    def feed(self, t, v):
+        t = np.asarray(t, dtype=np.float64)
+        v = np.asarray(v, dtype=np.float64).reshape(len(t), -1)
+        if not len(t):
+            return
+
+        if self._t is not None:
+            t = np.concatenate((self._t, t))
+            v = np.concatenate((self._v, v))
+        self._t = t[-1:]
+        self._v = v[-1:]
+
+        n = self.out.shape[0]
+        i0 = max(int(np.ceil((t[0] - self.t0) / self.step)), 0)
+        i1 = min(int(np.floor((t[-1] - self.t0) / self.step)), n - 1)
+        if i1 < i0:
+            return
+
+        g = self.t0 + self.step * np.arange(i0, i1 + 1)
+        k = np.searchsorted(t, g, side='right') - 1
+        if len(t) > 1:
+            kk = np.clip(k, 0, len(t) - 2)
+            gap = (t[kk + 1] - t[kk]) > self.max_gap
+        else:
+            gap = np.zeros(len(g), dtype=bool)
+
+        res = np.empty((len(g), v.shape[1]))
+        for c in range(v.shape[1]):
+            if self.hold[c]:
+                res[:, c] = v[k, c]
+            else:
+                res[:, c] = np.interp(g, t, v[:, c])
+
+        res[gap] = np.nan
+        self.out[i0:i1 + 1] = res
@@ -2,7 +2,7 @@
 
 from __future__ import print_function
 
-from pbstx import ReceiveError, msgs
+from pbstx import PBStx, ReceiveError, msgs
 from sql_log import Logger, LoggingWrapper
 
 
@@ -10,8 +10,15 @@ MESSAGE_FIELD_TYPE = (
     ('command', msgs.Command),
     ('param_request', msgs.ParamRequest),
     ('param_set', msgs.ParamSet),
+    ('param_set_batch', msgs.ParamSetBatch),
     ('time_reference', msgs.TimeReference),
-    ('memory_dump_request', msgs.MemoryDumpRequest)
+    ('engine_map_request', msgs.EngineMapRequest),
+    ('flash_stats_request', msgs.FlashStatsRequest),
+    ('spectrum_request', msgs.SpectrumRequest),
+    ('task_stats_request', msgs.TaskStatsRequest),
+    ('memory_dump_request', msgs.MemoryDumpRequest),
+    ('firmware_update_request', msgs.FirmwareUpdateRequest),
+    ('firmware_update_block', msgs.FirmwareUpdateBlock)
 )
 
 PARAM_TYPE_FIELD_TYPE = (
@@ -40,6 +47,45 @@ def make_ParamSet(engine_id, param_id, value):
     raise TypeError("Unsupported param type: %s" % repr(value))
 
 
+def _set_ParamType(pt, value):
+    for k, t in PARAM_TYPE_FIELD_TYPE:
+        if isinstance(value, t):
+            setattr(pt, k, value)
+            return
+
+    raise TypeError("Unsupported param type: %s" % repr(value))
+
+
+def make_ParamSetBatch(engine_id, items, max_count=8):
+    """
+    Make list of ParamSetBatch messages from (param_id, value) pairs.
+
+    Each message fits to one PBStx frame and ECU applies it atomically,
+    so group related parameters together.
+    """
+    ret = []
+    batch = msgs.ParamSetBatch(engine_id=engine_id)
+    for param_id, value in items:
+        item = batch.items.add(param_id=param_id)
+        _set_ParamType(item.value, value)
+
+        if len(batch.items) > max_count or \
+                wrap_msg(batch).ByteSize() > PBStx.MAX_LEN:
+            del batch.items[-1]
+            if len(batch.items) == 0:
+                raise ValueError("Param too long: %s" % param_id)
+
+            ret.append(wrap_msg(batch))
+            batch = msgs.ParamSetBatch(engine_id=engine_id)
+            item = batch.items.add(param_id=param_id)
+            _set_ParamType(item.value, value)
+
+    if len(batch.items) > 0:
+        ret.append(wrap_msg(batch))
+
+    return ret
+
+
 def make_Command(engine_id, operation):
     cmd = msgs.Command(engine_id=engine_id, operation=operation)
     return wrap_msg(cmd)
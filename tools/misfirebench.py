@@ -0,0 +1,198 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Synthetic pulse train test of fw/lib/combustion.c
+
+Builds the monitor with host C compiler as shared library and feeds it
+capture periods of single cylinder engine model: gas torque pulse per
+combustion cycle, load ~ w^2, cycle-to-cycle variation, injected misfires,
+tooth spacing error and 1 us capture quantization.
+Checks misfire counts and CoV, measures time per pulse against budget
+of one pulse at 20000 RPM with 64 pulses per revolution.
+"""
+
+from __future__ import print_function, division
+
+import sys
+import math
+import time
+import ctypes
+import random
+import argparse
+from hostbuild import add_build_args, build
+
+# timing loop without ctypes call overhead
+BENCH_SRC = r'''
+#include <stddef.h>
+#include "combustion.h"
+int cmon_bench(CombustionMonitor *m, const unsigned *p, size_t n)
+{
+    int cycles = 0;
+    for (size_t i = 0; i < n; i++)
+        cycles += cmonPulse(m, p[i]);
+    return cycles;
+}
+'''
+
+MONITOR_SIZE = 4096     # opaque buffer, > sizeof(CombustionMonitor)
+BUDGET_NS = 1e9 / (20000 / 60.0 * 64)
+
+
+class CombustionStats(ctypes.Structure):
+    # note: same layout as CombustionStats in combustion.h
+    _fields_ = [
+        ('cycles', ctypes.c_uint32),
+        ('misfires', ctypes.c_uint32),
+        ('cov', ctypes.c_float),
+        ('alpha_max', ctypes.c_float),
+        ('alpha_min', ctypes.c_float),
+    ]
+
+
+def build_cmon(args):
+    lib = build(args, 'cmon', ['lib/combustion.c'], ['lib'], {'cmon_bench.c': BENCH_SRC})
+    lib.cmonSetup.restype = ctypes.c_bool
+    lib.cmonSetup.argtypes = [ctypes.c_void_p, ctypes.c_uint32, ctypes.c_uint32, ctypes.c_float]
+    lib.cmonPulse.restype = ctypes.c_bool
+    lib.cmonPulse.argtypes = [ctypes.c_void_p, ctypes.c_uint32]
+    return lib
+
+
+class Monitor(object):
+    def __init__(self, lib, ppr, revs, thr):
+        self.lib = lib
+        self.buf = ctypes.create_string_buffer(MONITOR_SIZE)
+        lib.cmonObjectInit(self.buf)
+        if not lib.cmonSetup(self.buf, ppr, revs, thr):
+            raise ValueError("setup failed")
+
+    def feed(self, periods):
+        arr = (ctypes.c_uint * len(periods))(*periods)
+        return self.lib.cmon_bench(self.buf, arr, ctypes.c_size_t(len(periods)))
+
+    @property
+    def stats(self):
+        # first member of CombustionMonitor
+        return CombustionStats.from_buffer(self.buf)
+
+
+def engine(rpm, ppr, revs, cycles, rnd, sigma=0.03, fluct=0.05, misfire_at=(), tooth_err=0.003):
+    """
+    Single cylinder model, integrated by crank angle.
+    Returns capture periods [us] and number of injected misfires.
+    """
+    w0 = rpm * 2 * math.pi / 60
+    cycle = 2 * math.pi * revs
+    power = fluct * w0 * w0 / 2         # J = 1, gives ~fluct speed swing
+    comp = 0.4 * power
+    load = (2 * power - 2 * comp) / cycle / (w0 * w0)
+    teeth = [2 * math.pi / ppr * (1 + rnd.uniform(-tooth_err, tooth_err)) for i in range(ppr)]
+    teeth[-1] = 2 * math.pi - sum(teeth[:-1])
+    substeps = 8
+
+    e = w0 * w0
+    t = 0.0
+    phi = rnd.uniform(0, cycle)     # analysis does not know cycle phase
+    last_edge = 0
+    periods = []
+    fire = 1.0
+    ncycle = 0
+    misfires = 0
+
+    while ncycle < cycles:
+        for tooth in teeth:
+            dphi = tooth / substeps
+            for s in range(substeps):
+                x = phi % cycle
+                if x < math.pi:
+                    gas = power * fire * math.sin(x)
+                elif x >= cycle - math.pi:
+                    gas = -comp * math.sin(x - (cycle - math.pi))
+                else:
+                    gas = 0.0
+
+                w = math.sqrt(e)
+                e += 2 * (gas - load * e) * dphi
+                t += dphi / ((w + math.sqrt(e)) / 2)
+
+                phi += dphi
+                if phi >= cycle:
+                    phi -= cycle
+                    ncycle += 1
+                    fire = 1 + rnd.gauss(0, sigma)
+                    if ncycle in misfire_at:
+                        fire = 0.0
+                        misfires += 1
+
+            edge = int(t * 1e6)
+            periods.append(edge - last_edge)
+            last_edge = edge
+
+    return periods[ppr:], misfires
+
+
+def run_case(lib, name, rpm, ppr, revs, cycles, thr, rnd, check=True, **kvargs):
+    periods, injected = engine(rpm, ppr, revs, cycles, rnd, **kvargs)
+    mon = Monitor(lib, ppr, revs, thr)
+    mon.feed(periods)
+    st = mon.stats
+    ok = st.misfires == injected or not check
+    print("%-12s %6d %3d %d %6d %5d %5d %7.2f %10.0f %10.0f  %s" % (
+        name, rpm, ppr, revs, st.cycles, injected, st.misfires, st.cov,
+        st.alpha_max, st.alpha_min, "ok" if ok else "FAIL"))
+    return ok, st.cov
+
+
+def bench(lib, loops):
+    rnd = random.Random(2)
+    periods, _ = engine(20000, 64, 2, 64, rnd)
+    mon = Monitor(lib, 64, 2, 0.02)
+    n = len(periods) * loops
+    arr = (ctypes.c_uint * len(periods))(*periods)
+    t0 = time.time()
+    for i in range(loops):
+        lib.cmon_bench(mon.buf, arr, ctypes.c_size_t(len(periods)))
+    return (time.time() - t0) / n * 1e9
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    add_build_args(parser)
+    parser.add_argument("-c", "--cycles", help="cycles per case", type=int, default=600)
+    parser.add_argument("-t", "--threshold", help="misfire threshold", type=float, default=0.02)
+    parser.add_argument("-n", "--loops", help="benchmark loops", type=int, default=200)
+    args = parser.parse_args()
+
+    lib = build_cmon(args)
+    rnd = random.Random(1)
+    n = args.cycles
+    single = set(range(20, n, 37))
+    double = set(c + d for c in range(20, n, 53) for d in (0, 1))
+
+    print("%-12s %6s %3s %s %6s %5s %5s %7s %10s %10s" % (
+        "case", "rpm", "ppr", "r", "cycles", "inj", "det", "cov %", "acc max", "acc min"))
+
+    ok, steady_cov = run_case(lib, "steady", 6000, 64, 2, n, args.threshold, rnd)
+    # weak cycles may count as misfires here, check only CoV
+    _, unstable_cov = run_case(lib, "unstable", 6000, 64, 2, n, args.threshold, rnd, check=False, sigma=0.15)
+    ok &= unstable_cov > 2 * steady_cov
+    for case in (
+            ("misfire", 6000, 64, 2, dict(misfire_at=single)),
+            ("double", 6000, 64, 2, dict(misfire_at=double)),
+            ("idle", 1500, 24, 2, dict(misfire_at=single)),
+            ("high rpm", 20000, 64, 2, dict(misfire_at=single)),
+            ("two-stroke", 9000, 12, 1, dict(misfire_at=single)),
+            ("one pulse", 3000, 1, 2, dict(misfire_at=single, tooth_err=0))):
+        name, rpm, ppr, revs, kvargs = case
+        ok &= run_case(lib, name, rpm, ppr, revs, n, args.threshold, rnd, **kvargs)[0]
+
+    ns = bench(lib, args.loops)
+    print("host time per pulse: %.1f ns, budget at 20000 RPM x 64: %.0f ns" % (ns, BUDGET_NS))
+
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
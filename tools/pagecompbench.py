@@ -0,0 +1,196 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Round trip test and ratio estimate of fw/lib/pagecomp.c
+
+Builds the compressor with host C compiler as shared library, splits
+sample images into pages the same way as recv_memory_dump_request(),
+decodes them with miniecu/pagecomp.py and compares. Reports link bytes
+against raw 64-byte pages, with estimated framing of each MemoryDumpPage.
+Optional input files (e.g. memdump.py output) are tested too.
+"""
+
+from __future__ import print_function, division
+
+import os
+import sys
+import time
+import ctypes
+import random
+import struct
+import argparse
+from hostbuild import TOOLS_DIR, add_build_args, build
+
+sys.path.insert(0, os.path.join(TOOLS_DIR, 'miniecu'))
+from pagecomp import decompress, RLE, LZ    # noqa: E402
+
+# same as th_comm_pbstx.c and miniecu.options
+MEMDUMP_SIZE = 64
+MEMDUMP_PAGE_RAW = 4096
+PAGE_OUT = 192
+# PBStx frame, Message tag, engine_id, stream_id, address, page tag
+FRAME_BYTES = 24
+# compression and raw_size fields
+COMP_FIELDS_BYTES = 5
+
+# page splitting loop of recv_memory_dump_request()
+DUMP_SRC = r'''
+#include <string.h>
+#include "pagecomp.h"
+size_t pcomp_dump(PageCompressor *pc, int codec, const uint8_t *src, size_t len,
+        uint8_t *out, size_t out_size, uint32_t *raw, uint32_t *olen, size_t max_pages,
+        size_t page_raw)
+{
+    size_t pages = 0;
+
+    pcompObjectInit(pc, codec);
+    pcompPageBegin(pc, out, out_size);
+    while (len > 0) {
+        size_t n = (len > PCOMP_BLOCK)? PCOMP_BLOCK : len;
+
+        memcpy(pcompBlockBuffer(pc), src, n);
+        if (pc->raw_len + n > page_raw || !pcompBlock(pc, n)) {
+            raw[pages] = pc->raw_len;
+            olen[pages] = pc->out_len;
+            if (++pages >= max_pages)
+                return 0;
+
+            pcompPageBegin(pc, out + pages * out_size, out_size);
+            if (!pcompBlock(pc, n))
+                return 0;
+        }
+        src += n;
+        len -= n;
+    }
+    raw[pages] = pc->raw_len;
+    olen[pages] = pc->out_len;
+    return pages + 1;
+}
+'''
+
+COMPRESSOR_SIZE = 4096      # opaque buffer, > sizeof(PageCompressor)
+
+
+def build_pcomp(args):
+    lib = build(args, 'pcomp', ['lib/pagecomp.c'], ['lib'], {'pcomp_dump.c': DUMP_SRC})
+    lib.pcomp_dump.restype = ctypes.c_size_t
+    lib.pcomp_dump.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_char_p, ctypes.c_size_t,
+                               ctypes.c_void_p, ctypes.c_size_t, ctypes.c_void_p, ctypes.c_void_p,
+                               ctypes.c_size_t, ctypes.c_size_t]
+    return lib
+
+
+def compress(lib, codec, data):
+    max_pages = len(data) // 16 + 2
+    pc = ctypes.create_string_buffer(COMPRESSOR_SIZE)
+    out = ctypes.create_string_buffer(max_pages * PAGE_OUT)
+    raw = (ctypes.c_uint32 * max_pages)()
+    olen = (ctypes.c_uint32 * max_pages)()
+
+    t0 = time.time()
+    n = lib.pcomp_dump(pc, codec, bytes(data), len(data), out, PAGE_OUT, raw, olen, max_pages,
+                       MEMDUMP_PAGE_RAW)
+    dt = time.time() - t0
+    if n == 0:
+        raise RuntimeError("page split failed")
+
+    buf = out.raw
+    return [(raw[i], buf[i * PAGE_OUT:i * PAGE_OUT + olen[i]]) for i in range(n)], dt
+
+
+def link_bytes_raw(size):
+    pages = (size + MEMDUMP_SIZE - 1) // MEMDUMP_SIZE
+    return size + pages * FRAME_BYTES
+
+
+def check(lib, name, data):
+    data = bytearray(data)
+    ok = True
+    line = ["%-10s %8d" % (name, len(data))]
+    for codec in (RLE, LZ):
+        pages, dt = compress(lib, codec, data)
+        dec = bytearray()
+        for raw, page in pages:
+            if len(page) > PAGE_OUT:
+                ok = False
+            dec.extend(decompress(codec, page, raw))
+
+        good = dec == data
+        ok &= good
+        link = sum(len(page) + FRAME_BYTES + COMP_FIELDS_BYTES for raw, page in pages)
+        line.append("%6d %6.2fx %5.1f MB/s %s" % (
+            len(pages), link_bytes_raw(len(data)) / link, len(data) / 1e6 / max(dt, 1e-9),
+            "ok" if good else "FAIL"))
+
+    print("  ".join(line))
+    return ok
+
+
+def sample_ram(rnd, size):
+    """zeroed bss, stacks filled by 0x55 pattern, structs and pointers"""
+    buf = bytearray()
+    while len(buf) < size:
+        kind = rnd.random()
+        n = rnd.randint(16, 512)
+        if kind < 0.3:
+            chunk = bytearray(n)
+        elif kind < 0.45:
+            chunk = bytearray([0x55]) * n
+        elif kind < 0.8:
+            chunk = bytearray()
+            while len(chunk) < n:
+                chunk += struct.pack('<IIhhf', 0x20000000 + rnd.randint(0, 0x8000) * 4,
+                                     rnd.randint(0, 255), rnd.randint(-100, 100), 0, rnd.random())
+        else:
+            chunk = bytearray(rnd.getrandbits(8) for i in range(n))
+        buf += chunk[:n]
+    return buf[:size]
+
+
+def sample_log(rnd, size):
+    """slowly changing records, then erased tail"""
+    buf = bytearray()
+    t, rpm, temp = 0, 3000, 600
+    while len(buf) < size // 2:
+        t += 100
+        rpm += rnd.randint(-20, 20)
+        temp += rnd.randint(-1, 1)
+        buf += struct.pack('<BBIHhH', 0xa5, 7, t, rpm, temp, 12600)
+    buf += bytearray([0xff]) * (size - len(buf))
+    return buf[:size]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    add_build_args(parser)
+    parser.add_argument("-s", "--size", help="sample size", type=int, default=65536)
+    parser.add_argument("files", help="dump files to test", nargs='*')
+    args = parser.parse_args()
+
+    lib = build_pcomp(args)
+    rnd = random.Random(1)
+    size = args.size
+
+    print("%-10s %8s  %6s %7s %10s     %6s %7s %10s" % (
+        "sample", "bytes", "pages", "RLE", "host", "pages", "LZ", "host"))
+
+    ok = True
+    ok &= check(lib, "erased", bytearray([0xff]) * size)
+    ok &= check(lib, "zeros", bytearray(size))
+    ok &= check(lib, "ram", sample_ram(rnd, size))
+    ok &= check(lib, "log", sample_log(rnd, size))
+    ok &= check(lib, "random", bytearray(rnd.getrandbits(8) for i in range(size)))
+    ok &= check(lib, "odd size", sample_ram(rnd, 1000 + 37))
+    ok &= check(lib, "one byte", bytearray([0x42]))
+
+    for path in args.files:
+        with open(path, 'rb') as fd:
+            ok &= check(lib, os.path.basename(path)[:10], fd.read())
+
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == '__main__':
+    main()
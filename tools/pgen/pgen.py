@@ -43,7 +43,13 @@ class ParameterTable(object):
     @property
     def parameters_with_values(self):
         return dict(((k, v) for k, v in self.parameters.iteritems()
-                     if v._accept_values and v.values is not None))
+                     if v._accept_values and v.values is not None
+                     and not isinstance(v, PtString)))
+
+    @property
+    def parameters_with_names(self):
+        return dict(((k, v) for k, v in self.parameters.iteritems()
+                     if isinstance(v, PtString) and v.is_enum))
 
     @property
     def parameters_with_onchange(self):
@@ -70,6 +76,13 @@ class ParameterTable(object):
                     if len(sv) > Parameter.MAX_STRING:
                         raise ValueError("ParamId: {}, value: {} is too long ({})".format(k, sv, len(sv)))
 
+                # stored as uint8_t index
+                if len(v.values) > 256:
+                    raise ValueError("ParamId: {}, too many values ({})".format(k, len(v.values)))
+
+                if v.default not in v.values:
+                    raise ValueError("ParamId: {}, default: {} not in values".format(k, v.default))
+
 
 class Generator(object):
     def __init__(self):
@@ -46,6 +46,8 @@ class Parameter(object):
         self.desc = definition.get('desc')
         self.var = definition.get('var')
         self.onchange = definition.get('onchange')
+        self.validate = definition.get('validate')
+        self.apply = definition.get('apply')
         self.default = definition.get('default')
         # common flags
         self.read_only = definition.get('read_only', False)
@@ -130,3 +132,12 @@ class PtString(Y.YAMLObject, Parameter):
     _accept_values = True
     _need_minmax = False
     _norm_type = str
+
+    @property
+    def is_enum(self):
+        """String with values list stored as index in values"""
+        return self.values is not None
+
+    @property
+    def default_index(self):
+        return self.values.index(self.default)
@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Host benchmark and accuracy check of fw/lib/rfft.c
+
+Builds the kernel with host C compiler as shared library, compares
+transform and amplitude spectrum against reference DFT and measures
+time per transform.
+"""
+
+from __future__ import print_function, division
+
+import sys
+import math
+import time
+import ctypes
+import random
+import argparse
+from hostbuild import add_build_args, build
+
+
+def reference_dft(x):
+    n = len(x)
+    out = []
+    for k in range(n // 2 + 1):
+        re = im = 0.0
+        for i, v in enumerate(x):
+            a = -2 * math.pi * k * i / n
+            re += v * math.cos(a)
+            im += v * math.sin(a)
+        out.append((re, im))
+    return out
+
+
+def unpack(buf, n):
+    """packed rfft output to list of (re, im)"""
+    out = [(buf[0], 0.0)]
+    for k in range(1, n // 2):
+        out.append((buf[2 * k], buf[2 * k + 1]))
+    out.append((buf[1], 0.0))
+    return out
+
+
+def check_transform(lib, n, rnd):
+    x = [rnd.uniform(-1.0, 1.0) for i in range(n)]
+    buf = (ctypes.c_float * n)(*x)
+    lib.rfft(buf, ctypes.c_size_t(n))
+
+    ref = reference_dft(x)
+    got = unpack(buf, n)
+    scale = max(math.hypot(*v) for v in ref)
+    return max(math.hypot(g[0] - r[0], g[1] - r[1]) for g, r in zip(got, ref)) / scale
+
+
+def check_tone(lib, n, rnd):
+    """Hann windowed bin-centered tone: amplitude and DC must come back"""
+    k = rnd.randint(2, n // 2 - 2)
+    amp, dc = rnd.uniform(0.1, 2.0), rnd.uniform(-1.0, 1.0)
+    x = [dc + amp * math.cos(2 * math.pi * k * i / n + 0.3) for i in range(n)]
+
+    buf = (ctypes.c_float * n)(*x)
+    lib.rfft_hann(buf, ctypes.c_size_t(n))
+    lib.rfft(buf, ctypes.c_size_t(n))
+    lib.rfft_magnitude(buf, ctypes.c_size_t(n))
+    return max(abs(buf[k] - amp) / amp, abs(buf[0] - abs(dc)))
+
+
+def bench(lib, n, loops):
+    x = [math.sin(i * 0.1) for i in range(n)]
+    buf = (ctypes.c_float * n)()
+    t0 = time.time()
+    for i in range(loops):
+        ctypes.memmove(buf, (ctypes.c_float * n)(*x), n * 4)
+        lib.rfft_hann(buf, ctypes.c_size_t(n))
+        lib.rfft(buf, ctypes.c_size_t(n))
+        lib.rfft_magnitude(buf, ctypes.c_size_t(n))
+    return (time.time() - t0) / loops * 1e6
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    add_build_args(parser)
+    parser.add_argument("-n", "--loops", help="benchmark loops", type=int, default=1000)
+    parser.add_argument("--tolerance", help="max relative error", type=float, default=1e-4)
+    args = parser.parse_args()
+
+    lib = build(args, 'rfft', ['lib/rfft.c'])
+    rnd = random.Random(1)
+    failed = False
+
+    print("size\ttransform err\ttone err\thost us")
+    for n in (64, 128, 256, 512):
+        terr = check_transform(lib, n, rnd)
+        aerr = check_tone(lib, n, rnd)
+        us = bench(lib, n, args.loops)
+        ok = terr < args.tolerance and aerr < args.tolerance
+        failed |= not ok
+        print("%d\t%.2e\t%.2e\t%.1f\t%s" % (n, terr, aerr, us, "ok" if ok else "FAIL"))
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == '__main__':
+    main()
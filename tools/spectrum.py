@@ -0,0 +1,70 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Request amplitude spectrum of flow or oil pressure sensor channel
+"""
+
+from __future__ import print_function
+
+import sys
+import argparse
+from miniecu import msgs, PBStx, ReceiveError
+from miniecu.utils import wrap_msg, wrap_logger
+
+SR = msgs.SpectrumRequest
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("device", help="com port device file")
+    parser.add_argument("baudrate", help="com port baudrate", type=int, nargs='?', default=57600)
+    parser.add_argument("-i", "--id", help="engine id", type=int, default=1)
+    parser.add_argument("-c", "--channel", help="sensor channel", choices=[k.lower() for k in SR.Channel.keys()],
+                        default='flow')
+    parser.add_argument("-w", "--window", help="FFT size (64..512)", type=int, default=256)
+    parser.add_argument("-d", "--decimation", help="ADC samples per point (1..64)", type=int, default=4)
+    parser.add_argument("-t", "--timeout", help="capture timeout [s]", type=float, default=10.0)
+    parser.add_argument("-v", "--verbose", help="verbose io print", action='store_true')
+    parser.add_argument("-l", "--log-db", help="logging to sql db")
+    parser.add_argument("-n", "--log-name", help="log name")
+
+    args = parser.parse_args()
+
+    pbstx = PBStx(args.device, args.baudrate)
+    pbstx = wrap_logger(pbstx, args.log_db, args.log_name, "%s @ %s" % (args.device, args.baudrate))
+
+    req = SR(engine_id=args.id, channel=SR.Channel.Value(args.channel.upper()),
+             window=args.window, decimation=args.decimation)
+    pbstx.send(wrap_msg(req))
+
+    amp = None
+    while amp is None or None in amp:
+        try:
+            m = pbstx.receive(args.timeout)
+            if m is None:
+                print("timeout", file=sys.stderr)
+                sys.exit(1)
+
+            if m.HasField('spectrum') and m.spectrum.engine_id == args.id:
+                sp = m.spectrum
+                if amp is None:
+                    amp = [None] * (sp.window // 2 + 1)
+                    rate, window = sp.sample_rate, sp.window
+
+                amp[sp.bin_offset:sp.bin_offset + len(sp.magnitude)] = \
+                    [v * sp.scale for v in sp.magnitude]
+            elif m.HasField('status_text') or args.verbose:
+                print(m, file=sys.stderr)
+        except ReceiveError as ex:
+            print(repr(ex), file=sys.stderr)
+
+    print("# %s, sample rate %.1f Hz, window %d" % (args.channel, rate, window))
+    print("freq [Hz]\tamplitude [V]")
+    for k, v in enumerate(amp):
+        print("%.2f\t%.6f" % (k * rate / window, v))
+
+
+if __name__ == '__main__':
+    main()
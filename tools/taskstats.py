@@ -0,0 +1,73 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Download task supervisor statistics: deadline misses, worst check-in
+intervals and watchdog resets caused by each task
+"""
+
+from __future__ import print_function, division
+
+import sys
+import argparse
+from miniecu import msgs, PBStx, ReceiveError
+from miniecu.utils import wrap_msg, wrap_logger
+
+TS = msgs.TaskStats
+NR_TASKS = len(TS.Task.keys())
+
+
+def dump_stats(stats, fd=sys.stdout):
+    print("\t".join(["task", "active", "deadline ms", "misses", "worst ms", "wdt resets"]), file=fd)
+
+    for st in sorted(stats, key=lambda st: st.task):
+        line = [TS.Task.Name(st.task), "yes" if st.active else "no",
+                str(st.deadline), str(st.misses), str(st.worst_interval),
+                str(st.watchdog_resets) + (" (last)" if st.last_reset else "")]
+        print("\t".join(line), file=fd)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("device", help="com port device file")
+    parser.add_argument("baudrate", help="com port baudrate", type=int, nargs='?', default=57600)
+    parser.add_argument("-i", "--id", help="engine id", type=int, default=1)
+    parser.add_argument("--reset", help="clear miss counters and worst intervals on ECU", action='store_true')
+    parser.add_argument("-v", "--verbose", help="verbose io print", action='store_true')
+    parser.add_argument("-l", "--log-db", help="logging to sql db")
+    parser.add_argument("-n", "--log-name", help="log name")
+
+    args = parser.parse_args()
+
+    pbstx = PBStx(args.device, args.baudrate)
+    pbstx = wrap_logger(pbstx, args.log_db, args.log_name, "%s @ %s" % (args.device, args.baudrate))
+
+    req = msgs.TaskStatsRequest(engine_id=args.id)
+    if args.reset:
+        req.reset = True
+        pbstx.send(wrap_msg(req))
+        return
+
+    pbstx.send(wrap_msg(req))
+
+    stats = []
+    while len(stats) < NR_TASKS:
+        try:
+            m = pbstx.receive(5.0)
+            if m is None:
+                print("timeout", file=sys.stderr)
+                sys.exit(1)
+
+            if m.HasField('task_stats') and m.task_stats.engine_id == args.id:
+                stats.append(m.task_stats)
+            elif m.HasField('status_text') or args.verbose:
+                print(m, file=sys.stderr)
+        except ReceiveError as ex:
+            print(repr(ex), file=sys.stderr)
+
+    dump_stats(stats)
+
+
+if __name__ == '__main__':
+    main()
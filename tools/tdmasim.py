@@ -0,0 +1,277 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+# vim:set ts=4 sw=4 et
+
+"""
+Shared radio channel emulator: ECU frame delivery, free running vs TDMA slots
+
+N ECUs on one half duplex channel (SERIAL1 radio). Each one runs the
+comm loop of fw/comm/th_comm_pbstx.c: Status every STATUS_PERIOD,
+StatusText at random, reply to host TimeReference broadcast. Own crystal
+drift and boot phase per ECU. Host broadcasts TimeReference periodically.
+
+A frame is delivered if no other frame overlaps it on air. Slot logic is
+a port of fw/comm/tdma.c; sync error is the spread of TimeReference
+receive latency between ECUs (common latency cancels out). Frames sent
+before first sync and host broadcasts landing in a slot still collide.
+
+Columns: delivered Status and all ECU frames (percent of sent on air),
+deferred unsolicited frames dropped because one already waits for slot,
+delivered Status rate per ECU.
+"""
+
+from __future__ import print_function, division
+
+import heapq
+import random
+import argparse
+
+UART_CHAR_BITS = 10
+FRAME_OVERHEAD = 8          # v1 header and CRC
+GUARD_CHARS = 2
+SLOT_BYTES = 192
+SYNC_TIMEOUT_S = 60.0
+RX_TIMEOUT_MS = 100         # PBSTX_RX_TIMEOUT
+STATUS_PAYLOAD_BYTES = 96   # estimate used by firmware before encode
+
+STATUS_BYTES = (80, 100)    # encoded payload range
+TEXT_BYTES = (30, 70)
+TIMEREF_BYTES = 12
+TIMEREF_REPLY_BYTES = 22
+
+
+class Tdma(object):
+    """fw/comm/tdma.c, time in ECU local seconds"""
+    def __init__(self, engine_id, slots, slot_ms, guard_ms, baud):
+        self.engine_id = engine_id
+        self.slots = slots
+        self.baud = baud
+        self.guard = guard_ms + self.airtime_ms(GUARD_CHARS)
+        slot = slot_ms or self.airtime_ms(SLOT_BYTES) + 2 * self.guard
+        self.slot = max(slot, 2 * self.guard + self.airtime_ms(FRAME_OVERHEAD))
+        self.synced = False
+        self.sync_stamp = 0.0
+        self.sync_ms = 0
+        self.tx_end = 0
+
+    def airtime_ms(self, nbytes):
+        return (nbytes * UART_CHAR_BITS * 1000 + self.baud - 1) // self.baud
+
+    def now_ms(self, local):
+        return self.sync_ms + int((local - self.sync_stamp) * 1000)
+
+    def sync(self, local, timestamp_ms):
+        self.sync_stamp = local
+        self.sync_ms = timestamp_ms
+        self.synced = True
+
+    def is_active(self, local):
+        return self.slots > 0 and self.synced and local - self.sync_stamp < SYNC_TIMEOUT_S
+
+    def wait(self, local, nbytes):
+        """ms until frame may start, 0: now"""
+        if not self.is_active(local):
+            return 0
+
+        cycle = self.slot * self.slots
+        slot_start = ((self.engine_id - 1) % self.slots) * self.slot
+        airtime = min(self.airtime_ms(nbytes + FRAME_OVERHEAD), self.slot - 2 * self.guard)
+        now = self.now_ms(local)
+        start = max(self.tx_end, now)
+
+        pos = (start + cycle - slot_start) % cycle
+        if pos >= self.guard and pos + airtime + self.guard <= self.slot:
+            return 0
+
+        wait = self.guard - pos if pos < self.guard else cycle - pos + self.guard
+        return wait + (start - now)
+
+    def sent(self, local, nbytes):
+        if self.is_active(local):
+            now = self.now_ms(local)
+            self.tx_end = max(self.tx_end, now) + self.airtime_ms(nbytes + FRAME_OVERHEAD)
+
+
+class Channel(object):
+    def __init__(self, baud):
+        self.baud = baud
+        self.frames = []    # (start, end, src, kind)
+
+    def airtime(self, nbytes):
+        return (nbytes + FRAME_OVERHEAD) * UART_CHAR_BITS / self.baud
+
+    def send(self, t, src, kind, nbytes):
+        end = t + self.airtime(nbytes)
+        self.frames.append((t, end, src, kind))
+        return end
+
+    def delivered(self):
+        """[(src, kind, ok)]: no overlap with any other frame"""
+        frames = sorted(self.frames)
+        res = []
+        max_end = float('-inf')
+        for i, (start, end, src, kind) in enumerate(frames):
+            ok = start >= max_end
+            if i + 1 < len(frames) and frames[i + 1][0] < end:
+                ok = False
+            max_end = max(max_end, end)
+            res.append((src, kind, ok))
+        return res
+
+
+class Ecu(object):
+    def __init__(self, engine_id, args, rnd, channel, tdma):
+        self.engine_id = engine_id
+        self.args = args
+        self.rnd = rnd
+        self.channel = channel
+        self.rate = 1.0 + rnd.uniform(-args.drift, args.drift) * 1e-6
+        self.boot = rnd.uniform(0, 10.0)    # local clock at t = 0
+        self.send_time = self.boot - rnd.uniform(0, args.period / 1000.0)
+        self.uart_end = 0.0
+        self.pending = None                 # deferred frame (kind, bytes)
+        self.tdma = Tdma(engine_id, args.slots if tdma else 0, args.slot_ms, args.guard, args.baud)
+        self.dropped = 0
+
+    def local(self, t):
+        return self.boot + t * self.rate
+
+    def _send(self, t, kind, nbytes):
+        start = max(t, self.uart_end)
+        self.uart_end = self.channel.send(start, self.engine_id, kind, nbytes)
+
+    def _defer(self, t, kind, nbytes):
+        if self.tdma.is_active(self.local(t)):
+            if self.pending is None:
+                self.pending = (kind, nbytes)
+            else:
+                self.dropped += 1
+        else:
+            self._send(t, kind, nbytes)
+
+    def loop(self, t):
+        """th_comm_pbstx loop body, returns next wake up time"""
+        local = self.local(t)
+        rx_timeout = RX_TIMEOUT_MS
+
+        if local - self.send_time >= self.args.period / 1000.0:
+            wait = self.tdma.wait(local, STATUS_PAYLOAD_BYTES)
+            if wait == 0:
+                nbytes = self.rnd.randint(*STATUS_BYTES)
+                self._send(t, 'status', nbytes)
+                if self.tdma.is_active(local):
+                    self.tdma.sent(local, nbytes)
+                    self.send_time += self.args.period / 1000.0
+                    if local - self.send_time >= self.args.period / 1000.0:
+                        self.send_time = local
+                else:
+                    self.send_time = local
+            elif wait < rx_timeout:
+                rx_timeout = wait
+
+        if self.pending is not None:
+            kind, nbytes = self.pending
+            wait = self.tdma.wait(local, nbytes)
+            if wait == 0:
+                self._send(t, kind, nbytes)
+                self.tdma.sent(local, nbytes)
+                self.pending = None
+            elif wait < rx_timeout:
+                rx_timeout = wait
+
+        # one system tick late
+        return t + (rx_timeout + 0.1) / 1000.0 / self.rate
+
+    def status_text(self, t):
+        self._defer(t, 'text', self.rnd.randint(*TEXT_BYTES))
+
+    def time_reference(self, t, timestamp_ms):
+        self.tdma.sync(self.local(t), timestamp_ms)
+        self._defer(t, 'timeref', TIMEREF_REPLY_BYTES)
+
+
+def simulate(n, args, tdma, seed):
+    rnd = random.Random(seed)
+    channel = Channel(args.baud)
+    ecus = [Ecu(i + 1, args, rnd, channel, tdma) for i in range(n)]
+    events = []
+
+    for ecu in ecus:
+        heapq.heappush(events, (rnd.uniform(0, args.period / 1000.0), 'loop', ecu.engine_id))
+        if args.text_hz > 0:
+            heapq.heappush(events, (rnd.expovariate(args.text_hz), 'text', ecu.engine_id))
+    if args.timeref > 0:
+        heapq.heappush(events, (rnd.uniform(0, args.timeref / 1000.0), 'host', 0))
+
+    while events:
+        t, kind, eid = heapq.heappop(events)
+        if t > args.time:
+            break
+
+        if kind == 'loop':
+            heapq.heappush(events, (ecus[eid - 1].loop(t), 'loop', eid))
+        elif kind == 'text':
+            ecus[eid - 1].status_text(t)
+            heapq.heappush(events, (t + rnd.expovariate(args.text_hz), 'text', eid))
+        elif kind == 'host':
+            # host UNIX time of send, received after airtime and radio latency
+            end = channel.send(t, 0, 'host', TIMEREF_BYTES)
+            for ecu in ecus:
+                ecu.time_reference(end + rnd.uniform(0, args.sync_jitter / 1000.0), int(t * 1000))
+            heapq.heappush(events, (t + args.timeref / 1000.0, 'host', 0))
+
+    stats = {}
+    for src, kind, ok in channel.delivered():
+        if src == 0:
+            continue
+        sent, good = stats.get(kind, (0, 0))
+        stats[kind] = (sent + 1, good + ok)
+
+    dropped = sum(e.dropped for e in ecus)
+    sent, good = (sum(v[i] for v in stats.values()) for i in (0, 1))
+    status_sent, status_good = stats.get('status', (0, 0))
+    airtime = sum(end - start for start, end, src, kind in channel.frames)
+    return {
+        'load': airtime / args.time,
+        'status': status_good / max(status_sent, 1),
+        'status_hz': status_good / args.time / n,
+        'all': good / max(sent, 1),
+        'drop': dropped / max(sent + dropped, 1),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("-n", "--ecus", help="ECU counts", default="1,2,4,8,16,24,32")
+    parser.add_argument("-b", "--baud", help="SERIAL1_BAUD", type=int, default=57600)
+    parser.add_argument("-p", "--period", help="STATUS_PERIOD [ms]", type=int, default=1000)
+    parser.add_argument("--slots", help="TDMA_SLOTS (default: ECU count)", type=int, default=None)
+    parser.add_argument("--slot-ms", help="TDMA_SLOT_MS", type=int, default=0)
+    parser.add_argument("--guard", help="TDMA_GUARD_MS", type=int, default=5)
+    parser.add_argument("--drift", help="crystal tolerance [ppm]", type=float, default=50.0)
+    parser.add_argument("--sync-jitter", help="TimeReference latency spread [ms]", type=float, default=3.0)
+    parser.add_argument("--timeref", help="host TimeReference period [ms]", type=int, default=5000)
+    parser.add_argument("--text-hz", help="StatusText rate per ECU", type=float, default=0.1)
+    parser.add_argument("-t", "--time", help="simulated time [s]", type=float, default=120.0)
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args()
+
+    fixed_slots = args.slots
+    print("%5s %6s  %9s %9s  %9s %9s %9s %6s  %7s" % (
+        "ECUs", "load", "free st%", "free all%", "tdma st%", "tdma all%", "dropped",
+        "st Hz", "slot ms"))
+
+    for n in (int(x) for x in args.ecus.split(',')):
+        args.slots = fixed_slots or n
+        free = simulate(n, args, False, args.seed)
+        tdma = simulate(n, args, True, args.seed)
+        slot = Tdma(1, args.slots, args.slot_ms, args.guard, args.baud).slot
+
+        print("%5d %5.0f%%  %9.2f %9.2f  %9.2f %9.2f %8.2f%% %6.2f  %7d" % (
+            n, free['load'] * 100, free['status'] * 100, free['all'] * 100,
+            tdma['status'] * 100, tdma['all'] * 100, tdma['drop'] * 100,
+            tdma['status_hz'], slot))
+
+
+if __name__ == '__main__':
+    main()